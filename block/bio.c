@@ -272,9 +272,24 @@ void bio_init(struct bio *bio)
 	bio->bi_flags = 1 << BIO_UPTODATE;
 	atomic_set(&bio->bi_remaining, 1);
 	atomic_set(&bio->bi_cnt, 1);
+	bio->bi_cookie = BLK_QC_T_NONE;
 }
 EXPORT_SYMBOL(bio_init);
 
+/**
+ * bio_uninit - release the resources held by a bio set up with bio_init()
+ * @bio:	bio to release
+ *
+ * Description:
+ *   For bios embedded in other structures or on the stack, which are not
+ *   freed through bio_put(), once they have completed.
+ */
+void bio_uninit(struct bio *bio)
+{
+	__bio_free(bio);
+}
+EXPORT_SYMBOL(bio_uninit);
+
 /**
  * bio_reset - reinitialize a bio
  * @bio:	bio to reset
@@ -294,6 +309,7 @@ void bio_reset(struct bio *bio)
 	memset(bio, 0, BIO_RESET_BYTES);
 	bio->bi_flags = flags|(1 << BIO_UPTODATE);
 	atomic_set(&bio->bi_remaining, 1);
+	bio->bi_cookie = BLK_QC_T_NONE;
 }
 EXPORT_SYMBOL(bio_reset);
 
@@ -564,7 +580,8 @@ void __bio_clone_fast(struct bio *bio, struct bio *bio_src)
 	 */
 	bio->bi_bdev = bio_src->bi_bdev;
 	bio->bi_flags |= 1 << BIO_CLONED;
-	bio->bi_rw = bio_src->bi_rw;
+	/* an iocost charge only covers the queue @bio_src was charged at */
+	bio->bi_rw = bio_src->bi_rw & ~REQ_COST_CHARGED;
 	bio->bi_iter = bio_src->bi_iter;
 	bio->bi_io_vec = bio_src->bi_io_vec;
 }
@@ -646,7 +663,7 @@ struct bio *bio_clone_bioset(struct bio *bio_src, gfp_t gfp_mask,
 		return NULL;
 
 	bio->bi_bdev		= bio_src->bi_bdev;
-	bio->bi_rw		= bio_src->bi_rw;
+	bio->bi_rw		= bio_src->bi_rw & ~REQ_COST_CHARGED;
 	bio->bi_iter.bi_sector	= bio_src->bi_iter.bi_sector;
 	bio->bi_iter.bi_size	= bio_src->bi_iter.bi_size;
 
@@ -28,6 +28,11 @@
 #define CFQ_WEIGHT_MAX		1000
 #define CFQ_WEIGHT_DEFAULT	500
 
+/* blk-iocost specific, out here for blkcg->cost_weight */
+#define COST_WEIGHT_MIN		1
+#define COST_WEIGHT_MAX		10000
+#define COST_WEIGHT_DEFAULT	100
+
 #ifdef CONFIG_BLK_CGROUP
 
 enum blkg_rwstat_type {
@@ -53,6 +58,7 @@ struct blkcg {
 	/* TODO: per-policy storage in blkcg */
 	unsigned int			cfq_weight;	/* belongs to cfq */
 	unsigned int			cfq_leaf_weight;
+	unsigned int			cost_weight;	/* belongs to blk-iocost */
 };
 
 struct blkg_stat {
@@ -150,6 +156,7 @@ int blkcg_activate_policy(struct request_queue *q,
 void blkcg_deactivate_policy(struct request_queue *q,
 			     const struct blkcg_policy *pol);
 
+const char *blkg_dev_name(struct blkcg_gq *blkg);
 void blkcg_print_blkgs(struct seq_file *sf, struct blkcg *blkcg,
 		       u64 (*prfill)(struct seq_file *,
 				     struct blkg_policy_data *, int),
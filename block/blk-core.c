@@ -39,6 +39,9 @@
 #include "blk.h"
 #include "blk-cgroup.h"
 #include "blk-mq.h"
+#include "blk-wbt.h"
+#include "blk-lat.h"
+#include "blk-iocost.h"
 
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_bio_remap);
 EXPORT_TRACEPOINT_SYMBOL_GPL(block_rq_remap);
@@ -108,6 +111,7 @@ void blk_rq_init(struct request_queue *q, struct request *rq)
 	rq->cmd = rq->__cmd;
 	rq->cmd_len = BLK_MAX_CDB;
 	rq->tag = -1;
+	rq->internal_tag = -1;
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
 	rq->part = NULL;
@@ -366,7 +370,7 @@ static void __blk_drain_queue(struct request_queue *q, bool drain_all)
 		 * The caller might be trying to drain @q before its
 		 * elevator is initialized.
 		 */
-		if (q->elevator)
+		if (q->elevator && !q->elevator->type->uses_mq)
 			elv_drain_elevator(q);
 
 		blkcg_drain_queue(q);
@@ -531,6 +535,11 @@ void blk_cleanup_queue(struct request_queue *q)
 	 * prevent that q->request_fn() gets invoked after draining finished.
 	 */
 	if (q->mq_ops) {
+		/* bios held back by blkcg policies haven't entered @q yet */
+		spin_lock_irq(lock);
+		blkcg_drain_queue(q);
+		spin_unlock_irq(lock);
+
 		blk_mq_freeze_queue(q);
 		spin_lock_irq(lock);
 	} else {
@@ -1372,6 +1381,9 @@ void __blk_put_request(struct request_queue *q, struct request *req)
 
 	blk_pm_put_request(req);
 
+	wbt_done(q->rq_wb, req);
+	blk_lat_disassociate(req);
+
 	elv_completed_request(q, req);
 
 	/* this is a bio leak */
@@ -1570,6 +1582,7 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	int el_ret, rw_flags, where = ELEVATOR_INSERT_SORT;
 	struct request *req;
 	unsigned int request_count = 0;
+	unsigned int wb_acct;
 
 	/*
 	 * low level driver can indicate that it wants pages above a
@@ -1617,6 +1630,12 @@ void blk_queue_bio(struct request_queue *q, struct bio *bio)
 	}
 
 get_rq:
+	/*
+	 * Buffered writeback may have to wait here for the device to catch
+	 * up, dropping the queue lock while it does.
+	 */
+	wb_acct = wbt_wait(q->rq_wb, bio, q->queue_lock);
+
 	/*
 	 * This sync check and mask will be re-done in init_request_from_bio(),
 	 * but we need to set it earlier to expose the sync flag to the
@@ -1632,10 +1651,13 @@ get_rq:
 	 */
 	req = get_request(q, rw_flags, bio, GFP_NOIO);
 	if (IS_ERR(req)) {
+		__wbt_done(q->rq_wb, wb_acct);
 		bio_endio(bio, PTR_ERR(req));	/* @q is dead */
 		goto out_unlock;
 	}
 
+	wbt_track(req, wb_acct);
+
 	/*
 	 * After dropping the lock and possibly sleeping here, our request
 	 * may now be mergeable after it had proven unmergeable (above).
@@ -1643,6 +1665,7 @@ get_rq:
 	 * often, and the elevators are able to handle it.
 	 */
 	init_request_from_bio(req, bio);
+	blk_lat_associate(req, bio);
 
 	if (test_bit(QUEUE_FLAG_SAME_COMP, &q->queue_flags))
 		req->cpu = raw_smp_processor_id();
@@ -1854,6 +1877,9 @@ generic_make_request_checks(struct bio *bio)
 	if (blk_throtl_bio(q, bio))
 		return false;	/* throttled, will be resubmitted later */
 
+	if (blk_iocost_bio(q, bio))
+		return false;	/* over its share, resubmitted later */
+
 	trace_block_bio_queue(q, bio);
 	return true;
 
@@ -2364,6 +2390,9 @@ void blk_start_request(struct request *req)
 {
 	blk_dequeue_request(req);
 
+	wbt_issue(req->q->rq_wb, req);
+	blk_lat_issue(req);
+
 	/*
 	 * We are now handing the request to the hardware, initialize
 	 * resid_len to full count and add the timeout handler.
@@ -2597,6 +2626,8 @@ void blk_finish_request(struct request *req, int error)
 		blk_unprep_request(req);
 
 	blk_account_io_done(req);
+	blk_lat_done(req);
+	blk_iocost_done(req);
 
 	if (req->end_io)
 		req->end_io(req, error);
@@ -0,0 +1,1213 @@
+/*
+ * Proportional IO control based on a device cost model.
+ *
+ * Every bio is charged a cost in device time, derived from a linear model
+ * of the device: a per-IO cost, which differs for sequential and random
+ * IOs, plus a per-page cost for the transfer.  The model comes from the
+ * queue's iocost_model sysfs file, which takes the bandwidth and the
+ * sequential and random IOPS the device manages for reads and writes.
+ *
+ * The device has a virtual clock (vtime) which runs at the modeled speed
+ * of the device.  Each cgroup issuing IO has its own vtime, which is
+ * advanced by the cost of every bio it issues divided by its share of the
+ * device, its hierarchical weight or hweight.  A bio may be issued when
+ * the cgroup's vtime wouldn't pass the device's with it, otherwise it is
+ * held back until the device vtime catches up.  Only cgroups which issued
+ * IO recently count towards the hweights, so the share of idle cgroups
+ * goes to the busy ones.
+ *
+ * The model is never exact, so the rate at which the device vtime runs
+ * (vrate) is adjusted each period.  If bios were held back and the
+ * completion latencies of the device meet the targets in iocost_qos, the
+ * device has room to spare and vrate goes up, which lets all cgroups
+ * issue more.  When the device misses the latency targets, it is
+ * saturated and vrate comes down, which enforces the shares.  In effect
+ * cgroups are only throttled to their share while the device is busy.
+ *
+ * This is a bio based policy like blk-throttle, it works on blk-mq as
+ * well as on the legacy request path.  Per cgroup weights are set through
+ * blkio.cost.weight and blkio.cost.weight_device and blkio.cost.stat
+ * shows the usage.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/parser.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/timer.h>
+
+#include "blk.h"
+#include "blk-cgroup.h"
+#include "blk-iocost.h"
+
+/*
+ * vtime is in units of 1 / VTIME_PER_SEC seconds of device time, fine
+ * enough for the costs of single pages on fast devices
+ */
+#define VTIME_PER_SEC_SHIFT	37
+#define VTIME_PER_SEC		(1ULL << VTIME_PER_SEC_SHIFT)
+#define VTIME_PER_USEC		(VTIME_PER_SEC / USEC_PER_SEC)
+
+/* hweights are fixed point fractions of the whole device */
+#define HWEIGHT_WHOLE		(1U << 16)
+
+/* vrate in percent of the modeled device speed and its bounds */
+#define VRATE_DFL		100
+#define VRATE_MIN		25
+#define VRATE_MAX		10000
+
+#define IOC_PERIOD_MSECS	50
+
+/*
+ * How far a cgroup's vtime may lag behind the device's, i.e. the budget
+ * an idle cgroup may build up for a burst.
+ */
+#define IOC_MARGIN_USECS	(IOC_PERIOD_MSECS * USEC_PER_MSEC / 4)
+
+/* the model works in 4k pages, seeks shorter than 16M are sequential */
+#define IOC_PAGE_SHIFT		12
+#define IOC_SECT_TO_PAGE_SHIFT	(IOC_PAGE_SHIFT - 9)
+#define IOC_RANDIO_PAGES	4096
+
+/* don't judge the latencies of a period with fewer completions */
+#define IOC_QOS_MIN_SAMPLES	10
+
+enum {
+	IOC_RBPS,
+	IOC_RSEQIOPS,
+	IOC_RRANDIOPS,
+	IOC_WBPS,
+	IOC_WSEQIOPS,
+	IOC_WRANDIOPS,
+
+	IOC_NR_MODEL,
+};
+
+enum {
+	IOC_RPCT,
+	IOC_RLAT,
+	IOC_WPCT,
+	IOC_WLAT,
+
+	IOC_NR_QOS,
+};
+
+static const match_table_t iocost_model_tokens = {
+	{ IOC_RBPS,		"rbps=%s"	},
+	{ IOC_RSEQIOPS,		"rseqiops=%s"	},
+	{ IOC_RRANDIOPS,	"rrandiops=%s"	},
+	{ IOC_WBPS,		"wbps=%s"	},
+	{ IOC_WSEQIOPS,		"wseqiops=%s"	},
+	{ IOC_WRANDIOPS,	"wrandiops=%s"	},
+	{ IOC_NR_MODEL,		NULL		},
+};
+
+static const match_table_t iocost_qos_tokens = {
+	{ IOC_RPCT,		"rpct=%s"	},
+	{ IOC_RLAT,		"rlat=%s"	},
+	{ IOC_WPCT,		"wpct=%s"	},
+	{ IOC_WLAT,		"wlat=%s"	},
+	{ IOC_NR_QOS,		NULL		},
+};
+
+/*
+ * Starting points for rotational and solid state devices, vrate makes up
+ * for the difference to the actual device.  Latencies are in usecs.
+ */
+static const u64 iocost_model_rot[IOC_NR_MODEL] = {
+	[IOC_RBPS]		= 174019176,
+	[IOC_RSEQIOPS]		= 41708,
+	[IOC_RRANDIOPS]		= 370,
+	[IOC_WBPS]		= 178075866,
+	[IOC_WSEQIOPS]		= 42705,
+	[IOC_WRANDIOPS]		= 378,
+};
+
+static const u64 iocost_model_nonrot[IOC_NR_MODEL] = {
+	[IOC_RBPS]		= 488636629,
+	[IOC_RSEQIOPS]		= 8932,
+	[IOC_RRANDIOPS]		= 8518,
+	[IOC_WBPS]		= 427891549,
+	[IOC_WSEQIOPS]		= 28755,
+	[IOC_WRANDIOPS]		= 21940,
+};
+
+static const u64 iocost_qos_rot[IOC_NR_QOS] = {
+	[IOC_RPCT]		= 95,
+	[IOC_RLAT]		= 250000,
+	[IOC_WPCT]		= 95,
+	[IOC_WLAT]		= 250000,
+};
+
+static const u64 iocost_qos_nonrot[IOC_NR_QOS] = {
+	[IOC_RPCT]		= 95,
+	[IOC_RLAT]		= 25000,
+	[IOC_WPCT]		= 95,
+	[IOC_WLAT]		= 25000,
+};
+
+/* completions meeting and missing the latency target, READ and WRITE */
+struct iocost_pcpu_stat {
+	u64				met[2];
+	u64				missed[2];
+};
+
+struct iocost {
+	struct request_queue		*queue;
+	spinlock_t			lock;
+	bool				enabled;
+
+	u64				model[IOC_NR_MODEL];
+	u64				qos[IOC_NR_QOS];
+
+	/* model in vtime, indexed by READ and WRITE */
+	u64				page_cost[2];
+	u64				seqio_cost[2];
+	u64				randio_cost[2];
+
+	/* the device vtime is period_at_vtime + (now - period_at) * rate */
+	unsigned int			vrate;
+	u64				vtime_rate;	/* per usec */
+	u64				period_at;	/* ns */
+	u64				period_at_vtime;
+
+	struct timer_list		timer;
+	struct list_head		active_iocgs;
+	u64				hweight_gen;
+
+	/* groups with bios held back and whether any were this period */
+	struct list_head		waiting_iocgs;
+	bool				shortage;
+	struct delayed_work		dispatch_work;
+
+	struct iocost_pcpu_stat __percpu *pcpu_stat;
+	u64				last_met[2];
+	u64				last_missed[2];
+};
+
+struct iocost_grp {
+	/* must be the first member */
+	struct blkg_policy_data		pd;
+
+	struct iocost			*ioc;
+
+	/* per device weight, 0 if the cgroup wide one applies */
+	unsigned int			dev_weight;
+	unsigned int			weight;
+
+	/*
+	 * hweight is the share of the subtree, hweight_self that of the
+	 * group's own IO, which competes with its active children.
+	 */
+	u32				hweight;
+	u32				hweight_self;
+	u32				child_sum;
+	u64				sum_gen;
+	u64				hw_gen;
+
+	bool				active;
+	bool				used;
+	bool				offline;
+	struct list_head		active_node;
+
+	u64				vtime;
+	sector_t			cursor;
+
+	struct bio_list			waitq;
+	struct list_head		wait_node;
+	u64				wait_since;
+
+	/* stats, usage is in vtime at the modeled speed */
+	u64				usage;
+	u64				nr_throttled;
+	u64				wait_ns;
+};
+
+static struct blkcg_policy blkcg_policy_iocost;
+
+/* issues held back bios, can't be done from the timer */
+static struct workqueue_struct *kiocostd_workqueue;
+
+static inline struct iocost_grp *pd_to_iocg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct iocost_grp, pd) : NULL;
+}
+
+static inline struct iocost_grp *blkg_to_iocg(struct blkcg_gq *blkg)
+{
+	return pd_to_iocg(blkg_to_pd(blkg, &blkcg_policy_iocost));
+}
+
+static inline struct blkcg_gq *iocg_to_blkg(struct iocost_grp *iocg)
+{
+	return pd_to_blkg(&iocg->pd);
+}
+
+static inline struct iocost_grp *iocg_parent(struct iocost_grp *iocg)
+{
+	struct blkcg_gq *parent = iocg_to_blkg(iocg)->parent;
+
+	return parent ? blkg_to_iocg(parent) : NULL;
+}
+
+static u64 iocost_div_round_up(u64 dividend, u64 divisor)
+{
+	return div64_u64(dividend + divisor - 1, divisor);
+}
+
+/*
+ * Turn bps and IOPS into a per-page cost and a per-IO cost on top of it,
+ * so that IOs of a single page come out at the given IOPS.
+ */
+static void iocost_calc_coefs(u64 bps, u64 seqiops, u64 randiops,
+			      u64 *page, u64 *seqio, u64 *randio)
+{
+	u64 v;
+
+	*seqio = *randio = 0;
+
+	*page = iocost_div_round_up(VTIME_PER_SEC,
+				    max_t(u64, bps >> IOC_PAGE_SHIFT, 1));
+
+	v = iocost_div_round_up(VTIME_PER_SEC, seqiops);
+	if (v > *page)
+		*seqio = v - *page;
+
+	v = iocost_div_round_up(VTIME_PER_SEC, randiops);
+	if (v > *page)
+		*randio = v - *page;
+}
+
+static void iocost_refresh_params(struct iocost *ioc)
+{
+	lockdep_assert_held(&ioc->lock);
+
+	iocost_calc_coefs(ioc->model[IOC_RBPS], ioc->model[IOC_RSEQIOPS],
+			  ioc->model[IOC_RRANDIOPS], &ioc->page_cost[READ],
+			  &ioc->seqio_cost[READ], &ioc->randio_cost[READ]);
+	iocost_calc_coefs(ioc->model[IOC_WBPS], ioc->model[IOC_WSEQIOPS],
+			  ioc->model[IOC_WRANDIOPS], &ioc->page_cost[WRITE],
+			  &ioc->seqio_cost[WRITE], &ioc->randio_cost[WRITE]);
+}
+
+static void iocost_default_params(struct request_queue *q, u64 *model,
+				  u64 *qos)
+{
+	bool nonrot = blk_queue_nonrot(q);
+
+	if (model)
+		memcpy(model, nonrot ? iocost_model_nonrot : iocost_model_rot,
+		       sizeof(iocost_model_rot));
+	if (qos)
+		memcpy(qos, nonrot ? iocost_qos_nonrot : iocost_qos_rot,
+		       sizeof(iocost_qos_rot));
+}
+
+static u64 iocost_vnow(struct iocost *ioc, u64 now)
+{
+	u64 delta = now > ioc->period_at ? now - ioc->period_at : 0;
+
+	return ioc->period_at_vtime +
+		div_u64(delta, NSEC_PER_USEC) * ioc->vtime_rate;
+}
+
+/* start a new period at the current vrate, keeping vtime continuous */
+static void iocost_start_period(struct iocost *ioc, u64 now)
+{
+	ioc->period_at_vtime = iocost_vnow(ioc, now);
+	ioc->period_at = now;
+	ioc->vtime_rate = div_u64(VTIME_PER_USEC * ioc->vrate, 100);
+}
+
+/* returns true if @iocg wasn't visited in this generation yet */
+static bool iocg_visit(struct iocost_grp *iocg, u64 gen)
+{
+	if (iocg->sum_gen == gen)
+		return false;
+	iocg->sum_gen = gen;
+	iocg->child_sum = 0;
+	return true;
+}
+
+static u32 iocg_hweight(struct iocost_grp *iocg, u64 gen)
+{
+	struct iocost_grp *pos, *parent;
+
+	/* resolve from the topmost ancestor which isn't done yet */
+	while (iocg->hw_gen != gen) {
+		pos = iocg;
+		while ((parent = iocg_parent(pos)) && parent->hw_gen != gen)
+			pos = parent;
+
+		if (parent)
+			pos->hweight = max_t(u32, div_u64((u64)parent->hweight *
+							  pos->weight,
+							  parent->child_sum), 1);
+		else
+			pos->hweight = HWEIGHT_WHOLE;
+		pos->hw_gen = gen;
+	}
+	return iocg->hweight;
+}
+
+/*
+ * Recalculate the shares of the active groups.  A group's weight counts
+ * towards its parent's children while it or any of its descendants is
+ * active.
+ */
+static void iocost_update_hweights(struct iocost *ioc)
+{
+	struct iocost_grp *iocg, *child, *parent;
+	u64 gen = ++ioc->hweight_gen;
+	bool first;
+
+	lockdep_assert_held(&ioc->lock);
+
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_node) {
+		first = iocg_visit(iocg, gen);
+		iocg->child_sum += iocg->weight;
+
+		child = iocg;
+		while (first && (parent = iocg_parent(child))) {
+			first = iocg_visit(parent, gen);
+			parent->child_sum += child->weight;
+			child = parent;
+		}
+	}
+
+	list_for_each_entry(iocg, &ioc->active_iocgs, active_node) {
+		u32 hw = iocg_hweight(iocg, gen);
+
+		iocg->hweight_self = max_t(u32, div_u64((u64)hw * iocg->weight,
+							iocg->child_sum), 1);
+	}
+}
+
+static void iocg_activate(struct iocost *ioc, struct iocost_grp *iocg,
+			  u64 now)
+{
+	u64 vnow, vmin;
+
+	lockdep_assert_held(&ioc->lock);
+
+	/* the period timer stops when all groups are idle */
+	if (list_empty(&ioc->active_iocgs)) {
+		iocost_start_period(ioc, now);
+		mod_timer(&ioc->timer,
+			  jiffies + msecs_to_jiffies(IOC_PERIOD_MSECS));
+	}
+
+	/*
+	 * vtime wraps, so after a long enough idle time the group's would
+	 * look ahead of the device's.  It can't have been by more than
+	 * the last bio when the group went idle, so just catch it up.
+	 */
+	vnow = iocost_vnow(ioc, now);
+	vmin = vnow - IOC_MARGIN_USECS * ioc->vtime_rate;
+	if (time_before64(iocg->vtime, vmin) || time_after64(iocg->vtime, vnow))
+		iocg->vtime = vmin;
+
+	iocg->active = true;
+	list_add_tail(&iocg->active_node, &ioc->active_iocgs);
+	iocost_update_hweights(ioc);
+}
+
+static void iocg_deactivate(struct iocost_grp *iocg)
+{
+	iocg->active = false;
+	list_del_init(&iocg->active_node);
+}
+
+static u64 iocost_calc_cost(struct iocost *ioc, struct iocost_grp *iocg,
+			    struct bio *bio)
+{
+	int rw = bio_data_dir(bio);
+	sector_t sector = bio->bi_iter.bi_sector;
+	u64 pages, seek, cost;
+
+	pages = max_t(u64, bio_sectors(bio) >> IOC_SECT_TO_PAGE_SHIFT, 1);
+	seek = sector > iocg->cursor ? sector - iocg->cursor :
+				       iocg->cursor - sector;
+
+	if ((seek >> IOC_SECT_TO_PAGE_SHIFT) > IOC_RANDIO_PAGES)
+		cost = ioc->randio_cost[rw];
+	else
+		cost = ioc->seqio_cost[rw];
+
+	return cost + pages * ioc->page_cost[rw];
+}
+
+static u64 iocg_vcost(struct iocost_grp *iocg, u64 cost)
+{
+	return div_u64(cost * HWEIGHT_WHOLE, iocg->hweight_self);
+}
+
+/*
+ * Returns the vtime at which @bio could be issued.  Budget left unused
+ * while idle is only kept up to the margin.
+ */
+static u64 iocg_bio_ready(struct iocost *ioc, struct iocost_grp *iocg,
+			  struct bio *bio, u64 vnow, u64 *cost)
+{
+	u64 vmin = vnow - IOC_MARGIN_USECS * ioc->vtime_rate;
+
+	if (time_before64(iocg->vtime, vmin))
+		iocg->vtime = vmin;
+
+	*cost = iocost_calc_cost(ioc, iocg, bio);
+	return iocg->vtime + iocg_vcost(iocg, *cost);
+}
+
+static void iocg_charge(struct iocost_grp *iocg, struct bio *bio, u64 cost)
+{
+	iocg->vtime += iocg_vcost(iocg, cost);
+	iocg->cursor = bio_end_sector(bio);
+	iocg->usage += cost;
+}
+
+static void iocg_wait_done(struct iocost_grp *iocg, u64 now)
+{
+	list_del_init(&iocg->wait_node);
+	iocg->wait_ns += now - iocg->wait_since;
+	blkg_put(iocg_to_blkg(iocg));
+}
+
+/* kick the dispatch worker for when the first held back bio may go */
+static void iocost_schedule_dispatch(struct iocost *ioc, u64 vnow)
+{
+	struct iocost_grp *iocg;
+	u64 vdelay = U64_MAX;
+	unsigned long delay, expires;
+
+	lockdep_assert_held(&ioc->lock);
+
+	list_for_each_entry(iocg, &ioc->waiting_iocgs, wait_node) {
+		u64 cost, ready;
+
+		if (!ioc->enabled || iocg->offline) {
+			vdelay = 0;
+			break;
+		}
+		ready = iocg_bio_ready(ioc, iocg, bio_list_peek(&iocg->waitq),
+				       vnow, &cost);
+		vdelay = min(vdelay,
+			     time_after64(ready, vnow) ? ready - vnow : 0);
+	}
+
+	if (vdelay == U64_MAX)
+		return;
+
+	delay = usecs_to_jiffies(div64_u64(vdelay, ioc->vtime_rate) + 1);
+	expires = jiffies + delay;
+	if (delayed_work_pending(&ioc->dispatch_work) &&
+	    time_before_eq(ioc->dispatch_work.timer.expires, expires))
+		return;
+
+	mod_delayed_work(kiocostd_workqueue, &ioc->dispatch_work, delay);
+}
+
+/*
+ * Move the bios which may be issued now to @bios.  Without @force, this
+ * stops at the first bio of each group which is over its budget.
+ */
+static void iocost_dispatch(struct iocost *ioc, struct bio_list *bios,
+			    bool force)
+{
+	struct iocost_grp *iocg, *n;
+	u64 now = ktime_get_ns();
+	u64 vnow = iocost_vnow(ioc, now);
+	struct bio *bio;
+
+	lockdep_assert_held(&ioc->lock);
+
+	if (!ioc->enabled)
+		force = true;
+
+	list_for_each_entry_safe(iocg, n, &ioc->waiting_iocgs, wait_node) {
+		while ((bio = bio_list_peek(&iocg->waitq))) {
+			u64 cost;
+
+			if (!force && !iocg->offline) {
+				if (time_after64(iocg_bio_ready(ioc, iocg, bio,
+								vnow, &cost),
+						 vnow))
+					break;
+				iocg_charge(iocg, bio, cost);
+			}
+			bio_list_add(bios, bio_list_pop(&iocg->waitq));
+		}
+
+		if (bio_list_empty(&iocg->waitq))
+			iocg_wait_done(iocg, now);
+	}
+
+	iocost_schedule_dispatch(ioc, vnow);
+}
+
+static void iocost_issue_bios(struct bio_list *bios)
+{
+	struct blk_plug plug;
+	struct bio *bio;
+
+	if (bio_list_empty(bios))
+		return;
+
+	/* they already went through blk-throttle before being held back */
+	blk_start_plug(&plug);
+	while ((bio = bio_list_pop(bios))) {
+		bio->bi_rw |= REQ_COST_CHARGED | REQ_THROTTLED;
+		generic_make_request(bio);
+	}
+	blk_finish_plug(&plug);
+}
+
+static void iocost_dispatch_work_fn(struct work_struct *work)
+{
+	struct iocost *ioc = container_of(to_delayed_work(work), struct iocost,
+					  dispatch_work);
+	struct bio_list bios;
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&ioc->lock);
+	iocost_dispatch(ioc, &bios, false);
+	spin_unlock_irq(&ioc->lock);
+
+	iocost_issue_bios(&bios);
+}
+
+/*
+ * Returns true if the device missed the latency targets in the period
+ * which just ended.
+ */
+static bool iocost_saturated(struct iocost *ioc)
+{
+	bool saturated = false;
+	int cpu, rw;
+
+	for (rw = READ; rw <= WRITE; rw++) {
+		u64 met = 0, missed = 0, nr, pct;
+
+		for_each_possible_cpu(cpu) {
+			struct iocost_pcpu_stat *stat;
+
+			stat = per_cpu_ptr(ioc->pcpu_stat, cpu);
+			met += stat->met[rw];
+			missed += stat->missed[rw];
+		}
+
+		nr = met - ioc->last_met[rw] + missed - ioc->last_missed[rw];
+		missed -= ioc->last_missed[rw];
+		ioc->last_met[rw] = met;
+		ioc->last_missed[rw] += missed;
+
+		pct = ioc->qos[rw == READ ? IOC_RPCT : IOC_WPCT];
+		if (nr >= IOC_QOS_MIN_SAMPLES && missed * 100 > nr * (100 - pct))
+			saturated = true;
+	}
+	return saturated;
+}
+
+static void iocost_timer_fn(unsigned long data)
+{
+	struct iocost *ioc = (struct iocost *)data;
+	struct iocost_grp *iocg, *n;
+	u64 now = ktime_get_ns();
+	unsigned long flags;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+
+	/*
+	 * Speed up if bios had to wait while the device kept up, slow
+	 * down if it didn't.
+	 */
+	if (iocost_saturated(ioc))
+		ioc->vrate = max(ioc->vrate - ioc->vrate / 8,
+				 (unsigned int)VRATE_MIN);
+	else if (ioc->shortage)
+		ioc->vrate = min(ioc->vrate + max(ioc->vrate / 8, 1U),
+				 (unsigned int)VRATE_MAX);
+
+	iocost_start_period(ioc, now);
+	ioc->shortage = !list_empty(&ioc->waiting_iocgs);
+
+	list_for_each_entry_safe(iocg, n, &ioc->active_iocgs, active_node) {
+		if (!iocg->used && bio_list_empty(&iocg->waitq))
+			iocg_deactivate(iocg);
+		iocg->used = false;
+	}
+
+	/* also picks up weights changed during the period */
+	iocost_update_hweights(ioc);
+
+	if (!list_empty(&ioc->active_iocgs))
+		mod_timer(&ioc->timer,
+			  jiffies + msecs_to_jiffies(IOC_PERIOD_MSECS));
+
+	/* the rate and shares changed, so did the wait times */
+	iocost_schedule_dispatch(ioc, ioc->period_at_vtime);
+
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static void iocost_pd_init(struct blkcg_gq *blkg)
+{
+	struct iocost_grp *iocg = blkg_to_iocg(blkg);
+
+	iocg->ioc = blkg->q->iocost;
+	iocg->weight = blkg->blkcg->cost_weight;
+	iocg->hweight = HWEIGHT_WHOLE;
+	iocg->hweight_self = HWEIGHT_WHOLE;
+	INIT_LIST_HEAD(&iocg->active_node);
+	INIT_LIST_HEAD(&iocg->wait_node);
+	bio_list_init(&iocg->waitq);
+}
+
+/*
+ * The group is going away.  Its held back bios keep it around and are
+ * issued without being charged.
+ */
+static void iocost_pd_offline(struct blkcg_gq *blkg)
+{
+	struct iocost_grp *iocg = blkg_to_iocg(blkg);
+	struct iocost *ioc = iocg->ioc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ioc->lock, flags);
+	iocg->offline = true;
+	if (iocg->active) {
+		iocg_deactivate(iocg);
+		iocost_update_hweights(ioc);
+	}
+	if (!bio_list_empty(&iocg->waitq))
+		mod_delayed_work(kiocostd_workqueue, &ioc->dispatch_work, 0);
+	spin_unlock_irqrestore(&ioc->lock, flags);
+}
+
+static void iocost_pd_reset_stats(struct blkcg_gq *blkg)
+{
+	struct iocost_grp *iocg = blkg_to_iocg(blkg);
+	unsigned long flags;
+
+	spin_lock_irqsave(&iocg->ioc->lock, flags);
+	iocg->usage = 0;
+	iocg->nr_throttled = 0;
+	iocg->wait_ns = 0;
+	spin_unlock_irqrestore(&iocg->ioc->lock, flags);
+}
+
+static int iocost_print_weight(struct seq_file *sf, void *v)
+{
+	seq_printf(sf, "%u\n", css_to_blkcg(seq_css(sf))->cost_weight);
+	return 0;
+}
+
+static int iocost_set_weight(struct cgroup_subsys_state *css,
+			     struct cftype *cft, u64 val)
+{
+	struct blkcg *blkcg = css_to_blkcg(css);
+	struct blkcg_gq *blkg;
+
+	if (val < COST_WEIGHT_MIN || val > COST_WEIGHT_MAX)
+		return -EINVAL;
+
+	spin_lock_irq(&blkcg->lock);
+	blkcg->cost_weight = val;
+
+	/* the shares are recalculated at the end of the period */
+	hlist_for_each_entry(blkg, &blkcg->blkg_list, blkcg_node) {
+		struct iocost_grp *iocg = blkg_to_iocg(blkg);
+
+		if (iocg && !iocg->dev_weight)
+			ACCESS_ONCE(iocg->weight) = val;
+	}
+	spin_unlock_irq(&blkcg->lock);
+	return 0;
+}
+
+static u64 iocost_prfill_weight_device(struct seq_file *sf,
+				       struct blkg_policy_data *pd, int off)
+{
+	struct iocost_grp *iocg = pd_to_iocg(pd);
+
+	if (!iocg->dev_weight)
+		return 0;
+	return __blkg_prfill_u64(sf, pd, iocg->dev_weight);
+}
+
+static int iocost_print_weight_device(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)),
+			  iocost_prfill_weight_device, &blkcg_policy_iocost,
+			  0, false);
+	return 0;
+}
+
+static ssize_t iocost_set_weight_device(struct kernfs_open_file *of,
+					char *buf, size_t nbytes, loff_t off)
+{
+	struct blkcg *blkcg = css_to_blkcg(of_css(of));
+	struct blkg_conf_ctx ctx;
+	struct iocost_grp *iocg;
+	int ret;
+
+	ret = blkg_conf_prep(blkcg, &blkcg_policy_iocost, buf, &ctx);
+	if (ret)
+		return ret;
+
+	ret = -EINVAL;
+	iocg = blkg_to_iocg(ctx.blkg);
+	if (!ctx.v || (ctx.v >= COST_WEIGHT_MIN && ctx.v <= COST_WEIGHT_MAX)) {
+		iocg->dev_weight = ctx.v;
+		ACCESS_ONCE(iocg->weight) = ctx.v ?: blkcg->cost_weight;
+		ret = 0;
+	}
+
+	blkg_conf_finish(&ctx);
+	return ret ?: nbytes;
+}
+
+static u64 iocost_prfill_stat(struct seq_file *sf, struct blkg_policy_data *pd,
+			      int off)
+{
+	struct iocost_grp *iocg = pd_to_iocg(pd);
+	const char *dname = blkg_dev_name(pd->blkg);
+	u64 usage, nr_throttled, wait_ns;
+	u32 hweight;
+
+	if (!dname)
+		return 0;
+
+	spin_lock(&iocg->ioc->lock);
+	hweight = iocg->active ? iocg->hweight_self : 0;
+	usage = iocg->usage;
+	nr_throttled = iocg->nr_throttled;
+	wait_ns = iocg->wait_ns;
+	spin_unlock(&iocg->ioc->lock);
+
+	hweight = div_u64((u64)hweight * 10000, HWEIGHT_WHOLE);
+	seq_printf(sf, "%s weight=%u hweight=%u.%02u usage_us=%llu throttled=%llu wait_us=%llu\n",
+		   dname, iocg->weight, hweight / 100, hweight % 100,
+		   div64_u64(usage, VTIME_PER_USEC),
+		   (unsigned long long)nr_throttled,
+		   div64_u64(wait_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static int iocost_print_stat(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), iocost_prfill_stat,
+			  &blkcg_policy_iocost, 0, false);
+	return 0;
+}
+
+static struct cftype iocost_files[] = {
+	{
+		.name = "cost.weight",
+		.seq_show = iocost_print_weight,
+		.write_u64 = iocost_set_weight,
+	},
+	{
+		.name = "cost.weight_device",
+		.seq_show = iocost_print_weight_device,
+		.write = iocost_set_weight_device,
+	},
+	{
+		.name = "cost.stat",
+		.seq_show = iocost_print_stat,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_iocost = {
+	.pd_size		= sizeof(struct iocost_grp),
+	.cftypes		= iocost_files,
+
+	.pd_init_fn		= iocost_pd_init,
+	.pd_offline_fn		= iocost_pd_offline,
+	.pd_reset_stats_fn	= iocost_pd_reset_stats,
+};
+
+static struct blkcg_gq *iocost_lookup_blkg(struct request_queue *q,
+					   struct blkcg *blkcg)
+{
+	struct blkcg_gq *blkg;
+
+	blkg = blkg_lookup(blkcg, q);
+	if (likely(blkg))
+		return blkg;
+
+	/* first bio of this cgroup on @q */
+	spin_lock_irq(q->queue_lock);
+	blkg = blkg_lookup_create(blkcg, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return IS_ERR(blkg) ? NULL : blkg;
+}
+
+/*
+ * Called from generic_make_request_checks().  Returns true if @bio was
+ * held back, it is issued again by the dispatch worker.
+ */
+bool blk_iocost_bio(struct request_queue *q, struct bio *bio)
+{
+	struct iocost *ioc = q->iocost;
+	struct iocost_grp *iocg;
+	struct blkcg_gq *blkg;
+	bool throttled = false;
+	u64 now, vnow, cost = 0;
+
+	if (!ioc || !ACCESS_ONCE(ioc->enabled))
+		goto out;
+
+	/* issued by the dispatch worker, or passed through a stacked one */
+	if (bio->bi_rw & REQ_COST_CHARGED)
+		goto out;
+
+	if (!bio->bi_iter.bi_size ||
+	    (bio->bi_rw & (REQ_DISCARD | REQ_WRITE_SAME)) ||
+	    blk_queue_dying(q))
+		goto out;
+
+	rcu_read_lock();
+	blkg = iocost_lookup_blkg(q, bio_blkcg(bio));
+	iocg = blkg ? blkg_to_iocg(blkg) : NULL;
+	if (!iocg)
+		goto out_unlock_rcu;
+
+	spin_lock_irq(&ioc->lock);
+	if (!ioc->enabled || iocg->offline)
+		goto out_unlock;
+
+	now = ktime_get_ns();
+	if (!iocg->active)
+		iocg_activate(ioc, iocg, now);
+	iocg->used = true;
+
+	vnow = iocost_vnow(ioc, now);
+	if (bio_list_empty(&iocg->waitq) &&
+	    !time_after64(iocg_bio_ready(ioc, iocg, bio, vnow, &cost), vnow)) {
+		iocg_charge(iocg, bio, cost);
+		goto out_unlock;
+	}
+
+	/* over budget, queue @bio and keep the group until it's issued */
+	bio_associate_current(bio);
+	if (bio_list_empty(&iocg->waitq)) {
+		blkg_get(blkg);
+		iocg->wait_since = now;
+		list_add_tail(&iocg->wait_node, &ioc->waiting_iocgs);
+	}
+	bio_list_add(&iocg->waitq, bio);
+	iocg->nr_throttled++;
+	ioc->shortage = true;
+	iocost_schedule_dispatch(ioc, vnow);
+	throttled = true;
+
+out_unlock:
+	spin_unlock_irq(&ioc->lock);
+out_unlock_rcu:
+	rcu_read_unlock();
+out:
+	/* don't let the flag leak to a stacked device below */
+	if (!throttled)
+		bio->bi_rw &= ~REQ_COST_CHARGED;
+	return throttled;
+}
+
+void __blk_iocost_done(struct request *rq)
+{
+	struct iocost *ioc = rq->q->iocost;
+	int rw = rq_data_dir(rq);
+	u64 now = sched_clock(), lat, target;
+
+	if (!ioc->enabled || rq->cmd_type != REQ_TYPE_FS ||
+	    (rq->cmd_flags & (REQ_DISCARD | REQ_FLUSH_SEQ)))
+		return;
+
+	lat = now > rq_io_start_time_ns(rq) ? now - rq_io_start_time_ns(rq) : 0;
+	target = ioc->qos[rw == READ ? IOC_RLAT : IOC_WLAT] * NSEC_PER_USEC;
+
+	if (lat > target)
+		this_cpu_inc(ioc->pcpu_stat->missed[rw]);
+	else
+		this_cpu_inc(ioc->pcpu_stat->met[rw]);
+}
+
+/**
+ * blk_iocost_drain - issue all held back bios
+ * @q: request_queue to drain
+ *
+ * Called from blkcg_drain_queue() with the queue lock held.
+ */
+void blk_iocost_drain(struct request_queue *q)
+	__releases(q->queue_lock) __acquires(q->queue_lock)
+{
+	struct iocost *ioc = q->iocost;
+	struct bio_list bios;
+
+	if (!ioc)
+		return;
+
+	bio_list_init(&bios);
+
+	spin_unlock_irq(q->queue_lock);
+
+	spin_lock_irq(&ioc->lock);
+	iocost_dispatch(ioc, &bios, true);
+	spin_unlock_irq(&ioc->lock);
+
+	iocost_issue_bios(&bios);
+
+	spin_lock_irq(q->queue_lock);
+}
+
+static struct iocost *iocost_alloc(struct request_queue *q)
+{
+	struct iocost *ioc;
+
+	ioc = kzalloc_node(sizeof(*ioc), GFP_KERNEL, q->node);
+	if (!ioc)
+		return NULL;
+
+	ioc->pcpu_stat = alloc_percpu(struct iocost_pcpu_stat);
+	if (!ioc->pcpu_stat) {
+		kfree(ioc);
+		return NULL;
+	}
+
+	ioc->queue = q;
+	spin_lock_init(&ioc->lock);
+	setup_timer(&ioc->timer, iocost_timer_fn, (unsigned long)ioc);
+	INIT_LIST_HEAD(&ioc->active_iocgs);
+	INIT_LIST_HEAD(&ioc->waiting_iocgs);
+	INIT_DELAYED_WORK(&ioc->dispatch_work, iocost_dispatch_work_fn);
+
+	iocost_default_params(q, ioc->model, ioc->qos);
+	iocost_refresh_params(ioc);
+
+	ioc->vrate = VRATE_DFL;
+	iocost_start_period(ioc, ktime_get_ns());
+
+	return ioc;
+}
+
+/* allocated on first use from sysfs and kept until the queue is released */
+static struct iocost *iocost_get(struct request_queue *q)
+{
+	struct iocost *ioc;
+
+	if (!q->iocost) {
+		ioc = iocost_alloc(q);
+		if (!ioc)
+			return NULL;
+		/* the IO path may see it right away */
+		smp_wmb();
+		q->iocost = ioc;
+	}
+	return q->iocost;
+}
+
+bool blk_iocost_enabled(struct request_queue *q)
+{
+	return q->iocost && q->iocost->enabled;
+}
+
+/*
+ * Called with q->sysfs_lock held.  Like the latency histograms, the
+ * policy stays active until the queue is released once turned on, turning
+ * it off just lets everything through.
+ */
+int blk_iocost_enable(struct request_queue *q, bool enable)
+{
+	struct iocost *ioc = q->iocost;
+	struct bio_list bios;
+	int ret;
+
+	if (!enable && !ioc)
+		return 0;
+
+	ioc = iocost_get(q);
+	if (!ioc)
+		return -ENOMEM;
+
+	if (enable) {
+		ret = blkcg_activate_policy(q, &blkcg_policy_iocost);
+		if (ret)
+			return ret;
+	}
+
+	bio_list_init(&bios);
+
+	spin_lock_irq(&ioc->lock);
+	if (enable && !ioc->enabled)
+		iocost_start_period(ioc, ktime_get_ns());
+	ioc->enabled = enable;
+	if (!enable)
+		iocost_dispatch(ioc, &bios, true);
+	spin_unlock_irq(&ioc->lock);
+
+	iocost_issue_bios(&bios);
+	return 0;
+}
+
+static int iocost_parse(const char *page, const match_table_t tokens,
+			u64 *vals)
+{
+	char *buf, *p, *tok;
+	int ret = 0;
+
+	buf = kstrdup(page, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	p = buf;
+	while ((tok = strsep(&p, " \t\n"))) {
+		substring_t args[MAX_OPT_ARGS];
+		char num[24];
+		int token;
+
+		if (!*tok)
+			continue;
+
+		token = match_token(tok, tokens, args);
+		if (token < 0 || !tokens[token].pattern) {
+			ret = -EINVAL;
+			break;
+		}
+		match_strlcpy(num, &args[0], sizeof(num));
+		ret = kstrtou64(num, 0, &vals[token]);
+		if (ret)
+			break;
+	}
+
+	kfree(buf);
+	return ret;
+}
+
+ssize_t blk_iocost_model_show(struct request_queue *q, char *page)
+{
+	u64 model[IOC_NR_MODEL];
+
+	if (q->iocost) {
+		spin_lock_irq(&q->iocost->lock);
+		memcpy(model, q->iocost->model, sizeof(model));
+		spin_unlock_irq(&q->iocost->lock);
+	} else {
+		iocost_default_params(q, model, NULL);
+	}
+
+	return sprintf(page, "rbps=%llu rseqiops=%llu rrandiops=%llu "
+		       "wbps=%llu wseqiops=%llu wrandiops=%llu\n",
+		       model[IOC_RBPS], model[IOC_RSEQIOPS],
+		       model[IOC_RRANDIOPS], model[IOC_WBPS],
+		       model[IOC_WSEQIOPS], model[IOC_WRANDIOPS]);
+}
+
+/* Called with q->sysfs_lock held, only the given parameters change. */
+int blk_iocost_model_store(struct request_queue *q, const char *page)
+{
+	struct iocost *ioc = iocost_get(q);
+	u64 model[IOC_NR_MODEL];
+	int ret, i;
+
+	if (!ioc)
+		return -ENOMEM;
+
+	spin_lock_irq(&ioc->lock);
+	memcpy(model, ioc->model, sizeof(model));
+	spin_unlock_irq(&ioc->lock);
+
+	ret = iocost_parse(page, iocost_model_tokens, model);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < IOC_NR_MODEL; i++)
+		if (!model[i])
+			return -EINVAL;
+
+	spin_lock_irq(&ioc->lock);
+	memcpy(ioc->model, model, sizeof(model));
+	iocost_refresh_params(ioc);
+	spin_unlock_irq(&ioc->lock);
+	return 0;
+}
+
+ssize_t blk_iocost_qos_show(struct request_queue *q, char *page)
+{
+	u64 qos[IOC_NR_QOS];
+
+	if (q->iocost) {
+		spin_lock_irq(&q->iocost->lock);
+		memcpy(qos, q->iocost->qos, sizeof(qos));
+		spin_unlock_irq(&q->iocost->lock);
+	} else {
+		iocost_default_params(q, NULL, qos);
+	}
+
+	return sprintf(page, "rpct=%llu rlat=%llu wpct=%llu wlat=%llu\n",
+		       qos[IOC_RPCT], qos[IOC_RLAT], qos[IOC_WPCT],
+		       qos[IOC_WLAT]);
+}
+
+int blk_iocost_qos_store(struct request_queue *q, const char *page)
+{
+	struct iocost *ioc = iocost_get(q);
+	u64 qos[IOC_NR_QOS];
+	int ret;
+
+	if (!ioc)
+		return -ENOMEM;
+
+	spin_lock_irq(&ioc->lock);
+	memcpy(qos, ioc->qos, sizeof(qos));
+	spin_unlock_irq(&ioc->lock);
+
+	ret = iocost_parse(page, iocost_qos_tokens, qos);
+	if (ret)
+		return ret;
+
+	if (!qos[IOC_RPCT] || qos[IOC_RPCT] > 100 ||
+	    !qos[IOC_WPCT] || qos[IOC_WPCT] > 100 ||
+	    !qos[IOC_RLAT] || !qos[IOC_WLAT])
+		return -EINVAL;
+
+	spin_lock_irq(&ioc->lock);
+	memcpy(ioc->qos, qos, sizeof(qos));
+	spin_unlock_irq(&ioc->lock);
+	return 0;
+}
+
+ssize_t blk_iocost_vrate_show(struct request_queue *q, char *page)
+{
+	return sprintf(page, "%u\n", q->iocost ? q->iocost->vrate : VRATE_DFL);
+}
+
+void blk_iocost_exit(struct request_queue *q)
+{
+	struct iocost *ioc = q->iocost;
+
+	if (!ioc)
+		return;
+
+	/* takes the groups off the lists before the timer and work go */
+	blkcg_deactivate_policy(q, &blkcg_policy_iocost);
+	WARN_ON_ONCE(!list_empty(&ioc->waiting_iocgs));
+	del_timer_sync(&ioc->timer);
+	cancel_delayed_work_sync(&ioc->dispatch_work);
+
+	free_percpu(ioc->pcpu_stat);
+	kfree(ioc);
+	q->iocost = NULL;
+}
+
+static int __init iocost_init(void)
+{
+	kiocostd_workqueue = alloc_workqueue("kiocostd", WQ_MEM_RECLAIM, 0);
+	if (!kiocostd_workqueue)
+		panic("Failed to create kiocostd\n");
+
+	return blkcg_policy_register(&blkcg_policy_iocost);
+}
+module_init(iocost_init);
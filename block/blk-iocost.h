@@ -0,0 +1,59 @@
+#ifndef INT_BLK_IOCOST_H
+#define INT_BLK_IOCOST_H
+
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+
+#ifdef CONFIG_BLK_IOCOST
+
+bool blk_iocost_bio(struct request_queue *q, struct bio *bio);
+void blk_iocost_drain(struct request_queue *q);
+void blk_iocost_exit(struct request_queue *q);
+void __blk_iocost_done(struct request *rq);
+
+/*
+ * The legacy path stamps io_start_time_ns when the request is dequeued,
+ * blk-mq only does it for queues whose latency we are watching.
+ */
+static inline void blk_iocost_issue(struct request *rq)
+{
+	if (rq->q->iocost)
+		set_io_start_time_ns(rq);
+}
+
+static inline void blk_iocost_done(struct request *rq)
+{
+	if (rq->q->iocost && rq_io_start_time_ns(rq))
+		__blk_iocost_done(rq);
+}
+
+bool blk_iocost_enabled(struct request_queue *q);
+int blk_iocost_enable(struct request_queue *q, bool enable);
+ssize_t blk_iocost_model_show(struct request_queue *q, char *page);
+int blk_iocost_model_store(struct request_queue *q, const char *page);
+ssize_t blk_iocost_qos_show(struct request_queue *q, char *page);
+int blk_iocost_qos_store(struct request_queue *q, const char *page);
+ssize_t blk_iocost_vrate_show(struct request_queue *q, char *page);
+
+#else
+
+static inline bool blk_iocost_bio(struct request_queue *q, struct bio *bio)
+{
+	return false;
+}
+static inline void blk_iocost_drain(struct request_queue *q)
+{
+}
+static inline void blk_iocost_exit(struct request_queue *q)
+{
+}
+static inline void blk_iocost_issue(struct request *rq)
+{
+}
+static inline void blk_iocost_done(struct request *rq)
+{
+}
+
+#endif /* CONFIG_BLK_IOCOST */
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * Request latency histograms, per queue and per blkcg.
+ *
+ * With the queue's lat_hist_enable set, requests are stamped when they
+ * are handed to the driver and on completion the time it took is counted
+ * in a log2 usec bucket, separately for reads, writes and discards.  The
+ * buckets are per cpu, so the completion side never shares a cacheline
+ * with other cpus; they are only summed up when read.
+ *
+ * The same is done per blkcg - queue pair through a blkcg policy, which
+ * is activated on a queue the first time its histogram is enabled.  A
+ * request is charged to the cgroup of the bio it was created from, which
+ * is looked up in submission context as completions don't run in the
+ * context of the submitter.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+
+#include "blk.h"
+#include "blk-cgroup.h"
+#include "blk-lat.h"
+
+static const char *blk_lat_dir_name[BLK_LAT_NR_DIRS] = {
+	[BLK_LAT_READ]		= "read",
+	[BLK_LAT_WRITE]		= "write",
+	[BLK_LAT_DISCARD]	= "discard",
+};
+
+static unsigned int blk_lat_dir(struct request *rq)
+{
+	if (rq->cmd_flags & REQ_DISCARD)
+		return BLK_LAT_DISCARD;
+	return rq_data_dir(rq) == WRITE ? BLK_LAT_WRITE : BLK_LAT_READ;
+}
+
+static unsigned int blk_lat_bucket(u64 nsec)
+{
+	unsigned int bucket = fls64(div_u64(nsec, NSEC_PER_USEC));
+
+	return min_t(unsigned int, bucket, BLK_LAT_NR_BUCKETS - 1);
+}
+
+static void blk_lat_hist_sum(struct blk_lat_hist *sum,
+			     struct blk_lat_hist __percpu *hist)
+{
+	int cpu, dir, i;
+
+	memset(sum, 0, sizeof(*sum));
+
+	for_each_possible_cpu(cpu) {
+		struct blk_lat_hist *h = per_cpu_ptr(hist, cpu);
+
+		for (dir = 0; dir < BLK_LAT_NR_DIRS; dir++)
+			for (i = 0; i < BLK_LAT_NR_BUCKETS; i++)
+				sum->buckets[dir][i] += h->buckets[dir][i];
+	}
+}
+
+#ifdef CONFIG_BLK_CGROUP
+
+struct lat_grp {
+	/* must be the first member */
+	struct blkg_policy_data pd;
+
+	struct blk_lat_hist __percpu *hist;
+	struct list_head hist_alloc_node;
+};
+
+static struct blkcg_policy blkcg_policy_lat;
+
+/* list and work item to allocate percpu group histograms */
+static DEFINE_SPINLOCK(lg_hist_alloc_lock);
+static LIST_HEAD(lg_hist_alloc_list);
+
+static void lg_hist_alloc_fn(struct work_struct *);
+static DECLARE_DELAYED_WORK(lg_hist_alloc_work, lg_hist_alloc_fn);
+
+static inline struct lat_grp *pd_to_lg(struct blkg_policy_data *pd)
+{
+	return pd ? container_of(pd, struct lat_grp, pd) : NULL;
+}
+
+static inline struct lat_grp *blkg_to_lg(struct blkcg_gq *blkg)
+{
+	return pd_to_lg(blkg_to_pd(blkg, &blkcg_policy_lat));
+}
+
+/*
+ * Worker for allocating the per cpu histograms of new groups, the percpu
+ * allocator can't be called from the IO path where groups are created.
+ * Until it ran, the group's requests are only counted on the queue.
+ */
+static void lg_hist_alloc_fn(struct work_struct *work)
+{
+	static struct blk_lat_hist __percpu *hist;	/* this fn is non-reentrant */
+	struct delayed_work *dwork = to_delayed_work(work);
+	bool empty = false;
+
+alloc_hist:
+	if (!hist) {
+		hist = alloc_percpu(struct blk_lat_hist);
+		if (!hist) {
+			/* allocation failed, try again after some time */
+			schedule_delayed_work(dwork, msecs_to_jiffies(10));
+			return;
+		}
+	}
+
+	spin_lock_irq(&lg_hist_alloc_lock);
+
+	if (!list_empty(&lg_hist_alloc_list)) {
+		struct lat_grp *lg = list_first_entry(&lg_hist_alloc_list,
+						      struct lat_grp,
+						      hist_alloc_node);
+		swap(lg->hist, hist);
+		list_del_init(&lg->hist_alloc_node);
+	}
+
+	empty = list_empty(&lg_hist_alloc_list);
+	spin_unlock_irq(&lg_hist_alloc_lock);
+	if (!empty)
+		goto alloc_hist;
+}
+
+static void lat_pd_init(struct blkcg_gq *blkg)
+{
+	struct lat_grp *lg = blkg_to_lg(blkg);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lg_hist_alloc_lock, flags);
+	list_add(&lg->hist_alloc_node, &lg_hist_alloc_list);
+	schedule_delayed_work(&lg_hist_alloc_work, 0);
+	spin_unlock_irqrestore(&lg_hist_alloc_lock, flags);
+}
+
+static void lat_pd_exit(struct blkcg_gq *blkg)
+{
+	struct lat_grp *lg = blkg_to_lg(blkg);
+	unsigned long flags;
+
+	spin_lock_irqsave(&lg_hist_alloc_lock, flags);
+	list_del_init(&lg->hist_alloc_node);
+	spin_unlock_irqrestore(&lg_hist_alloc_lock, flags);
+
+	free_percpu(lg->hist);
+}
+
+static void lat_pd_reset_stats(struct blkcg_gq *blkg)
+{
+	struct lat_grp *lg = blkg_to_lg(blkg);
+	int cpu;
+
+	if (lg->hist == NULL)
+		return;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(lg->hist, cpu), 0,
+		       sizeof(struct blk_lat_hist));
+}
+
+static u64 lat_prfill_hist(struct seq_file *sf, struct blkg_policy_data *pd,
+			   int off)
+{
+	struct lat_grp *lg = pd_to_lg(pd);
+	const char *dname = blkg_dev_name(pd->blkg);
+	struct blk_lat_hist sum;
+	int dir, i;
+
+	if (!dname || lg->hist == NULL)
+		return 0;
+
+	blk_lat_hist_sum(&sum, lg->hist);
+
+	for (dir = 0; dir < BLK_LAT_NR_DIRS; dir++) {
+		seq_printf(sf, "%s %s", dname, blk_lat_dir_name[dir]);
+		for (i = 0; i < BLK_LAT_NR_BUCKETS; i++)
+			seq_printf(sf, " %llu",
+				   (unsigned long long)sum.buckets[dir][i]);
+		seq_putc(sf, '\n');
+	}
+	return 0;
+}
+
+static int lat_print_hist(struct seq_file *sf, void *v)
+{
+	blkcg_print_blkgs(sf, css_to_blkcg(seq_css(sf)), lat_prfill_hist,
+			  &blkcg_policy_lat, 0, false);
+	return 0;
+}
+
+static struct cftype lat_files[] = {
+	{
+		.name = "lat_hist",
+		.seq_show = lat_print_hist,
+	},
+	{ }	/* terminate */
+};
+
+static struct blkcg_policy blkcg_policy_lat = {
+	.pd_size		= sizeof(struct lat_grp),
+	.cftypes		= lat_files,
+
+	.pd_init_fn		= lat_pd_init,
+	.pd_exit_fn		= lat_pd_exit,
+	.pd_reset_stats_fn	= lat_pd_reset_stats,
+};
+
+/*
+ * Called in submission context, where bio_blkcg() is the right cgroup
+ * even for bios that weren't associated with one.  The root group lives
+ * as long as the queue, other ones are pinned until the request is freed.
+ */
+void __blk_lat_associate(struct request *rq, struct bio *bio)
+{
+	struct request_queue *q = rq->q;
+	struct blkcg *blkcg;
+	struct blkcg_gq *blkg;
+
+	rcu_read_lock();
+
+	blkcg = bio_blkcg(bio);
+	if (blkcg == &blkcg_root) {
+		blkg = q->root_blkg;
+		goto out;
+	}
+
+	blkg = blkg_lookup(blkcg, q);
+	if (likely(blkg)) {
+		/* lost a race with blkg_destroy(), leave it uncharged */
+		if (!atomic_inc_not_zero(&blkg->refcnt))
+			blkg = NULL;
+		goto out;
+	}
+
+	/* first request of this cgroup on @q */
+	spin_lock_irq(q->queue_lock);
+	blkg = blkg_lookup_create(blkcg, q);
+	if (IS_ERR(blkg))
+		blkg = NULL;
+	else
+		blkg_get(blkg);
+	spin_unlock_irq(q->queue_lock);
+out:
+	rcu_read_unlock();
+	rq->lat_blkg = blkg;
+}
+
+void __blk_lat_disassociate(struct request *rq)
+{
+	if (rq->lat_blkg->blkcg != &blkcg_root)
+		blkg_put(rq->lat_blkg);
+	rq->lat_blkg = NULL;
+}
+
+static void blk_lat_blkg_done(struct request *rq, unsigned int dir,
+			      unsigned int bucket)
+{
+	struct blk_lat_hist __percpu *hist;
+	struct lat_grp *lg;
+
+	lg = blkg_to_lg(rq->lat_blkg);
+	if (!lg)
+		return;
+
+	hist = ACCESS_ONCE(lg->hist);
+	if (hist)
+		this_cpu_inc(hist->buckets[dir][bucket]);
+}
+
+static int blk_lat_activate(struct request_queue *q)
+{
+	return blkcg_activate_policy(q, &blkcg_policy_lat);
+}
+
+static void blk_lat_deactivate(struct request_queue *q)
+{
+	blkcg_deactivate_policy(q, &blkcg_policy_lat);
+}
+
+static int __init blk_lat_init(void)
+{
+	return blkcg_policy_register(&blkcg_policy_lat);
+}
+module_init(blk_lat_init);
+
+#else
+
+static inline void blk_lat_blkg_done(struct request *rq, unsigned int dir,
+				     unsigned int bucket)
+{
+}
+
+static inline int blk_lat_activate(struct request_queue *q)
+{
+	return 0;
+}
+
+static inline void blk_lat_deactivate(struct request_queue *q)
+{
+}
+
+#endif /* CONFIG_BLK_CGROUP */
+
+void __blk_lat_done(struct request *rq)
+{
+	struct blk_lat_hist __percpu *hist = ACCESS_ONCE(rq->q->lat_hist);
+	u64 now = ktime_get_ns();
+	unsigned int dir, bucket;
+
+	dir = blk_lat_dir(rq);
+	bucket = blk_lat_bucket(now > rq->lat_issue_ns ?
+				now - rq->lat_issue_ns : 0);
+	rq->lat_issue_ns = 0;
+
+	if (hist)
+		this_cpu_inc(hist->buckets[dir][bucket]);
+	blk_lat_blkg_done(rq, dir, bucket);
+}
+
+/*
+ * Called with q->sysfs_lock held.  Turning the histograms off only stops
+ * stamping new requests, the counters and the blkcg policy stay around
+ * until the queue is released: on blk-mq bypassing the queue doesn't
+ * drain requests in flight, which may still be counted.
+ */
+int blk_lat_enable(struct request_queue *q, bool enable)
+{
+	int ret;
+
+	if (enable && !q->lat_hist) {
+		struct blk_lat_hist __percpu *hist;
+
+		hist = alloc_percpu(struct blk_lat_hist);
+		if (!hist)
+			return -ENOMEM;
+		q->lat_hist = hist;
+	}
+
+	if (enable) {
+		ret = blk_lat_activate(q);
+		if (ret)
+			return ret;
+	}
+
+	spin_lock_irq(q->queue_lock);
+	if (enable)
+		queue_flag_set(QUEUE_FLAG_LAT_HIST, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_LAT_HIST, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return 0;
+}
+
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page)
+{
+	struct blk_lat_hist sum;
+	ssize_t ret = 0;
+	int dir, i;
+
+	if (!q->lat_hist)
+		memset(&sum, 0, sizeof(sum));
+	else
+		blk_lat_hist_sum(&sum, q->lat_hist);
+
+	for (dir = 0; dir < BLK_LAT_NR_DIRS; dir++) {
+		ret += scnprintf(page + ret, PAGE_SIZE - ret, "%s",
+				 blk_lat_dir_name[dir]);
+		for (i = 0; i < BLK_LAT_NR_BUCKETS; i++)
+			ret += scnprintf(page + ret, PAGE_SIZE - ret, " %llu",
+					 (unsigned long long)sum.buckets[dir][i]);
+		ret += scnprintf(page + ret, PAGE_SIZE - ret, "\n");
+	}
+	return ret;
+}
+
+void blk_lat_exit(struct request_queue *q)
+{
+	blk_lat_deactivate(q);
+	free_percpu(q->lat_hist);
+	q->lat_hist = NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef INT_BLK_LAT_H
+#define INT_BLK_LAT_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/blkdev.h>
+
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE,
+	BLK_LAT_DISCARD,
+
+	BLK_LAT_NR_DIRS,
+};
+
+/*
+ * log2 buckets of usecs from issue to completion: bucket 0 counts
+ * requests done in less than 1 usec, bucket i those in [2^(i-1), 2^i)
+ * and the last one everything from 2^22 usecs (~4s) up.
+ */
+#define BLK_LAT_NR_BUCKETS	24
+
+struct blk_lat_hist {
+	u64 buckets[BLK_LAT_NR_DIRS][BLK_LAT_NR_BUCKETS];
+};
+
+#ifdef CONFIG_BLK_LAT_HIST
+
+/* only fs requests carrying data, flushes would skew the write side */
+static inline void blk_lat_issue(struct request *rq)
+{
+	if (test_bit(QUEUE_FLAG_LAT_HIST, &rq->q->queue_flags) &&
+	    rq->cmd_type == REQ_TYPE_FS && blk_rq_bytes(rq))
+		rq->lat_issue_ns = ktime_get_ns();
+}
+
+void __blk_lat_done(struct request *rq);
+
+static inline void blk_lat_done(struct request *rq)
+{
+	if (rq->lat_issue_ns)
+		__blk_lat_done(rq);
+}
+
+#ifdef CONFIG_BLK_CGROUP
+void __blk_lat_associate(struct request *rq, struct bio *bio);
+void __blk_lat_disassociate(struct request *rq);
+
+static inline void blk_lat_associate(struct request *rq, struct bio *bio)
+{
+	if (test_bit(QUEUE_FLAG_LAT_HIST, &rq->q->queue_flags))
+		__blk_lat_associate(rq, bio);
+}
+
+static inline void blk_lat_disassociate(struct request *rq)
+{
+	if (rq->lat_blkg)
+		__blk_lat_disassociate(rq);
+}
+#else
+static inline void blk_lat_associate(struct request *rq, struct bio *bio)
+{
+}
+static inline void blk_lat_disassociate(struct request *rq)
+{
+}
+#endif
+
+int blk_lat_enable(struct request_queue *q, bool enable);
+ssize_t blk_lat_hist_show(struct request_queue *q, char *page);
+void blk_lat_exit(struct request_queue *q);
+
+#else
+
+static inline void blk_lat_issue(struct request *rq)
+{
+}
+static inline void blk_lat_done(struct request *rq)
+{
+}
+static inline void blk_lat_associate(struct request *rq, struct bio *bio)
+{
+}
+static inline void blk_lat_disassociate(struct request *rq)
+{
+}
+static inline void blk_lat_exit(struct request_queue *q)
+{
+}
+
+#endif /* CONFIG_BLK_LAT_HIST */
+
+#endif
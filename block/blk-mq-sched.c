@@ -0,0 +1,200 @@
+/*
+ * blk-mq I/O scheduler support
+ *
+ * Requests owned by a scheduler are allocated from a per hardware queue
+ * set of scheduler tags, deeper than the device queue, and are handed to
+ * the scheduler on insertion. They only get a driver tag when the scheduler
+ * gives them back for dispatch, so anything the device has no room for
+ * stays in the scheduler where it can still be sorted and merged.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/elevator.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+#include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
+
+void blk_mq_sched_free_tags(struct request_queue *q)
+{
+	struct blk_mq_tag_set *set = q->tag_set;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (hctx->sched_tags) {
+			blk_mq_free_rq_map(set, hctx->sched_tags, i);
+			hctx->sched_tags = NULL;
+		}
+	}
+
+	q->nr_requests = set->queue_depth;
+}
+
+/*
+ * Allocate scheduler tags for every hardware queue, mapped or not, since
+ * CPU hotplug may map one later on. Must be called with the queue frozen.
+ */
+int blk_mq_sched_alloc_tags(struct request_queue *q)
+{
+	struct blk_mq_tag_set *set = q->tag_set;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i, depth;
+
+	/*
+	 * Twice the device depth, so the scheduler still has something to
+	 * choose from when the device queue is full.
+	 */
+	depth = 2 * min_t(unsigned int, set->queue_depth, BLKDEV_MAX_RQ);
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		hctx->sched_tags = blk_mq_init_rq_map(set, i, depth, 0);
+		if (!hctx->sched_tags) {
+			blk_mq_sched_free_tags(q);
+			return -ENOMEM;
+		}
+	}
+
+	q->nr_requests = depth;
+	return 0;
+}
+
+/*
+ * Detach and free the I/O scheduler of a frozen queue, if it has one.
+ */
+void blk_mq_sched_teardown(struct request_queue *q)
+{
+	struct elevator_queue *e = q->elevator;
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	if (!e)
+		return;
+
+	if (e->registered)
+		elv_unregister_queue(q);
+
+	/*
+	 * No request can be in the scheduler with the queue frozen, but a
+	 * queue run started off the last completion may still be looking
+	 * at it.
+	 */
+	q->elevator = NULL;
+	synchronize_rcu();
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		clear_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state);
+
+	elevator_exit(e);
+	blk_mq_sched_free_tags(q);
+}
+
+/*
+ * The driver tags of a shared tag set are handed out to all its queues,
+ * so the one just freed may be what a hardware queue of another queue
+ * ran out of. Rerun the ones with the same index that are waiting.
+ * Queues being torn down are skipped, they are gone once off the list.
+ */
+void blk_mq_sched_restart_shared(struct blk_mq_hw_ctx *hctx)
+{
+	struct blk_mq_tag_set *set = hctx->queue->tag_set;
+	unsigned int i = hctx->queue_num;
+	struct request_queue *q;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(q, &set->tag_list, tag_set_list) {
+		if (blk_queue_dying(q))
+			continue;
+
+		hctx = q->queue_hw_ctx[i];
+		if (test_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state) &&
+		    test_and_clear_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state))
+			blk_mq_run_hw_queue(hctx, true);
+	}
+	rcu_read_unlock();
+}
+
+void blk_mq_sched_insert_request(struct request *rq, bool at_head,
+				 bool run_queue, bool async)
+{
+	struct request_queue *q = rq->q;
+	struct elevator_queue *e = q->elevator;
+	struct blk_mq_hw_ctx *hctx;
+	LIST_HEAD(list);
+
+	/*
+	 * The scheduler tag came from the hardware queue of the submitting
+	 * ctx, keep the request there even if that CPU went offline.
+	 */
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	trace_block_rq_insert(q, rq);
+	list_add(&rq->queuelist, &list);
+	e->type->mq_ops.insert_requests(hctx, &list, at_head);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list, bool run_queue_async)
+{
+	struct request_queue *q = hctx->queue;
+	struct elevator_queue *e = q->elevator;
+	struct request *rq;
+
+	list_for_each_entry(rq, list, queuelist)
+		trace_block_rq_insert(q, rq);
+
+	e->type->mq_ops.insert_requests(hctx, list, false);
+	blk_mq_run_hw_queue(hctx, run_queue_async);
+}
+
+/**
+ * blk_mq_sched_try_merge - merge a bio into a request held by the scheduler
+ * @q:		the request queue
+ * @bio:	the bio to merge
+ *
+ * Back merges are looked up in the elevator merge hash, front merges
+ * through the scheduler's ->request_merge(). The scheduler must hold its
+ * own lock around this, and is told about a successful merge through
+ * ->request_merged() so it can reposition the request.
+ */
+bool blk_mq_sched_try_merge(struct request_queue *q, struct bio *bio)
+{
+	struct elevator_queue *e = q->elevator;
+	struct request *rq;
+
+	if (blk_queue_noxmerges(q))
+		return false;
+
+	rq = elv_rqhash_find(q, bio->bi_iter.bi_sector);
+	if (rq && elv_rq_merge_ok(rq, bio) &&
+	    bio_attempt_back_merge(q, rq, bio)) {
+		elv_rqhash_reposition(q, rq);
+		if (e->type->mq_ops.request_merged)
+			e->type->mq_ops.request_merged(q, rq,
+						       ELEVATOR_BACK_MERGE);
+		return true;
+	}
+
+	if (!e->type->mq_ops.request_merge)
+		return false;
+
+	rq = e->type->mq_ops.request_merge(q, bio);
+	if (rq && elv_rq_merge_ok(rq, bio) &&
+	    bio_attempt_front_merge(q, rq, bio)) {
+		if (e->type->mq_ops.request_merged)
+			e->type->mq_ops.request_merged(q, rq,
+						       ELEVATOR_FRONT_MERGE);
+		return true;
+	}
+
+	return false;
+}
+EXPORT_SYMBOL_GPL(blk_mq_sched_try_merge);
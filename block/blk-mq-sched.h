@@ -0,0 +1,65 @@
+#ifndef INT_BLK_MQ_SCHED_H
+#define INT_BLK_MQ_SCHED_H
+
+#include <linux/blk-mq.h>
+#include <linux/elevator.h>
+#include <linux/rcupdate.h>
+
+#include "blk-mq.h"
+
+int blk_mq_sched_alloc_tags(struct request_queue *q);
+void blk_mq_sched_free_tags(struct request_queue *q);
+void blk_mq_sched_teardown(struct request_queue *q);
+
+void blk_mq_sched_insert_request(struct request *rq, bool at_head,
+				 bool run_queue, bool async);
+void blk_mq_sched_insert_requests(struct blk_mq_hw_ctx *hctx,
+				  struct list_head *list, bool run_queue_async);
+
+bool blk_mq_sched_try_merge(struct request_queue *q, struct bio *bio);
+
+static inline bool blk_mq_sched_bio_merge(struct blk_mq_hw_ctx *hctx,
+					  struct bio *bio)
+{
+	struct elevator_queue *e = hctx->queue->elevator;
+
+	if (!e->type->mq_ops.bio_merge)
+		return false;
+
+	return e->type->mq_ops.bio_merge(hctx, bio);
+}
+
+/*
+ * Called without any request of the queue held, so the scheduler may be
+ * going away under us.
+ */
+static inline bool blk_mq_sched_has_work(struct blk_mq_hw_ctx *hctx)
+{
+	struct elevator_queue *e;
+	bool ret = false;
+
+	rcu_read_lock();
+	e = ACCESS_ONCE(hctx->queue->elevator);
+	if (e && e->type->mq_ops.has_work)
+		ret = e->type->mq_ops.has_work(hctx);
+	rcu_read_unlock();
+
+	return ret;
+}
+
+void blk_mq_sched_restart_shared(struct blk_mq_hw_ctx *hctx);
+
+/*
+ * A dispatch ran out of driver tags, rerun the queue now that one was freed.
+ * With a tag set shared between queues, that may have been any of them.
+ */
+static inline void blk_mq_sched_restart(struct blk_mq_hw_ctx *hctx)
+{
+	if (hctx->flags & BLK_MQ_F_TAG_SHARED)
+		blk_mq_sched_restart_shared(hctx);
+	else if (test_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state) &&
+		 test_and_clear_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state))
+		blk_mq_run_hw_queue(hctx, true);
+}
+
+#endif
@@ -28,6 +28,10 @@
 #include "blk.h"
 #include "blk-mq.h"
 #include "blk-mq-tag.h"
+#include "blk-mq-sched.h"
+#include "blk-wbt.h"
+#include "blk-lat.h"
+#include "blk-iocost.h"
 
 static DEFINE_MUTEX(all_q_mutex);
 static LIST_HEAD(all_q_list);
@@ -159,9 +163,13 @@ void blk_mq_wake_waiters(struct request_queue *q)
 	struct blk_mq_hw_ctx *hctx;
 	unsigned int i;
 
-	queue_for_each_hw_ctx(q, hctx, i)
-		if (blk_mq_hw_queue_mapped(hctx))
-			blk_mq_tag_wakeup_all(hctx->tags, true);
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!blk_mq_hw_queue_mapped(hctx))
+			continue;
+		blk_mq_tag_wakeup_all(hctx->tags, true);
+		if (hctx->sched_tags)
+			blk_mq_tag_wakeup_all(hctx->sched_tags, true);
+	}
 
 	/*
 	 * If we are called because the queue has now been marked as
@@ -199,6 +207,17 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 	rq->rl = NULL;
 	set_start_time_ns(rq);
 	rq->io_start_time_ns = 0;
+#endif
+#ifdef CONFIG_BLK_WBT
+	rq->wbt_issue_ns = 0;
+	rq->wbt_flags = 0;
+#endif
+	rq->poll_issue_ns = 0;
+#ifdef CONFIG_BLK_LAT_HIST
+	rq->lat_issue_ns = 0;
+#ifdef CONFIG_BLK_CGROUP
+	rq->lat_blkg = NULL;
+#endif
 #endif
 	rq->nr_phys_segments = 0;
 #if defined(CONFIG_BLK_DEV_INTEGRITY)
@@ -228,19 +247,28 @@ static void blk_mq_rq_ctx_init(struct request_queue *q, struct blk_mq_ctx *ctx,
 static struct request *
 __blk_mq_alloc_request(struct blk_mq_alloc_data *data, int rw)
 {
+	struct blk_mq_tags *tags = blk_mq_tags_from_data(data);
 	struct request *rq;
 	unsigned int tag;
 
 	tag = blk_mq_get_tag(data);
 	if (tag != BLK_MQ_TAG_FAIL) {
-		rq = data->hctx->tags->rqs[tag];
-
-		if (blk_mq_tag_busy(data->hctx)) {
-			rq->cmd_flags = REQ_MQ_INFLIGHT;
-			atomic_inc(&data->hctx->nr_active);
+		rq = tags->static_rqs[tag];
+
+		if (data->internal) {
+			/* the driver tag is assigned at dispatch time */
+			rq->tag = -1;
+			rq->internal_tag = tag;
+		} else {
+			if (blk_mq_tag_busy(data->hctx)) {
+				rq->cmd_flags = REQ_MQ_INFLIGHT;
+				atomic_inc(&data->hctx->nr_active);
+			}
+			rq->tag = tag;
+			rq->internal_tag = -1;
+			tags->rqs[tag] = rq;
 		}
 
-		rq->tag = tag;
 		blk_mq_rq_ctx_init(data->q, data->ctx, rq, rw);
 		return rq;
 	}
@@ -248,6 +276,56 @@ __blk_mq_alloc_request(struct blk_mq_alloc_data *data, int rw)
 	return NULL;
 }
 
+/*
+ * Requests coming out of the I/O scheduler only hold a scheduler tag, give
+ * them a driver tag before they are handed to the driver. Never blocks.
+ */
+static bool blk_mq_get_driver_tag(struct blk_mq_hw_ctx *hctx,
+				  struct request *rq)
+{
+	struct blk_mq_alloc_data data;
+	unsigned int tag;
+
+	if (rq->tag != -1)
+		return true;
+
+	blk_mq_set_alloc_data(&data, rq->q, GFP_ATOMIC, false, rq->mq_ctx,
+			hctx);
+	tag = blk_mq_get_tag(&data);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return false;
+
+	if (blk_mq_tag_busy(hctx)) {
+		rq->cmd_flags |= REQ_MQ_INFLIGHT;
+		atomic_inc(&hctx->nr_active);
+	}
+	rq->tag = tag;
+	hctx->tags->rqs[tag] = rq;
+	return true;
+}
+
+/*
+ * Give back the driver tag of a scheduler request that is going back to
+ * the dispatch list or the scheduler, it gets a new one when reissued.
+ */
+static void blk_mq_put_driver_tag(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+
+	if (rq->tag == -1 || rq->internal_tag == -1)
+		return;
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	if (rq->cmd_flags & REQ_MQ_INFLIGHT) {
+		rq->cmd_flags &= ~REQ_MQ_INFLIGHT;
+		atomic_dec(&hctx->nr_active);
+	}
+	hctx->tags->rqs[rq->tag] = hctx->tags->static_rqs[rq->tag];
+	blk_mq_put_tag(hctx, hctx->tags, rq->mq_ctx, rq->tag);
+	rq->tag = -1;
+}
+
 struct request *blk_mq_alloc_request(struct request_queue *q, int rw, gfp_t gfp,
 		bool reserved)
 {
@@ -291,14 +369,26 @@ static void __blk_mq_free_request(struct blk_mq_hw_ctx *hctx,
 				  struct blk_mq_ctx *ctx, struct request *rq)
 {
 	const int tag = rq->tag;
+	const int sched_tag = rq->internal_tag;
 	struct request_queue *q = rq->q;
 
+	wbt_done(q->rq_wb, rq);
+	blk_lat_disassociate(rq);
+
 	if (rq->cmd_flags & REQ_MQ_INFLIGHT)
 		atomic_dec(&hctx->nr_active);
 	rq->cmd_flags = 0;
 
 	clear_bit(REQ_ATOM_STARTED, &rq->atomic_flags);
-	blk_mq_put_tag(hctx, tag, &ctx->last_tag);
+	clear_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags);
+	if (tag != -1) {
+		if (sched_tag != -1)
+			hctx->tags->rqs[tag] = hctx->tags->static_rqs[tag];
+		blk_mq_put_tag(hctx, hctx->tags, ctx, tag);
+	}
+	if (sched_tag != -1)
+		blk_mq_put_tag(hctx, hctx->sched_tags, ctx, sched_tag);
+	blk_mq_sched_restart(hctx);
 	blk_mq_queue_exit(q);
 }
 
@@ -322,9 +412,31 @@ void blk_mq_free_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(blk_mq_free_request);
 
+/*
+ * Keep a running average of the completion time of requests on polled
+ * queues, per direction, for the hybrid poll sleep.
+ */
+static void blk_mq_poll_stats_add(struct request *rq)
+{
+	u64 *mean = &rq->q->poll_mean_nsec[rq_data_dir(rq)];
+	u64 now = ktime_get_ns();
+	u64 lat;
+
+	if (now > rq->poll_issue_ns) {
+		lat = now - rq->poll_issue_ns;
+		*mean = *mean ? (*mean * 7 + lat) >> 3 : lat;
+	}
+	rq->poll_issue_ns = 0;
+}
+
 inline void __blk_mq_end_request(struct request *rq, int error)
 {
 	blk_account_io_done(rq);
+	blk_lat_done(rq);
+	blk_iocost_done(rq);
+
+	if (rq->poll_issue_ns)
+		blk_mq_poll_stats_add(rq);
 
 	if (rq->end_io) {
 		rq->end_io(rq, error);
@@ -418,6 +530,13 @@ void blk_mq_start_request(struct request *rq)
 
 	trace_block_rq_issue(q, rq);
 
+	wbt_issue(q->rq_wb, rq);
+	blk_lat_issue(rq);
+	blk_iocost_issue(rq);
+
+	if (blk_queue_poll(q))
+		rq->poll_issue_ns = ktime_get_ns();
+
 	rq->resid_len = blk_rq_bytes(rq);
 	if (unlikely(blk_bidi_rq(rq)))
 		rq->next_rq->resid_len = blk_rq_bytes(rq->next_rq);
@@ -462,6 +581,8 @@ static void __blk_mq_requeue_request(struct request *rq)
 		if (q->dma_drain_size && blk_rq_bytes(rq))
 			rq->nr_phys_segments--;
 	}
+
+	blk_mq_put_driver_tag(rq);
 }
 
 void blk_mq_requeue_request(struct request *rq)
@@ -754,43 +875,19 @@ static void flush_busy_ctxs(struct blk_mq_hw_ctx *hctx, struct list_head *list)
 }
 
 /*
- * Run this hardware queue, pulling any software queues mapped to it in.
- * Note that this function currently has various problems around ordering
- * of IO. In particular, we'd like FIFO behaviour on handling existing
- * items on the hctx->dispatch list. Ignore that for now.
+ * Send the requests on @rq_list to the driver, until it is empty or the
+ * driver (or the driver tag space) is busy. Whatever could not be issued is
+ * left on @rq_list. Returns the number of requests queued.
  */
-static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+static int blk_mq_dispatch_rq_list(struct blk_mq_hw_ctx *hctx,
+				   struct list_head *rq_list)
 {
 	struct request_queue *q = hctx->queue;
 	struct request *rq;
-	LIST_HEAD(rq_list);
 	LIST_HEAD(driver_list);
 	struct list_head *dptr;
 	int queued;
 
-	WARN_ON(!cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask));
-
-	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
-		return;
-
-	hctx->run++;
-
-	/*
-	 * Touch any software queue that has pending entries.
-	 */
-	flush_busy_ctxs(hctx, &rq_list);
-
-	/*
-	 * If we have previous entries on our dispatch list, grab them
-	 * and stuff them at the front for more fair dispatch.
-	 */
-	if (!list_empty_careful(&hctx->dispatch)) {
-		spin_lock(&hctx->lock);
-		if (!list_empty(&hctx->dispatch))
-			list_splice_init(&hctx->dispatch, &rq_list);
-		spin_unlock(&hctx->lock);
-	}
-
 	/*
 	 * Start off with dptr being NULL, so we start the first request
 	 * immediately, even if we have more pending.
@@ -801,16 +898,27 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 	 * Now process all the entries, sending them to the driver.
 	 */
 	queued = 0;
-	while (!list_empty(&rq_list)) {
+	while (!list_empty(rq_list)) {
 		struct blk_mq_queue_data bd;
 		int ret;
 
-		rq = list_first_entry(&rq_list, struct request, queuelist);
+		rq = list_first_entry(rq_list, struct request, queuelist);
+		if (!blk_mq_get_driver_tag(hctx, rq)) {
+			/*
+			 * Out of driver tags. Have the next request
+			 * completion rerun us, and check again in case it
+			 * already came in before the flag was visible.
+			 */
+			set_bit(BLK_MQ_S_SCHED_RESTART, &hctx->state);
+			smp_mb__after_atomic();
+			if (!blk_mq_get_driver_tag(hctx, rq))
+				break;
+		}
 		list_del_init(&rq->queuelist);
 
 		bd.rq = rq;
 		bd.list = dptr;
-		bd.last = list_empty(&rq_list);
+		bd.last = list_empty(rq_list);
 
 		ret = q->mq_ops->queue_rq(hctx, &bd);
 		switch (ret) {
@@ -818,7 +926,7 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 			queued++;
 			continue;
 		case BLK_MQ_RQ_QUEUE_BUSY:
-			list_add(&rq->queuelist, &rq_list);
+			list_add(&rq->queuelist, rq_list);
 			__blk_mq_requeue_request(rq);
 			break;
 		default:
@@ -836,10 +944,89 @@ static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
 		 * We've done the first request. If we have more than 1
 		 * left in the list, set dptr to defer issue.
 		 */
-		if (!dptr && rq_list.next != rq_list.prev)
+		if (!dptr && rq_list->next != rq_list->prev)
 			dptr = &driver_list;
 	}
 
+	return queued;
+}
+
+/*
+ * Run this hardware queue, pulling any software queues mapped to it in.
+ * Note that this function currently has various problems around ordering
+ * of IO. In particular, we'd like FIFO behaviour on handling existing
+ * items on the hctx->dispatch list. Ignore that for now.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct elevator_queue *e;
+	LIST_HEAD(rq_list);
+	int queued;
+
+	WARN_ON(!cpumask_test_cpu(raw_smp_processor_id(), hctx->cpumask));
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	hctx->run++;
+
+	/*
+	 * Touch any software queue that has pending entries.
+	 */
+	flush_busy_ctxs(hctx, &rq_list);
+
+	/*
+	 * If we have previous entries on our dispatch list, grab them
+	 * and stuff them at the front for more fair dispatch.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		if (!list_empty(&hctx->dispatch))
+			list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	/*
+	 * The scheduler can only be switched with the queue frozen, the RCU
+	 * read section covers runs that outlive the last request.
+	 */
+	rcu_read_lock();
+	queued = blk_mq_dispatch_rq_list(hctx, &rq_list);
+
+	/*
+	 * Pull from the I/O scheduler one request at a time for as long as
+	 * the driver keeps taking them, leaving the rest in there to sort.
+	 */
+	e = ACCESS_ONCE(q->elevator);
+	if (e && list_empty(&rq_list)) {
+		struct request *rq;
+
+		while ((rq = e->type->mq_ops.dispatch_request(hctx))) {
+			struct blk_mq_hw_ctx *rq_hctx;
+
+			/*
+			 * A scheduler shared by all hardware queues may hand
+			 * out a request of another one. Its driver tag has to
+			 * come from there as well, so issue it from there.
+			 */
+			rq_hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+			if (rq_hctx != hctx) {
+				spin_lock(&rq_hctx->lock);
+				list_add_tail(&rq->queuelist, &rq_hctx->dispatch);
+				spin_unlock(&rq_hctx->lock);
+				blk_mq_run_hw_queue(rq_hctx, true);
+				break;
+			}
+
+			list_add(&rq->queuelist, &rq_list);
+			queued += blk_mq_dispatch_rq_list(hctx, &rq_list);
+			if (!list_empty(&rq_list))
+				break;
+		}
+	}
+	rcu_read_unlock();
+
 	if (!queued)
 		hctx->dispatched[0]++;
 	else if (queued < (1 << (BLK_MQ_MAX_DISPATCH_ORDER - 1)))
@@ -911,7 +1098,8 @@ static void blk_mq_run_queues(struct request_queue *q)
 
 	queue_for_each_hw_ctx(q, hctx, i) {
 		if ((!blk_mq_hctx_has_pending(hctx) &&
-		    list_empty_careful(&hctx->dispatch)) ||
+		    list_empty_careful(&hctx->dispatch) &&
+		    !blk_mq_sched_has_work(hctx)) ||
 		    test_bit(BLK_MQ_S_STOPPED, &hctx->state))
 			continue;
 
@@ -1021,6 +1209,11 @@ void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
 	struct blk_mq_hw_ctx *hctx;
 	struct blk_mq_ctx *ctx = rq->mq_ctx, *current_ctx;
 
+	if (rq->internal_tag != -1) {
+		blk_mq_sched_insert_request(rq, at_head, run_queue, async);
+		return;
+	}
+
 	current_ctx = blk_mq_get_ctx(q);
 	if (!cpu_online(ctx->cpu))
 		rq->mq_ctx = ctx = current_ctx;
@@ -1049,6 +1242,12 @@ static void blk_mq_insert_requests(struct request_queue *q,
 
 	trace_block_unplug(q, depth, !from_schedule);
 
+	if (q->elevator) {
+		hctx = q->mq_ops->map_queue(q, ctx->cpu);
+		blk_mq_sched_insert_requests(hctx, list, from_schedule);
+		return;
+	}
+
 	current_ctx = blk_mq_get_ctx(q);
 
 	if (!cpu_online(ctx->cpu))
@@ -1149,6 +1348,19 @@ static inline bool blk_mq_merge_queue_io(struct blk_mq_hw_ctx *hctx,
 					 struct blk_mq_ctx *ctx,
 					 struct request *rq, struct bio *bio)
 {
+	if (rq->internal_tag != -1) {
+		if (hctx_allow_merges(hctx) &&
+		    blk_mq_sched_bio_merge(hctx, bio)) {
+			ctx->rq_merged++;
+			__blk_mq_free_request(hctx, ctx, rq);
+			return true;
+		}
+
+		blk_mq_bio_to_request(rq, bio);
+		blk_mq_sched_insert_request(rq, false, false, false);
+		return false;
+	}
+
 	if (!hctx_allow_merges(hctx)) {
 		blk_mq_bio_to_request(rq, bio);
 		spin_lock(&ctx->lock);
@@ -1185,6 +1397,7 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 	struct request *rq;
 	int rw = bio_data_dir(bio);
 	struct blk_mq_alloc_data alloc_data;
+	bool internal;
 
 	if (unlikely(blk_mq_queue_enter(q))) {
 		bio_endio(bio, -EIO);
@@ -1197,9 +1410,16 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 	if (rw_is_sync(bio->bi_rw))
 		rw |= REQ_SYNC;
 
+	/*
+	 * With an I/O scheduler attached, everything but flushes is
+	 * allocated from the scheduler tags and goes through it.
+	 */
+	internal = q->elevator && !(bio->bi_rw & (REQ_FLUSH | REQ_FUA));
+
 	trace_block_getrq(q, bio, rw);
 	blk_mq_set_alloc_data(&alloc_data, q, GFP_ATOMIC, false, ctx,
 			hctx);
+	alloc_data.internal = internal;
 	rq = __blk_mq_alloc_request(&alloc_data, rw);
 	if (unlikely(!rq)) {
 		__blk_mq_run_hw_queue(hctx);
@@ -1210,17 +1430,28 @@ static struct request *blk_mq_map_request(struct request_queue *q,
 		hctx = q->mq_ops->map_queue(q, ctx->cpu);
 		blk_mq_set_alloc_data(&alloc_data, q,
 				__GFP_WAIT|GFP_ATOMIC, false, ctx, hctx);
+		alloc_data.internal = internal;
 		rq = __blk_mq_alloc_request(&alloc_data, rw);
 		ctx = alloc_data.ctx;
 		hctx = alloc_data.hctx;
 	}
 
 	hctx->queued++;
+	blk_lat_associate(rq, bio);
 	data->hctx = hctx;
 	data->ctx = ctx;
 	return rq;
 }
 
+static inline blk_qc_t request_to_qc_t(struct blk_mq_hw_ctx *hctx,
+				       struct request *rq)
+{
+	if (rq->tag != -1)
+		return blk_tag_to_qc_t(rq->tag, hctx->queue_num, false);
+
+	return blk_tag_to_qc_t(rq->internal_tag, hctx->queue_num, true);
+}
+
 /*
  * Multiple hardware queue variant. This will not use per-process plugs,
  * but will attempt to bypass the hctx queueing if we can go straight to
@@ -1232,6 +1463,7 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	const int is_flush_fua = bio->bi_rw & (REQ_FLUSH | REQ_FUA);
 	struct blk_map_ctx data;
 	struct request *rq;
+	unsigned int wb_acct;
 
 	blk_queue_bounce(q, &bio);
 
@@ -1240,9 +1472,17 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 		return;
 	}
 
+	wb_acct = wbt_wait(q->rq_wb, bio, NULL);
+
 	rq = blk_mq_map_request(q, bio, &data);
-	if (unlikely(!rq))
+	if (unlikely(!rq)) {
+		__wbt_done(q->rq_wb, wb_acct);
 		return;
+	}
+
+	wbt_track(rq, wb_acct);
+
+	bio->bi_cookie = request_to_qc_t(data.hctx, rq);
 
 	if (unlikely(is_flush_fua)) {
 		blk_mq_bio_to_request(rq, bio);
@@ -1253,9 +1493,11 @@ static void blk_mq_make_request(struct request_queue *q, struct bio *bio)
 	/*
 	 * If the driver supports defer issued based on 'last', then
 	 * queue it up like normal since we can potentially save some
-	 * CPU this way.
+	 * CPU this way. Requests owned by an I/O scheduler have to go
+	 * through it.
 	 */
-	if (is_sync && !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE)) {
+	if (is_sync && !(data.hctx->flags & BLK_MQ_F_DEFER_ISSUE) &&
+	    rq->internal_tag == -1) {
 		struct blk_mq_queue_data bd = {
 			.rq = rq,
 			.list = NULL,
@@ -1309,6 +1551,7 @@ static void blk_sq_make_request(struct request_queue *q, struct bio *bio)
 	unsigned int use_plug, request_count = 0;
 	struct blk_map_ctx data;
 	struct request *rq;
+	unsigned int wb_acct;
 
 	/*
 	 * If we have multiple hardware queues, just go directly to
@@ -1327,9 +1570,17 @@ static void blk_sq_make_request(struct request_queue *q, struct bio *bio)
 	    blk_attempt_plug_merge(q, bio, &request_count))
 		return;
 
+	wb_acct = wbt_wait(q->rq_wb, bio, NULL);
+
 	rq = blk_mq_map_request(q, bio, &data);
-	if (unlikely(!rq))
+	if (unlikely(!rq)) {
+		__wbt_done(q->rq_wb, wb_acct);
 		return;
+	}
+
+	wbt_track(rq, wb_acct);
+
+	bio->bi_cookie = request_to_qc_t(data.hctx, rq);
 
 	if (unlikely(is_flush_fua)) {
 		blk_mq_bio_to_request(rq, bio);
@@ -1373,6 +1624,153 @@ run_queue:
 	blk_mq_put_ctx(data.ctx);
 }
 
+/*
+ * Hybrid polling: instead of spinning for the whole life of the request,
+ * sleep for a while first. With a poll_nsec of 0 that is half the mean
+ * completion time, which should get us back before the request is done.
+ * Only done once per request, if it isn't done after the sleep it is
+ * polled for as usual.
+ */
+static bool blk_mq_poll_hybrid_sleep(struct request_queue *q,
+				     struct request *rq)
+{
+	struct hrtimer_sleeper hs;
+	enum hrtimer_mode mode;
+	u64 nsecs;
+
+	if (q->poll_nsec == -1 ||
+	    test_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags))
+		return false;
+
+	if (q->poll_nsec > 0)
+		nsecs = q->poll_nsec;
+	else
+		nsecs = (q->poll_mean_nsec[rq_data_dir(rq)] + 1) / 2;
+	if (!nsecs)
+		return false;
+
+	set_bit(REQ_ATOM_POLL_SLEPT, &rq->atomic_flags);
+
+	mode = HRTIMER_MODE_REL;
+	hrtimer_init_on_stack(&hs.timer, CLOCK_MONOTONIC, mode);
+	hrtimer_set_expires(&hs.timer, ns_to_ktime(nsecs));
+	hrtimer_init_sleeper(&hs, current);
+	do {
+		if (test_bit(REQ_ATOM_COMPLETE, &rq->atomic_flags))
+			break;
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		hrtimer_start_expires(&hs.timer, mode);
+		if (hs.task)
+			io_schedule();
+		hrtimer_cancel(&hs.timer);
+		mode = HRTIMER_MODE_ABS;
+	} while (hs.task && !signal_pending(current));
+
+	__set_current_state(TASK_RUNNING);
+	destroy_hrtimer_on_stack(&hs.timer);
+	return true;
+}
+
+static bool __blk_mq_poll(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	struct request_queue *q = hctx->queue;
+	long state;
+
+	hctx->poll_considered++;
+
+	/*
+	 * The caller rechecks for completion and calls back in, by then
+	 * the request is marked as slept on and gets polled for.
+	 */
+	if (blk_mq_poll_hybrid_sleep(q, rq))
+		return true;
+
+	state = current->state;
+	while (!need_resched()) {
+		int ret;
+
+		hctx->poll_invoked++;
+
+		ret = q->mq_ops->poll(hctx, rq->tag);
+		if (ret > 0) {
+			hctx->poll_success++;
+			set_current_state(TASK_RUNNING);
+			return true;
+		}
+
+		if (signal_pending_state(state, current))
+			set_current_state(TASK_RUNNING);
+
+		/* woken up by the completion, found by someone else */
+		if (current->state == TASK_RUNNING)
+			return true;
+		if (ret < 0)
+			break;
+		cpu_relax();
+	}
+
+	return false;
+}
+
+/**
+ * blk_poll - poll for completion of a request
+ * @q:		the request queue the bio was submitted to
+ * @cookie:	the bi_cookie of the submitted bio
+ *
+ * Description:
+ *	Spin on the hardware queue the bio went to until its request is
+ *	completed, the task needs to reschedule or is woken up. Callers set
+ *	their task state before calling this as they would before sleeping,
+ *	and go to sleep as usual if it returns false. Only does anything on
+ *	blk-mq queues with polling turned on in sysfs.
+ **/
+bool blk_poll(struct request_queue *q, blk_qc_t cookie)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_plug *plug;
+	struct request *rq;
+	unsigned int queue_num, tag;
+	bool ret = false;
+
+	if (!q->mq_ops || !q->mq_ops->poll || !blk_qc_t_valid(cookie) ||
+	    !blk_queue_poll(q))
+		return false;
+
+	queue_num = blk_qc_t_to_queue_num(cookie);
+	if (queue_num >= q->nr_hw_queues)
+		return false;
+
+	plug = current->plug;
+	if (plug)
+		blk_flush_plug_list(plug, false);
+
+	/*
+	 * Pin the queue, the scheduler tags the cookie may refer to go
+	 * away when the scheduler is switched on a frozen queue.
+	 */
+	if (!percpu_ref_tryget_live(&q->mq_usage_counter))
+		return false;
+
+	hctx = q->queue_hw_ctx[queue_num];
+	tag = blk_qc_t_to_tag(cookie);
+	if (!blk_qc_t_is_internal(cookie)) {
+		rq = blk_mq_tag_to_rq(hctx->tags, tag);
+	} else if (hctx->sched_tags) {
+		rq = hctx->sched_tags->static_rqs[tag];
+		/* still in the scheduler, nothing to poll for yet */
+		if (rq->tag == -1)
+			goto out;
+	} else {
+		goto out;
+	}
+
+	ret = __blk_mq_poll(hctx, rq);
+out:
+	blk_mq_queue_exit(q);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(blk_poll);
+
 /*
  * Default mapping to a software queue, since we use one per CPU.
  */
@@ -1382,20 +1780,20 @@ struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
 }
 EXPORT_SYMBOL(blk_mq_map_queue);
 
-static void blk_mq_free_rq_map(struct blk_mq_tag_set *set,
-		struct blk_mq_tags *tags, unsigned int hctx_idx)
+void blk_mq_free_rq_map(struct blk_mq_tag_set *set, struct blk_mq_tags *tags,
+		unsigned int hctx_idx)
 {
 	struct page *page;
 
-	if (tags->rqs && set->ops->exit_request) {
+	if (tags->static_rqs && set->ops->exit_request) {
 		int i;
 
 		for (i = 0; i < tags->nr_tags; i++) {
-			if (!tags->rqs[i])
+			if (!tags->static_rqs[i])
 				continue;
-			set->ops->exit_request(set->driver_data, tags->rqs[i],
-						hctx_idx, i);
-			tags->rqs[i] = NULL;
+			set->ops->exit_request(set->driver_data,
+						tags->static_rqs[i], hctx_idx, i);
+			tags->static_rqs[i] = NULL;
 		}
 	}
 
@@ -1406,6 +1804,7 @@ static void blk_mq_free_rq_map(struct blk_mq_tag_set *set,
 	}
 
 	kfree(tags->rqs);
+	kfree(tags->static_rqs);
 
 	blk_mq_free_tags(tags);
 }
@@ -1415,25 +1814,35 @@ static size_t order_to_size(unsigned int order)
 	return (size_t)PAGE_SIZE << order;
 }
 
-static struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
-		unsigned int hctx_idx)
+/*
+ * Allocate a tag map of @depth tags and the requests backing it. The driver
+ * tags use the tag set's depth, an I/O scheduler allocates a deeper one of
+ * its own for each hardware queue.
+ */
+struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
+		unsigned int hctx_idx, unsigned int depth,
+		unsigned int reserved_tags)
 {
 	struct blk_mq_tags *tags;
 	unsigned int i, j, entries_per_page, max_order = 4;
 	size_t rq_size, left;
 
-	tags = blk_mq_init_tags(set->queue_depth, set->reserved_tags,
-				set->numa_node,
+	tags = blk_mq_init_tags(depth, reserved_tags, set->numa_node,
 				BLK_MQ_FLAG_TO_ALLOC_POLICY(set->flags));
 	if (!tags)
 		return NULL;
 
 	INIT_LIST_HEAD(&tags->page_list);
 
-	tags->rqs = kzalloc_node(set->queue_depth * sizeof(struct request *),
+	tags->rqs = kzalloc_node(depth * sizeof(struct request *),
+				 GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY,
+				 set->numa_node);
+	tags->static_rqs = kzalloc_node(depth * sizeof(struct request *),
 				 GFP_KERNEL | __GFP_NOWARN | __GFP_NORETRY,
 				 set->numa_node);
-	if (!tags->rqs) {
+	if (!tags->rqs || !tags->static_rqs) {
+		kfree(tags->rqs);
+		kfree(tags->static_rqs);
 		blk_mq_free_tags(tags);
 		return NULL;
 	}
@@ -1444,9 +1853,9 @@ static struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
 	 */
 	rq_size = round_up(sizeof(struct request) + set->cmd_size,
 				cache_line_size());
-	left = rq_size * set->queue_depth;
+	left = rq_size * depth;
 
-	for (i = 0; i < set->queue_depth; ) {
+	for (i = 0; i < depth; ) {
 		int this_order = max_order;
 		struct page *page;
 		int to_do;
@@ -1475,18 +1884,19 @@ static struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
 
 		p = page_address(page);
 		entries_per_page = order_to_size(this_order) / rq_size;
-		to_do = min(entries_per_page, set->queue_depth - i);
+		to_do = min(entries_per_page, depth - i);
 		left -= to_do * rq_size;
 		for (j = 0; j < to_do; j++) {
-			tags->rqs[i] = p;
+			tags->static_rqs[i] = p;
 			if (set->ops->init_request) {
 				if (set->ops->init_request(set->driver_data,
-						tags->rqs[i], hctx_idx, i,
+						tags->static_rqs[i], hctx_idx, i,
 						set->numa_node)) {
-					tags->rqs[i] = NULL;
+					tags->static_rqs[i] = NULL;
 					goto fail;
 				}
 			}
+			tags->rqs[i] = tags->static_rqs[i];
 
 			p += rq_size;
 			i++;
@@ -1578,7 +1988,8 @@ static int blk_mq_hctx_cpu_online(struct blk_mq_hw_ctx *hctx, int cpu)
 	if (set->tags[hctx->queue_num])
 		return NOTIFY_OK;
 
-	set->tags[hctx->queue_num] = blk_mq_init_rq_map(set, hctx->queue_num);
+	set->tags[hctx->queue_num] = blk_mq_init_rq_map(set, hctx->queue_num,
+					set->queue_depth, set->reserved_tags);
 	if (!set->tags[hctx->queue_num])
 		return NOTIFY_STOP;
 
@@ -1850,9 +2261,13 @@ static void blk_mq_del_queue_tag_set(struct request_queue *q)
 	struct blk_mq_tag_set *set = q->tag_set;
 
 	mutex_lock(&set->tag_list_lock);
-	list_del_init(&q->tag_set_list);
+	list_del_rcu(&q->tag_set_list);
 	blk_mq_update_tag_set_depth(set);
 	mutex_unlock(&set->tag_list_lock);
+
+	/* blk_mq_sched_restart_shared() walks the list under RCU */
+	synchronize_rcu();
+	INIT_LIST_HEAD(&q->tag_set_list);
 }
 
 static void blk_mq_add_queue_tag_set(struct blk_mq_tag_set *set,
@@ -1861,7 +2276,7 @@ static void blk_mq_add_queue_tag_set(struct blk_mq_tag_set *set,
 	q->tag_set = set;
 
 	mutex_lock(&set->tag_list_lock);
-	list_add_tail(&q->tag_set_list, &set->tag_list);
+	list_add_tail_rcu(&q->tag_set_list, &set->tag_list);
 	blk_mq_update_tag_set_depth(set);
 	mutex_unlock(&set->tag_list_lock);
 }
@@ -1956,6 +2371,9 @@ struct request_queue *blk_mq_init_queue(struct blk_mq_tag_set *set)
 
 	q->sg_reserved_size = INT_MAX;
 
+	/* classic polling, once enabled through sysfs */
+	q->poll_nsec = -1;
+
 	INIT_WORK(&q->requeue_work, blk_mq_requeue_work);
 	INIT_LIST_HEAD(&q->requeue_list);
 	spin_lock_init(&q->requeue_lock);
@@ -2013,6 +2431,7 @@ void blk_mq_free_queue(struct request_queue *q)
 {
 	struct blk_mq_tag_set	*set = q->tag_set;
 
+	blk_mq_sched_teardown(q);
 	blk_mq_del_queue_tag_set(q);
 
 	blk_mq_exit_hw_queues(q, set, set->nr_hw_queues);
@@ -2093,7 +2512,8 @@ static int __blk_mq_alloc_rq_maps(struct blk_mq_tag_set *set)
 	int i;
 
 	for (i = 0; i < set->nr_hw_queues; i++) {
-		set->tags[i] = blk_mq_init_rq_map(set, i);
+		set->tags[i] = blk_mq_init_rq_map(set, i, set->queue_depth,
+						  set->reserved_tags);
 		if (!set->tags[i])
 			goto out_unwind;
 	}
@@ -2218,12 +2638,22 @@ int blk_mq_update_nr_requests(struct request_queue *q, unsigned int nr)
 	struct blk_mq_hw_ctx *hctx;
 	int i, ret;
 
-	if (!set || nr > set->queue_depth)
+	if (!set)
+		return -EINVAL;
+
+	/*
+	 * With an I/O scheduler this sizes the scheduler tags, which may go
+	 * deeper than the hardware.
+	 */
+	if (!q->elevator && nr > set->queue_depth)
 		return -EINVAL;
 
 	ret = 0;
 	queue_for_each_hw_ctx(q, hctx, i) {
-		ret = blk_mq_tag_update_depth(hctx->tags, nr);
+		if (q->elevator)
+			ret = blk_mq_tag_update_depth(hctx->sched_tags, nr);
+		else
+			ret = blk_mq_tag_update_depth(hctx->tags, nr);
 		if (ret)
 			break;
 	}
@@ -12,10 +12,8 @@ struct blk_mq_ctx {
 	unsigned int		cpu;
 	unsigned int		index_hw;
 
-	unsigned int		last_tag ____cacheline_aligned_in_smp;
-
 	/* incremented at dispatch time */
-	unsigned long		rq_dispatched[2];
+	unsigned long		rq_dispatched[2] ____cacheline_aligned_in_smp;
 	unsigned long		rq_merged;
 
 	/* incremented at completion time */
@@ -34,6 +32,15 @@ void blk_mq_clone_flush_request(struct request *flush_rq,
 int blk_mq_update_nr_requests(struct request_queue *q, unsigned int nr);
 void blk_mq_wake_waiters(struct request_queue *q);
 
+/*
+ * Request maps, for driver tags and for the I/O scheduler's tags
+ */
+struct blk_mq_tags *blk_mq_init_rq_map(struct blk_mq_tag_set *set,
+		unsigned int hctx_idx, unsigned int depth,
+		unsigned int reserved_tags);
+void blk_mq_free_rq_map(struct blk_mq_tag_set *set, struct blk_mq_tags *tags,
+		unsigned int hctx_idx);
+
 /*
  * CPU hotplug helpers
  */
@@ -100,6 +107,7 @@ struct blk_mq_alloc_data {
 	struct request_queue *q;
 	gfp_t gfp;
 	bool reserved;
+	bool internal;		/* allocate from the scheduler tags */
 
 	/* input & output parameter */
 	struct blk_mq_ctx *ctx;
@@ -114,10 +122,20 @@ static inline void blk_mq_set_alloc_data(struct blk_mq_alloc_data *data,
 	data->q = q;
 	data->gfp = gfp;
 	data->reserved = reserved;
+	data->internal = false;
 	data->ctx = ctx;
 	data->hctx = hctx;
 }
 
+static inline struct blk_mq_tags *
+blk_mq_tags_from_data(struct blk_mq_alloc_data *data)
+{
+	if (data->internal)
+		return data->hctx->sched_tags;
+
+	return data->hctx->tags;
+}
+
 static inline bool blk_mq_hw_queue_mapped(struct blk_mq_hw_ctx *hctx)
 {
 	return hctx->nr_ctx && hctx->tags;
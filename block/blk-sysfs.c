@@ -12,6 +12,9 @@
 #include "blk.h"
 #include "blk-cgroup.h"
 #include "blk-mq.h"
+#include "blk-wbt.h"
+#include "blk-lat.h"
+#include "blk-iocost.h"
 
 struct queue_sysfs_entry {
 	struct attribute attr;
@@ -69,6 +72,9 @@ queue_requests_store(struct request_queue *q, const char *page, size_t count)
 	if (err)
 		return err;
 
+	if (q->rq_wb)
+		wbt_update_limits(q->rq_wb);
+
 	return ret;
 }
 
@@ -285,6 +291,202 @@ queue_rq_affinity_store(struct request_queue *q, const char *page, size_t count)
 	return ret;
 }
 
+static ssize_t queue_poll_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_queue_poll(q), page);
+}
+
+static ssize_t queue_poll_store(struct request_queue *q, const char *page,
+				size_t count)
+{
+	unsigned long poll_on;
+	ssize_t ret;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	ret = queue_var_store(&poll_on, page, count);
+	if (ret < 0)
+		return ret;
+
+	spin_lock_irq(q->queue_lock);
+	if (poll_on)
+		queue_flag_set(QUEUE_FLAG_POLL, q);
+	else
+		queue_flag_clear(QUEUE_FLAG_POLL, q);
+	spin_unlock_irq(q->queue_lock);
+
+	return ret;
+}
+
+static ssize_t queue_poll_delay_show(struct request_queue *q, char *page)
+{
+	int val;
+
+	if (q->poll_nsec <= 0)
+		val = q->poll_nsec;
+	else
+		val = q->poll_nsec / 1000;
+
+	return sprintf(page, "%d\n", val);
+}
+
+/*
+ * Sleep before polling: -1 never sleeps, 0 sleeps for half the mean
+ * completion time and anything else is a fixed sleep in usecs.
+ */
+static ssize_t queue_poll_delay_store(struct request_queue *q, const char *page,
+				      size_t count)
+{
+	int err, val;
+
+	if (!q->mq_ops || !q->mq_ops->poll)
+		return -EINVAL;
+
+	err = kstrtoint(page, 10, &val);
+	if (err < 0)
+		return err;
+	if (val < -1 || val > INT_MAX / 1000)
+		return -EINVAL;
+
+	if (val <= 0)
+		q->poll_nsec = val;
+	else
+		q->poll_nsec = val * 1000;
+
+	return count;
+}
+
+#ifdef CONFIG_BLK_LAT_HIST
+static ssize_t queue_lat_hist_enable_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(test_bit(QUEUE_FLAG_LAT_HIST, &q->queue_flags),
+			      page);
+}
+
+static ssize_t queue_lat_hist_enable_store(struct request_queue *q,
+					   const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_lat_enable(q, val);
+	return err ? err : ret;
+}
+
+static ssize_t queue_lat_hist_show(struct request_queue *q, char *page)
+{
+	return blk_lat_hist_show(q, page);
+}
+#endif
+
+#ifdef CONFIG_BLK_IOCOST
+static ssize_t queue_iocost_enable_show(struct request_queue *q, char *page)
+{
+	return queue_var_show(blk_iocost_enabled(q), page);
+}
+
+static ssize_t queue_iocost_enable_store(struct request_queue *q,
+					 const char *page, size_t count)
+{
+	unsigned long val;
+	ssize_t ret;
+	int err;
+
+	ret = queue_var_store(&val, page, count);
+	if (ret < 0)
+		return ret;
+
+	err = blk_iocost_enable(q, val);
+	return err ? err : ret;
+}
+
+static ssize_t queue_iocost_model_show(struct request_queue *q, char *page)
+{
+	return blk_iocost_model_show(q, page);
+}
+
+static ssize_t queue_iocost_model_store(struct request_queue *q,
+					const char *page, size_t count)
+{
+	int err = blk_iocost_model_store(q, page);
+
+	return err ? err : count;
+}
+
+static ssize_t queue_iocost_qos_show(struct request_queue *q, char *page)
+{
+	return blk_iocost_qos_show(q, page);
+}
+
+static ssize_t queue_iocost_qos_store(struct request_queue *q,
+				      const char *page, size_t count)
+{
+	int err = blk_iocost_qos_store(q, page);
+
+	return err ? err : count;
+}
+
+static ssize_t queue_iocost_vrate_show(struct request_queue *q, char *page)
+{
+	return blk_iocost_vrate_show(q, page);
+}
+#endif
+
+#ifdef CONFIG_BLK_WBT
+static ssize_t queue_wb_lat_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	return sprintf(page, "%llu\n",
+		       (unsigned long long)div_u64(q->rq_wb->min_lat_nsec, 1000));
+}
+
+/*
+ * Target read latency in usecs, 0 turns throttling off and -1 restores
+ * the default for the device.
+ */
+static ssize_t queue_wb_lat_store(struct request_queue *q, const char *page,
+				  size_t count)
+{
+	ssize_t ret;
+	s64 val;
+
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	ret = kstrtoll(page, 10, &val);
+	if (ret < 0)
+		return ret;
+	if (val < -1)
+		return -EINVAL;
+	/* usecs, the limit is kept in nsecs */
+	if (val != -1 && (u64)val > U64_MAX / 1000)
+		return -EINVAL;
+
+	if (val == -1)
+		wbt_set_min_lat(q->rq_wb, wbt_default_latency_nsec(q));
+	else
+		wbt_set_min_lat(q->rq_wb, val * 1000ULL);
+
+	return count;
+}
+
+static ssize_t queue_wb_depth_show(struct request_queue *q, char *page)
+{
+	if (!q->rq_wb)
+		return -EINVAL;
+
+	return sprintf(page, "%u\n", q->rq_wb->wb_max);
+}
+#endif
+
 static struct queue_sysfs_entry queue_requests_entry = {
 	.attr = {.name = "nr_requests", .mode = S_IRUGO | S_IWUSR },
 	.show = queue_requests_show,
@@ -404,6 +606,69 @@ static struct queue_sysfs_entry queue_random_entry = {
 	.store = queue_store_random,
 };
 
+static struct queue_sysfs_entry queue_poll_entry = {
+	.attr = {.name = "io_poll", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_show,
+	.store = queue_poll_store,
+};
+
+static struct queue_sysfs_entry queue_poll_delay_entry = {
+	.attr = {.name = "io_poll_delay", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_poll_delay_show,
+	.store = queue_poll_delay_store,
+};
+
+#ifdef CONFIG_BLK_LAT_HIST
+static struct queue_sysfs_entry queue_lat_hist_enable_entry = {
+	.attr = {.name = "lat_hist_enable", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_lat_hist_enable_show,
+	.store = queue_lat_hist_enable_store,
+};
+
+static struct queue_sysfs_entry queue_lat_hist_entry = {
+	.attr = {.name = "lat_hist", .mode = S_IRUGO },
+	.show = queue_lat_hist_show,
+};
+#endif
+
+#ifdef CONFIG_BLK_IOCOST
+static struct queue_sysfs_entry queue_iocost_enable_entry = {
+	.attr = {.name = "iocost_enable", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_iocost_enable_show,
+	.store = queue_iocost_enable_store,
+};
+
+static struct queue_sysfs_entry queue_iocost_model_entry = {
+	.attr = {.name = "iocost_model", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_iocost_model_show,
+	.store = queue_iocost_model_store,
+};
+
+static struct queue_sysfs_entry queue_iocost_qos_entry = {
+	.attr = {.name = "iocost_qos", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_iocost_qos_show,
+	.store = queue_iocost_qos_store,
+};
+
+static struct queue_sysfs_entry queue_iocost_vrate_entry = {
+	.attr = {.name = "iocost_vrate", .mode = S_IRUGO },
+	.show = queue_iocost_vrate_show,
+};
+#endif
+
+#ifdef CONFIG_BLK_WBT
+static struct queue_sysfs_entry queue_wb_lat_entry = {
+	.attr = {.name = "wbt_lat_usec", .mode = S_IRUGO | S_IWUSR },
+	.show = queue_wb_lat_show,
+	.store = queue_wb_lat_store,
+};
+
+static struct queue_sysfs_entry queue_wb_depth_entry = {
+	.attr = {.name = "wbt_depth", .mode = S_IRUGO },
+	.show = queue_wb_depth_show,
+};
+#endif
+
 static struct attribute *default_attrs[] = {
 	&queue_requests_entry.attr,
 	&queue_ra_entry.attr,
@@ -427,6 +692,22 @@ static struct attribute *default_attrs[] = {
 	&queue_rq_affinity_entry.attr,
 	&queue_iostats_entry.attr,
 	&queue_random_entry.attr,
+	&queue_poll_entry.attr,
+	&queue_poll_delay_entry.attr,
+#ifdef CONFIG_BLK_LAT_HIST
+	&queue_lat_hist_enable_entry.attr,
+	&queue_lat_hist_entry.attr,
+#endif
+#ifdef CONFIG_BLK_IOCOST
+	&queue_iocost_enable_entry.attr,
+	&queue_iocost_model_entry.attr,
+	&queue_iocost_qos_entry.attr,
+	&queue_iocost_vrate_entry.attr,
+#endif
+#ifdef CONFIG_BLK_WBT
+	&queue_wb_lat_entry.attr,
+	&queue_wb_depth_entry.attr,
+#endif
 	NULL,
 };
 
@@ -501,8 +782,12 @@ static void blk_release_queue(struct kobject *kobj)
 	struct request_queue *q =
 		container_of(kobj, struct request_queue, kobj);
 
+	blk_lat_exit(q);
+	blk_iocost_exit(q);
 	blkcg_exit_queue(q);
 
+	wbt_exit(q);
+
 	if (q->elevator) {
 		spin_lock_irq(q->queue_lock);
 		ioc_clear_queue(q);
@@ -568,6 +853,13 @@ int blk_register_queue(struct gendisk *disk)
 	if (ret)
 		return ret;
 
+	/*
+	 * Throttle buffered writeback on request based queues. Failing to
+	 * set it up is not fatal, the queue just runs without.
+	 */
+	if ((q->request_fn || q->mq_ops) && !q->rq_wb)
+		wbt_init(q);
+
 	ret = kobject_add(&q->kobj, kobject_get(&dev->kobj), "%s", "queue");
 	if (ret < 0) {
 		blk_trace_remove_sysfs(dev);
@@ -579,7 +871,7 @@ int blk_register_queue(struct gendisk *disk)
 	if (q->mq_ops)
 		blk_mq_register_disk(disk);
 
-	if (!q->request_fn)
+	if (!q->request_fn && !q->elevator)
 		return 0;
 
 	ret = elv_register_queue(q);
@@ -606,6 +898,13 @@ void blk_unregister_queue(struct gendisk *disk)
 
 	if (q->request_fn)
 		elv_unregister_queue(q);
+	else if (q->mq_ops) {
+		/* serialize against a blk-mq scheduler switch */
+		mutex_lock(&q->sysfs_lock);
+		if (q->elevator && q->elevator->registered)
+			elv_unregister_queue(q);
+		mutex_unlock(&q->sysfs_lock);
+	}
 
 	kobject_uevent(&q->kobj, KOBJ_REMOVE);
 	kobject_del(&q->kobj);
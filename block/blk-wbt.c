@@ -0,0 +1,633 @@
+/*
+ * Buffered writeback throttling, loosely based on CoDel. We can't drop
+ * packets for IO scheduling, so the logic is something like this:
+ *
+ * - Monitor latencies in a defined window of time.
+ * - If the minimum latency in the above window exceeds some target, increment
+ *   scaling step and scale down queue depth by a factor of 2x. The monitoring
+ *   window is then shrunk to 100 / sqrt(scaling step + 1).
+ * - For any window where we don't have solid data on what the latencies
+ *   look like, retain status quo.
+ * - If latencies look good, decrement scaling step.
+ * - If we're only doing writes, allow the scaling step to go negative. This
+ *   will temporarily boost write performance, snapping back to a stable
+ *   scaling step of 0 if reads show up or the heavy writers finish. Unlike
+ *   positive scaling steps where we shrink the monitoring window, a negative
+ *   scaling step retains the default step==0 window size.
+ *
+ * Only buffered writes (WRITE without REQ_SYNC) are throttled, everything
+ * else just feeds the latency statistics.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/blkdev.h>
+#include <linux/blktrace_api.h>
+#include <linux/percpu.h>
+#include <linux/swap.h>
+#include <linux/slab.h>
+
+#include "blk.h"
+#include "blk-wbt.h"
+
+enum {
+	/*
+	 * Default setting, we'll scale up (to 75% of QD max) or down (min 1)
+	 * from here depending on device stats
+	 */
+	RWB_DEF_DEPTH	= 16,
+
+	/*
+	 * 100msec window
+	 */
+	RWB_WINDOW_NSEC		= 100 * 1000 * 1000ULL,
+
+	/*
+	 * Disregard stats, if we don't meet this minimum
+	 */
+	RWB_MIN_WRITE_SAMPLES	= 3,
+
+	/*
+	 * If we have this number of consecutive windows with not enough
+	 * information to scale up or down, scale up.
+	 */
+	RWB_UNKNOWN_BUMP	= 5,
+};
+
+enum {
+	LAT_OK = 1,
+	LAT_UNKNOWN,
+	LAT_UNKNOWN_WRITES,
+	LAT_EXCEEDED,
+};
+
+static inline bool rwb_enabled(struct rq_wb *rwb)
+{
+	return rwb && rwb->wb_normal != 0;
+}
+
+static unsigned int wbt_queue_depth(struct request_queue *q)
+{
+	if (q->mq_ops)
+		return q->tag_set->queue_depth;
+	return q->nr_requests;
+}
+
+static void rwb_wake_all(struct rq_wb *rwb)
+{
+	if (waitqueue_active(&rwb->wait))
+		wake_up_all(&rwb->wait);
+}
+
+void __wbt_done(struct rq_wb *rwb, unsigned int flags)
+{
+	unsigned int limit;
+	int inflight;
+
+	if (!(flags & WBT_TRACKED))
+		return;
+
+	inflight = atomic_dec_return(&rwb->inflight);
+
+	/*
+	 * wbt got disabled with IO in flight. Wake up any potential
+	 * waiters, we don't have to do more than that.
+	 */
+	if (unlikely(!rwb_enabled(rwb))) {
+		rwb_wake_all(rwb);
+		return;
+	}
+
+	/*
+	 * Don't wake anyone up until we are back under the normal limit,
+	 * and then wait for a batch of completions so the waiter gets
+	 * more than one request in.
+	 */
+	limit = rwb->wb_normal;
+	if (inflight && inflight >= limit)
+		return;
+
+	if (waitqueue_active(&rwb->wait)) {
+		int diff = limit - inflight;
+
+		if (!inflight || diff >= rwb->wb_background / 2)
+			wake_up(&rwb->wait);
+	}
+}
+
+static void wbt_stat_add(struct rq_wb *rwb, int dir, u64 lat)
+{
+	struct wbt_cpu_stat *cs;
+	struct wbt_stat *s;
+	unsigned long flags;
+	unsigned int win;
+
+	local_irq_save(flags);
+	cs = this_cpu_ptr(rwb->cpu_stat);
+	win = ACCESS_ONCE(rwb->win);
+	if (cs->win != win) {
+		memset(cs->stat, 0, sizeof(cs->stat));
+		cs->win = win;
+	}
+
+	s = &cs->stat[dir];
+	if (!s->nr || lat < s->min)
+		s->min = lat;
+	if (lat > s->max)
+		s->max = lat;
+	s->total += lat;
+	s->nr++;
+	local_irq_restore(flags);
+}
+
+/*
+ * Called when the request is freed, done or not. Drops the throttling
+ * count of a tracked write and accounts the completion latency of anything
+ * that made it to the device.
+ */
+void wbt_done(struct rq_wb *rwb, struct request *rq)
+{
+	if (!rwb)
+		return;
+
+	if (!wbt_is_tracked(rq)) {
+		if (rwb->sync_cookie == rq) {
+			rwb->sync_issue = 0;
+			rwb->sync_cookie = NULL;
+		}
+
+		if (rq_data_dir(rq) == READ)
+			rwb->last_comp = jiffies;
+	} else
+		__wbt_done(rwb, rq->wbt_flags);
+
+	if (rq->wbt_issue_ns && rwb->min_lat_nsec) {
+		u64 now = ktime_get_ns();
+
+		if (now > rq->wbt_issue_ns)
+			wbt_stat_add(rwb, rq_data_dir(rq),
+				     now - rq->wbt_issue_ns);
+	}
+
+	rq->wbt_flags = 0;
+	rq->wbt_issue_ns = 0;
+}
+
+/*
+ * Sum up the per cpu stats of the window that just ended, and start the
+ * next one. Samples that race with this may be lost, which is fine for
+ * what we use them for.
+ */
+static void wbt_stat_collect(struct rq_wb *rwb, struct wbt_stat *stat)
+{
+	unsigned int win = rwb->win;
+	int cpu, dir;
+
+	ACCESS_ONCE(rwb->win) = win + 1;
+
+	memset(stat, 0, 2 * sizeof(*stat));
+	for_each_possible_cpu(cpu) {
+		struct wbt_cpu_stat *cs = per_cpu_ptr(rwb->cpu_stat, cpu);
+
+		if (ACCESS_ONCE(cs->win) != win)
+			continue;
+
+		for (dir = READ; dir <= WRITE; dir++) {
+			struct wbt_stat *s = &cs->stat[dir];
+
+			if (!s->nr)
+				continue;
+			if (!stat[dir].nr || s->min < stat[dir].min)
+				stat[dir].min = s->min;
+			if (s->max > stat[dir].max)
+				stat[dir].max = s->max;
+			stat[dir].total += s->total;
+			stat[dir].nr += s->nr;
+		}
+	}
+}
+
+static u64 rwb_sync_issue_lat(struct rq_wb *rwb)
+{
+	u64 now, issue = ACCESS_ONCE(rwb->sync_issue);
+
+	if (!issue || !rwb->sync_cookie)
+		return 0;
+
+	now = ktime_get_ns();
+	return now > issue ? now - issue : 0;
+}
+
+static int latency_exceeded(struct rq_wb *rwb)
+{
+	struct wbt_stat stat[2];
+	u64 thislat;
+
+	wbt_stat_collect(rwb, stat);
+
+	/*
+	 * If our stored sync issue exceeds the window size, or it
+	 * exceeds our min target AND we haven't logged any entries,
+	 * flag the latency as exceeded. wbt works off completion latencies,
+	 * but for a flooded device, a single sync IO can take a long time
+	 * to complete after being issued. If this time exceeds our
+	 * monitoring window AND we didn't see any other completions in that
+	 * window, then count that sync IO as a violation of the latency.
+	 */
+	thislat = rwb_sync_issue_lat(rwb);
+	if (thislat > rwb->cur_win_nsec ||
+	    (thislat > rwb->min_lat_nsec && !stat[READ].nr))
+		return LAT_EXCEEDED;
+
+	/*
+	 * No read samples: if we have enough writes to judge by, let the
+	 * writers go faster, otherwise we don't know.
+	 */
+	if (!stat[READ].nr) {
+		if (stat[WRITE].nr >= RWB_MIN_WRITE_SAMPLES)
+			return LAT_UNKNOWN_WRITES;
+		return LAT_UNKNOWN;
+	}
+
+	/*
+	 * If the 'min' latency exceeds our target, step down.
+	 */
+	if (stat[READ].min > rwb->min_lat_nsec)
+		return LAT_EXCEEDED;
+
+	return LAT_OK;
+}
+
+static void calc_wb_limits(struct rq_wb *rwb)
+{
+	unsigned int depth, qd = wbt_queue_depth(rwb->queue);
+
+	if (!rwb->min_lat_nsec) {
+		rwb->wb_max = rwb->wb_normal = rwb->wb_background = 0;
+		return;
+	}
+
+	/*
+	 * For QD=1 devices, this is a special case. It's important for those
+	 * to have one request ready when one completes, so force a depth of
+	 * 2 for those devices. On the backend, it'll be a depth of 1 anyway,
+	 * since the device can't have more than that in flight.
+	 */
+	if (qd <= 1) {
+		depth = 2;
+	} else {
+		unsigned int def = min_t(unsigned int, RWB_DEF_DEPTH, qd);
+		unsigned int maxd = max(3 * qd / 4, 1U);
+
+		/*
+		 * Scale up or down from the default depth, scaling up is
+		 * capped at 3/4 of the queue depth to leave the rest to reads.
+		 */
+		rwb->scaled_max = false;
+		if (rwb->scale_step > 0)
+			depth = 1 + ((def - 1) >> min(31, rwb->scale_step));
+		else if (rwb->scale_step < 0) {
+			depth = 1 + ((def - 1) << min(31, -rwb->scale_step));
+			if (depth > maxd || depth < def) {
+				depth = maxd;
+				rwb->scaled_max = true;
+			}
+		} else
+			depth = min(def, maxd);
+	}
+
+	rwb->wb_max = depth;
+	rwb->wb_normal = (depth + 1) / 2;
+	rwb->wb_background = (depth + 3) / 4;
+}
+
+static void rwb_trace_step(struct rq_wb *rwb, const char *msg)
+{
+	blk_add_trace_msg(rwb->queue, "wbt: %s, step %d, max %u", msg,
+			  rwb->scale_step, rwb->wb_max);
+}
+
+static void scale_up(struct rq_wb *rwb)
+{
+	/*
+	 * Hit max in previous round, stop here
+	 */
+	if (rwb->scaled_max)
+		return;
+
+	rwb->scale_step--;
+	rwb->unknown_cnt = 0;
+
+	calc_wb_limits(rwb);
+
+	rwb_wake_all(rwb);
+	rwb_trace_step(rwb, "step up");
+}
+
+/*
+ * Scale rwb down. If 'hard_throttle' is set, do it quicker, since we
+ * had a latency violation.
+ */
+static void scale_down(struct rq_wb *rwb, bool hard_throttle)
+{
+	/*
+	 * Stop scaling down when we've hit the limit. This also prevents
+	 * ->scale_step from going to crazy values, if the device can't
+	 * keep up.
+	 */
+	if (rwb->wb_max == 1)
+		return;
+
+	if (rwb->scale_step < 0 && hard_throttle)
+		rwb->scale_step = 0;
+	else
+		rwb->scale_step++;
+
+	rwb->unknown_cnt = 0;
+	calc_wb_limits(rwb);
+	rwb_trace_step(rwb, "step down");
+}
+
+static void rwb_arm_timer(struct rq_wb *rwb)
+{
+	if (rwb->scale_step > 0) {
+		/*
+		 * We should speed this up, using some variant of a fast
+		 * integer inverse square root calculation. Since we only do
+		 * this for every window expiration, it's not a huge deal,
+		 * though.
+		 */
+		rwb->cur_win_nsec = div_u64(rwb->win_nsec << 4,
+					int_sqrt((rwb->scale_step + 1) << 8));
+	} else {
+		/*
+		 * For step < 0, we don't want to increase/decrease the
+		 * window size.
+		 */
+		rwb->cur_win_nsec = rwb->win_nsec;
+	}
+
+	mod_timer(&rwb->window_timer,
+		  jiffies + max(nsecs_to_jiffies(rwb->cur_win_nsec), 1UL));
+}
+
+static void wb_timer_fn(unsigned long data)
+{
+	struct rq_wb *rwb = (struct rq_wb *)data;
+	int status;
+
+	if (!rwb_enabled(rwb))
+		return;
+
+	status = latency_exceeded(rwb);
+	switch (status) {
+	case LAT_EXCEEDED:
+		scale_down(rwb, true);
+		break;
+	case LAT_OK:
+		scale_up(rwb);
+		break;
+	case LAT_UNKNOWN_WRITES:
+		/*
+		 * We started at the center step, but don't have a valid
+		 * read sample, but we do have writes going on.
+		 * Allow step to go negative, to increase write perf.
+		 */
+		scale_up(rwb);
+		break;
+	case LAT_UNKNOWN:
+		if (++rwb->unknown_cnt < RWB_UNKNOWN_BUMP)
+			break;
+		/*
+		 * We get here when previously scaled reduced depth, and we
+		 * currently don't have a valid read/write sample. For that
+		 * case, slowly return to center state (step == 0).
+		 */
+		if (rwb->scale_step > 0)
+			scale_up(rwb);
+		else if (rwb->scale_step < 0)
+			scale_down(rwb, false);
+		break;
+	default:
+		break;
+	}
+
+	/*
+	 * Re-arm timer, if we have IO in flight
+	 */
+	if (rwb->scale_step || atomic_read(&rwb->inflight))
+		rwb_arm_timer(rwb);
+}
+
+void wbt_update_limits(struct rq_wb *rwb)
+{
+	rwb->scale_step = 0;
+	rwb->scaled_max = false;
+	calc_wb_limits(rwb);
+
+	rwb_wake_all(rwb);
+}
+
+void wbt_set_min_lat(struct rq_wb *rwb, u64 min_lat_nsec)
+{
+	rwb->min_lat_nsec = min_lat_nsec;
+	wbt_update_limits(rwb);
+}
+
+static bool close_io(struct rq_wb *rwb)
+{
+	const unsigned long now = jiffies;
+
+	return time_before(now, rwb->last_issue + HZ / 10) ||
+		time_before(now, rwb->last_comp + HZ / 10);
+}
+
+static inline unsigned int get_wb_limit(struct rq_wb *rwb)
+{
+	/*
+	 * At this point we know it's a buffered write. kswapd needs to
+	 * clean pages to make progress, let it use the full depth.
+	 */
+	if (current_is_kswapd())
+		return rwb->wb_max;
+
+	/*
+	 * If there's been other recent IO, be more conservative and keep
+	 * writeback to the background depth.
+	 */
+	if (close_io(rwb))
+		return rwb->wb_background;
+
+	return rwb->wb_normal;
+}
+
+static bool atomic_inc_below(atomic_t *v, int below)
+{
+	int cur = atomic_read(v);
+
+	for (;;) {
+		int old;
+
+		if (cur >= below)
+			return false;
+		old = atomic_cmpxchg(v, cur, cur + 1);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+
+	return true;
+}
+
+static inline bool may_queue(struct rq_wb *rwb)
+{
+	/*
+	 * inc it here even if disabled, since we'll dec it at completion.
+	 * this only happens if the task was sleeping in __wbt_wait(),
+	 * and someone turned it off at the same time.
+	 */
+	if (!rwb_enabled(rwb)) {
+		atomic_inc(&rwb->inflight);
+		return true;
+	}
+
+	return atomic_inc_below(&rwb->inflight, get_wb_limit(rwb));
+}
+
+/*
+ * Block if we will exceed our limit, or if we are currently waiting for
+ * the timer to kick off queuing again.
+ */
+static void __wbt_wait(struct rq_wb *rwb, spinlock_t *lock)
+	__releases(lock)
+	__acquires(lock)
+{
+	DEFINE_WAIT(wait);
+
+	if (!waitqueue_active(&rwb->wait) && may_queue(rwb))
+		return;
+
+	do {
+		prepare_to_wait_exclusive(&rwb->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+
+		if (may_queue(rwb))
+			break;
+
+		if (lock)
+			spin_unlock_irq(lock);
+
+		io_schedule();
+
+		if (lock)
+			spin_lock_irq(lock);
+	} while (1);
+
+	finish_wait(&rwb->wait, &wait);
+}
+
+static inline bool wbt_should_throttle(struct bio *bio)
+{
+	/*
+	 * Only buffered writeback, sync writes (O_DIRECT, fsync driven) and
+	 * flushes are waited on by someone and go straight through.
+	 */
+	return (bio->bi_rw & (REQ_WRITE | REQ_SYNC | REQ_DISCARD |
+			      REQ_FLUSH | REQ_FUA)) == REQ_WRITE;
+}
+
+/**
+ * wbt_wait - throttle a bio before it gets a request
+ * @rwb:	the queue's writeback throttling state
+ * @bio:	the bio about to be turned into a request
+ * @lock:	queue lock held on entry, dropped while sleeping, or NULL
+ *
+ * Returns the flags the new request has to be tracked with through
+ * wbt_track(), or 0 if it isn't throttled. If no request ends up being
+ * allocated the caller must undo the accounting with __wbt_done().
+ */
+unsigned int wbt_wait(struct rq_wb *rwb, struct bio *bio, spinlock_t *lock)
+{
+	if (!rwb_enabled(rwb))
+		return 0;
+
+	if (!wbt_should_throttle(bio)) {
+		if (!(bio->bi_rw & REQ_WRITE))
+			rwb->last_issue = jiffies;
+		return 0;
+	}
+
+	__wbt_wait(rwb, lock);
+
+	if (!timer_pending(&rwb->window_timer))
+		rwb_arm_timer(rwb);
+
+	return WBT_TRACKED;
+}
+
+void wbt_issue(struct rq_wb *rwb, struct request *rq)
+{
+	if (!rwb_enabled(rwb) || rq->cmd_type != REQ_TYPE_FS)
+		return;
+
+	rq->wbt_issue_ns = ktime_get_ns();
+
+	/*
+	 * Track the issue time of a read, so latency_exceeded() can see one
+	 * that got stuck. Only one at a time, that is enough to notice.
+	 */
+	if (rq_data_dir(rq) == READ && !rwb->sync_issue) {
+		rwb->sync_cookie = rq;
+		rwb->sync_issue = rq->wbt_issue_ns;
+	}
+}
+
+u64 wbt_default_latency_nsec(struct request_queue *q)
+{
+	/*
+	 * We default to 2msec for non-rotational storage, and 75msec
+	 * for rotational storage.
+	 */
+	if (blk_queue_nonrot(q))
+		return 2000000ULL;
+	else
+		return 75000000ULL;
+}
+
+int wbt_init(struct request_queue *q)
+{
+	struct rq_wb *rwb;
+
+	rwb = kzalloc_node(sizeof(*rwb), GFP_KERNEL, q->node);
+	if (!rwb)
+		return -ENOMEM;
+
+	rwb->cpu_stat = alloc_percpu(struct wbt_cpu_stat);
+	if (!rwb->cpu_stat) {
+		kfree(rwb);
+		return -ENOMEM;
+	}
+
+	atomic_set(&rwb->inflight, 0);
+	init_waitqueue_head(&rwb->wait);
+	setup_timer(&rwb->window_timer, wb_timer_fn, (unsigned long)rwb);
+	rwb->last_comp = rwb->last_issue = jiffies;
+	rwb->queue = q;
+	rwb->win_nsec = RWB_WINDOW_NSEC;
+	rwb->min_lat_nsec = wbt_default_latency_nsec(q);
+	wbt_update_limits(rwb);
+
+	q->rq_wb = rwb;
+	return 0;
+}
+
+void wbt_exit(struct request_queue *q)
+{
+	struct rq_wb *rwb = q->rq_wb;
+
+	if (rwb) {
+		del_timer_sync(&rwb->window_timer);
+		q->rq_wb = NULL;
+		free_percpu(rwb->cpu_stat);
+		kfree(rwb);
+	}
+}
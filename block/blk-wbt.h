@@ -0,0 +1,129 @@
+#ifndef INT_BLK_WBT_H
+#define INT_BLK_WBT_H
+
+#include <linux/kernel.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/timer.h>
+#include <linux/blkdev.h>
+
+enum wbt_flags {
+	WBT_TRACKED		= 1,	/* write, tracked for throttling */
+};
+
+struct wbt_stat {
+	u64 min;
+	u64 max;
+	u64 total;
+	unsigned int nr;
+};
+
+/*
+ * Completion latencies are gathered per cpu, and only for the window
+ * numbered @win; a cpu still holding an older window resets its stats on
+ * the next sample.
+ */
+struct wbt_cpu_stat {
+	unsigned int win;
+	struct wbt_stat stat[2];	/* READ, WRITE */
+};
+
+struct rq_wb {
+	/*
+	 * Settings that govern how we throttle
+	 */
+	unsigned int wb_background;		/* background writeback */
+	unsigned int wb_normal;			/* normal writeback */
+	unsigned int wb_max;			/* max throughput writeback */
+	int scale_step;
+	bool scaled_max;
+
+	u64 win_nsec;				/* default window size */
+	u64 cur_win_nsec;			/* current window size */
+
+	/*
+	 * Target read latency, throttling is off if zero
+	 */
+	u64 min_lat_nsec;
+	unsigned int unknown_cnt;
+
+	struct timer_list window_timer;
+	unsigned int win;			/* current stat window */
+	struct wbt_cpu_stat __percpu *cpu_stat;
+
+	/*
+	 * Oldest read the device has not completed yet, to notice reads
+	 * that get stuck behind writes before they show up in the stats
+	 */
+	u64 sync_issue;
+	void *sync_cookie;
+
+	unsigned long last_issue;		/* last non-throttled issue */
+	unsigned long last_comp;		/* last non-throttled comp */
+
+	atomic_t inflight;
+	wait_queue_head_t wait;
+
+	struct request_queue *queue;
+};
+
+#ifdef CONFIG_BLK_WBT
+
+static inline bool wbt_is_tracked(struct request *rq)
+{
+	return rq->wbt_flags & WBT_TRACKED;
+}
+
+static inline void wbt_track(struct request *rq, unsigned int flags)
+{
+	rq->wbt_flags |= flags;
+}
+
+unsigned int wbt_wait(struct rq_wb *rwb, struct bio *bio, spinlock_t *lock);
+void __wbt_done(struct rq_wb *rwb, unsigned int flags);
+void wbt_done(struct rq_wb *rwb, struct request *rq);
+void wbt_issue(struct rq_wb *rwb, struct request *rq);
+
+int wbt_init(struct request_queue *q);
+void wbt_exit(struct request_queue *q);
+void wbt_update_limits(struct rq_wb *rwb);
+void wbt_set_min_lat(struct rq_wb *rwb, u64 min_lat_nsec);
+u64 wbt_default_latency_nsec(struct request_queue *q);
+
+#else
+
+static inline bool wbt_is_tracked(struct request *rq)
+{
+	return false;
+}
+static inline void wbt_track(struct request *rq, unsigned int flags)
+{
+}
+static inline unsigned int wbt_wait(struct rq_wb *rwb, struct bio *bio,
+				    spinlock_t *lock)
+{
+	return 0;
+}
+static inline void __wbt_done(struct rq_wb *rwb, unsigned int flags)
+{
+}
+static inline void wbt_done(struct rq_wb *rwb, struct request *rq)
+{
+}
+static inline void wbt_issue(struct rq_wb *rwb, struct request *rq)
+{
+}
+static inline int wbt_init(struct request_queue *q)
+{
+	return -EINVAL;
+}
+static inline void wbt_exit(struct request_queue *q)
+{
+}
+static inline void wbt_update_limits(struct rq_wb *rwb)
+{
+}
+
+#endif /* CONFIG_BLK_WBT */
+
+#endif
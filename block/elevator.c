@@ -39,6 +39,7 @@
 #include <trace/events/block.h>
 
 #include "blk.h"
+#include "blk-mq-sched.h"
 #include "blk-cgroup.h"
 
 static DEFINE_SPINLOCK(elv_list_lock);
@@ -218,6 +219,17 @@ int elevator_init(struct request_queue *q, char *name)
 							chosen_elevator);
 	}
 
+	/* blk-mq schedulers can't drive a request_fn queue */
+	if (e && e->uses_mq) {
+		if (!name)
+			printk(KERN_ERR "I/O scheduler %s is blk-mq only\n",
+							e->elevator_name);
+		elevator_put(e);
+		if (name)
+			return -EINVAL;
+		e = NULL;
+	}
+
 	if (!e) {
 		e = elevator_get(CONFIG_DEFAULT_IOSCHED, false);
 		if (!e) {
@@ -238,7 +250,10 @@ EXPORT_SYMBOL(elevator_init);
 void elevator_exit(struct elevator_queue *e)
 {
 	mutex_lock(&e->sysfs_lock);
-	if (e->type->ops.elevator_exit_fn)
+	if (e->type->uses_mq) {
+		if (e->type->mq_ops.exit_sched)
+			e->type->mq_ops.exit_sched(e);
+	} else if (e->type->ops.elevator_exit_fn)
 		e->type->ops.elevator_exit_fn(e);
 	mutex_unlock(&e->sysfs_lock);
 
@@ -252,13 +267,14 @@ static inline void __elv_rqhash_del(struct request *rq)
 	rq->cmd_flags &= ~REQ_HASHED;
 }
 
-static void elv_rqhash_del(struct request_queue *q, struct request *rq)
+void elv_rqhash_del(struct request_queue *q, struct request *rq)
 {
 	if (ELV_ON_HASH(rq))
 		__elv_rqhash_del(rq);
 }
+EXPORT_SYMBOL_GPL(elv_rqhash_del);
 
-static void elv_rqhash_add(struct request_queue *q, struct request *rq)
+void elv_rqhash_add(struct request_queue *q, struct request *rq)
 {
 	struct elevator_queue *e = q->elevator;
 
@@ -266,14 +282,15 @@ static void elv_rqhash_add(struct request_queue *q, struct request *rq)
 	hash_add(e->hash, &rq->hash, rq_hash_key(rq));
 	rq->cmd_flags |= REQ_HASHED;
 }
+EXPORT_SYMBOL_GPL(elv_rqhash_add);
 
-static void elv_rqhash_reposition(struct request_queue *q, struct request *rq)
+void elv_rqhash_reposition(struct request_queue *q, struct request *rq)
 {
 	__elv_rqhash_del(rq);
 	elv_rqhash_add(q, rq);
 }
 
-static struct request *elv_rqhash_find(struct request_queue *q, sector_t offset)
+struct request *elv_rqhash_find(struct request_queue *q, sector_t offset)
 {
 	struct elevator_queue *e = q->elevator;
 	struct hlist_node *next;
@@ -946,6 +963,51 @@ fail_init:
 	return err;
 }
 
+/*
+ * blk-mq version of elevator_switch(). Freezing the queue guarantees no
+ * request holds a scheduler tag, so the old scheduler and its tags can go
+ * before the new ones are set up. If that fails the queue is left without
+ * a scheduler, which always works for blk-mq. @new_e may be NULL for "none".
+ */
+static int elevator_switch_mq(struct request_queue *q,
+			      struct elevator_type *new_e)
+{
+	bool registered = q->kobj.state_in_sysfs;
+	int err = 0;
+
+	blk_mq_freeze_queue(q);
+
+	blk_mq_sched_teardown(q);
+	if (!new_e)
+		goto out;
+
+	err = blk_mq_sched_alloc_tags(q);
+	if (err) {
+		elevator_put(new_e);
+		goto out;
+	}
+
+	/* like ->elevator_init_fn, drops the type reference on failure */
+	err = new_e->mq_ops.init_sched(q, new_e);
+	if (err) {
+		blk_mq_sched_free_tags(q);
+		goto out;
+	}
+
+	if (registered) {
+		err = elv_register_queue(q);
+		if (err)
+			blk_mq_sched_teardown(q);
+	}
+out:
+	blk_mq_unfreeze_queue(q);
+
+	if (!err)
+		blk_add_trace_msg(q, "elv switch: %s",
+				  new_e ? new_e->elevator_name : "none");
+	return err;
+}
+
 /*
  * Switch this queue to the given IO scheduler.
  */
@@ -954,21 +1016,38 @@ static int __elevator_change(struct request_queue *q, const char *name)
 	char elevator_name[ELV_NAME_MAX];
 	struct elevator_type *e;
 
-	if (!q->elevator)
+	if (!q->elevator && !q->mq_ops)
 		return -ENXIO;
 
 	strlcpy(elevator_name, name, sizeof(elevator_name));
-	e = elevator_get(strstrip(elevator_name), true);
+	name = strstrip(elevator_name);
+
+	if (q->mq_ops && !strcmp(name, "none")) {
+		if (!q->elevator)
+			return 0;
+		return elevator_switch_mq(q, NULL);
+	}
+
+	e = elevator_get(name, true);
 	if (!e) {
-		printk(KERN_ERR "elevator: type %s not found\n", elevator_name);
+		printk(KERN_ERR "elevator: type %s not found\n", name);
 		return -EINVAL;
 	}
 
-	if (!strcmp(elevator_name, q->elevator->type->elevator_name)) {
+	if (q->elevator &&
+	    !strcmp(name, q->elevator->type->elevator_name)) {
 		elevator_put(e);
 		return 0;
 	}
 
+	if (e->uses_mq != !!q->mq_ops) {
+		elevator_put(e);
+		return -EINVAL;
+	}
+
+	if (q->mq_ops)
+		return elevator_switch_mq(q, e);
+
 	return elevator_switch(q, e);
 }
 
@@ -990,7 +1069,7 @@ ssize_t elv_iosched_store(struct request_queue *q, const char *name,
 {
 	int ret;
 
-	if (!q->elevator)
+	if (!q->elevator && !q->mq_ops)
 		return count;
 
 	ret = __elevator_change(q, name);
@@ -1008,14 +1087,20 @@ ssize_t elv_iosched_show(struct request_queue *q, char *name)
 	struct elevator_type *__e;
 	int len = 0;
 
-	if (!q->elevator || !blk_queue_stackable(q))
-		return sprintf(name, "none\n");
-
-	elv = e->type;
+	if (q->mq_ops) {
+		len += sprintf(name, e ? "none " : "[none] ");
+		elv = e ? e->type : NULL;
+	} else {
+		if (!e || !blk_queue_stackable(q))
+			return sprintf(name, "none\n");
+		elv = e->type;
+	}
 
 	spin_lock(&elv_list_lock);
 	list_for_each_entry(__e, &elv_list, list) {
-		if (!strcmp(elv->elevator_name, __e->elevator_name))
+		if (__e->uses_mq != !!q->mq_ops)
+			continue;
+		if (elv && !strcmp(elv->elevator_name, __e->elevator_name))
 			len += sprintf(name+len, "[%s] ", elv->elevator_name);
 		else
 			len += sprintf(name+len, "%s ", __e->elevator_name);
@@ -450,8 +450,95 @@ static int lo_req_flush(struct loop_device *lo, struct request *rq)
 	return ret;
 }
 
-static int do_req_filebacked(struct loop_device *lo, struct request *rq)
+static void lo_rw_aio_complete(struct kiocb *iocb, long ret, long ret2)
 {
+	struct loop_cmd *cmd = container_of(iocb, struct loop_cmd, iocb);
+	struct request *rq = cmd->rq;
+
+	kfree(cmd->bvec);
+	cmd->bvec = NULL;
+
+	/* a short read hit the end of the backing file, as in lo_receive() */
+	if (ret >= 0 && ret != blk_rq_bytes(rq) && !(rq->cmd_flags & REQ_WRITE)) {
+		struct bio *bio;
+
+		__rq_for_each_bio(bio, rq)
+			zero_fill_bio(bio);
+		ret = blk_rq_bytes(rq);
+	}
+
+	if (ret != blk_rq_bytes(rq))
+		rq->errors = -EIO;
+	blk_mq_complete_request(rq);
+}
+
+/*
+ * Hand the request's pages straight to the backing file's ->read_iter or
+ * ->write_iter as an O_DIRECT kiocb: no copy through the backing page
+ * cache, and the worker doesn't wait for the IO, lo_rw_aio_complete()
+ * finishes the request when the backing file is done with it.
+ */
+static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
+		     loff_t pos, int rw)
+{
+	struct file *file = lo->lo_backing_file;
+	struct request *rq = cmd->rq;
+	struct bio *bio = rq->bio;
+	struct bio_vec *bvec;
+	struct iov_iter iter;
+	unsigned int offset;
+	unsigned int nr_bvec;
+	ssize_t ret;
+
+	if (bio != rq->biotail) {
+		struct req_iterator rq_iter;
+		struct bio_vec tmp;
+
+		/* merged bios, gather their segments in one vector */
+		nr_bvec = 0;
+		rq_for_each_segment(tmp, rq, rq_iter)
+			nr_bvec++;
+		bvec = kmalloc_array(nr_bvec, sizeof(*bvec), GFP_NOIO);
+		if (!bvec)
+			return -EIO;
+		cmd->bvec = bvec;
+		rq_for_each_segment(tmp, rq, rq_iter)
+			*bvec++ = tmp;
+		bvec = cmd->bvec;
+		offset = 0;
+	} else {
+		/* a single bio's vector can be used in place */
+		cmd->bvec = NULL;
+		bvec = __bvec_iter_bvec(bio->bi_io_vec, bio->bi_iter);
+		nr_bvec = bio_segments(bio);
+		offset = bio->bi_iter.bi_bvec_done;
+	}
+
+	iov_iter_bvec(&iter, ITER_BVEC | rw, bvec, nr_bvec, blk_rq_bytes(rq));
+	iter.iov_offset = offset;
+
+	init_sync_kiocb(&cmd->iocb, file);
+	cmd->iocb.ki_pos = pos;
+	cmd->iocb.ki_nbytes = blk_rq_bytes(rq);
+	cmd->iocb.ki_flags = IOCB_DIRECT;
+	cmd->iocb.ki_complete = lo_rw_aio_complete;
+
+	if (rw == WRITE) {
+		file_start_write(file);
+		ret = file->f_op->write_iter(&cmd->iocb, &iter);
+		file_end_write(file);
+	} else {
+		ret = file->f_op->read_iter(&cmd->iocb, &iter);
+	}
+
+	if (ret != -EIOCBQUEUED)
+		lo_rw_aio_complete(&cmd->iocb, ret, 0);
+	return 0;
+}
+
+static int do_req_filebacked(struct loop_device *lo, struct loop_cmd *cmd)
+{
+	struct request *rq = cmd->rq;
 	loff_t pos;
 	int ret;
 
@@ -462,14 +549,75 @@ static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 			ret = lo_req_flush(lo, rq);
 		else if (rq->cmd_flags & REQ_DISCARD)
 			ret = lo_discard(lo, rq, pos);
+		else if (cmd->use_aio)
+			ret = lo_rw_aio(lo, cmd, pos, WRITE);
 		else
 			ret = lo_send(lo, rq, pos);
-	} else
+	} else if (cmd->use_aio)
+		ret = lo_rw_aio(lo, cmd, pos, READ);
+	else
 		ret = lo_receive(lo, rq, lo->lo_blocksize, pos);
 
 	return ret;
 }
 
+/*
+ * Direct IO to the backing file is only possible if every request the
+ * loop queue accepts is aligned for it: the backing logical block size
+ * can't be bigger than ours and lo_offset has to be a multiple of it.
+ * Transfer functions need a bounce buffer of their own.
+ */
+static void __loop_update_dio(struct loop_device *lo, bool dio)
+{
+	struct file *file = lo->lo_backing_file;
+	struct address_space *mapping = file->f_mapping;
+	struct inode *inode = mapping->host;
+	struct block_device *bdev = NULL;
+	unsigned short sb_bsize = 0;
+	unsigned dio_align = 0;
+	bool use_dio = false;
+
+	if (S_ISBLK(inode->i_mode))
+		bdev = I_BDEV(inode);
+	else if (inode->i_sb->s_bdev)
+		bdev = inode->i_sb->s_bdev;
+	if (bdev) {
+		sb_bsize = bdev_logical_block_size(bdev);
+		dio_align = sb_bsize - 1;
+	}
+
+	if (dio && queue_logical_block_size(lo->lo_queue) >= sb_bsize &&
+	    !(lo->lo_offset & dio_align) && mapping->a_ops->direct_IO &&
+	    file->f_op->read_iter && file->f_op->write_iter &&
+	    lo->transfer == transfer_none)
+		use_dio = true;
+
+	if (lo->use_dio == use_dio)
+		return;
+
+	/* buffered writes must be on disk before reads bypass the cache */
+	vfs_fsync(file, 0);
+
+	/*
+	 * Requests in flight were set up for the old mode, let them finish
+	 * before switching.
+	 */
+	blk_mq_freeze_queue(lo->lo_queue);
+	lo->use_dio = use_dio;
+	if (use_dio)
+		lo->lo_flags |= LO_FLAGS_DIRECT_IO;
+	else
+		lo->lo_flags &= ~LO_FLAGS_DIRECT_IO;
+	blk_mq_unfreeze_queue(lo->lo_queue);
+}
+
+/* keep direct IO on if possible after the setup of the device changed */
+static void loop_update_dio(struct loop_device *lo)
+{
+	__loop_update_dio(lo, io_is_direct(lo->lo_backing_file) ||
+			  lo->use_dio);
+}
+
 struct switch_request {
 	struct file *file;
 	struct completion wait;
@@ -575,6 +723,7 @@ static int loop_change_fd(struct loop_device *lo, struct block_device *bdev,
 		goto out_putf;
 
 	fput(old_file);
+	loop_update_dio(lo);
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
 		ioctl_by_bdev(bdev, BLKRRPART, 0);
 	return 0;
@@ -659,11 +808,19 @@ static ssize_t loop_attr_partscan_show(struct loop_device *lo, char *buf)
 	return sprintf(buf, "%s\n", partscan ? "1" : "0");
 }
 
+static ssize_t loop_attr_dio_show(struct loop_device *lo, char *buf)
+{
+	int dio = (lo->lo_flags & LO_FLAGS_DIRECT_IO);
+
+	return sprintf(buf, "%s\n", dio ? "1" : "0");
+}
+
 LOOP_ATTR_RO(backing_file);
 LOOP_ATTR_RO(offset);
 LOOP_ATTR_RO(sizelimit);
 LOOP_ATTR_RO(autoclear);
 LOOP_ATTR_RO(partscan);
+LOOP_ATTR_RO(dio);
 
 static struct attribute *loop_attrs[] = {
 	&loop_attr_backing_file.attr,
@@ -671,6 +828,7 @@ static struct attribute *loop_attrs[] = {
 	&loop_attr_sizelimit.attr,
 	&loop_attr_autoclear.attr,
 	&loop_attr_partscan.attr,
+	&loop_attr_dio.attr,
 	NULL,
 };
 
@@ -803,7 +961,10 @@ static int loop_set_fd(struct loop_device *lo, fmode_t mode,
 
 	set_blocksize(bdev, lo_blocksize);
 
+	lo->use_dio = false;
 	lo->lo_state = Lo_bound;
+	/* a backing file opened with O_DIRECT asks for direct IO */
+	loop_update_dio(lo);
 	if (part_shift)
 		lo->lo_flags |= LO_FLAGS_PARTSCAN;
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN)
@@ -922,6 +1083,7 @@ static int loop_clr_fd(struct loop_device *lo)
 	if (lo->lo_flags & LO_FLAGS_PARTSCAN && bdev)
 		ioctl_by_bdev(bdev, BLKRRPART, 0);
 	lo->lo_flags = 0;
+	lo->use_dio = false;
 	if (!part_shift)
 		lo->lo_disk->flags |= GENHD_FL_NO_PART_SCAN;
 	mutex_unlock(&lo->lo_ctl_mutex);
@@ -987,6 +1149,9 @@ loop_set_status(struct loop_device *lo, const struct loop_info64 *info)
 	lo->transfer = xfer->transfer;
 	lo->ioctl = xfer->ioctl;
 
+	/* the offset or the transfer function may rule out direct IO now */
+	loop_update_dio(lo);
+
 	if ((lo->lo_flags & LO_FLAGS_AUTOCLEAR) !=
 	     (info->lo_flags & LO_FLAGS_AUTOCLEAR))
 		lo->lo_flags ^= LO_FLAGS_AUTOCLEAR;
@@ -1157,6 +1322,17 @@ static int loop_set_capacity(struct loop_device *lo, struct block_device *bdev)
 	return figure_loop_size(lo, lo->lo_offset, lo->lo_sizelimit);
 }
 
+static int loop_set_dio(struct loop_device *lo, unsigned long arg)
+{
+	if (lo->lo_state != Lo_bound)
+		return -ENXIO;
+
+	__loop_update_dio(lo, !!arg);
+	if (lo->use_dio == !!arg)
+		return 0;
+	return -EINVAL;
+}
+
 static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 	unsigned int cmd, unsigned long arg)
 {
@@ -1200,6 +1376,11 @@ static int lo_ioctl(struct block_device *bdev, fmode_t mode,
 		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
 			err = loop_set_capacity(lo, bdev);
 		break;
+	case LOOP_SET_DIRECT_IO:
+		err = -EPERM;
+		if ((mode & FMODE_WRITE) || capable(CAP_SYS_ADMIN))
+			err = loop_set_dio(lo, arg);
+		break;
 	default:
 		err = lo->ioctl ? lo->ioctl(lo, cmd, arg) : -EINVAL;
 	}
@@ -1354,6 +1535,7 @@ static int lo_compat_ioctl(struct block_device *bdev, fmode_t mode,
 		arg = (unsigned long) compat_ptr(arg);
 	case LOOP_SET_FD:
 	case LOOP_CHANGE_FD:
+	case LOOP_SET_DIRECT_IO:
 		err = lo_ioctl(bdev, mode, cmd, arg);
 		break;
 	default:
@@ -1432,6 +1614,9 @@ module_param(max_loop, int, S_IRUGO);
 MODULE_PARM_DESC(max_loop, "Maximum number of loop devices");
 module_param(max_part, int, S_IRUGO);
 MODULE_PARM_DESC(max_part, "Maximum number of partitions per loop device");
+static unsigned int hw_queues = 1;
+module_param(hw_queues, uint, S_IRUGO);
+MODULE_PARM_DESC(hw_queues, "Number of blk-mq hardware queues per loop device (default: 1)");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
@@ -1477,11 +1662,15 @@ static int loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 		const struct blk_mq_queue_data *bd)
 {
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(bd->rq);
+	struct loop_device *lo = cmd->rq->q->queuedata;
 
 	blk_mq_start_request(bd->rq);
 
+	/* flushes and discards still go through the synchronous path */
+	cmd->use_aio = lo->use_dio &&
+		!(cmd->rq->cmd_flags & (REQ_FLUSH | REQ_DISCARD));
+
 	if (cmd->rq->cmd_flags & REQ_WRITE) {
-		struct loop_device *lo = cmd->rq->q->queuedata;
 		bool need_sched = true;
 
 		spin_lock_irq(&lo->lo_lock);
@@ -1513,12 +1702,15 @@ static void loop_handle_cmd(struct loop_cmd *cmd)
 	if (write && (lo->lo_flags & LO_FLAGS_READ_ONLY))
 		goto failed;
 
-	ret = do_req_filebacked(lo, cmd->rq);
+	ret = do_req_filebacked(lo, cmd);
 
  failed:
-	if (ret)
-		cmd->rq->errors = -EIO;
-	blk_mq_complete_request(cmd->rq);
+	/* requests submitted as AIO are completed by lo_rw_aio_complete() */
+	if (!cmd->use_aio || ret) {
+		if (ret)
+			cmd->rq->errors = -EIO;
+		blk_mq_complete_request(cmd->rq);
+	}
 }
 
 static void loop_queue_write_work(struct work_struct *work)
@@ -1599,7 +1791,7 @@ static int loop_add(struct loop_device **l, int i)
 
 	err = -ENOMEM;
 	lo->tag_set.ops = &loop_mq_ops;
-	lo->tag_set.nr_hw_queues = 1;
+	lo->tag_set.nr_hw_queues = hw_queues;
 	lo->tag_set.queue_depth = 128;
 	lo->tag_set.numa_node = NUMA_NO_NODE;
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
@@ -1837,6 +2029,8 @@ static int __init loop_init(void)
 		goto misc_out;
 	}
 
+	hw_queues = clamp_t(unsigned int, hw_queues, 1, nr_cpu_ids);
+
 	/*
 	 * If max_loop is specified, create that many devices upfront.
 	 * This also becomes a hard limit. If max_loop is not specified,
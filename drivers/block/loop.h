@@ -9,6 +9,7 @@
 #ifndef _LINUX_LOOP_H
 #define _LINUX_LOOP_H
 
+#include <linux/aio.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/blk-mq.h>
@@ -57,6 +58,7 @@ struct loop_device {
 	struct list_head	write_cmd_head;
 	struct work_struct	write_work;
 	bool			write_started;
+	bool			use_dio;	/* bypass the backing page cache */
 	int			lo_state;
 	struct mutex		lo_ctl_mutex;
 
@@ -69,6 +71,9 @@ struct loop_cmd {
 	struct work_struct read_work;
 	struct request *rq;
 	struct list_head list;
+	bool use_aio;		/* submitted as direct AIO to the backing file */
+	struct kiocb iocb;
+	struct bio_vec *bvec;	/* copy of the segments of merged bios */
 };
 
 /* Support for loadable transfer modules */
@@ -17,6 +17,7 @@ struct nullb_cmd {
 	struct bio *bio;
 	unsigned int tag;
 	struct nullb_queue *nq;
+	ktime_t deadline;
 };
 
 struct nullb_queue {
@@ -25,6 +26,11 @@ struct nullb_queue {
 	unsigned int queue_depth;
 
 	struct nullb_cmd *cmds;
+
+	/* timer completions of a polled queue, in deadline order */
+	spinlock_t poll_lock;
+	struct list_head poll_list;
+	struct hrtimer poll_timer;
 };
 
 struct nullb {
@@ -263,6 +269,84 @@ static void null_cmd_end_timer(struct nullb_cmd *cmd)
 	put_cpu();
 }
 
+/*
+ * Move the commands whose completion time has passed from the poll list
+ * of @nq to @done. Called with the poll lock held.
+ */
+static void null_poll_reap(struct nullb_queue *nq, struct list_head *done)
+{
+	ktime_t now = ktime_get();
+	struct nullb_cmd *cmd, *tmp;
+
+	list_for_each_entry_safe(cmd, tmp, &nq->poll_list, list) {
+		if (ktime_after(cmd->deadline, now))
+			break;
+		list_move_tail(&cmd->list, done);
+	}
+}
+
+static enum hrtimer_restart null_poll_timer_expired(struct hrtimer *timer)
+{
+	struct nullb_queue *nq = container_of(timer, struct nullb_queue,
+					      poll_timer);
+	struct nullb_cmd *cmd, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+
+	spin_lock_irqsave(&nq->poll_lock, flags);
+	null_poll_reap(nq, &done);
+	if (!list_empty(&nq->poll_list)) {
+		cmd = list_first_entry(&nq->poll_list, struct nullb_cmd, list);
+		hrtimer_start(&nq->poll_timer, cmd->deadline, HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&nq->poll_lock, flags);
+
+	list_for_each_entry_safe(cmd, tmp, &done, list)
+		end_cmd(cmd);
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * With completions polled for, timer completions are queued per hardware
+ * queue where null_poll() can find them, the timer only stands in for
+ * the interrupt.
+ */
+static void null_cmd_end_poll(struct nullb_cmd *cmd)
+{
+	struct nullb_queue *nq = cmd->nq;
+	unsigned long flags;
+
+	cmd->deadline = ktime_add_ns(ktime_get(), completion_nsec);
+
+	spin_lock_irqsave(&nq->poll_lock, flags);
+	list_add_tail(&cmd->list, &nq->poll_list);
+	if (list_is_singular(&nq->poll_list))
+		hrtimer_start(&nq->poll_timer, cmd->deadline, HRTIMER_MODE_ABS);
+	spin_unlock_irqrestore(&nq->poll_lock, flags);
+}
+
+static int null_poll(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	struct nullb_queue *nq = hctx->driver_data;
+	struct nullb_cmd *cmd, *tmp;
+	unsigned long flags;
+	LIST_HEAD(done);
+	int found = 0;
+
+	spin_lock_irqsave(&nq->poll_lock, flags);
+	null_poll_reap(nq, &done);
+	spin_unlock_irqrestore(&nq->poll_lock, flags);
+
+	list_for_each_entry_safe(cmd, tmp, &done, list) {
+		if (cmd->rq->tag == tag)
+			found = 1;
+		end_cmd(cmd);
+	}
+
+	return found;
+}
+
 static void null_softirq_done_fn(struct request *rq)
 {
 	if (queue_mode == NULL_Q_MQ)
@@ -295,7 +379,10 @@ static inline void null_handle_cmd(struct nullb_cmd *cmd)
 		end_cmd(cmd);
 		break;
 	case NULL_IRQ_TIMER:
-		null_cmd_end_timer(cmd);
+		if (queue_mode == NULL_Q_MQ && blk_queue_poll(cmd->rq->q))
+			null_cmd_end_poll(cmd);
+		else
+			null_cmd_end_timer(cmd);
 		break;
 	}
 }
@@ -372,6 +459,11 @@ static void null_init_queue(struct nullb *nullb, struct nullb_queue *nq)
 
 	init_waitqueue_head(&nq->wait);
 	nq->queue_depth = nullb->queue_depth;
+
+	spin_lock_init(&nq->poll_lock);
+	INIT_LIST_HEAD(&nq->poll_list);
+	hrtimer_init(&nq->poll_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	nq->poll_timer.function = null_poll_timer_expired;
 }
 
 static int null_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
@@ -392,14 +484,19 @@ static struct blk_mq_ops null_mq_ops = {
 	.map_queue      = blk_mq_map_queue,
 	.init_hctx	= null_init_hctx,
 	.complete	= null_softirq_done_fn,
+	.poll		= null_poll,
 };
 
 static void null_del_dev(struct nullb *nullb)
 {
+	int i;
+
 	list_del_init(&nullb->list);
 
 	del_gendisk(nullb->disk);
 	blk_cleanup_queue(nullb->q);
+	for (i = 0; i < nullb->nr_queues; i++)
+		hrtimer_cancel(&nullb->queues[i].poll_timer);
 	if (queue_mode == NULL_Q_MQ)
 		blk_mq_free_tag_set(&nullb->tag_set);
 	put_disk(nullb->disk);
@@ -910,7 +910,7 @@ static int nvme_queue_rq(struct blk_mq_hw_ctx *hctx,
 	return BLK_MQ_RQ_QUEUE_BUSY;
 }
 
-static int nvme_process_cq(struct nvme_queue *nvmeq)
+static int __nvme_process_cq(struct nvme_queue *nvmeq, unsigned int *tag)
 {
 	u16 head, phase;
 
@@ -928,6 +928,8 @@ static int nvme_process_cq(struct nvme_queue *nvmeq)
 			head = 0;
 			phase = !phase;
 		}
+		if (tag && *tag == cqe.command_id)
+			*tag = -1;
 		ctx = nvme_finish_cmd(nvmeq, cqe.command_id, &fn);
 		fn(nvmeq, ctx, &cqe);
 	}
@@ -949,6 +951,11 @@ static int nvme_process_cq(struct nvme_queue *nvmeq)
 	return 1;
 }
 
+static int nvme_process_cq(struct nvme_queue *nvmeq)
+{
+	return __nvme_process_cq(nvmeq, NULL);
+}
+
 /* Admin queue isn't initialized as a request queue. If at some point this
  * happens anyway, make sure to notify the user */
 static int nvme_admin_queue_rq(struct blk_mq_hw_ctx *hctx,
@@ -970,6 +977,21 @@ static irqreturn_t nvme_irq(int irq, void *data)
 	return result;
 }
 
+static int nvme_poll(struct blk_mq_hw_ctx *hctx, unsigned int tag)
+{
+	struct nvme_queue *nvmeq = hctx->driver_data;
+	struct nvme_completion cqe = nvmeq->cqes[nvmeq->cq_head];
+
+	if ((le16_to_cpu(cqe.status) & 1) != nvmeq->cq_phase)
+		return 0;
+
+	spin_lock_irq(&nvmeq->q_lock);
+	__nvme_process_cq(nvmeq, &tag);
+	spin_unlock_irq(&nvmeq->q_lock);
+
+	return tag == -1;
+}
+
 static irqreturn_t nvme_irq_check(int irq, void *data)
 {
 	struct nvme_queue *nvmeq = data;
@@ -1567,6 +1589,7 @@ static struct blk_mq_ops nvme_mq_ops = {
 	.exit_hctx	= nvme_exit_hctx,
 	.init_request	= nvme_init_request,
 	.timeout	= nvme_timeout,
+	.poll		= nvme_poll,
 };
 
 static void nvme_dev_remove_admin(struct nvme_dev *dev)
@@ -13,6 +13,8 @@
 #include <linux/slab.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
 
 #include "zcomp.h"
 #include "zcomp_lzo.h"
@@ -43,6 +45,13 @@ struct zcomp_strm_multi {
 	wait_queue_head_t strm_wait;
 };
 
+/*
+ * per-cpu zcomp_strm backend
+ */
+struct zcomp_strm_percpu {
+	struct zcomp_strm * __percpu *strms;
+};
+
 static struct zcomp_backend *backends[] = {
 	&zcomp_lzo,
 #ifdef CONFIG_ZRAM_LZ4_COMPRESS
@@ -80,6 +89,7 @@ static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
 	if (!zstrm)
 		return NULL;
 
+	mutex_init(&zstrm->lock);
 	zstrm->private = comp->backend->create();
 	/*
 	 * allocate 2 pages. 1 for compressed data, plus 1 extra for the
@@ -267,6 +277,85 @@ static int zcomp_strm_single_create(struct zcomp *comp)
 	return 0;
 }
 
+/*
+ * Use the stream of the cpu we are running on.  Compressing may sleep in
+ * the caller's zs_malloc(), so the stream is locked rather than pinned to
+ * the cpu with preemption disabled: a task that gets migrated keeps the
+ * stream it started with, and whoever runs on that cpu meanwhile waits
+ * for it, which is rare.
+ */
+static struct zcomp_strm *zcomp_strm_percpu_find(struct zcomp *comp)
+{
+	struct zcomp_strm_percpu *zs = comp->stream;
+	struct zcomp_strm *zstrm = *raw_cpu_ptr(zs->strms);
+
+	mutex_lock(&zstrm->lock);
+	return zstrm;
+}
+
+static void zcomp_strm_percpu_release(struct zcomp *comp,
+		struct zcomp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
+
+static bool zcomp_strm_percpu_set_max_streams(struct zcomp *comp, int num_strm)
+{
+	/* there is one stream per cpu, more wouldn't be used */
+	return num_strm >= num_online_cpus();
+}
+
+static void zcomp_strm_percpu_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm_percpu *zs = comp->stream;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct zcomp_strm *zstrm = *per_cpu_ptr(zs->strms, cpu);
+
+		if (zstrm)
+			zcomp_strm_free(comp, zstrm);
+	}
+	free_percpu(zs->strms);
+	kfree(zs);
+}
+
+static int zcomp_strm_percpu_create(struct zcomp *comp)
+{
+	struct zcomp_strm_percpu *zs;
+	int cpu;
+
+	comp->destroy = zcomp_strm_percpu_destroy;
+	comp->strm_find = zcomp_strm_percpu_find;
+	comp->strm_release = zcomp_strm_percpu_release;
+	comp->set_max_streams = zcomp_strm_percpu_set_max_streams;
+	zs = kmalloc(sizeof(struct zcomp_strm_percpu), GFP_KERNEL);
+	if (!zs)
+		return -ENOMEM;
+
+	zs->strms = alloc_percpu(struct zcomp_strm *);
+	if (!zs->strms) {
+		kfree(zs);
+		return -ENOMEM;
+	}
+
+	/* possible cpus, so that cpus coming online later find one */
+	for_each_possible_cpu(cpu) {
+		struct zcomp_strm *zstrm = zcomp_strm_alloc(comp);
+
+		if (!zstrm) {
+			comp->stream = zs;
+			zcomp_strm_percpu_destroy(comp);
+			comp->stream = NULL;
+			return -ENOMEM;
+		}
+		*per_cpu_ptr(zs->strms, cpu) = zstrm;
+	}
+
+	comp->stream = zs;
+	return 0;
+}
+
 /* show available compressors */
 ssize_t zcomp_available_show(const char *comp, char *buf)
 {
@@ -341,7 +430,9 @@ struct zcomp *zcomp_create(const char *compress, int max_strm)
 		return ERR_PTR(-ENOMEM);
 
 	comp->backend = backend;
-	if (max_strm > 1)
+	if (max_strm >= num_online_cpus())
+		zcomp_strm_percpu_create(comp);
+	else if (max_strm > 1)
 		zcomp_strm_multi_create(comp, max_strm);
 	else
 		zcomp_strm_single_create(comp);
@@ -32,6 +32,8 @@
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/file.h>
 
 #include "zram_drv.h"
 
@@ -265,6 +267,27 @@ static void zram_clear_flag(struct zram_meta *meta, u32 index,
 	meta->table[index].value &= ~BIT(flag);
 }
 
+static void zram_slot_lock(struct zram_meta *meta, u32 index)
+{
+	bit_spin_lock(ZRAM_LOCK, &meta->table[index].value);
+}
+
+static void zram_slot_unlock(struct zram_meta *meta, u32 index)
+{
+	bit_spin_unlock(ZRAM_LOCK, &meta->table[index].value);
+}
+
+static inline unsigned long zram_get_element(struct zram_meta *meta, u32 index)
+{
+	return meta->table[index].element;
+}
+
+static inline void zram_set_element(struct zram_meta *meta, u32 index,
+			unsigned long element)
+{
+	meta->table[index].element = element;
+}
+
 static size_t zram_get_obj_size(struct zram_meta *meta, u32 index)
 {
 	return meta->table[index].value & (BIT(ZRAM_FLAG_SHIFT) - 1);
@@ -278,6 +301,36 @@ static void zram_set_obj_size(struct zram_meta *meta,
 	meta->table[index].value = (flags << ZRAM_FLAG_SHIFT) | size;
 }
 
+/* the page holds data, in memory or on the backing device */
+static inline bool zram_allocated(struct zram_meta *meta, u32 index)
+{
+	return meta->table[index].handle ||
+		zram_test_flag(meta, index, ZRAM_SAME) ||
+		zram_test_flag(meta, index, ZRAM_WB);
+}
+
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+static void zram_accessed(struct zram_meta *meta, u32 index)
+{
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	meta->table[index].ac_time = ktime_get_boottime();
+}
+
+static void zram_reset_access(struct zram_meta *meta, u32 index)
+{
+	meta->table[index].ac_time = ktime_set(0, 0);
+}
+#else
+static void zram_accessed(struct zram_meta *meta, u32 index)
+{
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+}
+
+static void zram_reset_access(struct zram_meta *meta, u32 index)
+{
+}
+#endif
+
 static inline int is_partial_io(struct bio_vec *bvec)
 {
 	return bvec->bv_len != PAGE_SIZE;
@@ -316,7 +369,9 @@ static void zram_meta_free(struct zram_meta *meta, u64 disksize)
 	for (index = 0; index < num_pages; index++) {
 		unsigned long handle = meta->table[index].handle;
 
-		if (!handle)
+		/* same filled and written back pages hold no zsmalloc object */
+		if (!handle || zram_test_flag(meta, index, ZRAM_SAME) ||
+		    zram_test_flag(meta, index, ZRAM_WB))
 			continue;
 
 		zs_free(meta->mem_pool, handle);
@@ -377,36 +432,436 @@ static void update_position(u32 *index, int *offset, struct bio_vec *bvec)
 	*offset = (*offset + bvec->bv_len) % PAGE_SIZE;
 }
 
-static int page_zero_filled(void *ptr)
+static bool page_same_filled(void *ptr, unsigned long *element)
 {
-	unsigned int pos;
+	unsigned int pos, last_pos = PAGE_SIZE / sizeof(unsigned long) - 1;
 	unsigned long *page;
+	unsigned long val;
 
 	page = (unsigned long *)ptr;
+	val = page[0];
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
-			return 0;
+	/* mismatches tend to be at the end, check the last word early */
+	if (val != page[last_pos])
+		return false;
+
+	for (pos = 1; pos < last_pos; pos++) {
+		if (val != page[pos])
+			return false;
 	}
 
-	return 1;
+	*element = val;
+	return true;
+}
+
+static void zram_fill_page(void *ptr, unsigned long len, unsigned long value)
+{
+	unsigned long *page = ptr;
+	unsigned long i;
+
+	WARN_ON_ONCE(!IS_ALIGNED(len, sizeof(unsigned long)));
+
+	if (likely(value == 0)) {
+		memset(ptr, 0, len);
+	} else {
+		for (i = 0; i < len / sizeof(*page); i++)
+			page[i] = value;
+	}
 }
 
-static void handle_zero_page(struct bio_vec *bvec)
+static void handle_same_page(struct bio_vec *bvec, unsigned long element)
 {
 	struct page *page = bvec->bv_page;
 	void *user_mem;
 
 	user_mem = kmap_atomic(page);
-	if (is_partial_io(bvec))
-		memset(user_mem + bvec->bv_offset, 0, bvec->bv_len);
-	else
-		clear_page(user_mem);
+	zram_fill_page(user_mem + bvec->bv_offset, bvec->bv_len, element);
 	kunmap_atomic(user_mem);
 
 	flush_dcache_page(page);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static void reset_bdev(struct zram *zram)
+{
+	if (!zram->backing_dev)
+		return;
+
+	blkdev_put(zram->bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	filp_close(zram->backing_dev, NULL);
+	zram->backing_dev = NULL;
+	zram->bdev = NULL;
+	vfree(zram->bitmap);
+	zram->bitmap = NULL;
+	zram->nr_pages = 0;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *file;
+	ssize_t ret;
+	char *p;
+
+	down_read(&zram->init_lock);
+	file = zram->backing_dev;
+	if (!file) {
+		ret = scnprintf(buf, PAGE_SIZE, "none\n");
+		goto out;
+	}
+
+	p = d_path(&file->f_path, buf, PAGE_SIZE - 1);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto out;
+	}
+
+	ret = strlen(p);
+	memmove(buf, p, ret);
+	buf[ret++] = '\n';
+out:
+	up_read(&zram->init_lock);
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	struct file *backing_dev = NULL;
+	struct block_device *bdev = NULL;
+	unsigned long nr_pages, *bitmap;
+	struct inode *inode;
+	char *file_name;
+	size_t sz;
+	int err;
+
+	file_name = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!file_name)
+		return -ENOMEM;
+
+	down_write(&zram->init_lock);
+	if (init_done(zram)) {
+		pr_info("Can't setup backing device for initialized device\n");
+		err = -EBUSY;
+		goto out;
+	}
+
+	strlcpy(file_name, buf, PATH_MAX);
+	/* ignore trailing newline */
+	sz = strlen(file_name);
+	if (sz > 0 && file_name[sz - 1] == '\n')
+		file_name[sz - 1] = 0x00;
+
+	backing_dev = filp_open(file_name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(backing_dev)) {
+		err = PTR_ERR(backing_dev);
+		backing_dev = NULL;
+		goto out;
+	}
+
+	inode = backing_dev->f_mapping->host;
+	if (!S_ISBLK(inode->i_mode)) {
+		err = -ENOTBLK;
+		goto out;
+	}
+
+	/* blkdev_get() drops the reference on failure */
+	err = blkdev_get(bdgrab(I_BDEV(inode)),
+			 FMODE_READ | FMODE_WRITE | FMODE_EXCL, zram);
+	if (err < 0)
+		goto out;
+	bdev = I_BDEV(inode);
+
+	/* block 0 is never used, a zero element means no block */
+	nr_pages = i_size_read(inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		err = -EINVAL;
+		goto out;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	reset_bdev(zram);
+
+	zram->bdev = bdev;
+	zram->backing_dev = backing_dev;
+	zram->bitmap = bitmap;
+	zram->nr_pages = nr_pages;
+	up_write(&zram->init_lock);
+
+	pr_info("setup backing device %s\n", file_name);
+	kfree(file_name);
+
+	return len;
+out:
+	if (bdev)
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	if (backing_dev)
+		filp_close(backing_dev, NULL);
+	up_write(&zram->init_lock);
+	kfree(file_name);
+	return err;
+}
+
+static unsigned long alloc_block_bdev(struct zram *zram)
+{
+	unsigned long blk_idx = 1;
+retry:
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_pages, blk_idx);
+	if (blk_idx == zram->nr_pages)
+		return 0;
+
+	if (test_and_set_bit(blk_idx, zram->bitmap))
+		goto retry;
+
+	atomic64_inc(&zram->stats.bd_count);
+	return blk_idx;
+}
+
+static void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+	int was_set;
+
+	was_set = test_and_clear_bit(blk_idx, zram->bitmap);
+	WARN_ON_ONCE(!was_set);
+	atomic64_dec(&zram->stats.bd_count);
+}
+
+static int zram_bdev_rw(struct zram *zram, struct page *page,
+			unsigned long blk_idx, int rw)
+{
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_iter.bi_sector = blk_idx * SECTORS_PER_PAGE;
+	bio->bi_bdev = zram->bdev;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	ret = submit_bio_wait(rw, bio);
+	bio_put(bio);
+	return ret;
+}
+
+struct zram_work {
+	struct work_struct work;
+	struct zram *zram;
+	struct page *page;
+	unsigned long blk_idx;
+	int ret;
+};
+
+static void zram_sync_read(struct work_struct *work)
+{
+	struct zram_work *zw = container_of(work, struct zram_work, work);
+
+	zw->ret = zram_bdev_rw(zw->zram, zw->page, zw->blk_idx, READ);
+}
+
+/*
+ * Under zram_make_request() current->bio_list is set, so a bio submitted
+ * from here is only queued until we return and waiting for it would
+ * never end.  Do the read from a worker then.
+ */
+static int zram_bdev_read(struct zram *zram, struct page *page,
+			  unsigned long blk_idx)
+{
+	struct zram_work zw;
+
+	if (!current->bio_list)
+		return zram_bdev_rw(zram, page, blk_idx, READ);
+
+	zw.zram = zram;
+	zw.page = page;
+	zw.blk_idx = blk_idx;
+	INIT_WORK_ONSTACK(&zw.work, zram_sync_read);
+	queue_work(system_unbound_wq, &zw.work);
+	flush_work(&zw.work);
+	destroy_work_on_stack(&zw.work);
+
+	return zw.ret;
+}
+
+static int read_from_bdev(struct zram *zram, char *mem, unsigned long blk_idx)
+{
+	struct page *page;
+	void *src;
+	int ret;
+
+	page = alloc_page(GFP_NOIO);
+	if (!page)
+		return -ENOMEM;
+
+	atomic64_inc(&zram->stats.bd_reads);
+	ret = zram_bdev_read(zram, page, blk_idx);
+	if (!ret) {
+		src = kmap_atomic(page);
+		copy_page(mem, src);
+		kunmap_atomic(src);
+	}
+
+	__free_page(page);
+	return ret;
+}
+
+static int zram_decompress_page(struct zram *zram, char *mem, u32 index);
+static void zram_free_page(struct zram *zram, size_t index);
+
+/*
+ * Write pages marked idle, or those stored uncompressed, to the backing
+ * device one by one and free their memory.  A page that is freed or
+ * rewritten meanwhile, or read in idle mode, keeps its new state.  Only
+ * one writeback runs at a time, as ZRAM_UNDER_WB is only good for one.
+ */
+static ssize_t writeback_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages, index, blk_idx = 0;
+	struct zram_meta *meta;
+	struct page *page;
+	ssize_t ret = len;
+	void *mem;
+	int mode, err;
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_HUGE;
+	else
+		return -EINVAL;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
+
+	mutex_lock(&zram->wb_lock);
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (!zram->backing_dev) {
+		ret = -ENODEV;
+		goto out;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		if (!blk_idx) {
+			blk_idx = alloc_block_bdev(zram);
+			if (!blk_idx) {
+				ret = -ENOSPC;
+				break;
+			}
+		}
+
+		zram_slot_lock(meta, index);
+		if (!meta->table[index].handle ||
+		    zram_test_flag(meta, index, ZRAM_SAME) ||
+		    zram_test_flag(meta, index, ZRAM_WB) ||
+		    zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+		    !zram_test_flag(meta, index, mode)) {
+			zram_slot_unlock(meta, index);
+			continue;
+		}
+		zram_set_flag(meta, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(meta, index);
+
+		mem = kmap(page);
+		err = zram_decompress_page(zram, mem, index);
+		kunmap(page);
+		if (!err) {
+			atomic64_inc(&zram->stats.bd_writes);
+			err = zram_bdev_rw(zram, page, blk_idx, WRITE);
+		}
+
+		zram_slot_lock(meta, index);
+		if (err || !zram_test_flag(meta, index, ZRAM_UNDER_WB) ||
+		    (mode == ZRAM_IDLE &&
+		     !zram_test_flag(meta, index, ZRAM_IDLE))) {
+			zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+			zram_slot_unlock(meta, index);
+			if (err)
+				ret = err;
+			continue;
+		}
+
+		zram_free_page(zram, index);
+		zram_set_flag(meta, index, ZRAM_WB);
+		zram_set_element(meta, index, blk_idx);
+		blk_idx = 0;
+		zram_slot_unlock(meta, index);
+	}
+
+	if (blk_idx)
+		free_block_bdev(zram, blk_idx);
+out:
+	up_read(&zram->init_lock);
+	mutex_unlock(&zram->wb_lock);
+	__free_page(page);
+	return ret;
+}
+#else
+static inline void reset_bdev(struct zram *zram)
+{
+}
+
+static inline void free_block_bdev(struct zram *zram, unsigned long blk_idx)
+{
+}
+
+static int read_from_bdev(struct zram *zram, char *mem, unsigned long blk_idx)
+{
+	return -EIO;
+}
+#endif
+
+/* mark all pages holding data idle, for the idle writeback */
+static ssize_t idle_store(struct device *dev,
+		struct device_attribute *attr, const char *buf, size_t len)
+{
+	struct zram *zram = dev_to_zram(dev);
+	unsigned long nr_pages, index;
+	struct zram_meta *meta;
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = 0; index < nr_pages; index++) {
+		zram_slot_lock(meta, index);
+		if (zram_allocated(meta, index) &&
+		    !zram_test_flag(meta, index, ZRAM_WB))
+			zram_set_flag(meta, index, ZRAM_IDLE);
+		zram_slot_unlock(meta, index);
+	}
+	up_read(&zram->init_lock);
+
+	return len;
+}
+
 
 /*
  * To protect concurrent access to the same index entry,
@@ -416,30 +871,51 @@ static void handle_zero_page(struct bio_vec *bvec)
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	struct zram_meta *meta = zram->meta;
-	unsigned long handle = meta->table[index].handle;
+	unsigned long handle;
 
-	if (unlikely(!handle)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(meta, index, ZRAM_ZERO)) {
-			zram_clear_flag(meta, index, ZRAM_ZERO);
+	zram_reset_access(meta, index);
+	zram_clear_flag(meta, index, ZRAM_IDLE);
+	/* tells a writeback in progress the page went away */
+	zram_clear_flag(meta, index, ZRAM_UNDER_WB);
+
+	if (zram_test_flag(meta, index, ZRAM_HUGE)) {
+		zram_clear_flag(meta, index, ZRAM_HUGE);
+		atomic64_dec(&zram->stats.huge_pages);
+	}
+
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		zram_clear_flag(meta, index, ZRAM_WB);
+		free_block_bdev(zram, zram_get_element(meta, index));
+		goto out;
+	}
+
+	/*
+	 * No memory is allocated for same element filled pages.
+	 * Simply clear same page flag.
+	 */
+	if (zram_test_flag(meta, index, ZRAM_SAME)) {
+		zram_clear_flag(meta, index, ZRAM_SAME);
+		if (!zram_get_element(meta, index))
 			atomic64_dec(&zram->stats.zero_pages);
-		}
-		return;
+		atomic64_dec(&zram->stats.same_pages);
+		goto out;
 	}
 
+	handle = meta->table[index].handle;
+	if (unlikely(!handle))
+		return;
+
 	zs_free(meta->mem_pool, handle);
 
 	atomic64_sub(zram_get_obj_size(meta, index),
 			&zram->stats.compr_data_size);
 	atomic64_dec(&zram->stats.pages_stored);
-
+out:
 	meta->table[index].handle = 0;
 	zram_set_obj_size(meta, index, 0);
 }
 
+/* may sleep to read a written back page from the backing device */
 static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 {
 	int ret = 0;
@@ -448,13 +924,37 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	unsigned long handle;
 	size_t size;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+again:
+	zram_slot_lock(meta, index);
+	if (zram_test_flag(meta, index, ZRAM_WB)) {
+		unsigned long blk_idx = zram_get_element(meta, index);
+		bool stale;
+
+		zram_slot_unlock(meta, index);
+		ret = read_from_bdev(zram, mem, blk_idx);
+
+		/*
+		 * The slot is not locked during the read: if the page was
+		 * overwritten or discarded meanwhile, the block may have been
+		 * freed and reused, read the slot again.
+		 */
+		zram_slot_lock(meta, index);
+		stale = !zram_test_flag(meta, index, ZRAM_WB) ||
+			zram_get_element(meta, index) != blk_idx;
+		zram_slot_unlock(meta, index);
+		if (stale)
+			goto again;
+		return ret;
+	}
+
 	handle = meta->table[index].handle;
 	size = zram_get_obj_size(meta, index);
 
-	if (!handle || zram_test_flag(meta, index, ZRAM_ZERO)) {
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-		clear_page(mem);
+	if (!handle || zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long value = zram_get_element(meta, index);
+
+		zram_slot_unlock(meta, index);
+		zram_fill_page(mem, PAGE_SIZE, value);
 		return 0;
 	}
 
@@ -464,7 +964,7 @@ static int zram_decompress_page(struct zram *zram, char *mem, u32 index)
 	else
 		ret = zcomp_decompress(zram->comp, cmem, size, mem);
 	zs_unmap_object(meta->mem_pool, handle);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_unlock(meta, index);
 
 	/* Should NEVER happen. Return bio error if it does. */
 	if (unlikely(ret)) {
@@ -484,20 +984,24 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	struct zram_meta *meta = zram->meta;
 	page = bvec->bv_page;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_lock(meta, index);
+	zram_accessed(meta, index);
 	if (unlikely(!meta->table[index].handle) ||
-			zram_test_flag(meta, index, ZRAM_ZERO)) {
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-		handle_zero_page(bvec);
+			zram_test_flag(meta, index, ZRAM_SAME)) {
+		unsigned long value = zram_get_element(meta, index);
+
+		zram_slot_unlock(meta, index);
+		handle_same_page(bvec, value);
 		return 0;
 	}
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_unlock(meta, index);
 
 	if (is_partial_io(bvec))
 		/* Use  a temporary buffer to decompress the page */
 		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 
-	user_mem = kmap_atomic(page);
+	/* not kmap_atomic(), a written back page is read in sleeping */
+	user_mem = kmap(page);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
 
@@ -519,7 +1023,7 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	flush_dcache_page(page);
 	ret = 0;
 out_cleanup:
-	kunmap_atomic(user_mem);
+	kunmap(page);
 	if (is_partial_io(bvec))
 		kfree(uncmem);
 	return ret;
@@ -552,6 +1056,7 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	struct zcomp_strm *zstrm;
 	bool locked = false;
 	unsigned long alloced_pages;
+	unsigned long element;
 
 	page = bvec->bv_page;
 	if (is_partial_io(bvec)) {
@@ -582,16 +1087,20 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 		uncmem = user_mem;
 	}
 
-	if (page_zero_filled(uncmem)) {
+	if (page_same_filled(uncmem, &element)) {
 		if (user_mem)
 			kunmap_atomic(user_mem);
 		/* Free memory associated with this sector now. */
-		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_lock(meta, index);
 		zram_free_page(zram, index);
-		zram_set_flag(meta, index, ZRAM_ZERO);
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
-
-		atomic64_inc(&zram->stats.zero_pages);
+		zram_set_flag(meta, index, ZRAM_SAME);
+		zram_set_element(meta, index, element);
+		zram_accessed(meta, index);
+		zram_slot_unlock(meta, index);
+
+		atomic64_inc(&zram->stats.same_pages);
+		if (!element)
+			atomic64_inc(&zram->stats.zero_pages);
 		ret = 0;
 		goto out;
 	}
@@ -649,12 +1158,17 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 	 * Free memory associated with this sector
 	 * before overwriting unused sectors.
 	 */
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_lock(meta, index);
 	zram_free_page(zram, index);
 
 	meta->table[index].handle = handle;
 	zram_set_obj_size(meta, index, clen);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	if (clen == PAGE_SIZE) {
+		zram_set_flag(meta, index, ZRAM_HUGE);
+		atomic64_inc(&zram->stats.huge_pages);
+	}
+	zram_accessed(meta, index);
+	zram_slot_unlock(meta, index);
 
 	/* Update stats */
 	atomic64_add(clen, &zram->stats.compr_data_size);
@@ -720,9 +1234,9 @@ static void zram_bio_discard(struct zram *zram, u32 index,
 	}
 
 	while (n >= PAGE_SIZE) {
-		bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_lock(meta, index);
 		zram_free_page(zram, index);
-		bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+		zram_slot_unlock(meta, index);
 		atomic64_inc(&zram->stats.notify_free);
 		index++;
 		n -= PAGE_SIZE;
@@ -762,8 +1276,9 @@ static void zram_reset_device(struct zram *zram)
 	/* Reset stats */
 	memset(&zram->stats, 0, sizeof(zram->stats));
 	zram->disksize = 0;
-	zram->max_comp_streams = 1;
+	zram->max_comp_streams = num_online_cpus();
 	set_capacity(zram->disk, 0);
+	reset_bdev(zram);
 
 	up_write(&zram->init_lock);
 	/* I/O operation under all of CPU are done so let's free */
@@ -963,9 +1478,9 @@ static void zram_slot_free_notify(struct block_device *bdev,
 	zram = bdev->bd_disk->private_data;
 	meta = zram->meta;
 
-	bit_spin_lock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_lock(meta, index);
 	zram_free_page(zram, index);
-	bit_spin_unlock(ZRAM_ACCESS, &meta->table[index].value);
+	zram_slot_unlock(meta, index);
 	atomic64_inc(&zram->stats.notify_free);
 }
 
@@ -1011,6 +1526,114 @@ out:
 	return err;
 }
 
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+static struct dentry *zram_debugfs_root;
+
+static void zram_debugfs_create(void)
+{
+	zram_debugfs_root = debugfs_create_dir("zram", NULL);
+	if (IS_ERR(zram_debugfs_root))
+		zram_debugfs_root = NULL;
+}
+
+static void zram_debugfs_destroy(void)
+{
+	debugfs_remove_recursive(zram_debugfs_root);
+}
+
+/*
+ * One line per page holding data: index, last access time since boot
+ * and flags, s for same filled, w for written back, h for stored
+ * uncompressed and i for idle.  *ppos is the index to continue at.
+ */
+static ssize_t read_block_state(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
+{
+	struct zram *zram = file->private_data;
+	unsigned long nr_pages, index;
+	struct zram_meta *meta;
+	struct timespec64 ts;
+	ssize_t written = 0;
+	char *kbuf;
+
+	count = min_t(size_t, count, PAGE_SIZE);
+	kbuf = kmalloc(count, GFP_KERNEL);
+	if (!kbuf)
+		return -ENOMEM;
+
+	down_read(&zram->init_lock);
+	if (!init_done(zram)) {
+		up_read(&zram->init_lock);
+		kfree(kbuf);
+		return -EINVAL;
+	}
+
+	meta = zram->meta;
+	nr_pages = zram->disksize >> PAGE_SHIFT;
+	for (index = *ppos; index < nr_pages; index++) {
+		int copied;
+
+		zram_slot_lock(meta, index);
+		if (!zram_allocated(meta, index))
+			goto next;
+
+		ts = ktime_to_timespec64(meta->table[index].ac_time);
+		copied = snprintf(kbuf + written, count,
+			"%12lu %12lld.%06lu %c%c%c%c\n",
+			index, (s64)ts.tv_sec,
+			ts.tv_nsec / NSEC_PER_USEC,
+			zram_test_flag(meta, index, ZRAM_SAME) ? 's' : '.',
+			zram_test_flag(meta, index, ZRAM_WB) ? 'w' : '.',
+			zram_test_flag(meta, index, ZRAM_HUGE) ? 'h' : '.',
+			zram_test_flag(meta, index, ZRAM_IDLE) ? 'i' : '.');
+
+		if (count <= copied) {
+			zram_slot_unlock(meta, index);
+			break;
+		}
+		written += copied;
+		count -= copied;
+next:
+		zram_slot_unlock(meta, index);
+		*ppos += 1;
+	}
+	up_read(&zram->init_lock);
+
+	if (copy_to_user(buf, kbuf, written))
+		written = -EFAULT;
+	kfree(kbuf);
+
+	return written;
+}
+
+static const struct file_operations proc_zram_block_state_op = {
+	.open = simple_open,
+	.read = read_block_state,
+	.llseek = default_llseek,
+};
+
+static void zram_debugfs_register(struct zram *zram)
+{
+	if (!zram_debugfs_root)
+		return;
+
+	zram->debugfs_dir = debugfs_create_dir(zram->disk->disk_name,
+						zram_debugfs_root);
+	debugfs_create_file("block_state", 0400, zram->debugfs_dir,
+				zram, &proc_zram_block_state_op);
+}
+
+static void zram_debugfs_unregister(struct zram *zram)
+{
+	debugfs_remove_recursive(zram->debugfs_dir);
+}
+#else
+static void zram_debugfs_create(void) { }
+static void zram_debugfs_destroy(void) { }
+static void zram_debugfs_register(struct zram *zram) { }
+static void zram_debugfs_unregister(struct zram *zram) { }
+#endif
+
 static const struct block_device_operations zram_devops = {
 	.swap_slot_free_notify = zram_slot_free_notify,
 	.rw_page = zram_rw_page,
@@ -1026,6 +1649,11 @@ static DEVICE_ATTR_RW(mem_limit);
 static DEVICE_ATTR_RW(mem_used_max);
 static DEVICE_ATTR_RW(max_comp_streams);
 static DEVICE_ATTR_RW(comp_algorithm);
+static DEVICE_ATTR_WO(idle);
+#ifdef CONFIG_ZRAM_WRITEBACK
+static DEVICE_ATTR_RW(backing_dev);
+static DEVICE_ATTR_WO(writeback);
+#endif
 
 ZRAM_ATTR_RO(num_reads);
 ZRAM_ATTR_RO(num_writes);
@@ -1034,7 +1662,14 @@ ZRAM_ATTR_RO(failed_writes);
 ZRAM_ATTR_RO(invalid_io);
 ZRAM_ATTR_RO(notify_free);
 ZRAM_ATTR_RO(zero_pages);
+ZRAM_ATTR_RO(same_pages);
+ZRAM_ATTR_RO(huge_pages);
 ZRAM_ATTR_RO(compr_data_size);
+#ifdef CONFIG_ZRAM_WRITEBACK
+ZRAM_ATTR_RO(bd_count);
+ZRAM_ATTR_RO(bd_reads);
+ZRAM_ATTR_RO(bd_writes);
+#endif
 
 static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -1047,6 +1682,8 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_invalid_io.attr,
 	&dev_attr_notify_free.attr,
 	&dev_attr_zero_pages.attr,
+	&dev_attr_same_pages.attr,
+	&dev_attr_huge_pages.attr,
 	&dev_attr_orig_data_size.attr,
 	&dev_attr_compr_data_size.attr,
 	&dev_attr_mem_used_total.attr,
@@ -1054,6 +1691,14 @@ static struct attribute *zram_disk_attrs[] = {
 	&dev_attr_mem_used_max.attr,
 	&dev_attr_max_comp_streams.attr,
 	&dev_attr_comp_algorithm.attr,
+	&dev_attr_idle.attr,
+#ifdef CONFIG_ZRAM_WRITEBACK
+	&dev_attr_backing_dev.attr,
+	&dev_attr_writeback.attr,
+	&dev_attr_bd_count.attr,
+	&dev_attr_bd_reads.attr,
+	&dev_attr_bd_writes.attr,
+#endif
 	NULL,
 };
 
@@ -1067,6 +1712,9 @@ static int create_device(struct zram *zram, int device_id)
 	int ret = -ENOMEM;
 
 	init_rwsem(&zram->init_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	mutex_init(&zram->wb_lock);
+#endif
 
 	queue = blk_alloc_queue(GFP_KERNEL);
 	if (!queue) {
@@ -1133,7 +1781,8 @@ static int create_device(struct zram *zram, int device_id)
 	}
 	strlcpy(zram->compressor, default_compressor, sizeof(zram->compressor));
 	zram->meta = NULL;
-	zram->max_comp_streams = 1;
+	zram->max_comp_streams = num_online_cpus();
+	zram_debugfs_register(zram);
 	return 0;
 
 out_free_disk:
@@ -1158,6 +1807,7 @@ static void destroy_devices(unsigned int nr)
 		 */
 		sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
 				&zram_disk_attr_group);
+		zram_debugfs_unregister(zram);
 
 		zram_reset_device(zram);
 
@@ -1168,6 +1818,7 @@ static void destroy_devices(unsigned int nr)
 
 	kfree(zram_devices);
 	unregister_blkdev(zram_major, "zram");
+	zram_debugfs_destroy();
 	pr_info("Destroyed %u device(s)\n", nr);
 }
 
@@ -1187,9 +1838,12 @@ static int __init zram_init(void)
 		return -EBUSY;
 	}
 
+	zram_debugfs_create();
+
 	/* Allocate the device array and initialize each one */
 	zram_devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
 	if (!zram_devices) {
+		zram_debugfs_destroy();
 		unregister_blkdev(zram_major, "zram");
 		return -ENOMEM;
 	}
@@ -15,6 +15,7 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
 #include <linux/zsmalloc.h>
 
@@ -65,9 +66,13 @@ static const size_t max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /* Flags for zram pages (table[page_no].value) */
 enum zram_pageflags {
-	/* Page consists entirely of zeros */
-	ZRAM_ZERO = ZRAM_FLAG_SHIFT,
-	ZRAM_ACCESS,	/* page is now accessed */
+	/* Page is filled with one repeated word, kept in element */
+	ZRAM_SAME = ZRAM_FLAG_SHIFT,
+	ZRAM_LOCK,	/* entry is being accessed, bit spinlock */
+	ZRAM_WB,	/* page is on the backing device, block in element */
+	ZRAM_UNDER_WB,	/* page is being written back */
+	ZRAM_HUGE,	/* incompressible page, stored as is */
+	ZRAM_IDLE,	/* not accessed since last marked idle */
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -76,8 +81,14 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct zram_table_entry {
-	unsigned long handle;
+	union {
+		unsigned long handle;
+		unsigned long element;
+	};
 	unsigned long value;
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	ktime_t ac_time;
+#endif
 };
 
 struct zram_stats {
@@ -89,8 +100,15 @@ struct zram_stats {
 	atomic64_t invalid_io;	/* non-page-aligned I/O requests */
 	atomic64_t notify_free;	/* no. of swap slot free notifications */
 	atomic64_t zero_pages;		/* no. of zero filled pages */
+	atomic64_t same_pages;		/* no. of same element filled pages */
+	atomic64_t huge_pages;		/* no. of incompressible pages */
 	atomic64_t pages_stored;	/* no. of pages currently stored */
 	atomic_long_t max_used_pages;	/* no. of maximum pages stored */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	atomic64_t bd_count;		/* no. of pages in backing device */
+	atomic64_t bd_reads;		/* no. of reads from backing device */
+	atomic64_t bd_writes;		/* no. of writes to backing device */
+#endif
 };
 
 struct zram_meta {
@@ -120,5 +138,15 @@ struct zram {
 	 */
 	u64 disksize;	/* bytes */
 	char compressor[10];
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct file *backing_dev;
+	struct block_device *bdev;
+	unsigned long nr_pages;		/* size of the backing device */
+	unsigned long *bitmap;		/* used blocks of the backing device */
+	struct mutex wb_lock;		/* serializes writeback_store() */
+#endif
+#ifdef CONFIG_ZRAM_MEMORY_TRACKING
+	struct dentry *debugfs_dir;
+#endif
 };
 #endif
@@ -12,6 +12,7 @@
 #include <linux/module.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/bio.h>
 #include <linux/blkdev.h>
 #include <linux/mempool.h>
@@ -172,6 +173,11 @@ struct crypt_config {
 
 	unsigned int per_bio_data_size;
 
+	/* encryption unit, a power of two between 512 and 4096 bytes */
+	unsigned int sector_size;
+	/* largest sync write encrypted by the submitter, 0 if disabled */
+	unsigned int inline_sectors;
+
 	unsigned long flags;
 	unsigned int key_size;
 	unsigned int key_parts;      /* independent parts in key buffer */
@@ -846,18 +852,22 @@ static int crypt_convert_block(struct crypt_config *cc,
 	dmreq = dmreq_of_req(cc, req);
 	iv = iv_of_dmreq(cc, dmreq);
 
+	/* a crypto sector must not be split between two pages */
+	if (unlikely(bv_in.bv_len & (cc->sector_size - 1)))
+		return -EIO;
+
 	dmreq->iv_sector = ctx->cc_sector;
 	dmreq->ctx = ctx;
 	sg_init_table(&dmreq->sg_in, 1);
-	sg_set_page(&dmreq->sg_in, bv_in.bv_page, 1 << SECTOR_SHIFT,
+	sg_set_page(&dmreq->sg_in, bv_in.bv_page, cc->sector_size,
 		    bv_in.bv_offset);
 
 	sg_init_table(&dmreq->sg_out, 1);
-	sg_set_page(&dmreq->sg_out, bv_out.bv_page, 1 << SECTOR_SHIFT,
+	sg_set_page(&dmreq->sg_out, bv_out.bv_page, cc->sector_size,
 		    bv_out.bv_offset);
 
-	bio_advance_iter(ctx->bio_in, &ctx->iter_in, 1 << SECTOR_SHIFT);
-	bio_advance_iter(ctx->bio_out, &ctx->iter_out, 1 << SECTOR_SHIFT);
+	bio_advance_iter(ctx->bio_in, &ctx->iter_in, cc->sector_size);
+	bio_advance_iter(ctx->bio_out, &ctx->iter_out, cc->sector_size);
 
 	if (cc->iv_gen_ops) {
 		r = cc->iv_gen_ops->generator(cc, iv, dmreq);
@@ -866,7 +876,7 @@ static int crypt_convert_block(struct crypt_config *cc,
 	}
 
 	ablkcipher_request_set_crypt(req, &dmreq->sg_in, &dmreq->sg_out,
-				     1 << SECTOR_SHIFT, iv);
+				     cc->sector_size, iv);
 
 	if (bio_data_dir(ctx->bio_in) == WRITE)
 		r = crypto_ablkcipher_encrypt(req);
@@ -907,6 +917,9 @@ static void crypt_free_req(struct crypt_config *cc,
 
 /*
  * Encrypt / decrypt data from one bio to another one (can be the same one)
+ *
+ * Each crypto sector gets its own request, as it has its own IV.  The IV
+ * sector keeps counting in 512 byte units with larger crypto sectors.
  */
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
@@ -931,13 +944,13 @@ static int crypt_convert(struct crypt_config *cc,
 			/* fall through*/
 		case -EINPROGRESS:
 			ctx->req = NULL;
-			ctx->cc_sector++;
+			ctx->cc_sector += cc->sector_size >> SECTOR_SHIFT;
 			continue;
 
 		/* sync */
 		case 0:
 			atomic_dec(&ctx->cc_pending);
-			ctx->cc_sector++;
+			ctx->cc_sector += cc->sector_size >> SECTOR_SHIFT;
 			cond_resched();
 			continue;
 
@@ -968,8 +981,11 @@ static void crypt_free_buffer_pages(struct crypt_config *cc, struct bio *clone);
  * In order to not degrade performance with excessive locking, we try
  * non-blocking allocations without a mutex first but on failure we fallback
  * to blocking allocations with a mutex.
+ *
+ * Without @may_wait NULL is returned instead of falling back.
  */
-static struct bio *crypt_alloc_buffer(struct dm_crypt_io *io, unsigned size)
+static struct bio *crypt_alloc_buffer(struct dm_crypt_io *io, unsigned size,
+				      bool may_wait)
 {
 	struct crypt_config *cc = io->cc;
 	struct bio *clone;
@@ -983,7 +999,8 @@ retry:
 	if (unlikely(gfp_mask & __GFP_WAIT))
 		mutex_lock(&cc->bio_alloc_lock);
 
-	clone = bio_alloc_bioset(GFP_NOIO, nr_iovecs, cc->bs);
+	clone = bio_alloc_bioset(may_wait ? GFP_NOIO : GFP_NOWAIT, nr_iovecs,
+				 cc->bs);
 	if (!clone)
 		goto return_clone;
 
@@ -996,6 +1013,10 @@ retry:
 		if (!page) {
 			crypt_free_buffer_pages(cc, clone);
 			bio_put(clone);
+			if (!may_wait) {
+				clone = NULL;
+				goto return_clone;
+			}
 			gfp_mask |= __GFP_WAIT;
 			goto retry;
 		}
@@ -1118,7 +1139,7 @@ static void clone_init(struct dm_crypt_io *io, struct bio *clone)
 	clone->bi_private = io;
 	clone->bi_end_io  = crypt_endio;
 	clone->bi_bdev    = cc->dev->bdev;
-	clone->bi_rw      = io->base_bio->bi_rw;
+	clone->bi_rw      = io->base_bio->bi_rw & ~REQ_COST_CHARGED;
 }
 
 static int kcryptd_io_read(struct dm_crypt_io *io, gfp_t gfp)
@@ -1286,7 +1307,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 	crypt_inc_pending(io);
 	crypt_convert_init(cc, &io->ctx, NULL, io->base_bio, sector);
 
-	clone = crypt_alloc_buffer(io, io->base_bio->bi_iter.bi_size);
+	clone = crypt_alloc_buffer(io, io->base_bio->bi_iter.bi_size, true);
 	if (unlikely(!clone)) {
 		io->error = -EIO;
 		goto dec;
@@ -1313,6 +1334,47 @@ dec:
 	crypt_dec_pending(io);
 }
 
+/*
+ * Encrypt a small synchronous write in the context of its submitter, who
+ * is waiting for it anyway, and send it down without going through
+ * kcryptd and the write thread.  Clones generated here are only queued on
+ * current->bio_list until we return, so the buffer must be allocated
+ * without waiting for pages they hold: on failure leave it to kcryptd.
+ */
+static int kcryptd_crypt_write_inline(struct dm_crypt_io *io)
+{
+	struct crypt_config *cc = io->cc;
+	struct bio *clone;
+	int crypt_finished;
+	int r;
+
+	clone = crypt_alloc_buffer(io, io->base_bio->bi_iter.bi_size, false);
+	if (!clone)
+		return 1;
+
+	crypt_inc_pending(io);
+	crypt_convert_init(cc, &io->ctx, clone, io->base_bio, io->sector);
+
+	crypt_inc_pending(io);
+	r = crypt_convert(cc, &io->ctx);
+	if (r)
+		io->error = -EIO;
+	crypt_finished = atomic_dec_and_test(&io->ctx.cc_pending);
+
+	/* an async cipher submits it through the write thread when done */
+	if (crypt_finished) {
+		if (likely(!io->error)) {
+			BUG_ON(io->ctx.iter_out.bi_size);
+			clone->bi_iter.bi_sector = cc->start + io->sector;
+			generic_make_request(clone);
+		} else
+			kcryptd_crypt_write_io_submit(io, 0);
+	}
+
+	crypt_dec_pending(io);
+	return 0;
+}
+
 static void kcryptd_crypt_read_done(struct dm_crypt_io *io)
 {
 	crypt_dec_pending(io);
@@ -1706,7 +1768,14 @@ bad_mem:
 
 /*
  * Construct an encryption mapping:
- * <cipher> <key> <iv_offset> <dev_path> <start>
+ * <cipher> <key> <iv_offset> <dev_path> <start> [<#opt_params> <opt_params>]
+ *
+ * Optional feature arguments are:
+ *   allow_discards, same_cpu_crypt, submit_from_crypt_cpus
+ *   sector_size:<bytes>	encrypt in units of <bytes> instead of 512,
+ *				which changes the on-disk format
+ *   inline_sync_io:<sectors>	encrypt sync writes of up to <sectors> in
+ *				the context of the submitter
  */
 static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -1717,10 +1786,11 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	size_t iv_size_padding;
 	struct dm_arg_set as;
 	const char *opt_string;
+	unsigned int val;
 	char dummy;
 
 	static struct dm_arg _args[] = {
-		{0, 3, "Invalid number of feature args"},
+		{0, 5, "Invalid number of feature args"},
 	};
 
 	if (argc < 5) {
@@ -1736,6 +1806,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		return -ENOMEM;
 	}
 	cc->key_size = key_size;
+	cc->sector_size = 1 << SECTOR_SHIFT;
 
 	ti->private = cc;
 	ret = crypt_ctr_cipher(ti, argv[0], argv[1]);
@@ -1816,6 +1887,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		if (ret)
 			goto bad;
 
+		ret = -EINVAL;
 		while (opt_params--) {
 			opt_string = dm_shift_arg(&as);
 			if (!opt_string) {
@@ -1832,6 +1904,20 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 			else if (!strcasecmp(opt_string, "submit_from_crypt_cpus"))
 				set_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
 
+			else if (sscanf(opt_string, "sector_size:%u%c",
+					&val, &dummy) == 1) {
+				if (val < (1 << SECTOR_SHIFT) || val > 4096 ||
+				    !is_power_of_2(val)) {
+					ti->error = "Invalid feature value for sector_size";
+					goto bad;
+				}
+				cc->sector_size = val;
+			}
+
+			else if (sscanf(opt_string, "inline_sync_io:%u%c",
+					&val, &dummy) == 1)
+				cc->inline_sectors = val;
+
 			else {
 				ti->error = "Invalid feature arguments";
 				goto bad;
@@ -1839,6 +1925,26 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		}
 	}
 
+	if (cc->sector_size != (1 << SECTOR_SHIFT)) {
+		/* the other IV generators work on 512 byte sectors */
+		if (cc->iv_gen_ops && cc->iv_gen_ops != &crypt_iv_plain_ops &&
+		    cc->iv_gen_ops != &crypt_iv_plain64_ops &&
+		    cc->iv_gen_ops != &crypt_iv_essiv_ops &&
+		    cc->iv_gen_ops != &crypt_iv_null_ops) {
+			ti->error = "IV mode does not support sector_size";
+			goto bad;
+		}
+		if (cc->tfms_count > 1) {
+			ti->error = "Multiple keys do not support sector_size";
+			goto bad;
+		}
+		if ((ti->len | cc->iv_offset) &
+		    ((cc->sector_size >> SECTOR_SHIFT) - 1)) {
+			ti->error = "Device size or iv_offset not aligned to sector_size";
+			goto bad;
+		}
+	}
+
 	ret = -ENOMEM;
 	cc->io_queue = alloc_workqueue("kcryptd_io", WQ_MEM_RECLAIM, 1);
 	if (!cc->io_queue) {
@@ -1896,6 +2002,11 @@ static int crypt_map(struct dm_target *ti, struct bio *bio)
 		return DM_MAPIO_REMAPPED;
 	}
 
+	/* the queue limits keep everybody but a buggy submitter aligned */
+	if (unlikely((dm_target_offset(ti, bio->bi_iter.bi_sector) |
+		      bio_sectors(bio)) & ((cc->sector_size >> SECTOR_SHIFT) - 1)))
+		return -EIO;
+
 	io = dm_per_bio_data(bio, cc->per_bio_data_size);
 	crypt_io_init(io, cc, bio, dm_target_offset(ti, bio->bi_iter.bi_sector));
 	io->ctx.req = (struct ablkcipher_request *)(io + 1);
@@ -1903,6 +2014,10 @@ static int crypt_map(struct dm_target *ti, struct bio *bio)
 	if (bio_data_dir(io->base_bio) == READ) {
 		if (kcryptd_io_read(io, GFP_NOWAIT))
 			kcryptd_queue_read(io);
+	} else if ((bio->bi_rw & REQ_SYNC) &&
+		   bio_sectors(bio) <= cc->inline_sectors) {
+		if (kcryptd_crypt_write_inline(io))
+			kcryptd_queue_crypt(io);
 	} else
 		kcryptd_queue_crypt(io);
 
@@ -1936,6 +2051,8 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 		num_feature_args += !!ti->num_discard_bios;
 		num_feature_args += test_bit(DM_CRYPT_SAME_CPU, &cc->flags);
 		num_feature_args += test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags);
+		num_feature_args += cc->sector_size != (1 << SECTOR_SHIFT);
+		num_feature_args += !!cc->inline_sectors;
 		if (num_feature_args) {
 			DMEMIT(" %d", num_feature_args);
 			if (ti->num_discard_bios)
@@ -1944,6 +2061,10 @@ static void crypt_status(struct dm_target *ti, status_type_t type,
 				DMEMIT(" same_cpu_crypt");
 			if (test_bit(DM_CRYPT_NO_OFFLOAD, &cc->flags))
 				DMEMIT(" submit_from_crypt_cpus");
+			if (cc->sector_size != (1 << SECTOR_SHIFT))
+				DMEMIT(" sector_size:%u", cc->sector_size);
+			if (cc->inline_sectors)
+				DMEMIT(" inline_sync_io:%u", cc->inline_sectors);
 		}
 
 		break;
@@ -2039,9 +2160,22 @@ static int crypt_iterate_devices(struct dm_target *ti,
 	return fn(ti, cc->dev, cc->start, ti->len, data);
 }
 
+static void crypt_io_hints(struct dm_target *ti, struct queue_limits *limits)
+{
+	struct crypt_config *cc = ti->private;
+
+	/* crypto sectors can't be split, so they are the smallest IO */
+	limits->logical_block_size =
+		max_t(unsigned short, limits->logical_block_size,
+		      cc->sector_size);
+	limits->physical_block_size =
+		max_t(unsigned, limits->physical_block_size, cc->sector_size);
+	blk_limits_io_min(limits, cc->sector_size);
+}
+
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version = {1, 14, 0},
+	.version = {1, 15, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
@@ -2053,6 +2187,7 @@ static struct target_type crypt_target = {
 	.message = crypt_message,
 	.merge  = crypt_merge,
 	.iterate_devices = crypt_iterate_devices,
+	.io_hints = crypt_io_hints,
 };
 
 static int __init dm_crypt_init(void)
@@ -615,9 +615,9 @@ static int macvtap_skb_from_vnet_hdr(struct macvtap_queue *q,
 	return 0;
 }
 
-static void macvtap_skb_to_vnet_hdr(struct macvtap_queue *q,
-				    const struct sk_buff *skb,
-				    struct virtio_net_hdr *vnet_hdr)
+static int macvtap_skb_to_vnet_hdr(struct macvtap_queue *q,
+				   const struct sk_buff *skb,
+				   struct virtio_net_hdr *vnet_hdr)
 {
 	memset(vnet_hdr, 0, sizeof(*vnet_hdr));
 
@@ -634,7 +634,10 @@ static void macvtap_skb_to_vnet_hdr(struct macvtap_queue *q,
 		else if (sinfo->gso_type & SKB_GSO_UDP)
 			vnet_hdr->gso_type = VIRTIO_NET_HDR_GSO_UDP;
 		else
-			BUG();
+			/* e.g. SKB_GSO_UDP_L4, which TAP_FEATURES segments
+			 * before queueing and virtio_net_hdr cannot carry
+			 */
+			return -EINVAL;
 		if (sinfo->gso_type & SKB_GSO_TCP_ECN)
 			vnet_hdr->gso_type |= VIRTIO_NET_HDR_GSO_ECN;
 	} else
@@ -652,6 +655,8 @@ static void macvtap_skb_to_vnet_hdr(struct macvtap_queue *q,
 	} else if (skb->ip_summed == CHECKSUM_UNNECESSARY) {
 		vnet_hdr->flags = VIRTIO_NET_HDR_F_DATA_VALID;
 	} /* else everything is zero */
+
+	return 0;
 }
 
 /* Neighbour code has some assumptions on HH_DATA_MOD alignment */
@@ -810,7 +815,9 @@ static ssize_t macvtap_put_user(struct macvtap_queue *q,
 		if (iov_iter_count(iter) < vnet_hdr_len)
 			return -EINVAL;
 
-		macvtap_skb_to_vnet_hdr(q, skb, &vnet_hdr);
+		ret = macvtap_skb_to_vnet_hdr(q, skb, &vnet_hdr);
+		if (ret)
+			return ret;
 
 		if (copy_to_iter(&vnet_hdr, sizeof(vnet_hdr), iter) !=
 		    sizeof(vnet_hdr))
@@ -1026,6 +1026,11 @@ void aio_complete(struct kiocb *iocb, long res, long res2)
 	unsigned tail, pos, head;
 	unsigned long	flags;
 
+	if (iocb->ki_complete) {
+		iocb->ki_complete(iocb, res, res2);
+		return;
+	}
+
 	/*
 	 * Special case handling for sync iocbs:
 	 *  - events go directly into the iocb for fast handling
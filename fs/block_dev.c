@@ -28,6 +28,7 @@
 #include <linux/log2.h>
 #include <linux/cleancache.h>
 #include <linux/aio.h>
+#include <linux/task_io_accounting_ops.h>
 #include <asm/uaccess.h>
 #include "internal.h"
 
@@ -146,12 +147,128 @@ blkdev_get_block(struct inode *inode, sector_t iblock,
 	return 0;
 }
 
+#define DIO_INLINE_BIO_VECS 4
+
+static void blkdev_bio_end_io_simple(struct bio *bio, int error)
+{
+	struct task_struct *waiter = bio->bi_private;
+
+	WRITE_ONCE(bio->bi_private, NULL);
+	wake_up_process(waiter);
+}
+
+/*
+ * Small synchronous direct I/O to a block device: build a bio on the stack
+ * straight from the pages of @iter, submit it and wait for it, without the
+ * dio and get_block machinery of __blockdev_direct_IO(). Returns 0 if the
+ * I/O does not fit into one bio with the limits of the queue, for the
+ * caller to go the generic way instead.
+ */
+static ssize_t
+__blkdev_direct_IO_simple(int rw, struct kiocb *iocb, struct iov_iter *iter,
+			  loff_t offset)
+{
+	struct block_device *bdev = I_BDEV(iocb->ki_filp->f_mapping->host);
+	struct bio_vec vecs[DIO_INLINE_BIO_VECS], *bvec;
+	struct page *pages[DIO_INLINE_BIO_VECS];
+	bool should_dirty = false;
+	struct iov_iter i = *iter;
+	struct bio bio;
+	ssize_t ret;
+	int j;
+
+	if ((offset | iov_iter_alignment(iter)) &
+	    (bdev_logical_block_size(bdev) - 1))
+		return -EINVAL;
+
+	bio_init(&bio);
+	bio.bi_io_vec = vecs;
+	bio.bi_max_vecs = DIO_INLINE_BIO_VECS;
+	bio.bi_bdev = bdev;
+	bio.bi_iter.bi_sector = offset >> 9;
+	bio.bi_private = current;
+	bio.bi_end_io = blkdev_bio_end_io_simple;
+
+	while (iov_iter_count(&i)) {
+		unsigned int len, n, nr_pages;
+		size_t start;
+		ssize_t bytes;
+
+		ret = 0;
+		if (bio.bi_vcnt == bio.bi_max_vecs)
+			goto out_release;
+
+		bytes = iov_iter_get_pages(&i, pages, LONG_MAX,
+					   bio.bi_max_vecs - bio.bi_vcnt, &start);
+		if (bytes <= 0) {
+			ret = bytes ? bytes : -EFAULT;
+			goto out_release;
+		}
+		iov_iter_advance(&i, bytes);
+
+		nr_pages = DIV_ROUND_UP(bytes + start, PAGE_SIZE);
+		for (n = 0; n < nr_pages; n++) {
+			len = min_t(size_t, bytes, PAGE_SIZE - start);
+			if (bio_add_page(&bio, pages[n], len, start) != len)
+				break;
+			bytes -= len;
+			start = 0;
+		}
+		if (n < nr_pages) {
+			while (n < nr_pages)
+				page_cache_release(pages[n++]);
+			goto out_release;
+		}
+	}
+
+	if (rw & WRITE) {
+		rw = WRITE_ODIRECT;
+		task_io_account_write(bio.bi_iter.bi_size);
+	} else {
+		should_dirty = iter_is_iovec(iter);
+	}
+
+	ret = bio.bi_iter.bi_size;
+	submit_bio(rw, &bio);
+	for (;;) {
+		set_current_state(TASK_UNINTERRUPTIBLE);
+		if (!READ_ONCE(bio.bi_private))
+			break;
+		if (!blk_poll(bdev_get_queue(bdev), bio.bi_cookie))
+			io_schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+
+	if (!test_bit(BIO_UPTODATE, &bio.bi_flags))
+		ret = -EIO;
+
+out_release:
+	bio_for_each_segment_all(bvec, &bio, j) {
+		if (should_dirty && !PageCompound(bvec->bv_page))
+			set_page_dirty_lock(bvec->bv_page);
+		page_cache_release(bvec->bv_page);
+	}
+	bio_uninit(&bio);
+	return ret;
+}
+
 static ssize_t
 blkdev_direct_IO(int rw, struct kiocb *iocb, struct iov_iter *iter,
 			loff_t offset)
 {
 	struct file *file = iocb->ki_filp;
 	struct inode *inode = file->f_mapping->host;
+	int nr_pages;
+
+	nr_pages = iov_iter_npages(iter, DIO_INLINE_BIO_VECS + 1);
+	if (nr_pages && nr_pages <= DIO_INLINE_BIO_VECS &&
+	    is_sync_kiocb(iocb)) {
+		ssize_t ret;
+
+		ret = __blkdev_direct_IO_simple(rw, iocb, iter, offset);
+		if (ret)
+			return ret;
+	}
 
 	return __blockdev_direct_IO(rw, iocb, inode, I_BDEV(inode), iter,
 				    offset, blkdev_get_block,
@@ -1,6 +1,7 @@
 #ifndef __LINUX__AIO_H
 #define __LINUX__AIO_H
 
+#include <linux/fs.h>
 #include <linux/list.h>
 #include <linux/workqueue.h>
 #include <linux/aio_abi.h>
@@ -29,6 +30,9 @@ struct kiocb;
 
 typedef int (kiocb_cancel_fn)(struct kiocb *);
 
+/* ki_flags */
+#define IOCB_DIRECT		(1 << 0)	/* O_DIRECT for this iocb only */
+
 struct kiocb {
 	struct file		*ki_filp;
 	struct kioctx		*ki_ctx;	/* NULL for sync ops */
@@ -52,11 +56,23 @@ struct kiocb {
 	 * this is the underlying eventfd context to deliver events to.
 	 */
 	struct eventfd_ctx	*ki_eventfd;
+
+	/*
+	 * In-kernel submitters that don't want to wait may set ki_complete,
+	 * which aio_complete() then calls instead of posting an io_event.
+	 */
+	void (*ki_complete)(struct kiocb *iocb, long res, long res2);
+	int			ki_flags;
 };
 
 static inline bool is_sync_kiocb(struct kiocb *kiocb)
 {
-	return kiocb->ki_ctx == NULL;
+	return kiocb->ki_ctx == NULL && !kiocb->ki_complete;
+}
+
+static inline bool iocb_is_direct(struct kiocb *kiocb)
+{
+	return (kiocb->ki_flags & IOCB_DIRECT) || io_is_direct(kiocb->ki_filp);
 }
 
 static inline void init_sync_kiocb(struct kiocb *kiocb, struct file *filp)
@@ -79,7 +95,11 @@ extern long do_io_submit(aio_context_t ctx_id, long nr,
 void kiocb_set_cancel_fn(struct kiocb *req, kiocb_cancel_fn *cancel);
 #else
 static inline ssize_t wait_on_sync_kiocb(struct kiocb *iocb) { return 0; }
-static inline void aio_complete(struct kiocb *iocb, long res, long res2) { }
+static inline void aio_complete(struct kiocb *iocb, long res, long res2)
+{
+	if (iocb->ki_complete)
+		iocb->ki_complete(iocb, res, res2);
+}
 struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 static inline long do_io_submit(aio_context_t ctx_id, long nr,
@@ -17,6 +17,12 @@ struct cgroup_subsys_state;
 typedef void (bio_end_io_t) (struct bio *, int);
 typedef void (bio_destructor_t) (struct bio *);
 
+/*
+ * Cookie naming the request a bio ended up in on a blk-mq queue, for
+ * blk_poll(). See BLK_QC_T_* below.
+ */
+typedef unsigned int blk_qc_t;
+
 /*
  * was unsigned short, but we might as well be ready for > 64kB I/O pages
  */
@@ -67,6 +73,8 @@ struct bio {
 
 	atomic_t		bi_remaining;
 
+	blk_qc_t		bi_cookie;	/* set on blk-mq submission */
+
 	bio_end_io_t		*bi_end_io;
 
 	void			*bi_private;
@@ -170,6 +178,7 @@ enum rq_flag_bits {
 	__REQ_RAHEAD,		/* read ahead, can fail anytime */
 	__REQ_THROTTLED,	/* This bio has already been subjected to
 				 * throttling rules. Don't do it again. */
+	__REQ_COST_CHARGED,	/* already charged by blk-iocost */
 
 	/* request only flags */
 	__REQ_SORTED,		/* elevator knows about this request */
@@ -224,6 +233,7 @@ enum rq_flag_bits {
 
 #define REQ_RAHEAD		(1ULL << __REQ_RAHEAD)
 #define REQ_THROTTLED		(1ULL << __REQ_THROTTLED)
+#define REQ_COST_CHARGED	(1ULL << __REQ_COST_CHARGED)
 
 #define REQ_SORTED		(1ULL << __REQ_SORTED)
 #define REQ_SOFTBARRIER		(1ULL << __REQ_SOFTBARRIER)
@@ -248,4 +258,44 @@ enum rq_flag_bits {
 #define REQ_MQ_INFLIGHT		(1ULL << __REQ_MQ_INFLIGHT)
 #define REQ_NO_TIMEOUT		(1ULL << __REQ_NO_TIMEOUT)
 
+/*
+ * The hardware queue number goes in the upper bits of a blk_qc_t, the tag
+ * in the lower ones. Requests that only hold a scheduler tag when their
+ * bio is submitted have BLK_QC_T_INTERNAL set.
+ */
+#define BLK_QC_T_NONE		-1U
+#define BLK_QC_T_SHIFT		16
+#define BLK_QC_T_INTERNAL	(1U << 31)
+
+static inline bool blk_qc_t_valid(blk_qc_t cookie)
+{
+	return cookie != BLK_QC_T_NONE;
+}
+
+static inline blk_qc_t blk_tag_to_qc_t(unsigned int tag, unsigned int queue_num,
+				       bool internal)
+{
+	blk_qc_t ret = tag | (queue_num << BLK_QC_T_SHIFT);
+
+	if (internal)
+		ret |= BLK_QC_T_INTERNAL;
+
+	return ret;
+}
+
+static inline unsigned int blk_qc_t_to_queue_num(blk_qc_t cookie)
+{
+	return (cookie & ~BLK_QC_T_INTERNAL) >> BLK_QC_T_SHIFT;
+}
+
+static inline unsigned int blk_qc_t_to_tag(blk_qc_t cookie)
+{
+	return cookie & ((1u << BLK_QC_T_SHIFT) - 1);
+}
+
+static inline bool blk_qc_t_is_internal(blk_qc_t cookie)
+{
+	return (cookie & BLK_QC_T_INTERNAL) != 0;
+}
+
 #endif /* __LINUX_BLK_TYPES_H */
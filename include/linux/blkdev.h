@@ -37,6 +37,9 @@ struct sg_io_hdr;
 struct bsg_job;
 struct blkcg_gq;
 struct blk_flush_queue;
+struct rq_wb;
+struct blk_lat_hist;
+struct iocost;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -45,7 +48,7 @@ struct blk_flush_queue;
  * Maximum number of blkcg policies allowed to be registered concurrently.
  * Defined here to simplify include dependency.
  */
-#define BLKCG_MAX_POLS		2
+#define BLKCG_MAX_POLS		4
 
 struct request;
 typedef void (rq_end_io_fn)(struct request *, int);
@@ -168,6 +171,17 @@ struct request {
 	struct request_list *rl;		/* rl this rq is alloced from */
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_WBT
+	u64 wbt_issue_ns;			/* when passed to hardware */
+	unsigned int wbt_flags;			/* writeback throttling */
+#endif
+	u64 poll_issue_ns;			/* issue time on a polled queue */
+#ifdef CONFIG_BLK_LAT_HIST
+	u64 lat_issue_ns;			/* latency histogram start */
+#ifdef CONFIG_BLK_CGROUP
+	struct blkcg_gq *lat_blkg;		/* blkg the latency is charged to */
+#endif
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -182,6 +196,7 @@ struct request {
 	void *special;		/* opaque pointer available for LLD use */
 
 	int tag;
+	int internal_tag;	/* blk-mq scheduler tag, -1 if none */
 	int errors;
 
 	/*
@@ -488,6 +503,22 @@ struct request_queue {
 
 	struct blk_mq_tag_set	*tag_set;
 	struct list_head	tag_set_list;
+
+	struct rq_wb		*rq_wb;		/* writeback throttling */
+
+	/*
+	 * blk-mq completion polling: -1 polls without sleeping, 0 sleeps for
+	 * half the mean completion time first, anything else that many nsecs
+	 */
+	int			poll_nsec;
+	u64			poll_mean_nsec[2];	/* READ, WRITE */
+
+#ifdef CONFIG_BLK_LAT_HIST
+	struct blk_lat_hist __percpu *lat_hist;
+#endif
+#ifdef CONFIG_BLK_IOCOST
+	struct iocost		*iocost;	/* cost model based IO control */
+#endif
 };
 
 #define QUEUE_FLAG_QUEUED	1	/* uses generic tag queueing */
@@ -513,6 +544,8 @@ struct request_queue {
 #define QUEUE_FLAG_INIT_DONE   20	/* queue is initialized */
 #define QUEUE_FLAG_NO_SG_MERGE 21	/* don't attempt to merge SG segments*/
 #define QUEUE_FLAG_SG_GAPS     22	/* queue doesn't support SG gaps */
+#define QUEUE_FLAG_POLL	       23	/* IO polling enabled if set */
+#define QUEUE_FLAG_LAT_HIST    24	/* latency histograms enabled */
 
 #define QUEUE_FLAG_DEFAULT	((1 << QUEUE_FLAG_IO_STAT) |		\
 				 (1 << QUEUE_FLAG_STACKABLE)	|	\
@@ -590,6 +623,7 @@ static inline void queue_flag_clear(unsigned int flag, struct request_queue *q)
 #define blk_queue_dead(q)	test_bit(QUEUE_FLAG_DEAD, &(q)->queue_flags)
 #define blk_queue_bypass(q)	test_bit(QUEUE_FLAG_BYPASS, &(q)->queue_flags)
 #define blk_queue_init_done(q)	test_bit(QUEUE_FLAG_INIT_DONE, &(q)->queue_flags)
+#define blk_queue_poll(q)	test_bit(QUEUE_FLAG_POLL, &(q)->queue_flags)
 #define blk_queue_nomerges(q)	test_bit(QUEUE_FLAG_NOMERGES, &(q)->queue_flags)
 #define blk_queue_noxmerges(q)	\
 	test_bit(QUEUE_FLAG_NOXMERGES, &(q)->queue_flags)
@@ -862,6 +896,8 @@ extern int blk_execute_rq(struct request_queue *, struct gendisk *,
 extern void blk_execute_rq_nowait(struct request_queue *, struct gendisk *,
 				  struct request *, int, rq_end_io_fn *);
 
+bool blk_poll(struct request_queue *q, blk_qc_t cookie);
+
 static inline struct request_queue *bdev_get_queue(struct block_device *bdev)
 {
 	return bdev->bd_disk->queue;	/* this is never NULL */
@@ -10,6 +10,8 @@
 #include <uapi/linux/bpf.h>
 #include <linux/workqueue.h>
 #include <linux/file.h>
+#include <linux/err.h>
+#include <linux/cpumask.h>
 
 struct bpf_map;
 
@@ -24,6 +26,10 @@ struct bpf_map_ops {
 	void *(*map_lookup_elem)(struct bpf_map *map, void *key);
 	int (*map_update_elem)(struct bpf_map *map, void *key, void *value, u64 flags);
 	int (*map_delete_elem)(struct bpf_map *map, void *key);
+
+	/* funcs called by prog_array and maps of maps, which store fds */
+	void *(*map_fd_get_ptr)(struct bpf_map *map, int fd);
+	void (*map_fd_put_ptr)(void *ptr);
 };
 
 struct bpf_map {
@@ -32,9 +38,32 @@ struct bpf_map {
 	u32 key_size;
 	u32 value_size;
 	u32 max_entries;
+	u32 map_flags;
 	struct bpf_map_ops *ops;
 	struct work_struct work;
+	/* maps of maps: template every inner map must match */
+	struct bpf_map *inner_map_meta;
+};
+
+struct bpf_array {
+	struct bpf_map map;
+	u32 elem_size;
+	/* 'ownership' of prog_array is claimed by the first program that
+	 * is going to use this map or by the first program which FD is stored
+	 * in the map to make sure that all callers and callees have the same
+	 * prog_type and JITed flag
+	 */
+	enum bpf_prog_type owner_prog_type;
+	bool owner_jited;
+	union {
+		char value[0] __aligned(8);
+		/* prog_array and arrays of maps hold a reference per element */
+		void *ptrs[0] __aligned(8);
+		/* per-cpu arrays only keep a pointer per element */
+		void __percpu *pptrs[0] __aligned(8);
+	};
 };
+#define MAX_TAIL_CALL_CNT 32
 
 struct bpf_map_type_list {
 	struct list_head list_node;
@@ -44,6 +73,35 @@ struct bpf_map_type_list {
 
 void bpf_register_map_type(struct bpf_map_type_list *tl);
 void bpf_map_put(struct bpf_map *map);
+
+/* per-cpu maps hold one value per possible cpu, the syscall side reads
+ * and writes all of them at once, each rounded up to 8 bytes
+ */
+static inline u32 bpf_map_value_size(struct bpf_map *map)
+{
+	if (map->map_type == BPF_MAP_TYPE_PERCPU_HASH ||
+	    map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY)
+		return round_up(map->value_size, 8) * num_possible_cpus();
+	return map->value_size;
+}
+
+static inline bool bpf_map_is_of_maps(const struct bpf_map *map)
+{
+	return map->map_type == BPF_MAP_TYPE_ARRAY_OF_MAPS ||
+	       map->map_type == BPF_MAP_TYPE_HASH_OF_MAPS;
+}
+
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 flags);
+int bpf_percpu_array_copy(struct bpf_map *map, void *key, void *value);
+int bpf_percpu_array_update(struct bpf_map *map, void *key, void *value,
+			    u64 flags);
+int bpf_fd_array_map_update_elem(struct bpf_map *map, void *key, void *value,
+				 u64 flags);
+int bpf_fd_htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				u64 flags);
+void bpf_fd_array_map_clear(struct bpf_map *map);
 struct bpf_map *bpf_map_get(struct fd f);
 
 /* function argument constraints */
@@ -62,6 +120,8 @@ enum bpf_arg_type {
 	 */
 	ARG_PTR_TO_STACK,	/* any pointer to eBPF program stack */
 	ARG_CONST_STACK_SIZE,	/* number of bytes accessed from stack */
+
+	ARG_PTR_TO_CTX,		/* pointer to context */
 };
 
 /* type of values returned from helper functions */
@@ -125,15 +185,27 @@ struct bpf_prog_aux {
 	struct bpf_map **used_maps;
 	u32 used_map_cnt;
 	struct bpf_prog *prog;
-	struct work_struct work;
+	void *jit_cache;	/* JITed image shared with identical programs */
+	union {
+		struct work_struct work;
+		struct rcu_head	rcu;
+	};
 };
 
+bool bpf_prog_array_compatible(struct bpf_array *array, const struct bpf_prog *fp);
+
 #ifdef CONFIG_BPF_SYSCALL
 void bpf_prog_put(struct bpf_prog *prog);
+void bpf_prog_put_rcu(struct bpf_prog *prog);
+struct bpf_prog *bpf_prog_get(u32 ufd);
 #else
 static inline void bpf_prog_put(struct bpf_prog *prog) {}
+static inline void bpf_prog_put_rcu(struct bpf_prog *prog) {}
+static inline struct bpf_prog *bpf_prog_get(u32 ufd)
+{
+	return ERR_PTR(-EOPNOTSUPP);
+}
 #endif
-struct bpf_prog *bpf_prog_get(u32 ufd);
 /* verify correctness of eBPF program */
 int bpf_check(struct bpf_prog *fp, union bpf_attr *attr);
 
@@ -141,5 +213,6 @@ int bpf_check(struct bpf_prog *fp, union bpf_attr *attr);
 extern struct bpf_func_proto bpf_map_lookup_elem_proto;
 extern struct bpf_func_proto bpf_map_update_elem_proto;
 extern struct bpf_func_proto bpf_map_delete_elem_proto;
+extern const struct bpf_func_proto bpf_tail_call_proto;
 
 #endif /* _LINUX_BPF_H */
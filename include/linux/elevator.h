@@ -8,6 +8,7 @@
 
 struct io_cq;
 struct elevator_type;
+struct blk_mq_hw_ctx;
 
 typedef int (elevator_merge_fn) (struct request_queue *, struct request **,
 				 struct bio *);
@@ -70,6 +71,24 @@ struct elevator_ops
 	elevator_exit_fn *elevator_exit_fn;
 };
 
+/*
+ * blk-mq schedulers. Requests are handed in per hardware context and pulled
+ * back out one at a time when the driver has room for more, so whatever is
+ * still inside the scheduler can be reordered or merged.
+ */
+struct elevator_mq_ops {
+	int (*init_sched)(struct request_queue *, struct elevator_type *);
+	void (*exit_sched)(struct elevator_queue *);
+
+	bool (*bio_merge)(struct blk_mq_hw_ctx *, struct bio *);
+	struct request *(*request_merge)(struct request_queue *, struct bio *);
+	void (*request_merged)(struct request_queue *, struct request *, int);
+
+	void (*insert_requests)(struct blk_mq_hw_ctx *, struct list_head *, bool);
+	struct request *(*dispatch_request)(struct blk_mq_hw_ctx *);
+	bool (*has_work)(struct blk_mq_hw_ctx *);
+};
+
 #define ELV_NAME_MAX	(16)
 
 struct elv_fs_entry {
@@ -88,6 +107,8 @@ struct elevator_type
 
 	/* fields provided by elevator implementation */
 	struct elevator_ops ops;
+	struct elevator_mq_ops mq_ops;
+	bool uses_mq;
 	size_t icq_size;	/* see iocontext.h */
 	size_t icq_align;	/* ditto */
 	struct elv_fs_entry *elevator_attrs;
@@ -172,6 +193,15 @@ extern void elv_rb_add(struct rb_root *, struct request *);
 extern void elv_rb_del(struct rb_root *, struct request *);
 extern struct request *elv_rb_find(struct rb_root *, sector_t);
 
+/*
+ * merge hash support functions, for blk-mq schedulers that do their own
+ * locking.
+ */
+extern void elv_rqhash_add(struct request_queue *, struct request *);
+extern void elv_rqhash_del(struct request_queue *, struct request *);
+extern void elv_rqhash_reposition(struct request_queue *, struct request *);
+extern struct request *elv_rqhash_find(struct request_queue *, sector_t);
+
 /*
  * Return values from elevator merger
  */
@@ -0,0 +1,213 @@
+#ifndef _NF_FLOW_TABLE_H
+#define _NF_FLOW_TABLE_H
+
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/atomic.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_conntrack_tuple_common.h>
+#include <linux/rhashtable.h>
+#include <linux/rcupdate.h>
+#include <linux/tcp.h>
+#include <linux/workqueue.h>
+#include <net/dst.h>
+
+struct nf_conn;
+struct nf_flowtable;
+
+/**
+ *	struct nf_flowtable_type - flow table type
+ *
+ *	@list: used internally
+ *	@family: address family of the flows in the table
+ *	@init: set up a flow table of this type
+ *	@free: release all flows and the flow table itself
+ *	@hook: fast path hook function, ops->priv points to the flow table
+ *	@owner: module owner
+ */
+struct nf_flowtable_type {
+	struct list_head		list;
+	int				family;
+	int				(*init)(struct nf_flowtable *ft,
+						struct net *net);
+	void				(*free)(struct nf_flowtable *ft);
+	nf_hookfn			*hook;
+	struct module			*owner;
+};
+
+/**
+ *	struct nf_flowtable - hash table of offloaded flows
+ *
+ *	@list: used internally
+ *	@rhashtable: flows, hashed by both of their tuples
+ *	@type: flow table type
+ *	@gc_work: removes expired and torn down flows
+ *	@net: namespace the flows belong to
+ */
+struct nf_flowtable {
+	struct list_head		list;
+	struct rhashtable		rhashtable;
+	const struct nf_flowtable_type	*type;
+	struct delayed_work		gc_work;
+	struct net			*net;
+};
+
+enum flow_offload_tuple_dir {
+	FLOW_OFFLOAD_DIR_ORIGINAL = IP_CT_DIR_ORIGINAL,
+	FLOW_OFFLOAD_DIR_REPLY = IP_CT_DIR_REPLY,
+	FLOW_OFFLOAD_DIR_MAX = IP_CT_DIR_MAX
+};
+
+/* Everything up to @dir is the lookup key, it has to be zeroed in full */
+struct flow_offload_tuple {
+	union {
+		struct in_addr		src_v4;
+		struct in6_addr		src_v6;
+	};
+	union {
+		struct in_addr		dst_v4;
+		struct in6_addr		dst_v6;
+	};
+	struct {
+		__be16			src_port;
+		__be16			dst_port;
+	};
+
+	int				iifidx;
+
+	u8				l3proto;
+	u8				l4proto;
+	u8				dir;
+
+	int				oifidx;
+	u16				mtu;
+
+	struct dst_entry		*dst_cache;
+	u32				dst_cookie;
+};
+
+struct flow_offload_tuple_rhash {
+	struct rhash_head		node;
+	struct flow_offload_tuple	tuple;
+};
+
+#define FLOW_OFFLOAD_SNAT	0x1
+#define FLOW_OFFLOAD_DNAT	0x2
+#define FLOW_OFFLOAD_DYING	0x4
+#define FLOW_OFFLOAD_TEARDOWN	0x8
+
+/**
+ *	struct flow_offload - an offloaded conntrack entry
+ *
+ *	@tuplehash: lookup keys and cached route of both directions
+ *	@ct: conntrack entry, referenced as long as the flow exists
+ *	@flags: NAT to apply and removal state
+ *	@timeout: jiffies after which the idle flow is removed
+ *	@counter: per direction packets and bytes not yet folded into
+ *		  the conntrack accounting extension
+ *	@rcu_head: used internally
+ */
+struct flow_offload {
+	struct flow_offload_tuple_rhash		tuplehash[FLOW_OFFLOAD_DIR_MAX];
+	struct nf_conn				*ct;
+	u32					flags;
+	u32					timeout;
+	struct {
+		atomic64_t			packets;
+		atomic64_t			bytes;
+	} counter[FLOW_OFFLOAD_DIR_MAX];
+	struct rcu_head				rcu_head;
+};
+
+#define NF_FLOW_TIMEOUT (30 * HZ)
+
+/* Port pair at the start of the TCP and UDP headers */
+struct flow_ports {
+	__be16 source, dest;
+};
+
+/* Routes of both directions, as seen by the packet that offloads the flow */
+struct nf_flow_route {
+	struct {
+		struct dst_entry	*dst;
+		int			ifindex;
+	} tuple[FLOW_OFFLOAD_DIR_MAX];
+};
+
+struct flow_offload *flow_offload_alloc(struct nf_conn *ct,
+					struct nf_flow_route *route);
+void flow_offload_free(struct flow_offload *flow);
+
+int flow_offload_add(struct nf_flowtable *flow_table, struct flow_offload *flow);
+void flow_offload_teardown(struct flow_offload *flow);
+struct flow_offload_tuple_rhash *flow_offload_lookup(struct nf_flowtable *flow_table,
+						     struct flow_offload_tuple *tuple);
+
+int nf_flow_table_init(struct nf_flowtable *flow_table, struct net *net);
+void nf_flow_table_free(struct nf_flowtable *flow_table);
+void nf_flow_table_cleanup(struct net *net, struct net_device *dev);
+
+int nf_flow_snat_port(const struct flow_offload *flow,
+		      struct sk_buff *skb, unsigned int thoff,
+		      u8 protocol, enum flow_offload_tuple_dir dir);
+int nf_flow_dnat_port(const struct flow_offload *flow,
+		      struct sk_buff *skb, unsigned int thoff,
+		      u8 protocol, enum flow_offload_tuple_dir dir);
+
+static inline void flow_offload_refresh(struct flow_offload *flow,
+					enum flow_offload_tuple_dir dir,
+					unsigned int len)
+{
+	flow->timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+	atomic64_inc(&flow->counter[dir].packets);
+	atomic64_add(len, &flow->counter[dir].bytes);
+}
+
+static inline bool nf_flow_exceeds_mtu(const struct sk_buff *skb,
+				       unsigned int mtu)
+{
+	if (skb->len <= mtu)
+		return false;
+
+	return !skb_is_gso(skb) || skb_gso_network_seglen(skb) > mtu;
+}
+
+/* A TCP flow that is being closed goes back to conntrack, which has to
+ * see the FIN and RST packets to follow the connection to its end.
+ */
+static inline int nf_flow_state_check(struct flow_offload *flow, int proto,
+				      struct sk_buff *skb, unsigned int thoff)
+{
+	struct tcphdr *tcph;
+
+	if (proto != IPPROTO_TCP)
+		return 0;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*tcph)))
+		return -1;
+
+	tcph = (void *)(skb_network_header(skb) + thoff);
+	if (unlikely(tcph->fin || tcph->rst)) {
+		flow_offload_teardown(flow);
+		return -1;
+	}
+
+	return 0;
+}
+
+unsigned int nf_flow_offload_ip_hook(const struct nf_hook_ops *ops,
+				     struct sk_buff *skb,
+				     const struct net_device *in,
+				     const struct net_device *out,
+				     int (*okfn)(struct sk_buff *));
+unsigned int nf_flow_offload_ipv6_hook(const struct nf_hook_ops *ops,
+				       struct sk_buff *skb,
+				       const struct net_device *in,
+				       const struct net_device *out,
+				       int (*okfn)(struct sk_buff *));
+
+#define MODULE_ALIAS_NF_FLOWTABLE(family)	\
+	MODULE_ALIAS("nf-flowtable-" __stringify(family))
+
+#endif /* _NF_FLOW_TABLE_H */
@@ -8,6 +8,7 @@
 #include <linux/netfilter/nf_tables.h>
 #include <linux/u64_stats_sync.h>
 #include <net/netlink.h>
+#include <net/netfilter/nf_flow_table.h>
 
 #define NFT_JUMP_STACK_SIZE	16
 
@@ -181,11 +182,13 @@ struct nft_set_desc {
  *	enum nft_set_class - performance class
  *
  *	@NFT_LOOKUP_O_1: constant, O(1)
+ *	@NFT_LOOKUP_O_K: bounded by the key length, O(K)
  *	@NFT_LOOKUP_O_LOG_N: logarithmic, O(log N)
  *	@NFT_LOOKUP_O_N: linear, O(N)
  */
 enum nft_set_class {
 	NFT_SET_CLASS_O_1,
+	NFT_SET_CLASS_O_K,
 	NFT_SET_CLASS_O_LOG_N,
 	NFT_SET_CLASS_O_N,
 };
@@ -477,6 +480,13 @@ struct nft_trans_elem {
 #define nft_trans_elem(trans)	\
 	(((struct nft_trans_elem *)trans->data)->elem)
 
+struct nft_trans_flowtable {
+	struct nft_flowtable	*flowtable;
+};
+
+#define nft_trans_flowtable(trans)	\
+	(((struct nft_trans_flowtable *)trans->data)->flowtable)
+
 static inline struct nft_expr *nft_expr_first(const struct nft_rule *rule)
 {
 	return (struct nft_expr *)&rule->data[0];
@@ -588,6 +598,7 @@ unsigned int nft_do_chain(struct nft_pktinfo *pkt,
  *	@list: used internally
  *	@chains: chains in the table
  *	@sets: sets in the table
+ *	@flowtables: flow tables in the table
  *	@hgenerator: handle generator state
  *	@use: number of chain references to this table
  *	@flags: table flag (see enum nft_table_flags)
@@ -597,6 +608,7 @@ struct nft_table {
 	struct list_head		list;
 	struct list_head		chains;
 	struct list_head		sets;
+	struct list_head		flowtables;
 	u64				hgenerator;
 	u32				use;
 	u16				flags;
@@ -655,6 +667,43 @@ void nft_unregister_chain_type(const struct nf_chain_type *);
 int nft_register_expr(struct nft_expr_type *);
 void nft_unregister_expr(struct nft_expr_type *);
 
+#define NFT_FLOWTABLE_DEVICE_MAX	8
+
+/**
+ *	struct nft_flowtable - nf_tables flow table
+ *
+ *	@list: flow table list node in table list
+ *	@name: name of the flow table
+ *	@hooknum: netfilter hook the fast path runs from
+ *	@priority: priority of the fast path hook
+ *	@use: number of rule references to this flow table
+ *	@flags: internal flags
+ *	@ndevs: number of devices in @devices
+ *	@devices: names of the devices whose flows may be offloaded
+ *	@ops: netfilter hook ops
+ *	@data: the flow table
+ */
+struct nft_flowtable {
+	struct list_head		list;
+	char				name[IFNAMSIZ];
+	u32				hooknum;
+	int				priority;
+	u32				use;
+	u16				flags;
+	unsigned int			ndevs;
+	char				devices[NFT_FLOWTABLE_DEVICE_MAX][IFNAMSIZ];
+	struct nf_hook_ops		ops[NFT_HOOK_OPS_MAX];
+	struct nf_flowtable		data;
+};
+
+struct nft_flowtable *nf_tables_flowtable_lookup(const struct nft_table *table,
+						 const struct nlattr *nla);
+bool nft_flowtable_has_device(const struct nft_flowtable *flowtable,
+			      const struct net_device *dev);
+
+void nft_register_flowtable_type(struct nf_flowtable_type *type);
+void nft_unregister_flowtable_type(struct nf_flowtable_type *type);
+
 #define nft_dereference(p)					\
 	nfnl_dereference(p, NFNL_SUBSYS_NFTABLES)
 
@@ -96,6 +96,9 @@ struct netns_ct {
 
 	unsigned int		htable_size;
 	seqcount_t		generation;
+	struct delayed_work	gc_dwork;
+	unsigned int		gc_next_bucket;
+	unsigned long		gc_interval;
 	struct kmem_cache	*nf_conntrack_cachep;
 	struct hlist_nulls_head	*hash;
 	struct hlist_head	*expect_hash;
@@ -217,6 +217,17 @@ struct sock_common {
 	/* public: */
 };
 
+/* Pacing of a socket is done by sch_fq when it is the root qdisc of the
+ * egress device, else by the transport itself (see tcp_internal_pacing()).
+ * A socket that wants pacing moves from NONE to NEEDED; sch_fq moves it to
+ * FQ the first time it sees one of its packets, turning internal pacing off.
+ */
+enum sk_pacing {
+	SK_PACING_NONE		= 0,
+	SK_PACING_NEEDED	= 1,
+	SK_PACING_FQ		= 2,
+};
+
 struct cg_proto;
 /**
   *	struct sock - network layer representation of sockets
@@ -241,6 +252,7 @@ struct cg_proto;
   *	@sk_allocation: allocation mode
   *	@sk_pacing_rate: Pacing rate (if supported by transport/packet scheduler)
   *	@sk_max_pacing_rate: Maximum pacing rate (%SO_MAX_PACING_RATE)
+  *	@sk_pacing_status: Pacing status (requested, handled by sch_fq)
   *	@sk_sndbuf: size of send buffer in bytes
   *	@sk_flags: %SO_LINGER (l_onoff), %SO_BROADCAST, %SO_KEEPALIVE,
   *		   %SO_OOBINLINE settings, %SO_TIMESTAMPING settings
@@ -276,11 +288,13 @@ struct cg_proto;
   *	@sk_incoming_cpu: record cpu processing incoming packets
   *	@sk_txhash: computed flow hash for use on transmit
   *	@sk_filter: socket filtering instructions
+  *	@sk_reuseport_cb: reuseport group container
   *	@sk_protinfo: private area, net family specific, when not using slab
   *	@sk_timer: sock cleanup timer
   *	@sk_stamp: time stamp of last packet received
   *	@sk_tsflags: SO_TIMESTAMPING socket options
   *	@sk_tskey: counter to disambiguate concurrent tstamp requests
+  *	@sk_zckey: counter to order MSG_ZEROCOPY notifications
   *	@sk_socket: Identd and reporting IO signals
   *	@sk_user_data: RPC layer private data
   *	@sk_frag: cached page frag
@@ -367,6 +381,7 @@ struct sock {
 
 	struct sk_filter __rcu	*sk_filter;
 	struct socket_wq __rcu	*sk_wq;
+	struct sock_reuseport __rcu	*sk_reuseport_cb;
 
 #ifdef CONFIG_XFRM
 	struct xfrm_policy	*sk_policy[2];
@@ -396,6 +411,7 @@ struct sock {
 	int			sk_gso_type;
 	unsigned int		sk_gso_max_size;
 	u16			sk_gso_max_segs;
+	u32			sk_pacing_status; /* see enum sk_pacing */
 	int			sk_rcvlowat;
 	unsigned long	        sk_lingertime;
 	struct sk_buff_head	sk_error_queue;
@@ -418,6 +434,7 @@ struct sock {
 	ktime_t			sk_stamp;
 	u16			sk_tsflags;
 	u32			sk_tskey;
+	atomic_t		sk_zckey;
 	struct socket		*sk_socket;
 	void			*sk_user_data;
 	struct page_frag	sk_frag;
@@ -711,7 +728,7 @@ enum sock_flags {
 	SOCK_TIMESTAMPING_RX_SOFTWARE,  /* %SOF_TIMESTAMPING_RX_SOFTWARE */
 	SOCK_FASYNC, /* fasync() active */
 	SOCK_RXQ_OVFL,
-	SOCK_ZEROCOPY, /* buffers from userspace */
+	SOCK_ZEROCOPY, /* buffers from userspace, %SO_ZEROCOPY on TCP */
 	SOCK_WIFI_STATUS, /* push wifi status to userspace */
 	SOCK_NOFCS, /* Tell NIC not to do the Ethernet FCS.
 		     * Will use last 4 bytes of packet sent from
@@ -719,6 +736,7 @@ enum sock_flags {
 		     */
 	SOCK_FILTER_LOCKED, /* Filter cannot be changed anymore */
 	SOCK_SELECT_ERR_QUEUE, /* Wake select on error queue */
+	SOCK_INCOMING_CPU_SET, /* %SO_INCOMING_CPU set, do not track */
 };
 
 static inline void sock_copy_flags(struct sock *nsk, struct sock *osk)
@@ -842,6 +860,8 @@ static inline int sk_backlog_rcv(struct sock *sk, struct sk_buff *skb)
 
 static inline void sk_incoming_cpu_update(struct sock *sk)
 {
+	if (unlikely(sock_flag(sk, SOCK_INCOMING_CPU_SET)))
+		return;
 	sk->sk_incoming_cpu = raw_smp_processor_id();
 }
 
@@ -1522,6 +1542,8 @@ struct sock *sk_clone_lock(const struct sock *sk, const gfp_t priority);
 struct sk_buff *sock_wmalloc(struct sock *sk, unsigned long size, int force,
 			     gfp_t priority);
 void sock_wfree(struct sk_buff *skb);
+struct sk_buff *sock_omalloc(struct sock *sk, unsigned long size,
+			     gfp_t priority);
 void skb_orphan_partial(struct sk_buff *skb);
 void sock_rfree(struct sk_buff *skb);
 void sock_efree(struct sk_buff *skb);
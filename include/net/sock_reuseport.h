@@ -0,0 +1,33 @@
+#ifndef _SOCK_REUSEPORT_H
+#define _SOCK_REUSEPORT_H
+
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/types.h>
+#include <net/sock.h>
+
+/* A group of sockets bound to the same address and port with SO_REUSEPORT.
+ * Lookups that land on any member pick the receiving socket from socks[]
+ * either by flow hash, by an attached BPF program returning an index, or
+ * by SO_INCOMING_CPU, instead of walking every member in the hash chain.
+ */
+struct sock_reuseport {
+	struct rcu_head		rcu;
+
+	u16			max_socks;	/* length of socks */
+	u16			num_socks;	/* elements in socks */
+	/* members with SO_INCOMING_CPU set by the application */
+	unsigned int		incoming_cpu;
+	struct bpf_prog __rcu	*prog;		/* optional BPF sock selector */
+	struct sock		*socks[0];	/* array of sock pointers */
+};
+
+int reuseport_alloc(struct sock *sk);
+int reuseport_add_sock(struct sock *sk, struct sock *sk2);
+void reuseport_detach_sock(struct sock *sk);
+struct sock *reuseport_select_sock(struct sock *sk, u32 hash,
+				   struct sk_buff *skb, int hdr_len);
+struct bpf_prog *reuseport_attach_prog(struct sock *sk, struct bpf_prog *prog);
+void reuseport_update_incoming_cpu(struct sock *sk, int val);
+
+#endif  /* _SOCK_REUSEPORT_H */
@@ -19,6 +19,13 @@ struct sock_extended_err {
 #define SO_EE_ORIGIN_ICMP6	3
 #define SO_EE_ORIGIN_TXSTATUS	4
 #define SO_EE_ORIGIN_TIMESTAMPING SO_EE_ORIGIN_TXSTATUS
+#define SO_EE_ORIGIN_ZEROCOPY	5
+
+/* MSG_ZEROCOPY notification: ee_info..ee_data is the range of completed
+ * send calls.  COPIED is set if the kernel fell back to copying the data,
+ * e.g. on loopback or devices without scatter-gather.
+ */
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
 
 #define SO_EE_OFFENDER(ee)	((struct sockaddr*)((ee)+1))
 
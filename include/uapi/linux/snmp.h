@@ -276,6 +276,8 @@ enum
 	LINUX_MIB_TCPACKSKIPPEDFINWAIT2,	/* TCPACKSkippedFinWait2 */
 	LINUX_MIB_TCPACKSKIPPEDTIMEWAIT,	/* TCPACKSkippedTimeWait */
 	LINUX_MIB_TCPACKSKIPPEDCHALLENGE,	/* TCPACKSkippedChallenge */
+	LINUX_MIB_TCPPACINGTIMER,		/* TCPPacingTimer */
+	LINUX_MIB_TCPPACINGDEFERRED,		/* TCPPacingDeferred */
 	__LINUX_MIB_MAX
 };
 
@@ -189,6 +189,10 @@ struct tcp_info {
 
 	__u64	tcpi_pacing_rate;
 	__u64	tcpi_max_pacing_rate;
+
+	__u32	tcpi_min_rtt;		/* windowed min RTT in usec */
+	__u32	tcpi_delivery_rate_app_limited;
+	__u64	tcpi_delivery_rate;	/* bytes/s from the last rate sample */
 };
 
 /* for TCP_MD5SIG socket option */
@@ -26,6 +26,8 @@
 #include <linux/vmalloc.h>
 #include <linux/random.h>
 #include <linux/moduleloader.h>
+#include <linux/jhash.h>
+#include <linux/hashtable.h>
 #include <asm/unaligned.h>
 #include <linux/bpf.h>
 
@@ -165,6 +167,129 @@ void bpf_jit_binary_free(struct bpf_binary_header *hdr)
 {
 	module_memfree(hdr);
 }
+
+/* The same program is often loaded many times over, e.g. one filter per
+ * socket or one classifier per device.  Such copies share a single JITed
+ * image, found by program type and by the instructions after helper calls
+ * were fixed up, which also carry the pointers of the maps they use.
+ */
+struct bpf_jit_cache_entry {
+	struct hlist_node hash_node;
+	u32 hash;
+	u32 len;
+	enum bpf_prog_type type;
+	unsigned int refcnt;		/* programs using the image */
+	unsigned int (*bpf_func)(const struct sk_buff *skb,
+				 const struct bpf_insn *filter);
+	struct bpf_insn insns[0];
+};
+
+#define BPF_JIT_CACHE_BITS	8
+
+static DEFINE_HASHTABLE(bpf_jit_cache, BPF_JIT_CACHE_BITS);
+static DEFINE_MUTEX(bpf_jit_cache_mutex);
+
+static u32 bpf_jit_cache_hash(const struct bpf_prog *fp)
+{
+	return jhash2((const u32 *) fp->insnsi,
+		      fp->len * sizeof(struct bpf_insn) / sizeof(u32),
+		      fp->aux->prog_type);
+}
+
+static struct bpf_jit_cache_entry *
+bpf_jit_cache_lookup(const struct bpf_prog *fp, u32 hash)
+{
+	struct bpf_jit_cache_entry *e;
+
+	hash_for_each_possible(bpf_jit_cache, e, hash_node, hash)
+		if (e->hash == hash && e->len == fp->len &&
+		    e->type == fp->aux->prog_type &&
+		    !memcmp(e->insns, fp->insnsi,
+			    fp->len * sizeof(struct bpf_insn)))
+			return e;
+	return NULL;
+}
+
+/**
+ *	bpf_jit_cache_get - reuse the image of an identical JITed program
+ *	@fp: program about to be JITed
+ *
+ * Returns true and makes @fp run the cached image if there is one, in
+ * which case the JIT has nothing left to do.
+ */
+bool bpf_jit_cache_get(struct bpf_prog *fp)
+{
+	struct bpf_jit_cache_entry *e;
+
+	mutex_lock(&bpf_jit_cache_mutex);
+	e = bpf_jit_cache_lookup(fp, bpf_jit_cache_hash(fp));
+	if (e) {
+		e->refcnt++;
+		fp->bpf_func = e->bpf_func;
+		fp->jited = true;
+		fp->aux->jit_cache = e;
+	}
+	mutex_unlock(&bpf_jit_cache_mutex);
+
+	return e != NULL;
+}
+
+/**
+ *	bpf_jit_cache_add - offer a freshly JITed image to later copies
+ *	@fp: program that was just JITed
+ *
+ * Failing to add it is not an error, @fp then owns its image alone.
+ */
+void bpf_jit_cache_add(struct bpf_prog *fp)
+{
+	struct bpf_jit_cache_entry *e;
+	u32 hash = bpf_jit_cache_hash(fp);
+
+	e = kmalloc(sizeof(*e) + fp->len * sizeof(struct bpf_insn),
+		    GFP_KERNEL | __GFP_NOWARN);
+	if (!e)
+		return;
+
+	e->hash = hash;
+	e->len = fp->len;
+	e->type = fp->aux->prog_type;
+	e->refcnt = 1;
+	e->bpf_func = fp->bpf_func;
+	memcpy(e->insns, fp->insnsi, fp->len * sizeof(struct bpf_insn));
+
+	mutex_lock(&bpf_jit_cache_mutex);
+	hash_add(bpf_jit_cache, &e->hash_node, hash);
+	fp->aux->jit_cache = e;
+	mutex_unlock(&bpf_jit_cache_mutex);
+}
+
+/**
+ *	bpf_jit_cache_put - drop the reference of a program on its image
+ *	@fp: JITed program being freed
+ *
+ * Returns true if other programs still run the image, so that the JIT
+ * must not free it.
+ */
+bool bpf_jit_cache_put(struct bpf_prog *fp)
+{
+	struct bpf_jit_cache_entry *e = fp->aux->jit_cache;
+	bool in_use;
+
+	if (!e)
+		return false;
+
+	mutex_lock(&bpf_jit_cache_mutex);
+	in_use = --e->refcnt != 0;
+	if (!in_use)
+		hash_del(&e->hash_node);
+	mutex_unlock(&bpf_jit_cache_mutex);
+
+	fp->aux->jit_cache = NULL;
+	if (!in_use)
+		kfree(e);
+
+	return in_use;
+}
 #endif /* CONFIG_BPF_JIT */
 
 /* Base function for offset calculation. Needs to go into .text section,
@@ -244,6 +369,7 @@ static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
 		[BPF_ALU64 | BPF_NEG] = &&ALU64_NEG,
 		/* Call instruction */
 		[BPF_JMP | BPF_CALL] = &&JMP_CALL,
+		[BPF_JMP | BPF_CALL | BPF_X] = &&JMP_TAIL_CALL,
 		/* Jumps */
 		[BPF_JMP | BPF_JA] = &&JMP_JA,
 		[BPF_JMP | BPF_JEQ | BPF_X] = &&JMP_JEQ_X,
@@ -286,6 +412,7 @@ static unsigned int __bpf_prog_run(void *ctx, const struct bpf_insn *insn)
 		[BPF_LD | BPF_IND | BPF_B] = &&LD_IND_B,
 		[BPF_LD | BPF_IMM | BPF_DW] = &&LD_IMM_DW,
 	};
+	u32 tail_call_cnt = 0;
 	void *ptr;
 	int off;
 
@@ -431,6 +558,35 @@ select_insn:
 						       BPF_R4, BPF_R5);
 		CONT;
 
+	JMP_TAIL_CALL: {
+		struct bpf_map *map = (struct bpf_map *) (unsigned long) BPF_R2;
+		struct bpf_array *array = container_of(map, struct bpf_array, map);
+		struct bpf_prog *prog;
+		u32 index = BPF_R3;
+
+		if (unlikely(index >= array->map.max_entries))
+			goto out;
+
+		if (unlikely(tail_call_cnt > MAX_TAIL_CALL_CNT))
+			goto out;
+
+		tail_call_cnt++;
+
+		prog = READ_ONCE(array->ptrs[index]);
+		if (unlikely(!prog))
+			goto out;
+
+		/* ARG1 at this point is guaranteed to point to CTX from
+		 * the verifier side due to the fact that the tail call is
+		 * handled like a helper, that is, bpf_tail_call_proto,
+		 * where arg1_type is ARG_PTR_TO_CTX.
+		 */
+		insn = prog->insnsi;
+		goto select_insn;
+out:
+		CONT;
+	}
+
 	/* JMP */
 	JMP_JA:
 		insn += insn->off;
@@ -637,6 +793,23 @@ void bpf_prog_select_runtime(struct bpf_prog *fp)
 }
 EXPORT_SYMBOL_GPL(bpf_prog_select_runtime);
 
+bool bpf_prog_array_compatible(struct bpf_array *array,
+			       const struct bpf_prog *fp)
+{
+	if (!array->owner_prog_type) {
+		/* There's no owner yet where we could check for
+		 * compatibility.
+		 */
+		array->owner_prog_type = fp->aux->prog_type;
+		array->owner_jited = fp->jited;
+
+		return true;
+	}
+
+	return array->owner_prog_type == fp->aux->prog_type &&
+	       array->owner_jited == fp->jited;
+}
+
 static void bpf_prog_free_deferred(struct work_struct *work)
 {
 	struct bpf_prog_aux *aux;
@@ -656,6 +829,16 @@ void bpf_prog_free(struct bpf_prog *fp)
 }
 EXPORT_SYMBOL_GPL(bpf_prog_free);
 
+/* Always built-in helper functions. */
+const struct bpf_func_proto bpf_tail_call_proto = {
+	.func		= NULL,
+	.gpl_only	= false,
+	.ret_type	= RET_VOID,
+	.arg1_type	= ARG_PTR_TO_CTX,
+	.arg2_type	= ARG_CONST_MAP_PTR,
+	.arg3_type	= ARG_ANYTHING,
+};
+
 /* To execute LD_ABS/LD_IND instructions __bpf_prog_run() may call
  * skb_copy_bits(), so provide a weak definition of it for NET-less config.
  */
@@ -12,39 +12,195 @@
 #include <linux/bpf.h>
 #include <linux/jhash.h>
 #include <linux/filter.h>
+#include <linux/rculist_nulls.h>
 #include <linux/vmalloc.h>
+#include "percpu_freelist.h"
+#include "bpf_lru_list.h"
+#include "map_in_map.h"
+
+/* the nulls value of a bucket is its index, a lookup that ends on another
+ * one went through an element moved to another bucket meanwhile
+ */
+struct bucket {
+	struct hlist_nulls_head head;
+	raw_spinlock_t lock;
+};
 
 struct bpf_htab {
 	struct bpf_map map;
-	struct hlist_head *buckets;
-	spinlock_t lock;
-	u32 count;	/* number of elements in this hashtable */
+	struct bucket *buckets;
+	void *elems;		/* preallocated elements, unless BPF_F_NO_PREALLOC */
+	union {
+		struct pcpu_freelist freelist;
+		struct bpf_lru lru;	/* free and in use elements of LRU maps */
+	};
+	atomic_t count;	/* number of elements in this hashtable */
 	u32 n_buckets;	/* number of hash buckets */
 	u32 elem_size;	/* size of each element in bytes */
 };
 
-/* each htab element is struct htab_elem + key + value */
+/* each htab element is struct htab_elem + key + value, where the value of
+ * per-cpu maps is a pointer to the per-cpu area holding the values
+ */
 struct htab_elem {
-	struct hlist_node hash_node;
-	struct rcu_head rcu;
+	struct hlist_nulls_node hash_node;
+	union {
+		struct rcu_head rcu;
+		struct pcpu_freelist_node fnode;
+		struct bpf_lru_node lru_node;
+	};
 	u32 hash;
 	char key[0] __aligned(8);
 };
 
+static bool htab_is_prealloc(const struct bpf_htab *htab)
+{
+	return !(htab->map.map_flags & BPF_F_NO_PREALLOC);
+}
+
+static bool htab_is_percpu(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_PERCPU_HASH;
+}
+
+static bool htab_is_lru(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_LRU_HASH;
+}
+
+static bool htab_is_of_maps(const struct bpf_htab *htab)
+{
+	return htab->map.map_type == BPF_MAP_TYPE_HASH_OF_MAPS;
+}
+
+static inline void htab_elem_set_ptr(struct htab_elem *l, u32 key_size,
+				     void __percpu *pptr)
+{
+	*(void __percpu **)(l->key + round_up(key_size, 8)) = pptr;
+}
+
+static inline void __percpu *htab_elem_get_ptr(struct htab_elem *l, u32 key_size)
+{
+	return *(void __percpu **)(l->key + round_up(key_size, 8));
+}
+
+static struct htab_elem *get_htab_elem(struct bpf_htab *htab, int i)
+{
+	return (struct htab_elem *) (htab->elems + i * htab->elem_size);
+}
+
+/* number of preallocated elements: one per entry, plus one per cpu so that
+ * replacing an element of a full map always finds a spare one.  LRU maps
+ * evict an element instead.
+ */
+static u32 htab_nr_elems(const struct bpf_htab *htab)
+{
+	if (htab_is_lru(htab))
+		return htab->map.max_entries;
+	return htab->map.max_entries + num_possible_cpus();
+}
+
+static void htab_free_elems(struct bpf_htab *htab)
+{
+	int i;
+
+	if (!htab_is_percpu(htab))
+		goto free_elems;
+
+	for (i = 0; i < htab_nr_elems(htab); i++)
+		free_percpu(htab_elem_get_ptr(get_htab_elem(htab, i),
+					      htab->map.key_size));
+free_elems:
+	vfree(htab->elems);
+}
+
+static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node);
+
+static int prealloc_elems_and_freelist(struct bpf_htab *htab)
+{
+	u32 nr_elems = htab_nr_elems(htab);
+	int err = -ENOMEM, i;
+
+	htab->elems = vzalloc(htab->elem_size * nr_elems);
+	if (!htab->elems)
+		return -ENOMEM;
+
+	if (!htab_is_percpu(htab))
+		goto skip_percpu_elems;
+
+	for (i = 0; i < nr_elems; i++) {
+		u32 size = round_up(htab->map.value_size, 8);
+		void __percpu *pptr;
+
+		pptr = __alloc_percpu_gfp(size, 8, GFP_USER | __GFP_NOWARN);
+		if (!pptr)
+			goto free_elems;
+		htab_elem_set_ptr(get_htab_elem(htab, i), htab->map.key_size,
+				  pptr);
+	}
+
+skip_percpu_elems:
+	if (htab_is_lru(htab))
+		err = bpf_lru_init(&htab->lru,
+				   htab->map.map_flags & BPF_F_NO_COMMON_LRU,
+				   offsetof(struct htab_elem, hash) -
+				   offsetof(struct htab_elem, lru_node),
+				   htab_lru_map_delete_node, htab);
+	else
+		err = pcpu_freelist_init(&htab->freelist);
+	if (err)
+		goto free_elems;
+
+	if (htab_is_lru(htab))
+		bpf_lru_populate(&htab->lru, htab->elems,
+				 offsetof(struct htab_elem, lru_node),
+				 htab->elem_size, nr_elems);
+	else
+		pcpu_freelist_populate(&htab->freelist, htab->elems,
+				       htab->elem_size, nr_elems);
+	return 0;
+
+free_elems:
+	htab_free_elems(htab);
+	return err;
+}
+
 /* Called from syscall */
 static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 {
+	bool percpu = attr->map_type == BPF_MAP_TYPE_PERCPU_HASH;
+	bool lru = attr->map_type == BPF_MAP_TYPE_LRU_HASH;
+	/* percpu_lru means each cpu has its own LRU list.
+	 * it is different from BPF_MAP_TYPE_PERCPU_HASH where
+	 * the map's value itself is percpu.
+	 */
+	bool percpu_lru = attr->map_flags & BPF_F_NO_COMMON_LRU;
+	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
 	struct bpf_htab *htab;
+	u64 cost;
 	int err, i;
 
+	if (attr->map_flags & ~(BPF_F_NO_PREALLOC | BPF_F_NO_COMMON_LRU))
+		/* reserved bits should not be used */
+		return ERR_PTR(-EINVAL);
+
+	if (lru && !prealloc)
+		/* LRU maps evict preallocated elements only */
+		return ERR_PTR(-EINVAL);
+
+	if (!lru && percpu_lru)
+		return ERR_PTR(-EINVAL);
+
 	htab = kzalloc(sizeof(*htab), GFP_USER);
 	if (!htab)
 		return ERR_PTR(-ENOMEM);
 
 	/* mandatory map attributes */
+	htab->map.map_type = attr->map_type;
 	htab->map.key_size = attr->key_size;
 	htab->map.value_size = attr->value_size;
 	htab->map.max_entries = attr->max_entries;
+	htab->map.map_flags = attr->map_flags;
 
 	/* check sanity of attributes.
 	 * value_size == 0 may be allowed in the future to use map as a set
@@ -54,6 +210,20 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	    htab->map.value_size == 0)
 		goto free_htab;
 
+	if (percpu_lru) {
+		/* ensure each CPU's lru list has >=1 elements.
+		 * since we are at it, make each lru list has the same
+		 * number of elements.
+		 */
+		htab->map.max_entries = roundup(attr->max_entries,
+						num_possible_cpus());
+		if (htab->map.max_entries < attr->max_entries)
+			htab->map.max_entries = rounddown(attr->max_entries,
+							  num_possible_cpus());
+		if (htab->map.max_entries == 0)
+			goto free_htab;
+	}
+
 	/* hash table size must be power of 2 */
 	htab->n_buckets = roundup_pow_of_two(htab->map.max_entries);
 
@@ -64,32 +234,54 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		 */
 		goto free_htab;
 
+	if (percpu && htab->map.value_size > PCPU_MIN_UNIT_SIZE)
+		/* make sure the per-cpu allocator can satisfy the request */
+		goto free_htab;
+
+	htab->elem_size = sizeof(struct htab_elem) +
+			  round_up(htab->map.key_size, 8);
+	if (percpu)
+		htab->elem_size += sizeof(void *);
+	else
+		htab->elem_size += round_up(htab->map.value_size, 8);
+
 	err = -ENOMEM;
 	/* prevent zero size kmalloc and check for u32 overflow */
 	if (htab->n_buckets == 0 ||
-	    htab->n_buckets > U32_MAX / sizeof(struct hlist_head))
+	    htab->n_buckets > U32_MAX / sizeof(struct bucket))
 		goto free_htab;
 
-	htab->buckets = kmalloc_array(htab->n_buckets, sizeof(struct hlist_head),
+	cost = (u64) htab_nr_elems(htab) * htab->elem_size;
+	if (htab_is_prealloc(htab) && cost >= U32_MAX)
+		/* make sure the preallocated area size fits into u32 */
+		goto free_htab;
+
+	htab->buckets = kmalloc_array(htab->n_buckets, sizeof(struct bucket),
 				      GFP_USER | __GFP_NOWARN);
 
 	if (!htab->buckets) {
-		htab->buckets = vmalloc(htab->n_buckets * sizeof(struct hlist_head));
+		htab->buckets = vmalloc(htab->n_buckets * sizeof(struct bucket));
 		if (!htab->buckets)
 			goto free_htab;
 	}
 
-	for (i = 0; i < htab->n_buckets; i++)
-		INIT_HLIST_HEAD(&htab->buckets[i]);
+	for (i = 0; i < htab->n_buckets; i++) {
+		INIT_HLIST_NULLS_HEAD(&htab->buckets[i].head, i);
+		raw_spin_lock_init(&htab->buckets[i].lock);
+	}
+
+	atomic_set(&htab->count, 0);
 
-	spin_lock_init(&htab->lock);
-	htab->count = 0;
+	if (htab_is_prealloc(htab)) {
+		err = prealloc_elems_and_freelist(htab);
+		if (err)
+			goto free_buckets;
+	}
 
-	htab->elem_size = sizeof(struct htab_elem) +
-			  round_up(htab->map.key_size, 8) +
-			  htab->map.value_size;
 	return &htab->map;
 
+free_buckets:
+	kvfree(htab->buckets);
 free_htab:
 	kfree(htab);
 	return ERR_PTR(err);
@@ -100,29 +292,60 @@ static inline u32 htab_map_hash(const void *key, u32 key_len)
 	return jhash(key, key_len, 0);
 }
 
-static inline struct hlist_head *select_bucket(struct bpf_htab *htab, u32 hash)
+static inline struct bucket *__select_bucket(struct bpf_htab *htab, u32 hash)
 {
 	return &htab->buckets[hash & (htab->n_buckets - 1)];
 }
 
-static struct htab_elem *lookup_elem_raw(struct hlist_head *head, u32 hash,
-					 void *key, u32 key_size)
+static inline struct hlist_nulls_head *select_bucket(struct bpf_htab *htab,
+						     u32 hash)
 {
+	return &__select_bucket(htab, hash)->head;
+}
+
+/* Called with the bucket lock held, or from get_next_key, which at worst
+ * returns a key of another bucket
+ */
+static struct htab_elem *lookup_elem_raw(struct hlist_nulls_head *head,
+					 u32 hash, void *key, u32 key_size)
+{
+	struct hlist_nulls_node *n;
 	struct htab_elem *l;
 
-	hlist_for_each_entry_rcu(l, head, hash_node)
+	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
 		if (l->hash == hash && !memcmp(&l->key, key, key_size))
 			return l;
 
 	return NULL;
 }
 
+/* Lookups under RCU only.  Preallocated elements are reused at once and
+ * may move to another bucket while they are walked, so restart when the
+ * walk does not end on the nulls value of the bucket it started in.
+ */
+static struct htab_elem *lookup_nulls_elem_raw(struct hlist_nulls_head *head,
+					       u32 hash, void *key,
+					       u32 key_size, u32 n_buckets)
+{
+	struct hlist_nulls_node *n;
+	struct htab_elem *l;
+
+again:
+	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
+		if (l->hash == hash && !memcmp(&l->key, key, key_size))
+			return l;
+
+	if (unlikely(get_nulls_value(n) != (hash & (n_buckets - 1))))
+		goto again;
+
+	return NULL;
+}
+
 /* Called from syscall or from eBPF program */
-static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+static struct htab_elem *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
-	struct hlist_head *head;
-	struct htab_elem *l;
+	struct hlist_nulls_head *head;
 	u32 hash, key_size;
 
 	/* Must be called with rcu_read_lock. */
@@ -134,7 +357,13 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 
 	head = select_bucket(htab, hash);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	return lookup_nulls_elem_raw(head, hash, key, key_size,
+				     htab->n_buckets);
+}
+
+static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
 
 	if (l)
 		return l->key + round_up(map->key_size, 8);
@@ -142,12 +371,79 @@ static void *htab_map_lookup_elem(struct bpf_map *map, void *key)
 	return NULL;
 }
 
+/* Called from syscall or from eBPF program, marks the element as recently
+ * used for the next rotation of the LRU lists
+ */
+static void *htab_lru_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
+
+	if (l) {
+		bpf_lru_node_set_ref(&l->lru_node);
+		return l->key + round_up(map->key_size, 8);
+	}
+
+	return NULL;
+}
+
+/* Called from eBPF program, returns the inner map itself */
+static void *htab_of_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct bpf_map **inner_map = htab_map_lookup_elem(map, key);
+
+	if (!inner_map)
+		return NULL;
+
+	return READ_ONCE(*inner_map);
+}
+
+/* Called from eBPF program, which only sees the value of its own cpu */
+static void *htab_percpu_map_lookup_elem(struct bpf_map *map, void *key)
+{
+	struct htab_elem *l = __htab_map_lookup_elem(map, key);
+
+	if (l)
+		return this_cpu_ptr(htab_elem_get_ptr(l, map->key_size));
+
+	return NULL;
+}
+
+/* Called from syscall, gathers the values of all possible cpus */
+int bpf_percpu_hash_copy(struct bpf_map *map, void *key, void *value)
+{
+	struct htab_elem *l;
+	void __percpu *pptr;
+	int ret = -ENOENT;
+	int cpu, off = 0;
+	u32 size;
+
+	/* per_cpu areas are zero-filled and bpf programs can only
+	 * access 'value_size' of them, so copying rounded areas
+	 * will not leak any kernel data
+	 */
+	size = round_up(map->value_size, 8);
+	rcu_read_lock();
+	l = __htab_map_lookup_elem(map, key);
+	if (!l)
+		goto out;
+	pptr = htab_elem_get_ptr(l, map->key_size);
+	for_each_possible_cpu(cpu) {
+		memcpy(value + off, per_cpu_ptr(pptr, cpu), size);
+		off += size;
+	}
+	ret = 0;
+out:
+	rcu_read_unlock();
+	return ret;
+}
+
 /* Called from syscall */
 static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
-	struct hlist_head *head;
-	struct htab_elem *l, *next_l;
+	struct hlist_nulls_head *head;
+	struct hlist_nulls_node *n;
+	struct htab_elem *l;
 	u32 hash, key_size;
 	int i;
 
@@ -168,12 +464,12 @@ static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 	}
 
 	/* key was found, get next key in the same bucket */
-	next_l = hlist_entry_safe(rcu_dereference_raw(hlist_next_rcu(&l->hash_node)),
-				  struct htab_elem, hash_node);
+	n = rcu_dereference_raw(hlist_nulls_next_rcu(&l->hash_node));
 
-	if (next_l) {
+	if (!is_a_nulls(n)) {
 		/* if next elem in this hash list is non-zero, just return it */
-		memcpy(next_key, next_l->key, key_size);
+		l = hlist_nulls_entry(n, struct htab_elem, hash_node);
+		memcpy(next_key, l->key, key_size);
 		return 0;
 	}
 
@@ -187,11 +483,11 @@ find_first_elem:
 		head = select_bucket(htab, i);
 
 		/* pick first element in the bucket */
-		next_l = hlist_entry_safe(rcu_dereference_raw(hlist_first_rcu(head)),
-					  struct htab_elem, hash_node);
-		if (next_l) {
+		n = rcu_dereference_raw(hlist_nulls_first_rcu(head));
+		if (!is_a_nulls(n)) {
 			/* if it's not empty, just return it */
-			memcpy(next_key, next_l->key, key_size);
+			l = hlist_nulls_entry(n, struct htab_elem, hash_node);
+			memcpy(next_key, l->key, key_size);
 			return 0;
 		}
 	}
@@ -200,15 +496,173 @@ find_first_elem:
 	return -ENOENT;
 }
 
-/* Called from syscall or from eBPF program */
-static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
-				u64 map_flags)
+static void htab_elem_free(struct bpf_htab *htab, struct htab_elem *l)
+{
+	if (htab_is_percpu(htab))
+		free_percpu(htab_elem_get_ptr(l, htab->map.key_size));
+	kfree(l);
+}
+
+static void htab_percpu_elem_free_rcu(struct rcu_head *head)
+{
+	struct htab_elem *l = container_of(head, struct htab_elem, rcu);
+
+	free_percpu(htab_elem_get_ptr(l, 0));
+	kfree(l);
+}
+
+/* Called from the LRU lists, with their lock held, to evict an element */
+static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node)
+{
+	struct bpf_htab *htab = (struct bpf_htab *)arg;
+	struct htab_elem *l, *tgt_l;
+	struct hlist_nulls_node *n;
+	unsigned long flags;
+	struct bucket *b;
+	bool found = false;
+
+	tgt_l = container_of(node, struct htab_elem, lru_node);
+	b = __select_bucket(htab, tgt_l->hash);
+
+	raw_spin_lock_irqsave(&b->lock, flags);
+
+	hlist_nulls_for_each_entry(l, n, &b->head, hash_node)
+		if (l == tgt_l) {
+			hlist_nulls_del_rcu(&l->hash_node);
+			atomic_dec(&htab->count);
+			found = true;
+			break;
+		}
+
+	raw_spin_unlock_irqrestore(&b->lock, flags);
+
+	return found;
+}
+
+/* Drop the reference a map of maps holds on the inner map of an element */
+static void htab_put_fd_value(struct bpf_htab *htab, struct htab_elem *l)
+{
+	void **inner_map;
+
+	if (!htab_is_of_maps(htab))
+		return;
+
+	inner_map = (void *)(l->key + round_up(htab->map.key_size, 8));
+	htab->map.ops->map_fd_put_ptr(*inner_map);
+}
+
+/* Give an element unlinked from its bucket back.  Preallocated elements
+ * go straight back to the free list: a concurrent lookup that still walks
+ * through one never leaves the preallocated area, and restarts if the
+ * element was meanwhile added to another bucket.
+ * The LRU lists take their own lock before the bucket locks, so elements
+ * of LRU maps must be released once the bucket is unlocked.
+ */
+static void htab_elem_release(struct bpf_htab *htab, struct htab_elem *l)
+{
+	if (htab_is_lru(htab)) {
+		bpf_lru_push_free(&htab->lru, &l->lru_node);
+	} else if (htab_is_prealloc(htab)) {
+		pcpu_freelist_push(&htab->freelist, &l->fnode);
+	} else if (htab_is_percpu(htab)) {
+		/* the rcu callback does not know the key size: move the per-cpu
+		 * pointer over the key, which lookups racing with the removal
+		 * then merely fail to match
+		 */
+		htab_elem_set_ptr(l, 0, htab_elem_get_ptr(l, htab->map.key_size));
+		call_rcu(&l->rcu, htab_percpu_elem_free_rcu);
+	} else {
+		kfree_rcu(l, rcu);
+	}
+}
+
+static void pcpu_copy_value(struct bpf_htab *htab, void __percpu *pptr,
+			    void *value, bool onallcpus, bool new)
+{
+	u32 size = round_up(htab->map.value_size, 8);
+	int off = 0, cpu;
+
+	if (!onallcpus) {
+		/* a new element must not show stale values on other cpus */
+		if (new)
+			for_each_possible_cpu(cpu)
+				memset(per_cpu_ptr(pptr, cpu), 0, size);
+		memcpy(this_cpu_ptr(pptr), value, htab->map.value_size);
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		memcpy(per_cpu_ptr(pptr, cpu), value + off, size);
+		off += size;
+	}
+}
+
+static struct htab_elem *alloc_htab_elem(struct bpf_htab *htab, void *key,
+					 u32 hash)
+{
+	u32 key_size = htab->map.key_size;
+	struct htab_elem *l_new;
+
+	if (htab_is_lru(htab)) {
+		struct bpf_lru_node *node;
+
+		/* evicts the coldest element when there is no free one */
+		node = bpf_lru_pop_free(&htab->lru, hash);
+		if (!node)
+			return ERR_PTR(-ENOMEM);
+		l_new = container_of(node, struct htab_elem, lru_node);
+	} else if (htab_is_prealloc(htab)) {
+		struct pcpu_freelist_node *l;
+
+		l = pcpu_freelist_pop(&htab->freelist);
+		if (!l)
+			return ERR_PTR(-E2BIG);
+		l_new = container_of(l, struct htab_elem, fnode);
+	} else {
+		l_new = kmalloc(htab->elem_size, GFP_ATOMIC | __GFP_NOWARN);
+		if (!l_new)
+			return ERR_PTR(-ENOMEM);
+
+		if (htab_is_percpu(htab)) {
+			void __percpu *pptr;
+
+			pptr = __alloc_percpu_gfp(round_up(htab->map.value_size, 8),
+						  8, GFP_ATOMIC | __GFP_NOWARN);
+			if (!pptr) {
+				kfree(l_new);
+				return ERR_PTR(-ENOMEM);
+			}
+			htab_elem_set_ptr(l_new, key_size, pptr);
+		}
+	}
+
+	memcpy(l_new->key, key, key_size);
+	l_new->hash = hash;
+	return l_new;
+}
+
+static int check_flags(struct htab_elem *l_old, u64 map_flags)
+{
+	if (l_old && map_flags == BPF_NOEXIST)
+		/* elem already exists */
+		return -EEXIST;
+
+	if (!l_old && map_flags == BPF_EXIST)
+		/* elem doesn't exist, cannot update it */
+		return -ENOENT;
+
+	return 0;
+}
+
+static int __htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				  u64 map_flags, bool onallcpus)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	bool percpu = htab_is_percpu(htab);
 	struct htab_elem *l_new, *l_old;
-	struct hlist_head *head;
+	u32 key_size, value_size, hash;
+	struct bucket *b;
 	unsigned long flags;
-	u32 key_size;
 	int ret;
 
 	if (map_flags > BPF_EXIST)
@@ -217,61 +671,105 @@ static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 
 	WARN_ON_ONCE(!rcu_read_lock_held());
 
-	/* allocate new element outside of lock */
-	l_new = kmalloc(htab->elem_size, GFP_ATOMIC);
-	if (!l_new)
-		return -ENOMEM;
-
 	key_size = map->key_size;
 
-	memcpy(l_new->key, key, key_size);
-	memcpy(l_new->key + round_up(key_size, 8), value, map->value_size);
+	hash = htab_map_hash(key, key_size);
+
+	/* allocate new element outside of the bucket lock, the per-cpu
+	 * allocator must not be entered under a raw spinlock.  Per-cpu
+	 * values are updated in place when the key already exists, the new
+	 * element is given back then.
+	 */
+	l_new = alloc_htab_elem(htab, key, hash);
+	if (IS_ERR(l_new))
+		return PTR_ERR(l_new);
 
-	l_new->hash = htab_map_hash(l_new->key, key_size);
+	if (percpu) {
+		pcpu_copy_value(htab, htab_elem_get_ptr(l_new, key_size),
+				value, onallcpus, true);
+	} else {
+		/* maps of maps store the inner map pointer, not the fd */
+		value_size = htab_is_of_maps(htab) ? sizeof(void *) :
+						     map->value_size;
+		memcpy(l_new->key + round_up(key_size, 8), value, value_size);
+	}
 
-	/* bpf_map_update_elem() can be called in_irq() */
-	spin_lock_irqsave(&htab->lock, flags);
+	b = __select_bucket(htab, hash);
 
-	head = select_bucket(htab, l_new->hash);
+	/* bpf_map_update_elem() can be called in_irq() */
+	raw_spin_lock_irqsave(&b->lock, flags);
 
-	l_old = lookup_elem_raw(head, l_new->hash, key, key_size);
+	l_old = lookup_elem_raw(&b->head, hash, key, key_size);
 
-	if (!l_old && unlikely(htab->count >= map->max_entries)) {
-		/* if elem with this 'key' doesn't exist and we've reached
-		 * max_entries limit, fail insertion of new elem
-		 */
-		ret = -E2BIG;
+	ret = check_flags(l_old, map_flags);
+	if (ret)
 		goto err;
-	}
 
-	if (l_old && map_flags == BPF_NOEXIST) {
-		/* elem already exists */
-		ret = -EEXIST;
+	if (percpu && l_old) {
+		/* ret is 0, only l_new has to go */
+		pcpu_copy_value(htab, htab_elem_get_ptr(l_old, key_size),
+				value, onallcpus, false);
 		goto err;
 	}
 
-	if (!l_old && map_flags == BPF_EXIST) {
-		/* elem doesn't exist, cannot update it */
-		ret = -ENOENT;
+	if (!l_old && atomic_inc_return(&htab->count) > map->max_entries &&
+	    !htab_is_lru(htab)) {
+		/* if elem with this 'key' doesn't exist and we've reached
+		 * max_entries limit, fail insertion of new elem.  LRU maps
+		 * made room when allocating the new one.
+		 */
+		atomic_dec(&htab->count);
+		ret = -E2BIG;
 		goto err;
 	}
 
 	/* add new element to the head of the list, so that concurrent
 	 * search will find it before old elem
 	 */
-	hlist_add_head_rcu(&l_new->hash_node, head);
+	hlist_nulls_add_head_rcu(&l_new->hash_node, &b->head);
+	if (l_old)
+		hlist_nulls_del_rcu(&l_old->hash_node);
+	raw_spin_unlock_irqrestore(&b->lock, flags);
 	if (l_old) {
-		hlist_del_rcu(&l_old->hash_node);
-		kfree_rcu(l_old, rcu);
-	} else {
-		htab->count++;
+		htab_put_fd_value(htab, l_old);
+		htab_elem_release(htab, l_old);
 	}
-	spin_unlock_irqrestore(&htab->lock, flags);
-
 	return 0;
 err:
-	spin_unlock_irqrestore(&htab->lock, flags);
-	kfree(l_new);
+	raw_spin_unlock_irqrestore(&b->lock, flags);
+	htab_elem_release(htab, l_new);
+	return ret;
+}
+
+/* Called from syscall or from eBPF program */
+static int htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				u64 map_flags)
+{
+	return __htab_map_update_elem(map, key, value, map_flags, false);
+}
+
+/* Called from syscall, sets the values of all possible cpus at once */
+int bpf_percpu_hash_update(struct bpf_map *map, void *key, void *value,
+			   u64 map_flags)
+{
+	return __htab_map_update_elem(map, key, value, map_flags, true);
+}
+
+/* Called from syscall, the value is the fd of the inner map to store */
+int bpf_fd_htab_map_update_elem(struct bpf_map *map, void *key, void *value,
+				u64 map_flags)
+{
+	void *inner_map;
+	int ret;
+
+	inner_map = map->ops->map_fd_get_ptr(map, *(u32 *)value);
+	if (IS_ERR(inner_map))
+		return PTR_ERR(inner_map);
+
+	ret = htab_map_update_elem(map, key, &inner_map, map_flags);
+	if (ret)
+		map->ops->map_fd_put_ptr(inner_map);
+
 	return ret;
 }
 
@@ -279,10 +777,10 @@ err:
 static int htab_map_delete_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
-	struct hlist_head *head;
 	struct htab_elem *l;
 	unsigned long flags;
 	u32 hash, key_size;
+	struct bucket *b;
 	int ret = -ENOENT;
 
 	WARN_ON_ONCE(!rcu_read_lock_held());
@@ -291,20 +789,24 @@ static int htab_map_delete_elem(struct bpf_map *map, void *key)
 
 	hash = htab_map_hash(key, key_size);
 
-	spin_lock_irqsave(&htab->lock, flags);
+	b = __select_bucket(htab, hash);
 
-	head = select_bucket(htab, hash);
+	raw_spin_lock_irqsave(&b->lock, flags);
 
-	l = lookup_elem_raw(head, hash, key, key_size);
+	l = lookup_elem_raw(&b->head, hash, key, key_size);
 
 	if (l) {
-		hlist_del_rcu(&l->hash_node);
-		htab->count--;
-		kfree_rcu(l, rcu);
+		hlist_nulls_del_rcu(&l->hash_node);
+		atomic_dec(&htab->count);
 		ret = 0;
 	}
 
-	spin_unlock_irqrestore(&htab->lock, flags);
+	raw_spin_unlock_irqrestore(&b->lock, flags);
+
+	if (l) {
+		htab_put_fd_value(htab, l);
+		htab_elem_release(htab, l);
+	}
 	return ret;
 }
 
@@ -313,18 +815,33 @@ static void delete_all_elements(struct bpf_htab *htab)
 	int i;
 
 	for (i = 0; i < htab->n_buckets; i++) {
-		struct hlist_head *head = select_bucket(htab, i);
-		struct hlist_node *n;
+		struct hlist_nulls_head *head = select_bucket(htab, i);
 		struct htab_elem *l;
 
-		hlist_for_each_entry_safe(l, n, head, hash_node) {
-			hlist_del_rcu(&l->hash_node);
-			htab->count--;
-			kfree(l);
+		while (!hlist_nulls_empty(head)) {
+			l = hlist_nulls_entry(head->first, struct htab_elem,
+					      hash_node);
+			hlist_nulls_del_rcu(&l->hash_node);
+			atomic_dec(&htab->count);
+			htab_elem_free(htab, l);
 		}
 	}
 }
 
+static void htab_free_fd_values(struct bpf_htab *htab)
+{
+	int i;
+
+	for (i = 0; i < htab->n_buckets; i++) {
+		struct hlist_nulls_head *head = select_bucket(htab, i);
+		struct hlist_nulls_node *n;
+		struct htab_elem *l;
+
+		hlist_nulls_for_each_entry(l, n, head, hash_node)
+			htab_put_fd_value(htab, l);
+	}
+}
+
 /* Called when map->refcnt goes to zero, either from workqueue or from syscall */
 static void htab_map_free(struct bpf_map *map)
 {
@@ -340,7 +857,20 @@ static void htab_map_free(struct bpf_map *map)
 	/* some of kfree_rcu() callbacks for elements of this map may not have
 	 * executed. It's ok. Proceed to free residual elements and map itself
 	 */
-	delete_all_elements(htab);
+	if (htab_is_of_maps(htab)) {
+		htab_free_fd_values(htab);
+		bpf_map_meta_free(map->inner_map_meta);
+	}
+
+	if (htab_is_lru(htab)) {
+		htab_free_elems(htab);
+		bpf_lru_destroy(&htab->lru);
+	} else if (htab_is_prealloc(htab)) {
+		htab_free_elems(htab);
+		pcpu_freelist_destroy(&htab->freelist);
+	} else {
+		delete_all_elements(htab);
+	}
 	kvfree(htab->buckets);
 	kfree(htab);
 }
@@ -359,9 +889,81 @@ static struct bpf_map_type_list tl = {
 	.type = BPF_MAP_TYPE_HASH,
 };
 
+static struct bpf_map_ops htab_percpu_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_percpu_map_lookup_elem,
+	.map_update_elem = htab_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list percpu_tl = {
+	.ops = &htab_percpu_ops,
+	.type = BPF_MAP_TYPE_PERCPU_HASH,
+};
+
+static struct bpf_map_ops htab_lru_ops = {
+	.map_alloc = htab_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_lru_map_lookup_elem,
+	.map_update_elem = htab_map_update_elem,
+	.map_delete_elem = htab_map_delete_elem,
+};
+
+static struct bpf_map_type_list lru_tl = {
+	.ops = &htab_lru_ops,
+	.type = BPF_MAP_TYPE_LRU_HASH,
+};
+
+static struct bpf_map *htab_of_map_alloc(union bpf_attr *attr)
+{
+	struct bpf_map *map, *inner_map_meta;
+
+	/* user space passes the fd of the inner map as value */
+	if (attr->value_size != sizeof(u32))
+		return ERR_PTR(-EINVAL);
+
+	inner_map_meta = bpf_map_meta_alloc(attr->inner_map_fd);
+	if (IS_ERR(inner_map_meta))
+		return inner_map_meta;
+
+	map = htab_map_alloc(attr);
+	if (IS_ERR(map)) {
+		bpf_map_meta_free(inner_map_meta);
+		return map;
+	}
+
+	map->inner_map_meta = inner_map_meta;
+
+	return map;
+}
+
+/* updates go through bpf_fd_htab_map_update_elem(), programs may only
+ * look inner maps up
+ */
+static struct bpf_map_ops htab_of_maps_ops = {
+	.map_alloc = htab_of_map_alloc,
+	.map_free = htab_map_free,
+	.map_get_next_key = htab_map_get_next_key,
+	.map_lookup_elem = htab_of_map_lookup_elem,
+	.map_delete_elem = htab_map_delete_elem,
+	.map_fd_get_ptr = bpf_map_fd_get_ptr,
+	.map_fd_put_ptr = bpf_map_fd_put_ptr,
+};
+
+static struct bpf_map_type_list of_maps_tl = {
+	.ops = &htab_of_maps_ops,
+	.type = BPF_MAP_TYPE_HASH_OF_MAPS,
+};
+
 static int __init register_htab_map(void)
 {
 	bpf_register_map_type(&tl);
+	bpf_register_map_type(&percpu_tl);
+	bpf_register_map_type(&lru_tl);
+	bpf_register_map_type(&of_maps_tl);
 	return 0;
 }
 late_initcall(register_htab_map);
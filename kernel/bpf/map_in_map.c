@@ -0,0 +1,101 @@
+/*
+ * Helpers for maps whose values are other maps
+ *
+ * An outer map is created from a template inner map and only accepts
+ * inner maps of the same type, key and value sizes and flags, so that the
+ * verifier can check the accesses a program makes through any of them
+ * against the template alone.  The outer map holds a reference on each
+ * of its inner maps; a program looking one up under rcu_read_lock() keeps
+ * using it after it was replaced, since freeing a map waits for a grace
+ * period first.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/slab.h>
+#include <linux/bpf.h>
+
+#include "map_in_map.h"
+
+/* Copy what the verifier needs to know of the template inner map */
+struct bpf_map *bpf_map_meta_alloc(int inner_map_ufd)
+{
+	struct bpf_map *inner_map, *inner_map_meta;
+	struct fd f;
+
+	f = fdget(inner_map_ufd);
+	inner_map = bpf_map_get(f);
+	if (IS_ERR(inner_map))
+		return inner_map;
+
+	/* one level of nesting only, and program arrays need an owner
+	 * program type the template cannot carry
+	 */
+	if (bpf_map_is_of_maps(inner_map) ||
+	    inner_map->map_type == BPF_MAP_TYPE_PROG_ARRAY) {
+		fdput(f);
+		return ERR_PTR(-EINVAL);
+	}
+
+	inner_map_meta = kzalloc(sizeof(*inner_map_meta), GFP_USER);
+	if (!inner_map_meta) {
+		fdput(f);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	inner_map_meta->map_type = inner_map->map_type;
+	inner_map_meta->key_size = inner_map->key_size;
+	inner_map_meta->value_size = inner_map->value_size;
+	inner_map_meta->map_flags = inner_map->map_flags;
+	inner_map_meta->ops = inner_map->ops;
+	inner_map_meta->max_entries = inner_map->max_entries;
+
+	fdput(f);
+	return inner_map_meta;
+}
+
+void bpf_map_meta_free(struct bpf_map *map_meta)
+{
+	kfree(map_meta);
+}
+
+bool bpf_map_meta_equal(const struct bpf_map *meta0,
+			const struct bpf_map *meta1)
+{
+	/* No need to compare ops because it is covered by map_type */
+	return meta0->map_type == meta1->map_type &&
+		meta0->key_size == meta1->key_size &&
+		meta0->value_size == meta1->value_size &&
+		meta0->map_flags == meta1->map_flags;
+}
+
+/* Called from syscall: take a reference on the map behind @ufd if it can
+ * be stored in the outer map @map
+ */
+void *bpf_map_fd_get_ptr(struct bpf_map *map, int ufd)
+{
+	struct bpf_map *inner_map;
+	struct fd f;
+
+	f = fdget(ufd);
+	inner_map = bpf_map_get(f);
+	if (IS_ERR(inner_map))
+		return inner_map;
+
+	if (bpf_map_meta_equal(map->inner_map_meta, inner_map))
+		atomic_inc(&inner_map->refcnt);
+	else
+		inner_map = ERR_PTR(-EINVAL);
+
+	fdput(f);
+	return inner_map;
+}
+
+void bpf_map_fd_put_ptr(void *ptr)
+{
+	/* the map is freed from a workqueue after a grace period, programs
+	 * that looked it up before it was replaced can keep using it
+	 */
+	bpf_map_put(ptr);
+}
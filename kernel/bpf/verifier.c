@@ -188,6 +188,25 @@ struct verifier_stack_elem {
 
 #define MAX_USED_MAPS 64 /* max number of maps accessed by one eBPF program */
 
+/* what the verifier learned about one instruction over all the paths that
+ * reached it, used to simplify the program once it is proven safe
+ */
+struct bpf_insn_aux_data {
+	bool seen;		/* reached by at least one path */
+	u8 jmp_dir;		/* JMP_DIR_* a conditional jump went */
+	u8 src_state;		/* SRC_* of the source register */
+	int src_imm;		/* its value when SRC_CONST */
+};
+
+#define JMP_DIR_TAKEN		1
+#define JMP_DIR_FALLTHROUGH	2
+
+enum {
+	SRC_UNSEEN,		/* no path read the source register yet */
+	SRC_CONST,		/* same CONST_IMM on every path so far */
+	SRC_VARIES,		/* anything else */
+};
+
 /* single container for all structs
  * one verifier_env per bpf_check() call
  */
@@ -199,6 +218,7 @@ struct verifier_env {
 	struct verifier_state_list **explored_states; /* search pruning optimization */
 	struct bpf_map *used_maps[MAX_USED_MAPS]; /* array of map's used by eBPF program */
 	u32 used_map_cnt;		/* number of used maps */
+	struct bpf_insn_aux_data *insn_aux_data; /* per-instruction facts */
 };
 
 /* verbose verifier prints what it's seeing
@@ -770,6 +790,8 @@ static int check_func_arg(struct verifier_env *env, u32 regno,
 		expected_type = CONST_IMM;
 	} else if (arg_type == ARG_CONST_MAP_PTR) {
 		expected_type = CONST_PTR_TO_MAP;
+	} else if (arg_type == ARG_PTR_TO_CTX) {
+		expected_type = PTR_TO_CTX;
 	} else {
 		verbose("unsupported arg_type %d\n", arg_type);
 		return -EFAULT;
@@ -874,6 +896,24 @@ static int check_call(struct verifier_env *env, int func_id)
 	if (err)
 		return err;
 
+	/* maps of maps are filled from user space, programs only pick
+	 * their inner maps
+	 */
+	if (map && map->inner_map_meta &&
+	    func_id != BPF_FUNC_map_lookup_elem) {
+		verbose("cannot pass map_type %d into func %d\n",
+			map->map_type, func_id);
+		return -EINVAL;
+	}
+
+	/* program arrays are only reachable through bpf_tail_call() */
+	if ((map && map->map_type == BPF_MAP_TYPE_PROG_ARRAY) !=
+	    (func_id == BPF_FUNC_tail_call)) {
+		verbose("cannot pass map_type %d into func %d\n",
+			map ? map->map_type : BPF_MAP_TYPE_UNSPEC, func_id);
+		return -EINVAL;
+	}
+
 	/* reset caller saved regs */
 	for (i = 0; i < CALLER_SAVED_REGS; i++) {
 		reg = regs + caller_saved[i];
@@ -905,6 +945,21 @@ static int check_call(struct verifier_env *env, int func_id)
 	return 0;
 }
 
+/* a non-NULL lookup result points to a value, or to an inner map when
+ * looking up a map of maps
+ */
+static void mark_map_reg(struct reg_state *regs, u32 regno)
+{
+	struct reg_state *reg = &regs[regno];
+
+	if (reg->map_ptr->inner_map_meta) {
+		reg->type = CONST_PTR_TO_MAP;
+		reg->map_ptr = reg->map_ptr->inner_map_meta;
+	} else {
+		reg->type = PTR_TO_MAP_VALUE;
+	}
+}
+
 /* check validity of 32-bit and 64-bit arithmetic operations */
 static int check_alu_op(struct reg_state *regs, struct bpf_insn *insn)
 {
@@ -1078,6 +1133,7 @@ static int check_cond_jmp_op(struct verifier_env *env,
 			/* if (imm == imm) goto pc+off;
 			 * only follow the goto, ignore fall-through
 			 */
+			env->insn_aux_data[*insn_idx].jmp_dir |= JMP_DIR_TAKEN;
 			*insn_idx += insn->off;
 			return 0;
 		} else {
@@ -1085,6 +1141,7 @@ static int check_cond_jmp_op(struct verifier_env *env,
 			 * only follow fall-through branch, since
 			 * that's where the program will go
 			 */
+			env->insn_aux_data[*insn_idx].jmp_dir |= JMP_DIR_FALLTHROUGH;
 			return 0;
 		}
 	}
@@ -1092,6 +1149,8 @@ static int check_cond_jmp_op(struct verifier_env *env,
 	other_branch = push_stack(env, *insn_idx + insn->off + 1, *insn_idx);
 	if (!other_branch)
 		return -EFAULT;
+	env->insn_aux_data[*insn_idx].jmp_dir |= JMP_DIR_TAKEN |
+						 JMP_DIR_FALLTHROUGH;
 
 	/* detect if R == 0 where R is returned value from bpf_map_lookup_elem() */
 	if (BPF_SRC(insn->code) == BPF_K &&
@@ -1102,12 +1161,12 @@ static int check_cond_jmp_op(struct verifier_env *env,
 			/* next fallthrough insn can access memory via
 			 * this register
 			 */
-			regs[insn->dst_reg].type = PTR_TO_MAP_VALUE;
+			mark_map_reg(regs, insn->dst_reg);
 			/* branch targer cannot access it, since reg == 0 */
 			other_branch->regs[insn->dst_reg].type = CONST_IMM;
 			other_branch->regs[insn->dst_reg].imm = 0;
 		} else {
-			other_branch->regs[insn->dst_reg].type = PTR_TO_MAP_VALUE;
+			mark_map_reg(other_branch->regs, insn->dst_reg);
 			regs[insn->dst_reg].type = CONST_IMM;
 			regs[insn->dst_reg].imm = 0;
 		}
@@ -1542,6 +1601,34 @@ static int is_state_visited(struct verifier_env *env, int insn_idx)
 	return 0;
 }
 
+/* remember whether the source register of an ALU or jump instruction held
+ * the same constant every time it was reached
+ */
+static void record_src_reg(struct verifier_env *env, int insn_idx)
+{
+	struct bpf_insn_aux_data *aux = &env->insn_aux_data[insn_idx];
+	struct bpf_insn *insn = &env->prog->insnsi[insn_idx];
+	struct reg_state *reg;
+
+	if (BPF_SRC(insn->code) != BPF_X || insn->src_reg >= MAX_BPF_REG)
+		return;
+
+	/* BPF_END reuses the source bit for its direction */
+	if (BPF_CLASS(insn->code) != BPF_JMP &&
+	    (BPF_OP(insn->code) == BPF_END || BPF_OP(insn->code) == BPF_NEG))
+		return;
+
+	reg = &env->cur_state.regs[insn->src_reg];
+	if (reg->type != CONST_IMM) {
+		aux->src_state = SRC_VARIES;
+	} else if (aux->src_state == SRC_UNSEEN) {
+		aux->src_state = SRC_CONST;
+		aux->src_imm = reg->imm;
+	} else if (aux->src_state == SRC_CONST && aux->src_imm != reg->imm) {
+		aux->src_state = SRC_VARIES;
+	}
+}
+
 static int do_check(struct verifier_env *env)
 {
 	struct verifier_state *state = &env->cur_state;
@@ -1600,7 +1687,14 @@ static int do_check(struct verifier_env *env)
 			print_bpf_insn(insn);
 		}
 
+		/* paths pruned above ended in a state at least as general
+		 * as one explored from here, so whatever that one recorded
+		 * below also holds for them
+		 */
+		env->insn_aux_data[insn_idx].seen = true;
+
 		if (class == BPF_ALU || class == BPF_ALU64) {
+			record_src_reg(env, insn_idx);
 			err = check_alu_op(regs, insn);
 			if (err)
 				return err;
@@ -1733,6 +1827,7 @@ process_bpf_exit:
 					continue;
 				}
 			} else {
+				record_src_reg(env, insn_idx);
 				err = check_cond_jmp_op(env, insn, &insn_idx);
 				if (err)
 					return err;
@@ -1751,6 +1846,7 @@ process_bpf_exit:
 					return err;
 
 				insn_idx++;
+				env->insn_aux_data[insn_idx].seen = true;
 			} else {
 				verbose("invalid BPF_LD mode\n");
 				return -EINVAL;
@@ -1867,6 +1963,122 @@ static void convert_pseudo_ld_imm64(struct verifier_env *env)
 			insn->src_reg = 0;
 }
 
+static bool insn_is_cond_jmp(const struct bpf_insn *insn)
+{
+	u8 opcode = BPF_OP(insn->code);
+
+	return BPF_CLASS(insn->code) == BPF_JMP && opcode != BPF_JA &&
+	       opcode != BPF_CALL && opcode != BPF_EXIT;
+}
+
+/* turn register operands that held the same constant on every path into
+ * immediates, and jumps that always went the same way into unconditional
+ * ones, so that neither the interpreter nor the JIT has to compare at run
+ * time what the verifier already proved
+ */
+static void fold_constants(struct verifier_env *env)
+{
+	struct bpf_insn *insn = env->prog->insnsi;
+	int insn_cnt = env->prog->len;
+	int i;
+
+	for (i = 0; i < insn_cnt; i++, insn++) {
+		struct bpf_insn_aux_data *aux = &env->insn_aux_data[i];
+		u8 class = BPF_CLASS(insn->code);
+		u8 opcode = BPF_OP(insn->code);
+
+		if (!aux->seen)
+			continue;
+
+		/* the immediate of 64-bit operations is sign extended, while
+		 * CONST_IMM does not tell whether a negative constant came
+		 * from a 32-bit move, so only fold those when non-negative.
+		 * A zero divisor makes the program return 0 at run time and
+		 * has no immediate form.
+		 */
+		if (aux->src_state == SRC_CONST &&
+		    (class == BPF_ALU || aux->src_imm >= 0) &&
+		    !((opcode == BPF_DIV || opcode == BPF_MOD) &&
+		      aux->src_imm == 0)) {
+			insn->code = class | opcode | BPF_K;
+			insn->src_reg = 0;
+			insn->imm = aux->src_imm;
+		}
+
+		if (insn_is_cond_jmp(insn) && aux->jmp_dir == JMP_DIR_TAKEN) {
+			insn->code = BPF_JMP | BPF_JA;
+			insn->dst_reg = 0;
+			insn->src_reg = 0;
+			insn->imm = 0;
+		}
+	}
+}
+
+static bool insn_is_dead(struct verifier_env *env, int insn_idx)
+{
+	struct bpf_insn_aux_data *aux = &env->insn_aux_data[insn_idx];
+	struct bpf_insn *insn = &env->prog->insnsi[insn_idx];
+
+	if (!aux->seen)
+		return true;
+	if (insn_is_cond_jmp(insn))
+		return aux->jmp_dir == JMP_DIR_FALLTHROUGH;
+	return insn->code == (BPF_JMP | BPF_JA) && insn->off == 0;
+}
+
+/* drop instructions no path reaches, jumps that were never taken and jumps
+ * to the next instruction, then fix up the offsets of the remaining jumps.
+ * A removed instruction that is the target of a jump either was never
+ * reached or falls through, so the jump moves on to the next kept one.
+ */
+static int remove_dead_code(struct verifier_env *env)
+{
+	struct bpf_prog *prog = env->prog;
+	struct bpf_insn *insn = prog->insnsi;
+	int insn_cnt = prog->len;
+	int i, new_cnt = 0;
+	u32 *new_idx;
+
+	new_idx = kcalloc(insn_cnt + 1, sizeof(u32), GFP_USER);
+	if (!new_idx)
+		return -ENOMEM;
+
+	for (i = 0; i < insn_cnt; i++) {
+		new_idx[i] = new_cnt;
+		if (!insn_is_dead(env, i))
+			new_cnt++;
+	}
+	new_idx[insn_cnt] = new_cnt;
+
+	if (new_cnt == insn_cnt)
+		goto out;
+
+	/* instructions only move backwards, so rewriting in place never
+	 * overwrites one that is still to be looked at
+	 */
+	for (i = 0; i < insn_cnt; i++) {
+		u8 opcode = BPF_OP(insn[i].code);
+
+		if (insn_is_dead(env, i))
+			continue;
+
+		if (BPF_CLASS(insn[i].code) == BPF_JMP &&
+		    opcode != BPF_CALL && opcode != BPF_EXIT)
+			insn[i].off = new_idx[i + insn[i].off + 1] -
+				      new_idx[i] - 1;
+
+		insn[new_idx[i]] = insn[i];
+	}
+
+	if (log_level)
+		verbose("removed %d of %d insns\n", insn_cnt - new_cnt,
+			insn_cnt);
+	prog->len = new_cnt;
+out:
+	kfree(new_idx);
+	return 0;
+}
+
 static void free_states(struct verifier_env *env)
 {
 	struct verifier_state_list *sl, *sln;
@@ -1907,6 +2119,14 @@ int bpf_check(struct bpf_prog *prog, union bpf_attr *attr)
 
 	env->prog = prog;
 
+	/* facts about each instruction collected during do_check() */
+	env->insn_aux_data = vzalloc(sizeof(struct bpf_insn_aux_data) *
+				     prog->len);
+	if (!env->insn_aux_data) {
+		kfree(env);
+		return -ENOMEM;
+	}
+
 	/* grab the mutex to protect few globals used by verifier */
 	mutex_lock(&bpf_verifier_lock);
 
@@ -1954,6 +2174,12 @@ skip_full_check:
 	while (pop_stack(env, NULL) >= 0);
 	free_states(env);
 
+	if (ret == 0) {
+		/* program is safe, simplify it with what do_check() learned */
+		fold_constants(env);
+		ret = remove_dead_code(env);
+	}
+
 	if (log_level && log_len >= log_size - 1) {
 		BUG_ON(log_len >= log_size);
 		/* verifier log exceeded user supplied buffer */
@@ -1997,6 +2223,7 @@ free_env:
 		 * them now. Otherwise free_bpf_prog_info() will release them.
 		 */
 		release_maps(env);
+	vfree(env->insn_aux_data);
 	kfree(env);
 	mutex_unlock(&bpf_verifier_lock);
 	return ret;
@@ -42,6 +42,8 @@
 #include <linux/module.h>
 #include <linux/mman.h>
 #include <linux/compat.h>
+#include <linux/bpf.h>
+#include <linux/filter.h>
 
 #include "internal.h"
 
@@ -3402,6 +3404,7 @@ errout:
 }
 
 static void perf_event_free_filter(struct perf_event *event);
+static void perf_event_free_bpf_prog(struct perf_event *event);
 
 static void free_event_rcu(struct rcu_head *head)
 {
@@ -3461,6 +3464,8 @@ static void __free_event(struct perf_event *event)
 			put_callchain_buffers();
 	}
 
+	perf_event_free_bpf_prog(event);
+
 	if (event->destroy)
 		event->destroy(event);
 
@@ -3927,6 +3932,7 @@ static inline int perf_fget_light(int fd, struct fd *p)
 static int perf_event_set_output(struct perf_event *event,
 				 struct perf_event *output_event);
 static int perf_event_set_filter(struct perf_event *event, void __user *arg);
+static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd);
 
 static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned long arg)
 {
@@ -3980,6 +3986,9 @@ static long _perf_ioctl(struct perf_event *event, unsigned int cmd, unsigned lon
 	case PERF_EVENT_IOC_SET_FILTER:
 		return perf_event_set_filter(event, (void __user *)arg);
 
+	case PERF_EVENT_IOC_SET_BPF:
+		return perf_event_set_bpf_prog(event, arg);
+
 	default:
 		return -ENOTTY;
 	}
@@ -6449,6 +6458,64 @@ static void perf_event_free_filter(struct perf_event *event)
 	ftrace_profile_free_filter(event);
 }
 
+/*
+ * Attach an eBPF program to the trace event behind @event.  The program
+ * runs for every hit of the event, before any perf buffer is filled, and
+ * the event is only recorded when it returns non-zero.  There is a single
+ * program per trace event, shared by all the perf events opened on it.
+ */
+static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd)
+{
+	struct ftrace_event_call *call;
+	enum bpf_prog_type type;
+	struct bpf_prog *prog;
+
+	if (event->attr.type != PERF_TYPE_TRACEPOINT)
+		return -EINVAL;
+
+	if (event->prog)
+		return -EEXIST;
+
+	call = event->tp_event;
+	if (call->flags & TRACE_EVENT_FL_KPROBE)
+		type = BPF_PROG_TYPE_KPROBE;
+	else if (call->flags & TRACE_EVENT_FL_TRACEPOINT)
+		type = BPF_PROG_TYPE_TRACEPOINT;
+	else
+		/* syscall and ftrace internal events have no program type */
+		return -EINVAL;
+
+	prog = bpf_prog_get(prog_fd);
+	if (IS_ERR(prog))
+		return PTR_ERR(prog);
+
+	if (prog->aux->prog_type != type) {
+		bpf_prog_put(prog);
+		return -EINVAL;
+	}
+
+	if (cmpxchg(&call->prog, NULL, prog) != NULL) {
+		bpf_prog_put(prog);
+		return -EEXIST;
+	}
+	event->prog = prog;
+
+	return 0;
+}
+
+static void perf_event_free_bpf_prog(struct perf_event *event)
+{
+	struct bpf_prog *prog = event->prog;
+
+	if (!prog)
+		return;
+
+	cmpxchg(&event->tp_event->prog, prog, NULL);
+	event->prog = NULL;
+	/* the program may still be running on another cpu */
+	bpf_prog_put_rcu(prog);
+}
+
 #else
 
 static inline void perf_tp_register(void)
@@ -6464,6 +6531,15 @@ static void perf_event_free_filter(struct perf_event *event)
 {
 }
 
+static int perf_event_set_bpf_prog(struct perf_event *event, u32 prog_fd)
+{
+	return -ENOENT;
+}
+
+static void perf_event_free_bpf_prog(struct perf_event *event)
+{
+}
+
 #endif /* CONFIG_EVENT_TRACING */
 
 #ifdef CONFIG_HAVE_HW_BREAKPOINT
@@ -18,6 +18,7 @@
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/filter.h>
+#include <linux/bpf.h>
 #include <linux/skbuff.h>
 #include <linux/netdevice.h>
 #include <linux/if_vlan.h>
@@ -1987,6 +1988,290 @@ static int run_one(const struct bpf_prog *fp, struct bpf_test *test)
 	return err_cnt;
 }
 
+/* Programs chained through bpf_tail_call().  Each one sits in the slot of
+ * the program array matching its index in tail_call_tests[]; the slot after
+ * the last one stays empty.  TAIL_CALL() jumps 'offset' slots away from the
+ * current program, or to the empty slot or past the end of the array.
+ */
+#define TAIL_CALL_MARKER	0x7a11ca11
+#define TAIL_CALL_NULL		0x7fff
+#define TAIL_CALL_INVALID	0x7ffe
+
+#define TAIL_CALL(offset)					\
+	BPF_LD_IMM64(R2, TAIL_CALL_MARKER),			\
+	BPF_RAW_INSN(BPF_ALU | BPF_MOV | BPF_K, R3, 0,		\
+		     offset, TAIL_CALL_MARKER),			\
+	BPF_RAW_INSN(BPF_JMP | BPF_CALL | BPF_X, 0, 0, 0, 0)
+
+struct tail_call_test {
+	const char *descr;
+	struct bpf_insn insns[MAX_INSNS];
+	int result;
+};
+
+static struct tail_call_test tail_call_tests[] = {
+	{
+		"Tail call leaf",
+		.insns = {
+			BPF_ALU64_REG(BPF_MOV, R0, R1),
+			BPF_ALU64_IMM(BPF_ADD, R0, 1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 1,
+	},
+	{
+		"Tail call 2",
+		.insns = {
+			BPF_ALU64_IMM(BPF_ADD, R1, 2),
+			TAIL_CALL(-1),
+			BPF_ALU64_IMM(BPF_MOV, R0, -1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 3,
+	},
+	{
+		"Tail call 3",
+		.insns = {
+			BPF_ALU64_IMM(BPF_ADD, R1, 3),
+			TAIL_CALL(-1),
+			BPF_ALU64_IMM(BPF_MOV, R0, -1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 6,
+	},
+	{
+		"Tail call 4",
+		.insns = {
+			BPF_ALU64_IMM(BPF_ADD, R1, 4),
+			TAIL_CALL(-1),
+			BPF_ALU64_IMM(BPF_MOV, R0, -1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 10,
+	},
+	{
+		"Tail call error path, max count reached",
+		.insns = {
+			BPF_ALU64_IMM(BPF_ADD, R1, 1),
+			TAIL_CALL(0),
+			BPF_ALU64_REG(BPF_MOV, R0, R1),
+			BPF_EXIT_INSN(),
+		},
+		/* first run plus MAX_TAIL_CALL_CNT + 1 tail calls */
+		.result = MAX_TAIL_CALL_CNT + 2,
+	},
+	{
+		"Tail call error path, NULL target",
+		.insns = {
+			TAIL_CALL(TAIL_CALL_NULL),
+			BPF_ALU64_IMM(BPF_MOV, R0, 1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 1,
+	},
+	{
+		"Tail call error path, index out of range",
+		.insns = {
+			TAIL_CALL(TAIL_CALL_INVALID),
+			BPF_ALU64_IMM(BPF_MOV, R0, 1),
+			BPF_EXIT_INSN(),
+		},
+		.result = 1,
+	},
+};
+
+static void __init destroy_tail_call_tests(struct bpf_array *progs)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tail_call_tests); i++)
+		if (progs->ptrs[i])
+			bpf_prog_free(progs->ptrs[i]);
+	kfree(progs);
+}
+
+static __init int prepare_tail_call_tests(struct bpf_array **pprogs)
+{
+	int ntests = ARRAY_SIZE(tail_call_tests);
+	struct bpf_array *progs;
+	int which, err;
+
+	/* Allocate the table of programs to be used for tail calls */
+	progs = kzalloc(sizeof(*progs) + (ntests + 1) * sizeof(progs->ptrs[0]),
+			GFP_KERNEL);
+	if (!progs)
+		goto out_nomem;
+
+	/* Create all eBPF programs and populate the table */
+	for (which = 0; which < ntests; which++) {
+		struct tail_call_test *test = &tail_call_tests[which];
+		struct bpf_prog *fp;
+		int len, i;
+
+		/* Compute the number of program instructions */
+		for (len = 0; len < MAX_INSNS; len++) {
+			struct bpf_insn *insn = &test->insns[len];
+
+			if (len < MAX_INSNS - 1 &&
+			    insn->code == (BPF_LD | BPF_DW | BPF_IMM))
+				len++;
+			if (insn->code == 0)
+				break;
+		}
+
+		/* Allocate and initialize the program */
+		fp = bpf_prog_alloc(bpf_prog_size(len), 0);
+		if (!fp)
+			goto out_nomem;
+
+		fp->len = len;
+		memcpy(fp->insnsi, test->insns, len * sizeof(struct bpf_insn));
+
+		/* Relocate runtime tail call offsets and addresses */
+		for (i = 0; i < len; i++) {
+			struct bpf_insn *insn = &fp->insnsi[i];
+
+			if (insn->imm != TAIL_CALL_MARKER)
+				continue;
+
+			switch (insn->code) {
+			case BPF_LD | BPF_DW | BPF_IMM:
+				insn[0].imm = (u32)(long)progs;
+				insn[1].imm = ((u64)(long)progs) >> 32;
+				break;
+
+			case BPF_ALU | BPF_MOV | BPF_K:
+				if (insn->off == TAIL_CALL_NULL)
+					insn->imm = ntests;
+				else if (insn->off == TAIL_CALL_INVALID)
+					insn->imm = ntests + 1;
+				else
+					insn->imm = which + insn->off;
+				insn->off = 0;
+			}
+		}
+
+		bpf_prog_select_runtime(fp);
+		progs->ptrs[which] = fp;
+	}
+
+	/* the JIT jumps straight into the image of the next program, so
+	 * either all of them or none may be JITed
+	 */
+	for (which = 1; which < ntests; which++) {
+		struct bpf_prog *fp = progs->ptrs[which];
+
+		if (fp->jited != ((struct bpf_prog *)progs->ptrs[0])->jited) {
+			pr_err("tail call programs JITed inconsistently\n");
+			err = -EINVAL;
+			goto out_err;
+		}
+	}
+
+	progs->map.max_entries = ntests + 1;
+	*pprogs = progs;
+	return 0;
+
+out_nomem:
+	err = -ENOMEM;
+out_err:
+	if (progs)
+		destroy_tail_call_tests(progs);
+	return err;
+}
+
+static __init int test_tail_calls(struct bpf_array *progs)
+{
+	int i, err_cnt = 0, pass_cnt = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tail_call_tests); i++) {
+		struct tail_call_test *test = &tail_call_tests[i];
+		struct bpf_prog *fp = progs->ptrs[i];
+		u64 duration;
+		int ret;
+
+		pr_info("#%d %s ", i, test->descr);
+
+		ret = __run_one(fp, NULL, MAX_TESTRUNS, &duration);
+		if (ret == test->result) {
+			pr_cont("%lld PASS", duration);
+			pass_cnt++;
+		} else {
+			pr_cont("ret %d != %d FAIL", ret, test->result);
+			err_cnt++;
+		}
+		pr_cont("\n");
+	}
+
+	pr_info("%s: Summary: %d PASSED, %d FAILED\n",
+		__func__, pass_cnt, err_cnt);
+
+	return err_cnt ? -EINVAL : 0;
+}
+
+/* Identical programs share one JITed image: load the same program many
+ * times over and check that only the first copy paid for the JIT.
+ */
+#define JIT_CACHE_COPIES	64
+
+static __init int test_jit_cache(void)
+{
+	static const struct bpf_insn insns[] = {
+		BPF_ALU64_IMM(BPF_MOV, R0, 1),
+		BPF_ALU64_IMM(BPF_ADD, R0, 2),
+		BPF_ALU64_IMM(BPF_MUL, R0, 3),
+		BPF_EXIT_INSN(),
+	};
+	struct bpf_prog *fp[JIT_CACHE_COPIES] = {};
+	u64 start, first = 0, rest = 0;
+	int i, err = 0;
+
+	for (i = 0; i < JIT_CACHE_COPIES; i++) {
+		fp[i] = bpf_prog_alloc(bpf_prog_size(ARRAY_SIZE(insns)), 0);
+		if (!fp[i]) {
+			err = -ENOMEM;
+			goto out;
+		}
+		fp[i]->len = ARRAY_SIZE(insns);
+		memcpy(fp[i]->insnsi, insns, sizeof(insns));
+
+		start = ktime_get_ns();
+		bpf_prog_select_runtime(fp[i]);
+		if (i)
+			rest += ktime_get_ns() - start;
+		else
+			first = ktime_get_ns() - start;
+
+		if (BPF_PROG_RUN(fp[i], NULL) != 9) {
+			pr_err("JIT cache: copy %d returned wrong result\n", i);
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	if (!fp[0]->jited) {
+		pr_info("JIT cache: JIT disabled, skipped\n");
+		goto out;
+	}
+
+	for (i = 1; i < JIT_CACHE_COPIES; i++) {
+		if (fp[i]->bpf_func != fp[0]->bpf_func) {
+			pr_err("JIT cache: copy %d got its own image\n", i);
+			err = -EINVAL;
+			goto out;
+		}
+	}
+
+	do_div(rest, JIT_CACHE_COPIES - 1);
+	pr_info("JIT cache: %d copies share one image, %llu ns to JIT, %llu ns cached PASS\n",
+		JIT_CACHE_COPIES, first, rest);
+out:
+	for (i = 0; i < JIT_CACHE_COPIES; i++)
+		if (fp[i])
+			bpf_prog_free(fp[i]);
+	return err;
+}
+
 static __init int test_bpf(void)
 {
 	int i, err_cnt = 0, pass_cnt = 0;
@@ -2024,7 +2309,22 @@ static __init int test_bpf(void)
 
 static int __init test_bpf_init(void)
 {
-	return test_bpf();
+	struct bpf_array *progs = NULL;
+	int ret;
+
+	ret = test_bpf();
+	if (ret)
+		return ret;
+
+	ret = prepare_tail_call_tests(&progs);
+	if (ret)
+		return ret;
+	ret = test_tail_calls(progs);
+	destroy_tail_call_tests(progs);
+	if (ret)
+		return ret;
+
+	return test_jit_cache();
 }
 
 static void __exit test_bpf_exit(void)
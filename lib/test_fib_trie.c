@@ -0,0 +1,160 @@
+/*
+ * Benchmark for IPv4 FIB lookups
+ *
+ * Replays a trace of destination addresses through fib_lookup() in the
+ * initial network namespace and reports the average time per lookup, so
+ * that changes to the trie layout or to the lookup cache can be compared
+ * against the routes and traffic of a real box.  The trace is a file of
+ * raw IPv4 addresses in network byte order; without one, random addresses
+ * are looked up instead.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
+#include <net/ip_fib.h>
+#include <net/net_namespace.h>
+
+static char *trace;
+module_param(trace, charp, 0444);
+MODULE_PARM_DESC(trace, "File of IPv4 addresses (network order) to look up");
+
+static unsigned int count = 1 << 16;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Number of random addresses without a trace (default: 64K)");
+
+static unsigned int rounds = 16;
+module_param(rounds, uint, 0444);
+MODULE_PARM_DESC(rounds, "Number of times the addresses are replayed (default: 16)");
+
+#define TEST_FIB_MAX_ADDRS	(1 << 24)
+#define TEST_FIB_CHUNK		1024
+
+static __be32 *test_fib_read_trace(const char *path, unsigned int *n)
+{
+	struct file *filp;
+	__be32 *addrs;
+	loff_t size;
+	int ret;
+
+	filp = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(filp))
+		return ERR_CAST(filp);
+
+	size = i_size_read(file_inode(filp));
+	size -= size % sizeof(__be32);
+	if (size == 0 || size > TEST_FIB_MAX_ADDRS * sizeof(__be32)) {
+		addrs = ERR_PTR(-EINVAL);
+		goto out;
+	}
+
+	addrs = vmalloc(size);
+	if (!addrs) {
+		addrs = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+
+	ret = kernel_read(filp, 0, (char *)addrs, size);
+	if (ret != size) {
+		vfree(addrs);
+		addrs = ERR_PTR(ret < 0 ? ret : -EIO);
+		goto out;
+	}
+	*n = size / sizeof(__be32);
+out:
+	filp_close(filp, NULL);
+	return addrs;
+}
+
+static __be32 *test_fib_random_addrs(unsigned int n)
+{
+	__be32 *addrs;
+
+	if (n == 0 || n > TEST_FIB_MAX_ADDRS)
+		return ERR_PTR(-EINVAL);
+
+	addrs = vmalloc(n * sizeof(__be32));
+	if (!addrs)
+		return ERR_PTR(-ENOMEM);
+
+	prandom_bytes(addrs, n * sizeof(__be32));
+	return addrs;
+}
+
+/* Look up in chunks so that long traces do not hog the CPU */
+static unsigned int test_fib_replay(const __be32 *addrs, unsigned int n)
+{
+	struct flowi4 fl4 = { .flowi4_scope = RT_SCOPE_UNIVERSE };
+	struct fib_result res;
+	unsigned int i, end, hits = 0;
+
+	for (i = 0; i < n; i = end) {
+		end = min(i + TEST_FIB_CHUNK, n);
+
+		rcu_read_lock();
+		for (; i < end; i++) {
+			fl4.daddr = addrs[i];
+			if (!fib_lookup(&init_net, &fl4, &res))
+				hits++;
+		}
+		rcu_read_unlock();
+
+		cond_resched();
+	}
+
+	return hits;
+}
+
+static int __init test_fib_trie_init(void)
+{
+	unsigned int i, n = count, hits = 0;
+	u64 start, elapsed;
+	__be32 *addrs;
+
+	if (trace)
+		addrs = test_fib_read_trace(trace, &n);
+	else
+		addrs = test_fib_random_addrs(n);
+	if (IS_ERR(addrs)) {
+		pr_err("cannot load addresses: %ld\n", PTR_ERR(addrs));
+		return PTR_ERR(addrs);
+	}
+
+	/* warm the caches up with a first pass */
+	test_fib_replay(addrs, n);
+
+	start = ktime_get_ns();
+	for (i = 0; i < rounds; i++)
+		hits += test_fib_replay(addrs, n);
+	elapsed = ktime_get_ns() - start;
+
+	pr_info("%s: %u addresses, %u rounds, %u hits, %llu ns/lookup\n",
+		trace ? : "random", n, rounds, hits,
+		rounds ? div64_u64(elapsed, (u64)n * rounds) : 0ULL);
+
+	vfree(addrs);
+
+	return 0;
+}
+
+static void __exit test_fib_trie_exit(void)
+{
+}
+
+module_init(test_fib_trie_init);
+module_exit(test_fib_trie_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,224 @@
+/*
+ * Self test and benchmark for the ptr_ring producer/consumer FIFO
+ *
+ * A producer and a consumer kthread are bound to a pair of CPUs and pass
+ * "count" tokens through a ring, the consumer checking that they arrive in
+ * order.  The pairs cover two SMT siblings of the same core (sharing L1/L2)
+ * and two distinct cores, which is where cache line bouncing between the
+ * producer and consumer indices shows up.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/ptr_ring.h>
+#include <linux/sched.h>
+#include <linux/topology.h>
+
+static unsigned int ring_size = 256;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Number of slots in the ring (default: 256)");
+
+static unsigned int count = 1 << 22;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Number of tokens passed per run (default: 4M)");
+
+static unsigned int batch;
+module_param(batch, uint, 0444);
+MODULE_PARM_DESC(batch, "Consume up to this many tokens per lock (default: 0, one at a time)");
+
+#define TEST_MAX_BATCH	64
+
+struct test_ring_ctx {
+	struct ptr_ring		ring;
+	struct completion	start;
+	struct completion	done;
+	atomic_t		running;
+	unsigned int		errors;
+	ktime_t			t_end;
+};
+
+static int test_ring_producer(void *data)
+{
+	struct test_ring_ctx *ctx = data;
+	unsigned long i;
+
+	wait_for_completion(&ctx->start);
+
+	/* Tokens start at 1, a NULL pointer marks an empty slot. */
+	for (i = 1; i <= count; i++) {
+		while (ptr_ring_produce(&ctx->ring, (void *)i)) {
+			cpu_relax();
+			cond_resched();
+		}
+	}
+
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+	return 0;
+}
+
+static int test_ring_consumer(void *data)
+{
+	struct test_ring_ctx *ctx = data;
+	void *array[TEST_MAX_BATCH];
+	unsigned long expect = 1;
+	int i, n;
+
+	wait_for_completion(&ctx->start);
+
+	while (expect <= count) {
+		if (batch > 1) {
+			n = ptr_ring_consume_batched(&ctx->ring, array,
+						     min_t(int, batch,
+							   TEST_MAX_BATCH));
+		} else {
+			array[0] = ptr_ring_consume(&ctx->ring);
+			n = array[0] ? 1 : 0;
+		}
+
+		if (!n) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		for (i = 0; i < n; i++, expect++)
+			if (unlikely((unsigned long)array[i] != expect))
+				ctx->errors++;
+	}
+
+	ctx->t_end = ktime_get();
+	if (atomic_dec_and_test(&ctx->running))
+		complete(&ctx->done);
+	return 0;
+}
+
+static int __init test_ring_run(const char *name, int pcpu, int ccpu)
+{
+	struct task_struct *producer, *consumer;
+	struct test_ring_ctx *ctx;
+	ktime_t t_start;
+	u64 ns, rate;
+	int err;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	err = ptr_ring_init(&ctx->ring, ring_size, GFP_KERNEL);
+	if (err)
+		goto out_free;
+
+	init_completion(&ctx->start);
+	init_completion(&ctx->done);
+	atomic_set(&ctx->running, 2);
+
+	producer = kthread_create(test_ring_producer, ctx, "ptr_ring_prod/%d",
+				  pcpu);
+	if (IS_ERR(producer)) {
+		err = PTR_ERR(producer);
+		goto out_ring;
+	}
+	consumer = kthread_create(test_ring_consumer, ctx, "ptr_ring_cons/%d",
+				  ccpu);
+	if (IS_ERR(consumer)) {
+		err = PTR_ERR(consumer);
+		kthread_stop(producer);
+		goto out_ring;
+	}
+
+	kthread_bind(producer, pcpu);
+	kthread_bind(consumer, ccpu);
+	wake_up_process(producer);
+	wake_up_process(consumer);
+
+	t_start = ktime_get();
+	complete_all(&ctx->start);
+	wait_for_completion(&ctx->done);
+
+	ns = ktime_to_ns(ktime_sub(ctx->t_end, t_start));
+	rate = ns ? div64_u64((u64)count * NSEC_PER_SEC, ns) : 0;
+
+	if (ctx->errors) {
+		pr_warn("%s (cpu %d -> cpu %d): %u tokens out of order\n",
+			name, pcpu, ccpu, ctx->errors);
+		err = -EINVAL;
+	} else {
+		pr_info("%s (cpu %d -> cpu %d): %u ops in %llu ns, %llu ops/s\n",
+			name, pcpu, ccpu, count, ns, rate);
+	}
+
+out_ring:
+	ptr_ring_cleanup(&ctx->ring, NULL);
+out_free:
+	kfree(ctx);
+	return err;
+}
+
+static int __init test_ptr_ring_init(void)
+{
+	int cpu, sibling = -1, other = -1;
+	int err = 0;
+
+	pr_info("ring_size=%u count=%u batch=%u\n", ring_size, count, batch);
+
+	if (!ring_size)
+		return -EINVAL;
+
+	get_online_cpus();
+
+	cpu = cpumask_first(cpu_online_mask);
+	for_each_online_cpu(sibling)
+		if (sibling != cpu &&
+		    cpumask_test_cpu(sibling, topology_thread_cpumask(cpu)))
+			break;
+	if (sibling >= nr_cpu_ids)
+		sibling = -1;
+
+	for_each_online_cpu(other)
+		if (other != cpu &&
+		    !cpumask_test_cpu(other, topology_thread_cpumask(cpu)))
+			break;
+	if (other >= nr_cpu_ids)
+		other = -1;
+
+	if (sibling >= 0)
+		err = test_ring_run("smt siblings", cpu, sibling);
+	else
+		pr_info("smt siblings: no online sibling of cpu %d, skipped\n",
+			cpu);
+
+	if (!err && other >= 0)
+		err = test_ring_run("cross core", cpu, other);
+	else if (!err)
+		pr_info("cross core: no second online core, skipped\n");
+
+	if (!err && sibling < 0 && other < 0)
+		err = test_ring_run("same cpu", cpu, cpu);
+
+	put_online_cpus();
+
+	return err;
+}
+
+static void __exit test_ptr_ring_exit(void)
+{
+}
+
+module_init(test_ptr_ring_init);
+module_exit(test_ptr_ring_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,242 @@
+/*
+ * Self test and benchmark for the scalable bitmap
+ *
+ * First a few sanity checks on a private sbitmap: it must hand out every
+ * bit exactly once before failing, account for them in the weight, and
+ * honour a shrunk depth after a resize.  Then 1, 2, 4, ... kthreads, each
+ * bound to its own online CPU, allocate and free bits of one shared
+ * sbitmap_queue "count" times, which is the pattern of blk-mq tag
+ * allocation from many submitters.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/sbitmap.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+static unsigned int depth = 128;
+module_param(depth, uint, 0444);
+MODULE_PARM_DESC(depth, "Number of bits in the shared map (default: 128)");
+
+static unsigned int count = 1 << 20;
+module_param(count, uint, 0444);
+MODULE_PARM_DESC(count, "Allocate/free pairs per thread and run (default: 1M)");
+
+static unsigned int threads_max;
+module_param(threads_max, uint, 0444);
+MODULE_PARM_DESC(threads_max, "Maximum number of threads (default: 0, all online CPUs)");
+
+struct test_sbq_ctx {
+	struct sbitmap_queue	sbq;
+	struct completion	start;
+	struct completion	done;
+	atomic_t		running;
+	atomic_t		errors;
+	ktime_t			t_end;
+};
+
+static int __init test_sbitmap_check(void)
+{
+	struct sbitmap sb;
+	unsigned int i;
+	int nr, err;
+
+	err = sbitmap_init_node(&sb, depth, -1, GFP_KERNEL, NUMA_NO_NODE);
+	if (err)
+		return err;
+
+	err = -EINVAL;
+	for (i = 0; i < depth; i++) {
+		nr = sbitmap_get(&sb, i, false);
+		if (nr < 0 || nr >= depth) {
+			pr_warn("get %u of %u failed: %d\n", i, depth, nr);
+			goto out;
+		}
+	}
+	if (sbitmap_get(&sb, 0, false) != -1) {
+		pr_warn("full map handed out another bit\n");
+		goto out;
+	}
+	if (sbitmap_weight(&sb) != depth || sbitmap_any_bit_clear(&sb)) {
+		pr_warn("full map has weight %u, expected %u\n",
+			sbitmap_weight(&sb), depth);
+		goto out;
+	}
+
+	for (i = 0; i < depth; i++)
+		sbitmap_clear_bit(&sb, i);
+	if (sbitmap_weight(&sb) || sbitmap_any_bit_set(&sb)) {
+		pr_warn("empty map has weight %u\n", sbitmap_weight(&sb));
+		goto out;
+	}
+
+	sbitmap_resize(&sb, depth / 2);
+	for (i = 0; i < depth / 2; i++) {
+		nr = sbitmap_get(&sb, 0, false);
+		if (nr < 0 || nr >= depth / 2) {
+			pr_warn("resized get %u of %u failed: %d\n", i,
+				depth / 2, nr);
+			goto out;
+		}
+	}
+	if (sbitmap_get(&sb, 0, false) != -1) {
+		pr_warn("full resized map handed out another bit\n");
+		goto out;
+	}
+
+	err = 0;
+out:
+	sbitmap_free(&sb);
+	return err;
+}
+
+static int test_sbq_thread(void *data)
+{
+	struct test_sbq_ctx *ctx = data;
+	unsigned int i, cpu;
+	int nr;
+
+	wait_for_completion(&ctx->start);
+
+	for (i = 0; i < count; i++) {
+		nr = sbitmap_queue_get(&ctx->sbq, &cpu);
+		if (nr < 0) {
+			/* fewer bits than threads, somebody else has them */
+			cpu_relax();
+			continue;
+		}
+		if (unlikely(nr >= depth))
+			atomic_inc(&ctx->errors);
+		sbitmap_queue_clear(&ctx->sbq, nr, cpu);
+		if (!(i & 1023))
+			cond_resched();
+	}
+
+	if (atomic_dec_and_test(&ctx->running)) {
+		ctx->t_end = ktime_get();
+		complete(&ctx->done);
+	}
+	return 0;
+}
+
+static int __init test_sbq_run(unsigned int threads)
+{
+	struct task_struct *task;
+	struct test_sbq_ctx *ctx;
+	unsigned int started = 0;
+	ktime_t t_start;
+	u64 ns, rate;
+	int cpu, err;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	err = sbitmap_queue_init_node(&ctx->sbq, depth, -1, false, GFP_KERNEL,
+				      NUMA_NO_NODE);
+	if (err)
+		goto out_free;
+
+	init_completion(&ctx->start);
+	init_completion(&ctx->done);
+	atomic_set(&ctx->running, threads);
+
+	for_each_online_cpu(cpu) {
+		if (started == threads)
+			break;
+		task = kthread_create(test_sbq_thread, ctx, "sbitmap/%d", cpu);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			break;
+		}
+		kthread_bind(task, cpu);
+		wake_up_process(task);
+		started++;
+	}
+
+	/* let the ones we got run, and have them drop the missing ones */
+	if (started < threads)
+		atomic_sub(threads - started, &ctx->running);
+	if (!started)
+		goto out_sbq;
+
+	t_start = ktime_get();
+	complete_all(&ctx->start);
+	wait_for_completion(&ctx->done);
+	if (err)
+		goto out_sbq;
+
+	ns = ktime_to_ns(ktime_sub(ctx->t_end, t_start));
+	rate = ns ? div64_u64((u64)count * threads * NSEC_PER_SEC, ns) : 0;
+
+	if (atomic_read(&ctx->errors)) {
+		pr_warn("%u threads: %d bits out of range\n", threads,
+			atomic_read(&ctx->errors));
+		err = -EINVAL;
+	} else {
+		pr_info("%u threads: %llu ops in %llu ns, %llu ops/s\n",
+			threads, (u64)count * threads, ns, rate);
+	}
+
+out_sbq:
+	sbitmap_queue_free(&ctx->sbq);
+out_free:
+	kfree(ctx);
+	return err;
+}
+
+static int __init test_sbitmap_init(void)
+{
+	unsigned int max, threads;
+	int err;
+
+	pr_info("depth=%u count=%u threads_max=%u\n", depth, count, threads_max);
+
+	if (!depth)
+		return -EINVAL;
+
+	err = test_sbitmap_check();
+	if (err)
+		return err;
+
+	get_online_cpus();
+
+	max = num_online_cpus();
+	if (threads_max && threads_max < max)
+		max = threads_max;
+
+	for (threads = 1; !err; threads *= 2) {
+		if (threads > max)
+			threads = max;
+		err = test_sbq_run(threads);
+		if (threads == max)
+			break;
+	}
+
+	put_online_cpus();
+
+	return err;
+}
+
+static void __exit test_sbitmap_exit(void)
+{
+}
+
+module_init(test_sbitmap_init);
+module_exit(test_sbitmap_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -1729,7 +1729,7 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
-	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+	if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -3745,7 +3745,7 @@ ncls:
 	}
 
 	if (pt_prev) {
-		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		if (unlikely(skb_orphan_frags_rx(skb, GFP_ATOMIC)))
 			goto drop;
 		else
 			ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
@@ -5837,6 +5837,33 @@ int dev_set_mtu(struct net_device *dev, int new_mtu)
 }
 EXPORT_SYMBOL(dev_set_mtu);
 
+/**
+ *	dev_change_tx_queue_len - Change TX queue length of a netdevice
+ *	@dev: device
+ *	@new_len: new tx queue length
+ *
+ *	Drivers sizing their own queues from tx_queue_len can refuse the
+ *	change from their NETDEV_CHANGE_TX_QUEUE_LEN notifier.
+ */
+int dev_change_tx_queue_len(struct net_device *dev, unsigned long new_len)
+{
+	unsigned long orig_len = dev->tx_queue_len;
+	int err;
+
+	if (new_len == orig_len)
+		return 0;
+
+	dev->tx_queue_len = new_len;
+	err = call_netdevice_notifiers(NETDEV_CHANGE_TX_QUEUE_LEN, dev);
+	err = notifier_to_errno(err);
+	if (err) {
+		netdev_err(dev, "refused to change device tx_queue_len\n");
+		dev->tx_queue_len = orig_len;
+	}
+	return err;
+}
+EXPORT_SYMBOL(dev_change_tx_queue_len);
+
 /**
  *	dev_set_group - Change group this device belongs to
  *	@dev: device
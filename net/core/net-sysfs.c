@@ -311,8 +311,7 @@ NETDEVICE_SHOW_RW(flags, fmt_hex);
 
 static int change_tx_queue_len(struct net_device *dev, unsigned long new_len)
 {
-	dev->tx_queue_len = new_len;
-	return 0;
+	return dev_change_tx_queue_len(dev, new_len);
 }
 
 static ssize_t tx_queue_len_store(struct device *dev,
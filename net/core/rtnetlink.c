@@ -1664,7 +1664,9 @@ static int do_setlink(const struct sk_buff *skb,
 		if (dev->tx_queue_len ^ value)
 			status |= DO_SETLINK_NOTIFY;
 
-		dev->tx_queue_len = value;
+		err = dev_change_tx_queue_len(dev, value);
+		if (err)
+			goto errout;
 	}
 
 	if (tb[IFLA_OPERSTATE])
@@ -57,7 +57,19 @@ static struct hlist_head fib_info_devhash[DEVINDEX_HASHSIZE];
 
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 
-static DEFINE_SPINLOCK(fib_multipath_lock);
+/* Resilient hashing maps the hash of a flow to one of FIB_NH_BUCKETS
+ * buckets, each owned by a nexthop in proportion to its weight.  When a
+ * nexthop comes or goes, only the buckets needed to restore the shares
+ * change owner, so the flows of the other buckets stay where they are.
+ */
+#define FIB_NH_BUCKET_SHIFT	8
+#define FIB_NH_BUCKETS		(1 << FIB_NH_BUCKET_SHIFT)
+
+struct fib_nh_buckets {
+	u16	bucket[FIB_NH_BUCKETS];
+	/* buckets held minus buckets due, per nexthop, under RTNL */
+	int	excess[0];
+};
 
 #define for_nexthops(fi) {						\
 	int nhsel; const struct fib_nh *nh;				\
@@ -213,6 +225,10 @@ static void free_fib_info_rcu(struct rcu_head *head)
 		rt_fibinfo_free(&nexthop_nh->nh_rth_input);
 	} endfor_nexthops(fi);
 
+#ifdef CONFIG_IP_ROUTE_MULTIPATH
+	kfree(fi->fib_nh_buckets);
+	free_percpu(fi->fib_nh_selected);
+#endif
 	release_net(fi->fib_net);
 	if (fi->fib_metrics != (u32 *) dst_default_metrics)
 		kfree(fi->fib_metrics);
@@ -375,6 +391,10 @@ static inline size_t fib_nlmsg_size(struct fib_info *fi)
 		/* may contain flow and gateway attribute */
 		nhsize += 2 * nla_total_size(4);
 
+		/* and the selection count of multipath nexthops */
+		if (fi->fib_nhs > 1)
+			nhsize += nla_total_size(sizeof(u64));
+
 		/* all nexthops are packed in a nested attribute */
 		payload += nla_total_size(fi->fib_nhs * nhsize);
 	}
@@ -484,6 +504,101 @@ static int fib_get_nhs(struct fib_info *fi, struct rtnexthop *rtnh,
 	return 0;
 }
 
+static int fib_alloc_multipath(struct fib_info *fi)
+{
+	fi->fib_nh_buckets = kzalloc(sizeof(struct fib_nh_buckets) +
+				     fi->fib_nhs * sizeof(int), GFP_KERNEL);
+	if (!fi->fib_nh_buckets)
+		return -ENOMEM;
+
+	fi->fib_nh_selected = __alloc_percpu(fi->fib_nhs * sizeof(u64),
+					     __alignof__(u64));
+	if (!fi->fib_nh_selected)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* Spread the hash space over the live nexthops in proportion to their
+ * weights: for hash-threshold, each one owns the hashes up to its upper
+ * bound; for resilient hashing, the buckets of dead or overweight
+ * nexthops move to the ones below their share, the others stay put.
+ * Readers do not lock, they may see a mix of old and new owners.
+ */
+static void fib_rebalance(struct fib_info *fi)
+{
+	struct fib_nh_buckets *nhb = fi->fib_nh_buckets;
+	int total, w, due, next, i;
+
+	if (fi->fib_nhs < 2)
+		return;
+
+	total = 0;
+	for_nexthops(fi) {
+		if (!(nh->nh_flags & RTNH_F_DEAD))
+			total += nh->nh_weight;
+	} endfor_nexthops(fi);
+
+	w = 0;
+	due = 0;
+	change_nexthops(fi) {
+		int upper_bound = -1;
+
+		nhb->excess[nhsel] = 0;
+		if (!(nexthop_nh->nh_flags & RTNH_F_DEAD)) {
+			w += nexthop_nh->nh_weight;
+			upper_bound = div_u64(((u64)w << 31) + total / 2,
+					      total) - 1;
+
+			nhb->excess[nhsel] = due;
+			due = DIV_ROUND_CLOSEST(w * FIB_NH_BUCKETS, total);
+			nhb->excess[nhsel] -= due;
+		}
+		atomic_set(&nexthop_nh->nh_upper_bound, upper_bound);
+	} endfor_nexthops(fi);
+
+	/* nothing alive to hand the buckets to */
+	if (!total)
+		return;
+
+	for (i = 0; i < FIB_NH_BUCKETS; i++)
+		nhb->excess[nhb->bucket[i]]++;
+
+	/* the excess sums up to zero, a nexthop below its share is left
+	 * for every bucket that has to move
+	 */
+	next = 0;
+	for (i = 0; i < FIB_NH_BUCKETS; i++) {
+		int nhsel = nhb->bucket[i];
+
+		if (nhb->excess[nhsel] <= 0)
+			continue;
+		nhb->excess[nhsel]--;
+
+		while (nhb->excess[next] >= 0)
+			next++;
+		nhb->excess[next]++;
+		ACCESS_ONCE(nhb->bucket[i]) = next;
+	}
+}
+
+static u64 fib_nh_selected(const struct fib_info *fi, int nhsel)
+{
+	u64 selected = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		selected += per_cpu_ptr(fi->fib_nh_selected, cpu)[nhsel];
+
+	return selected;
+}
+
+#else
+
+static inline void fib_rebalance(struct fib_info *fi)
+{
+}
+
 #endif
 
 int fib_nh_match(struct fib_config *cfg, struct fib_info *fi)
@@ -866,6 +981,11 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 		err = fib_get_nhs(fi, cfg->fc_mp, cfg->fc_mp_len, cfg);
 		if (err != 0)
 			goto failure;
+		if (nhs > 1) {
+			err = fib_alloc_multipath(fi);
+			if (err != 0)
+				goto failure;
+		}
 		if (cfg->fc_oif && fi->fib_nh->nh_oif != cfg->fc_oif)
 			goto err_inval;
 		if (cfg->fc_gw && fi->fib_nh->nh_gw != cfg->fc_gw)
@@ -943,6 +1063,8 @@ struct fib_info *fib_create_info(struct fib_config *cfg)
 		fib_info_update_nh_saddr(net, nexthop_nh);
 	} endfor_nexthops(fi)
 
+	fib_rebalance(fi);
+
 link_it:
 	ofi = fib_find_info(fi);
 	if (ofi) {
@@ -1066,6 +1188,9 @@ int fib_dump_info(struct sk_buff *skb, u32 portid, u32 seq, int event,
 			    nla_put_u32(skb, RTA_FLOW, nh->nh_tclassid))
 				goto nla_put_failure;
 #endif
+			if (nla_put_u64(skb, RTA_MP_SELECTED,
+					fib_nh_selected(fi, nhsel)))
+				goto nla_put_failure;
 			/* length of rtnetlink header + attributes */
 			rtnh->rtnh_len = nlmsg_get_pos(skb) - (void *) rtnh;
 		} endfor_nexthops(fi);
@@ -1135,12 +1260,6 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 			else if (nexthop_nh->nh_dev == dev &&
 				 nexthop_nh->nh_scope != scope) {
 				nexthop_nh->nh_flags |= RTNH_F_DEAD;
-#ifdef CONFIG_IP_ROUTE_MULTIPATH
-				spin_lock_bh(&fib_multipath_lock);
-				fi->fib_power -= nexthop_nh->nh_power;
-				nexthop_nh->nh_power = 0;
-				spin_unlock_bh(&fib_multipath_lock);
-#endif
 				dead++;
 			}
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
@@ -1154,6 +1273,8 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 			fi->fib_flags |= RTNH_F_DEAD;
 			ret++;
 		}
+
+		fib_rebalance(fi);
 	}
 
 	return ret;
@@ -1163,14 +1284,18 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 void fib_select_default(struct fib_result *res)
 {
 	struct fib_info *fi = NULL, *last_resort = NULL;
-	struct list_head *fa_head = res->fa_head;
+	struct hlist_head *fa_head = res->fa_head;
 	struct fib_table *tb = res->table;
+	u8 slen = 32 - res->prefixlen;
 	int order = -1, last_idx = -1;
 	struct fib_alias *fa;
 
-	list_for_each_entry_rcu(fa, fa_head, fa_list) {
+	hlist_for_each_entry_rcu(fa, fa_head, fa_list) {
 		struct fib_info *next_fi = fa->fa_info;
 
+		/* the leaf also holds the aliases of longer prefixes */
+		if (fa->fa_slen != slen)
+			continue;
 		if (next_fi->fib_scope != res->scope ||
 		    fa->fa_type != RTN_UNICAST)
 			continue;
@@ -1259,71 +1384,47 @@ int fib_sync_up(struct net_device *dev)
 			    !__in_dev_get_rtnl(dev))
 				continue;
 			alive++;
-			spin_lock_bh(&fib_multipath_lock);
-			nexthop_nh->nh_power = 0;
 			nexthop_nh->nh_flags &= ~RTNH_F_DEAD;
-			spin_unlock_bh(&fib_multipath_lock);
 		} endfor_nexthops(fi)
 
 		if (alive > 0) {
 			fi->fib_flags &= ~RTNH_F_DEAD;
 			ret++;
 		}
+
+		fib_rebalance(fi);
 	}
 
 	return ret;
 }
 
-/*
- * The algorithm is suboptimal, but it provides really
- * fair weighted route distribution.
- */
-void fib_select_multipath(struct fib_result *res)
+/* @hash is a 31-bit hash of the flow */
+void fib_select_multipath(struct fib_result *res, int hash)
 {
 	struct fib_info *fi = res->fi;
-	int w;
-
-	spin_lock_bh(&fib_multipath_lock);
-	if (fi->fib_power <= 0) {
-		int power = 0;
-		change_nexthops(fi) {
-			if (!(nexthop_nh->nh_flags & RTNH_F_DEAD)) {
-				power += nexthop_nh->nh_weight;
-				nexthop_nh->nh_power = nexthop_nh->nh_weight;
-			}
-		} endfor_nexthops(fi);
-		fi->fib_power = power;
-		if (power <= 0) {
-			spin_unlock_bh(&fib_multipath_lock);
-			/* Race condition: route has just become dead. */
-			res->nh_sel = 0;
-			return;
-		}
-	}
+	int nhsel;
 
+	if (fi->fib_net->ipv4.sysctl_fib_multipath_resilient) {
+		const struct fib_nh_buckets *nhb = fi->fib_nh_buckets;
 
-	/* w should be random number [0..fi->fib_power-1],
-	 * it is pretty bad approximation.
-	 */
-
-	w = jiffies % fi->fib_power;
+		nhsel = ACCESS_ONCE(nhb->bucket[hash >>
+						(31 - FIB_NH_BUCKET_SHIFT)]);
+		/* a bucket may still point to a nexthop that just died */
+		if (!(fi->fib_nh[nhsel].nh_flags & RTNH_F_DEAD))
+			goto found;
+	}
 
-	change_nexthops(fi) {
-		if (!(nexthop_nh->nh_flags & RTNH_F_DEAD) &&
-		    nexthop_nh->nh_power) {
-			w -= nexthop_nh->nh_power;
-			if (w <= 0) {
-				nexthop_nh->nh_power--;
-				fi->fib_power--;
-				res->nh_sel = nhsel;
-				spin_unlock_bh(&fib_multipath_lock);
-				return;
-			}
-		}
-	} endfor_nexthops(fi);
+	for (nhsel = 0; nhsel < fi->fib_nhs; nhsel++) {
+		if (hash <= atomic_read(&fi->fib_nh[nhsel].nh_upper_bound))
+			goto found;
+	}
 
 	/* Race condition: route has just become dead. */
 	res->nh_sel = 0;
-	spin_unlock_bh(&fib_multipath_lock);
+	return;
+
+found:
+	this_cpu_inc(fi->fib_nh_selected[nhsel]);
+	res->nh_sel = nhsel;
 }
 #endif
@@ -101,6 +101,7 @@
 #include <net/arp.h>
 #include <net/tcp.h>
 #include <net/icmp.h>
+#include <net/flow_keys.h>
 #include <net/xfrm.h>
 #include <net/netevent.h>
 #include <net/rtnetlink.h>
@@ -1633,6 +1634,104 @@ out:
 	return err;
 }
 
+#ifdef CONFIG_IP_ROUTE_MULTIPATH
+static u32 fib_multipath_secret __read_mostly;
+
+/* An ICMP error is hashed as the replies of the flow it is about, so
+ * that it follows them and reaches the sender of the flow.  With l4, the
+ * protocol and the ports of the quoted header are hashed too, swapped.
+ */
+static bool ip_multipath_icmp_keys(const struct sk_buff *skb,
+				   struct flow_keys *keys, bool l4)
+{
+	const struct iphdr *outer_iph = ip_hdr(skb);
+	const struct iphdr *inner_iph;
+	const struct icmphdr *icmph;
+	struct iphdr _inner_iph;
+	struct icmphdr _icmph;
+	union {
+		__be32 ports;
+		__be16 port16[2];
+	} inner;
+	int thoff;
+
+	if (likely(outer_iph->protocol != IPPROTO_ICMP))
+		return false;
+
+	if (unlikely(outer_iph->frag_off & htons(IP_OFFSET)))
+		return false;
+
+	icmph = skb_header_pointer(skb, outer_iph->ihl * 4, sizeof(_icmph),
+				   &_icmph);
+	if (!icmph)
+		return false;
+
+	if (icmph->type != ICMP_DEST_UNREACH &&
+	    icmph->type != ICMP_REDIRECT &&
+	    icmph->type != ICMP_TIME_EXCEEDED &&
+	    icmph->type != ICMP_PARAMETERPROB)
+		return false;
+
+	inner_iph = skb_header_pointer(skb,
+				       outer_iph->ihl * 4 + sizeof(_icmph),
+				       sizeof(_inner_iph), &_inner_iph);
+	if (!inner_iph)
+		return false;
+
+	keys->src = inner_iph->daddr;
+	keys->dst = inner_iph->saddr;
+
+	/* only the first fragment quotes the ports */
+	if (!l4 || inner_iph->ihl < 5 ||
+	    (inner_iph->frag_off & htons(IP_OFFSET)))
+		return true;
+
+	thoff = outer_iph->ihl * 4 + sizeof(_icmph) + inner_iph->ihl * 4;
+	inner.ports = __skb_flow_get_ports(skb, thoff, inner_iph->protocol,
+					   NULL, 0);
+	keys->port16[0] = inner.port16[1];
+	keys->port16[1] = inner.port16[0];
+	keys->ip_proto = inner_iph->protocol;
+	return true;
+}
+
+/* Hash the addresses of a flow, and its protocol and ports if
+ * fib_multipath_hash_policy asks for it, into 31 bits.
+ */
+static int fib_multipath_hash(const struct net *net,
+			      const struct flowi4 *fl4,
+			      const struct sk_buff *skb)
+{
+	bool l4 = net->ipv4.sysctl_fib_multipath_hash_policy;
+	struct flow_keys keys;
+
+	net_get_random_once(&fib_multipath_secret,
+			    sizeof(fib_multipath_secret));
+
+	memset(&keys, 0, sizeof(keys));
+	if (skb) {
+		if (!ip_multipath_icmp_keys(skb, &keys, l4) &&
+		    (!l4 || !skb_flow_dissect(skb, &keys))) {
+			memset(&keys, 0, sizeof(keys));
+			keys.src = ip_hdr(skb)->saddr;
+			keys.dst = ip_hdr(skb)->daddr;
+		}
+	} else {
+		keys.src = fl4->saddr;
+		keys.dst = fl4->daddr;
+		if (l4) {
+			keys.port16[0] = fl4->fl4_sport;
+			keys.port16[1] = fl4->fl4_dport;
+			keys.ip_proto = fl4->flowi4_proto;
+		}
+	}
+
+	return jhash_3words((__force u32)keys.src, (__force u32)keys.dst,
+			    (__force u32)keys.ports ^ keys.ip_proto,
+			    fib_multipath_secret) >> 1;
+}
+#endif /* CONFIG_IP_ROUTE_MULTIPATH */
+
 static int ip_mkroute_input(struct sk_buff *skb,
 			    struct fib_result *res,
 			    const struct flowi4 *fl4,
@@ -1640,8 +1739,11 @@ static int ip_mkroute_input(struct sk_buff *skb,
 			    __be32 daddr, __be32 saddr, u32 tos)
 {
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
-	if (res->fi && res->fi->fib_nhs > 1)
-		fib_select_multipath(res);
+	if (res->fi && res->fi->fib_nhs > 1) {
+		int h = fib_multipath_hash(dev_net(in_dev->dev), fl4, skb);
+
+		fib_select_multipath(res, h);
+	}
 #endif
 
 	/* create a routing cache entry */
@@ -2171,7 +2273,7 @@ struct rtable *__ip_route_output_key(struct net *net, struct flowi4 *fl4)
 
 #ifdef CONFIG_IP_ROUTE_MULTIPATH
 	if (res.fi->fib_nhs > 1 && fl4->flowi4_oif == 0)
-		fib_select_multipath(&res);
+		fib_select_multipath(&res, fib_multipath_hash(net, fl4, NULL));
 	else
 #endif
 	if (!res.prefixlen &&
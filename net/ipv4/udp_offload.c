@@ -175,6 +175,64 @@ out_unlock:
 	return segs;
 }
 
+/* Split a UDP_SEGMENT packet into gso_size datagrams.  The sender or GRO
+ * left the pseudo header sum for the whole payload in uh->check; each
+ * datagram gets its own length patched into it.  The last one may be
+ * shorter than gso_size.
+ */
+struct sk_buff *__udp_gso_segment(struct sk_buff *gso_skb,
+				  netdev_features_t features)
+{
+	struct sk_buff *segs, *seg;
+	struct udphdr *uh;
+	unsigned int mss;
+	__sum16 check;
+	__be16 newlen;
+
+	mss = skb_shinfo(gso_skb)->gso_size;
+	if (gso_skb->len <= sizeof(*uh) + mss)
+		return ERR_PTR(-EINVAL);
+
+	skb_pull(gso_skb, sizeof(*uh));
+
+	segs = skb_segment(gso_skb, features);
+	if (IS_ERR_OR_NULL(segs))
+		return segs;
+
+	seg = segs;
+	uh = udp_hdr(seg);
+
+	newlen = htons(sizeof(*uh) + mss);
+	check = csum16_add(csum16_sub(uh->check, uh->len), newlen);
+
+	for (;;) {
+		uh->len = newlen;
+		uh->check = check;
+
+		if (seg->ip_summed != CHECKSUM_PARTIAL)
+			uh->check = gso_make_checksum(seg, ~check) ? :
+				    CSUM_MANGLED_0;
+
+		seg = seg->next;
+		uh = udp_hdr(seg);
+		if (!seg->next)
+			break;
+	}
+
+	newlen = htons(skb_tail_pointer(seg) - skb_transport_header(seg) +
+		       seg->data_len);
+	check = csum16_add(csum16_sub(uh->check, uh->len), newlen);
+
+	uh->len = newlen;
+	uh->check = check;
+
+	if (seg->ip_summed != CHECKSUM_PARTIAL)
+		uh->check = gso_make_checksum(seg, ~check) ? : CSUM_MANGLED_0;
+
+	return segs;
+}
+EXPORT_SYMBOL_GPL(__udp_gso_segment);
+
 static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 					 netdev_features_t features)
 {
@@ -194,6 +252,9 @@ static struct sk_buff *udp4_ufo_fragment(struct sk_buff *skb,
 	if (!pskb_may_pull(skb, sizeof(struct udphdr)))
 		goto out;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		return __udp_gso_segment(skb, features);
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -290,13 +351,83 @@ unlock:
 }
 EXPORT_SYMBOL(udp_del_offload);
 
+static struct static_key udp_gro_needed __read_mostly;
+
+/* Called when a socket enables UDP_GRO: from then on GRO looks up the
+ * destination socket of every UDP packet without a tunnel offload.
+ */
+void udp_gro_enable(void)
+{
+	if (!static_key_enabled(&udp_gro_needed))
+		static_key_slow_inc(&udp_gro_needed);
+}
+EXPORT_SYMBOL(udp_gro_enable);
+
+#define UDP_GRO_CNT_MAX	UDP_MAX_SEGMENTS
+
+/* Coalesce datagrams of one flow for a socket that set UDP_GRO.  All but
+ * the last must have the same length, which becomes the gso_size.
+ */
+static struct sk_buff **udp_gro_receive_segment(struct sk_buff **head,
+						struct sk_buff *skb,
+						struct udphdr *uh)
+{
+	unsigned int off = skb_gro_offset(skb);
+	struct sk_buff *p, **pp;
+	struct udphdr *uh2;
+	unsigned int ulen;
+
+	/* requires non zero csum, for symmetry with GSO */
+	if (!uh->check) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	ulen = ntohs(uh->len);
+	if (ulen <= sizeof(*uh) || ulen != skb_gro_len(skb)) {
+		NAPI_GRO_CB(skb)->flush = 1;
+		return NULL;
+	}
+
+	skb_gro_pull(skb, sizeof(struct udphdr));
+	skb_gro_postpull_rcsum(skb, uh, sizeof(struct udphdr));
+
+	for (pp = head; (p = *pp); pp = &p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		uh2 = (struct udphdr *)(p->data + off);
+
+		/* Match ports only, as csum is always non zero */
+		if (*(u32 *)&uh->source != *(u32 *)&uh2->source) {
+			NAPI_GRO_CB(p)->same_flow = 0;
+			continue;
+		}
+
+		/* A longer datagram cannot follow: start a new packet.  A
+		 * shorter one is appended but ends the packet, as does
+		 * reaching the segment limit.
+		 */
+		if (ulen > ntohs(uh2->len) || skb_gro_receive(pp, skb) ||
+		    ulen != ntohs(uh2->len) ||
+		    NAPI_GRO_CB(p)->count >= UDP_GRO_CNT_MAX)
+			return pp;
+
+		return NULL;
+	}
+
+	/* mismatch, but we never need to flush */
+	return NULL;
+}
+
 struct sk_buff **udp_gro_receive(struct sk_buff **head, struct sk_buff *skb,
-				 struct udphdr *uh)
+				 struct udphdr *uh, udp_lookup_t lookup)
 {
 	struct udp_offload_priv *uo_priv;
 	struct sk_buff *p, **pp = NULL;
 	struct udphdr *uh2;
 	unsigned int off = skb_gro_offset(skb);
+	struct sock *sk;
 	int flush = 1;
 
 	if (NAPI_GRO_CB(skb)->udp_mark ||
@@ -315,6 +446,17 @@ struct sk_buff **udp_gro_receive(struct sk_buff **head, struct sk_buff *skb,
 		    uo_priv->offload->callbacks.gro_receive)
 			goto unflush;
 	}
+
+	if (static_key_false(&udp_gro_needed)) {
+		sk = lookup(skb, uh->source, uh->dest);
+		if (sk) {
+			if (udp_sk(sk)->gro_enabled) {
+				pp = udp_gro_receive_segment(head, skb, uh);
+				flush = 0;
+			}
+			sock_put(sk);
+		}
+	}
 	goto out_unlock;
 
 unflush:
@@ -349,6 +491,16 @@ out:
 	return pp;
 }
 
+static struct sock *udp4_gro_lookup(struct sk_buff *skb, __be16 sport,
+				    __be16 dport)
+{
+	const struct iphdr *iph = skb_gro_network_header(skb);
+
+	return __udp4_lib_lookup(dev_net(skb->dev), iph->saddr, sport,
+				 iph->daddr, dport, skb->dev->ifindex,
+				 &udp_table, NULL);
+}
+
 static struct sk_buff **udp4_gro_receive(struct sk_buff **head,
 					 struct sk_buff *skb)
 {
@@ -369,13 +521,28 @@ static struct sk_buff **udp4_gro_receive(struct sk_buff **head,
 					     inet_gro_compute_pseudo);
 skip:
 	NAPI_GRO_CB(skb)->is_ipv6 = 0;
-	return udp_gro_receive(head, skb, uh);
+	return udp_gro_receive(head, skb, uh, udp4_gro_lookup);
 
 flush:
 	NAPI_GRO_CB(skb)->flush = 1;
 	return NULL;
 }
 
+static int udp_gro_complete_segment(struct sk_buff *skb, int nhoff)
+{
+	skb->csum_start = skb->data + nhoff - skb->head;
+	skb->csum_offset = offsetof(struct udphdr, check);
+	skb->ip_summed = CHECKSUM_PARTIAL;
+
+	skb_shinfo(skb)->gso_segs = NAPI_GRO_CB(skb)->count;
+	skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_L4;
+	return 0;
+}
+
+/* Finish a GRO packet built either by a tunnel offload or, when none is
+ * registered for the port, by udp_gro_receive_segment().  The caller has
+ * set uh->check to the pseudo header sum if it was nonzero.
+ */
 int udp_gro_complete(struct sk_buff *skb, int nhoff)
 {
 	struct udp_offload_priv *uo_priv;
@@ -394,13 +561,19 @@ int udp_gro_complete(struct sk_buff *skb, int nhoff)
 			break;
 	}
 
-	if (uo_priv != NULL) {
-		NAPI_GRO_CB(skb)->proto = uo_priv->offload->ipproto;
-		err = uo_priv->offload->callbacks.gro_complete(skb,
-				nhoff + sizeof(struct udphdr),
-				uo_priv->offload);
+	if (!uo_priv) {
+		rcu_read_unlock();
+		return udp_gro_complete_segment(skb, nhoff);
 	}
 
+	skb_shinfo(skb)->gso_type |= uh->check ? SKB_GSO_UDP_TUNNEL_CSUM :
+						 SKB_GSO_UDP_TUNNEL;
+
+	NAPI_GRO_CB(skb)->proto = uo_priv->offload->ipproto;
+	err = uo_priv->offload->callbacks.gro_complete(skb,
+			nhoff + sizeof(struct udphdr),
+			uo_priv->offload);
+
 	rcu_read_unlock();
 
 	if (skb->remcsum_offload)
@@ -417,13 +590,9 @@ static int udp4_gro_complete(struct sk_buff *skb, int nhoff)
 	const struct iphdr *iph = ip_hdr(skb);
 	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
 
-	if (uh->check) {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL_CSUM;
+	if (uh->check)
 		uh->check = ~udp_v4_check(skb->len - nhoff, iph->saddr,
 					  iph->daddr, 0);
-	} else {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
-	}
 
 	return udp_gro_complete(skb, nhoff);
 }
@@ -81,6 +81,7 @@ static struct sk_buff *ipv6_gso_segment(struct sk_buff *skb,
 		       SKB_GSO_UDP_TUNNEL_CSUM |
 		       SKB_GSO_TUNNEL_REMCSUM |
 		       SKB_GSO_TCPV6 |
+		       SKB_GSO_UDP_L4 |
 		       0)))
 		goto out;
 
@@ -105,6 +106,8 @@ static struct sk_buff *ipv6_gso_segment(struct sk_buff *skb,
 		udpfrag = proto == IPPROTO_UDP && encap;
 	else
 		udpfrag = proto == IPPROTO_UDP && !skb->encapsulation;
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)
+		udpfrag = false;
 
 	ops = rcu_dereference(inet6_offloads[proto]);
 	if (likely(ops && ops->callbacks.gso_segment)) {
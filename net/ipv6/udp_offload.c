@@ -30,6 +30,12 @@ static struct sk_buff *udp6_ufo_fragment(struct sk_buff *skb,
 	__wsum csum;
 	int tnl_hlen;
 
+	if (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4) {
+		if (!pskb_may_pull(skb, sizeof(struct udphdr)))
+			goto out;
+		return __udp_gso_segment(skb, features);
+	}
+
 	mss = skb_shinfo(skb)->gso_size;
 	if (unlikely(skb->len <= mss))
 		goto out;
@@ -126,6 +132,16 @@ out:
 	return segs;
 }
 
+static struct sock *udp6_gro_lookup(struct sk_buff *skb, __be16 sport,
+				    __be16 dport)
+{
+	const struct ipv6hdr *iph = skb_gro_network_header(skb);
+
+	return __udp6_lib_lookup(dev_net(skb->dev), &iph->saddr, sport,
+				 &iph->daddr, dport, skb->dev->ifindex,
+				 &udp_table, NULL);
+}
+
 static struct sk_buff **udp6_gro_receive(struct sk_buff **head,
 					 struct sk_buff *skb)
 {
@@ -147,7 +163,7 @@ static struct sk_buff **udp6_gro_receive(struct sk_buff **head,
 
 skip:
 	NAPI_GRO_CB(skb)->is_ipv6 = 1;
-	return udp_gro_receive(head, skb, uh);
+	return udp_gro_receive(head, skb, uh, udp6_gro_lookup);
 
 flush:
 	NAPI_GRO_CB(skb)->flush = 1;
@@ -159,13 +175,9 @@ static int udp6_gro_complete(struct sk_buff *skb, int nhoff)
 	const struct ipv6hdr *ipv6h = ipv6_hdr(skb);
 	struct udphdr *uh = (struct udphdr *)(skb->data + nhoff);
 
-	if (uh->check) {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL_CSUM;
+	if (uh->check)
 		uh->check = ~udp_v6_check(skb->len - nhoff, &ipv6h->saddr,
 					  &ipv6h->daddr, 0);
-	} else {
-		skb_shinfo(skb)->gso_type |= SKB_GSO_UDP_TUNNEL;
-	}
 
 	return udp_gro_complete(skb, nhoff);
 }
@@ -162,6 +162,27 @@ static inline u_int32_t hash_conntrack(const struct net *net, u16 zone,
 	return __hash_conntrack(tuple, zone, net->ct.htable_size);
 }
 
+/* A consistent snapshot of the hash table and its size: the table may be
+ * replaced by a resize at any time, callers must be in a RCU read side
+ * section for as long as they use it.
+ */
+void nf_conntrack_get_ht(const struct net *net, struct hlist_nulls_head **hash,
+			 unsigned int *hsize)
+{
+	struct hlist_nulls_head *hptr;
+	unsigned int sequence, hsz;
+
+	do {
+		sequence = read_seqcount_begin(&net->ct.generation);
+		hsz = net->ct.htable_size;
+		hptr = net->ct.hash;
+	} while (read_seqcount_retry(&net->ct.generation, sequence));
+
+	*hash = hptr;
+	*hsize = hsz;
+}
+EXPORT_SYMBOL_GPL(nf_conntrack_get_ht);
+
 bool
 nf_ct_get_tuple(const struct sk_buff *skb,
 		unsigned int nhoff,
@@ -296,7 +317,6 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
-	NF_CT_ASSERT(!timer_pending(&ct->timeout));
 
 	rcu_read_lock();
 	l4proto = __nf_ct_l4proto_find(nf_ct_l3num(ct), nf_ct_protonum(ct));
@@ -352,37 +372,60 @@ static void nf_ct_delete_from_lists(struct nf_conn *ct)
 	local_bh_enable();
 }
 
+/* Unlink ct from the hash table and drop the table's reference.
+ *
+ * Setting the DYING bit makes the caller the only one to remove it, every
+ * other racing caller (timeout, gc, ctnetlink, ...) gets false.
+ */
 bool nf_ct_delete(struct nf_conn *ct, u32 portid, int report)
 {
 	struct nf_conn_tstamp *tstamp;
 
+	/* never inserted, nothing to unlink */
+	if (!nf_ct_is_confirmed(ct))
+		return false;
+
+	if (test_and_set_bit(IPS_DYING_BIT, &ct->status))
+		return false;
+
 	tstamp = nf_conn_tstamp_find(ct);
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_get_real_ns();
 
-	if (nf_ct_is_dying(ct))
-		goto delete;
-
 	if (nf_conntrack_event_report(IPCT_DESTROY, ct,
 				    portid, report) < 0) {
-		/* destroy event was not delivered */
+		/* destroy event was not delivered, the event cache worker
+		 * drops the reference once it is redelivered.
+		 */
 		nf_ct_delete_from_lists(ct);
 		nf_conntrack_ecache_delayed_work(nf_ct_net(ct));
 		return false;
 	}
 
 	nf_conntrack_ecache_work(nf_ct_net(ct));
-	set_bit(IPS_DYING_BIT, &ct->status);
- delete:
 	nf_ct_delete_from_lists(ct);
 	nf_ct_put(ct);
 	return true;
 }
 EXPORT_SYMBOL_GPL(nf_ct_delete);
 
-static void death_by_timeout(unsigned long ul_conntrack)
+/* Reap a timed out entry found while walking the hash table */
+static bool nf_ct_gc_expired(struct nf_conn *ct)
 {
-	nf_ct_delete((struct nf_conn *)ul_conntrack, 0, 0);
+	bool ret = false;
+
+	if (nf_ct_is_dying(ct))
+		return false;
+
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		return false;
+
+	/* the object may have been freed and reused meanwhile */
+	if (nf_ct_should_gc(ct))
+		ret = nf_ct_kill(ct);
+
+	nf_ct_put(ct);
+	return ret;
 }
 
 static inline bool
@@ -410,15 +453,26 @@ ____nf_conntrack_find(struct net *net, u16 zone,
 		      const struct nf_conntrack_tuple *tuple, u32 hash)
 {
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
-	unsigned int bucket = hash_bucket(hash, net);
+	unsigned int bucket, hsize;
 
 	/* Disable BHs the entire time since we normally need to disable them
 	 * at least once for the stats anyway.
 	 */
 	local_bh_disable();
 begin:
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	bucket = __hash_bucket(hash, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[bucket], hnnode) {
+		struct nf_conn *ct = nf_ct_tuplehash_to_ctrack(h);
+
+		if (nf_ct_is_expired(ct)) {
+			nf_ct_gc_expired(ct);
+			continue;
+		}
+
 		if (nf_ct_key_equal(h, tuple, zone)) {
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
@@ -429,7 +483,8 @@ begin:
 	/*
 	 * if the nulls value we got at the end of this lookup is
 	 * not the expected one, we must restart lookup.
-	 * We probably met an item that was moved to another chain.
+	 * We probably met an item that was moved to another chain,
+	 * or to the new table of a resize.
 	 */
 	if (get_nulls_value(n) != bucket) {
 		NF_CT_STAT_INC(net, search_restart);
@@ -522,7 +577,6 @@ nf_conntrack_hash_check_insert(struct nf_conn *ct)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	add_timer(&ct->timeout);
 	smp_wmb();
 	/* The caller holds a reference to this object */
 	atomic_set(&ct->ct_general.use, 2);
@@ -635,11 +689,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		    zone == nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)))
 			goto out;
 
-	/* Timer relative to confirmation time, not original
+	/* Timeout relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	ct->timeout += nfct_time_stamp;
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -652,7 +705,7 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
 	/* Since the lookup is lockless, hash insertion must be done after
-	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
+	 * setting the timeout and the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
@@ -686,17 +739,27 @@ nf_conntrack_tuple_taken(const struct nf_conntrack_tuple *tuple,
 {
 	struct net *net = nf_ct_net(ignored_conntrack);
 	struct nf_conntrack_tuple_hash *h;
+	struct hlist_nulls_head *ct_hash;
 	struct hlist_nulls_node *n;
 	struct nf_conn *ct;
 	u16 zone = nf_ct_zone(ignored_conntrack);
-	unsigned int hash = hash_conntrack(net, zone, tuple);
+	unsigned int hash, hsize;
 
 	/* Disable BHs the entire time since we need to disable them at
 	 * least once for the stats anyway.
 	 */
 	rcu_read_lock_bh();
-	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash], hnnode) {
+	nf_conntrack_get_ht(net, &ct_hash, &hsize);
+	hash = __hash_conntrack(tuple, zone, hsize);
+
+	hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[hash], hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
+
+		if (nf_ct_is_expired(ct)) {
+			nf_ct_gc_expired(ct);
+			continue;
+		}
+
 		if (ct != ignored_conntrack &&
 		    nf_ct_tuple_equal(tuple, &h->tuple) &&
 		    nf_ct_zone(ct) == zone) {
@@ -715,7 +778,8 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
 #define NF_CT_EVICTION_RANGE	8
 
 /* There's a small race here where we may free a just-assured
-   connection.  Too bad: we're in trouble anyway. */
+   connection.  Too bad: we're in trouble anyway.  Timed out entries
+   the gc has not reaped yet go first, whether assured or not. */
 static noinline int early_drop(struct net *net, unsigned int _hash)
 {
 	/* Use oldest entry, which is roughly LRU */
@@ -741,7 +805,8 @@ restart:
 		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
-			if (!test_bit(IPS_ASSURED_BIT, &tmp->status) &&
+			if ((!test_bit(IPS_ASSURED_BIT, &tmp->status) ||
+			     nf_ct_is_expired(tmp)) &&
 			    !nf_ct_is_dying(tmp) &&
 			    atomic_inc_not_zero(&tmp->ct_general.use)) {
 				ct = tmp;
@@ -762,11 +827,9 @@ restart:
 	if (!ct)
 		return dropped;
 
-	if (del_timer(&ct->timeout)) {
-		if (nf_ct_delete(ct, 0, 0)) {
-			dropped = 1;
-			NF_CT_STAT_INC_ATOMIC(net, early_drop);
-		}
+	if (nf_ct_delete(ct, 0, 0)) {
+		dropped = 1;
+		NF_CT_STAT_INC_ATOMIC(net, early_drop);
 	}
 	nf_ct_put(ct);
 	return dropped;
@@ -829,8 +892,8 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
 	ct->status = 0;
-	/* Don't set timer yet: wait for confirmation */
-	setup_timer(&ct->timeout, death_by_timeout, (unsigned long)ct);
+	/* relative until confirmation, see __nf_conntrack_confirm() */
+	ct->timeout = 0;
 	write_pnet(&ct->ct_net, net);
 	memset(&ct->__nfct_init_offset[0], 0,
 	       offsetof(struct nf_conn, proto) -
@@ -1207,25 +1270,22 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
-	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
+	u32 timeout;
+
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
 	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
 		goto acct;
 
-	/* If not in hash table, timer will not be active yet */
-	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
-	} else {
-		unsigned long newtime = jiffies + extra_jiffies;
+	/* If not in hash table, the timeout is relative to confirmation */
+	timeout = extra_jiffies;
+	if (nf_ct_is_confirmed(ct))
+		timeout += nfct_time_stamp;
 
-		/* Only update the timeout if the new timeout is at least
-		   HZ jiffies from the old timeout. Need del_timer for race
-		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
-			mod_timer_pending(&ct->timeout, newtime);
-	}
+	/* Avoid dirtying the cacheline on every packet of a busy flow */
+	if (ct->timeout != timeout)
+		ct->timeout = timeout;
 
 acct:
 	if (do_acct) {
@@ -1260,11 +1320,7 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->timeout.function((unsigned long)ct);
-		return true;
-	}
-	return false;
+	return nf_ct_delete(ct, 0, 0);
 }
 EXPORT_SYMBOL_GPL(__nf_ct_kill_acct);
 
@@ -1399,16 +1455,85 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			nf_ct_delete(ct, portid, report);
-
-		/* ... else the timer will get him soon. */
-
+		nf_ct_delete(ct, portid, report);
 		nf_ct_put(ct);
 	}
 }
 EXPORT_SYMBOL_GPL(nf_ct_iterate_cleanup);
 
+/* Timed out entries are reaped lazily, by lookups that stumble over them
+ * and by a per-netns worker that walks a slice of the hash table on each
+ * run.  The worker comes back sooner the more dead entries it finds.
+ */
+#define GC_MAX_BUCKETS_DIV	64u
+#define GC_MAX_BUCKETS		8192u
+#define GC_INTERVAL		(5 * HZ)
+#define GC_MAX_EVICTS		256u
+
+static void gc_worker(struct work_struct *work)
+{
+	struct netns_ct *ctnet =
+		container_of(work, struct netns_ct, gc_dwork.work);
+	struct net *net = container_of(ctnet, struct net, ct);
+	unsigned int i, goal, buckets = 0, expired_count = 0;
+	unsigned int scanned = 0, ratio;
+	unsigned long next_run;
+
+	goal = min(ctnet->htable_size / GC_MAX_BUCKETS_DIV, GC_MAX_BUCKETS);
+	i = ctnet->gc_next_bucket;
+
+	do {
+		struct nf_conntrack_tuple_hash *h;
+		struct hlist_nulls_head *ct_hash;
+		struct hlist_nulls_node *n;
+		unsigned int hsize;
+		struct nf_conn *tmp;
+
+		rcu_read_lock();
+
+		nf_conntrack_get_ht(net, &ct_hash, &hsize);
+		if (i >= hsize)
+			i = 0;
+
+		hlist_nulls_for_each_entry_rcu(h, n, &ct_hash[i], hnnode) {
+			tmp = nf_ct_tuplehash_to_ctrack(h);
+
+			scanned++;
+			if (nf_ct_is_expired(tmp) && nf_ct_gc_expired(tmp))
+				expired_count++;
+		}
+
+		rcu_read_unlock();
+		cond_resched();
+		i++;
+	} while (++buckets < goal && expired_count < GC_MAX_EVICTS);
+
+	ctnet->gc_next_bucket = i;
+
+	local_bh_disable();
+	NF_CT_STAT_INC(net, gc_runs);
+	__this_cpu_add(net->ct.stat->gc_scanned, scanned);
+	__this_cpu_add(net->ct.stat->gc_expired, expired_count);
+	local_bh_enable();
+
+	ratio = scanned ? expired_count * 100 / scanned : 0;
+	if (ratio >= 90 || expired_count == GC_MAX_EVICTS) {
+		/* mostly dead entries, keep going right away */
+		ctnet->gc_interval = 0;
+		next_run = 0;
+	} else if (expired_count) {
+		ctnet->gc_interval /= 2;
+		next_run = msecs_to_jiffies(1);
+	} else {
+		if (ctnet->gc_interval < GC_INTERVAL)
+			ctnet->gc_interval += msecs_to_jiffies(1);
+		next_run = ctnet->gc_interval;
+	}
+
+	queue_delayed_work(system_power_efficient_wq, &ctnet->gc_dwork,
+			   next_run);
+}
+
 static int kill_all(struct nf_conn *i, void *data)
 {
 	return 1;
@@ -1478,6 +1603,9 @@ void nf_conntrack_cleanup_net_list(struct list_head *net_exit_list)
 	int busy;
 	struct net *net;
 
+	list_for_each_entry(net, net_exit_list, exit_list)
+		cancel_delayed_work_sync(&net->ct.gc_dwork);
+
 	/*
 	 * This makes sure all current packets have passed through
 	 *  netfilter framework.  Roll on, two-stage module
@@ -1567,7 +1695,8 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	/* Lookups in the old hash might happen in parallel, which means we
 	 * might get false negatives during connection lookup. New connections
 	 * created because of a false negative won't make it into the hash
-	 * though since that required taking the locks.
+	 * though since that required taking the locks.  Lookups that end up
+	 * on a nulls marker of the new table restart on it.
 	 */
 
 	for (i = 0; i < init_net.ct.htable_size; i++) {
@@ -1591,6 +1720,8 @@ int nf_conntrack_set_hashsize(const char *val, struct kernel_param *kp)
 	nf_conntrack_all_unlock();
 	local_bh_enable();
 
+	/* lockless readers may still walk the old table */
+	synchronize_net();
 	nf_ct_free_hashtable(old_hash, old_size);
 	return 0;
 }
@@ -1794,6 +1925,11 @@ int nf_conntrack_init_net(struct net *net)
 	ret = nf_conntrack_proto_pernet_init(net);
 	if (ret < 0)
 		goto err_proto;
+
+	INIT_DEFERRABLE_WORK(&net->ct.gc_dwork, gc_worker);
+	net->ct.gc_interval = GC_INTERVAL;
+	queue_delayed_work(system_power_efficient_wq, &net->ct.gc_dwork,
+			   GC_INTERVAL);
 	return 0;
 
 err_proto:
@@ -141,10 +141,7 @@ nla_put_failure:
 static inline int
 ctnetlink_dump_timeout(struct sk_buff *skb, const struct nf_conn *ct)
 {
-	long timeout = ((long)ct->timeout.expires - (long)jiffies) / HZ;
-
-	if (timeout < 0)
-		timeout = 0;
+	long timeout = nf_ct_expires(ct) / HZ;
 
 	if (nla_put_be32(skb, CTA_TIMEOUT, htonl(timeout)))
 		goto nla_put_failure;
@@ -828,6 +825,9 @@ restart:
 					continue;
 				cb->args[1] = 0;
 			}
+			/* timed out, left for the gc to reap */
+			if (nf_ct_is_expired(ct))
+				continue;
 			if (!ctnetlink_filter_match(ct, cb->data))
 				continue;
 
@@ -1092,8 +1092,7 @@ ctnetlink_del_conntrack(struct sock *ctnl, struct sk_buff *skb,
 		}
 	}
 
-	if (del_timer(&ct->timeout))
-		nf_ct_delete(ct, NETLINK_CB(skb).portid, nlmsg_report(nlh));
+	nf_ct_delete(ct, NETLINK_CB(skb).portid, nlmsg_report(nlh));
 
 	nf_ct_put(ct);
 
@@ -1366,8 +1365,9 @@ ctnetlink_change_status(struct nf_conn *ct, const struct nlattr * const cda[])
 
 	/* Be careful here, modifying NAT bits can screw up things,
 	 * so don't let users modify them directly if they don't pass
-	 * nf_nat_range. */
-	ct->status |= status & ~(IPS_NAT_DONE_MASK | IPS_NAT_MASK);
+	 * nf_nat_range.  The offload bit belongs to the flow table. */
+	ct->status |= status & ~(IPS_NAT_DONE_MASK | IPS_NAT_MASK |
+				 IPS_OFFLOAD);
 	return 0;
 }
 
@@ -1459,13 +1459,14 @@ ctnetlink_change_helper(struct nf_conn *ct, const struct nlattr * const cda[])
 static inline int
 ctnetlink_change_timeout(struct nf_conn *ct, const struct nlattr * const cda[])
 {
-	u_int32_t timeout = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
+	u64 timeout = (u64)ntohl(nla_get_be32(cda[CTA_TIMEOUT])) * HZ;
 
-	if (!del_timer(&ct->timeout))
+	if (!nf_ct_is_confirmed(ct) || nf_ct_is_dying(ct))
 		return -ETIME;
 
-	ct->timeout.expires = jiffies + timeout * HZ;
-	add_timer(&ct->timeout);
+	if (timeout > INT_MAX)
+		timeout = INT_MAX;
+	ct->timeout = nfct_time_stamp + (u32)timeout;
 
 	return 0;
 }
@@ -1655,6 +1656,7 @@ ctnetlink_create_conntrack(struct net *net, u16 zone,
 	int err = -EINVAL;
 	struct nf_conntrack_helper *helper;
 	struct nf_conn_tstamp *tstamp;
+	u64 timeout;
 
 	ct = nf_conntrack_alloc(net, zone, otuple, rtuple, GFP_ATOMIC);
 	if (IS_ERR(ct))
@@ -1662,9 +1664,10 @@ ctnetlink_create_conntrack(struct net *net, u16 zone,
 
 	if (!cda[CTA_TIMEOUT])
 		goto err1;
-	ct->timeout.expires = ntohl(nla_get_be32(cda[CTA_TIMEOUT]));
-
-	ct->timeout.expires = jiffies + ct->timeout.expires * HZ;
+	timeout = (u64)ntohl(nla_get_be32(cda[CTA_TIMEOUT])) * HZ;
+	if (timeout > INT_MAX)
+		timeout = INT_MAX;
+	ct->timeout = nfct_time_stamp + (u32)timeout;
 
 	rcu_read_lock();
  	if (cda[CTA_HELP]) {
@@ -1921,7 +1924,10 @@ ctnetlink_ct_stat_cpu_fill_info(struct sk_buff *skb, u32 portid, u32 seq,
 	    nla_put_be32(skb, CTA_STATS_EARLY_DROP, htonl(st->early_drop)) ||
 	    nla_put_be32(skb, CTA_STATS_ERROR, htonl(st->error)) ||
 	    nla_put_be32(skb, CTA_STATS_SEARCH_RESTART,
-				htonl(st->search_restart)))
+				htonl(st->search_restart)) ||
+	    nla_put_be32(skb, CTA_STATS_GC_RUNS, htonl(st->gc_runs)) ||
+	    nla_put_be32(skb, CTA_STATS_GC_SCANNED, htonl(st->gc_scanned)) ||
+	    nla_put_be32(skb, CTA_STATS_GC_EXPIRED, htonl(st->gc_expired)))
 		goto nla_put_failure;
 
 	nlmsg_end(skb, nlh);
@@ -0,0 +1,520 @@
+/*
+ * Flow table: established conntrack entries that are forwarded from a
+ * netfilter hook with their cached route and NAT, without walking the
+ * classic forwarding path.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netfilter.h>
+#include <linux/rhashtable.h>
+#include <linux/netdevice.h>
+#include <linux/jhash.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
+#include <net/ip.h>
+#include <net/ip6_fib.h>
+#include <net/netfilter/nf_flow_table.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_acct.h>
+#include <net/netfilter/nf_conntrack_tuple.h>
+
+/* Timeouts handed back to conntrack when a flow leaves the flow table */
+#define NF_FLOW_TIMEOUT_TCP_FIXUP	(120 * HZ)
+#define NF_FLOW_TIMEOUT_UDP_FIXUP	(30 * HZ)
+
+static DEFINE_MUTEX(flowtable_lock);
+static LIST_HEAD(flowtables);
+
+static void
+flow_offload_fill_dir(struct flow_offload *flow, struct nf_conn *ct,
+		      struct nf_flow_route *route,
+		      enum flow_offload_tuple_dir dir)
+{
+	struct flow_offload_tuple *ft = &flow->tuplehash[dir].tuple;
+	struct nf_conntrack_tuple *ctt = &ct->tuplehash[dir].tuple;
+	struct dst_entry *dst = route->tuple[dir].dst;
+
+	ft->dir = dir;
+
+	switch (ctt->src.l3num) {
+	case NFPROTO_IPV4:
+		ft->src_v4 = ctt->src.u3.in;
+		ft->dst_v4 = ctt->dst.u3.in;
+		ft->mtu = ip_dst_mtu_maybe_forward(dst, true);
+		break;
+	case NFPROTO_IPV6:
+		ft->src_v6 = ctt->src.u3.in6;
+		ft->dst_v6 = ctt->dst.u3.in6;
+		ft->mtu = dst_mtu(dst);
+		if (((struct rt6_info *)dst)->rt6i_node)
+			ft->dst_cookie =
+				((struct rt6_info *)dst)->rt6i_node->fn_sernum;
+		break;
+	}
+
+	ft->l3proto = ctt->src.l3num;
+	ft->l4proto = ctt->dst.protonum;
+	ft->src_port = ctt->src.u.tcp.port;
+	ft->dst_port = ctt->dst.u.tcp.port;
+
+	ft->iifidx = route->tuple[dir].ifindex;
+	ft->oifidx = route->tuple[!dir].ifindex;
+	ft->dst_cache = dst;
+}
+
+/**
+ *	flow_offload_alloc - create a flow for an established conntrack entry
+ *	@ct: conntrack entry, a reference is taken
+ *	@route: routes of both directions, a reference is taken on each
+ */
+struct flow_offload *
+flow_offload_alloc(struct nf_conn *ct, struct nf_flow_route *route)
+{
+	struct flow_offload *flow;
+
+	if (unlikely(nf_ct_is_dying(ct) ||
+		     !atomic_inc_not_zero(&ct->ct_general.use)))
+		return NULL;
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow) {
+		nf_ct_put(ct);
+		return NULL;
+	}
+
+	dst_hold(route->tuple[FLOW_OFFLOAD_DIR_ORIGINAL].dst);
+	dst_hold(route->tuple[FLOW_OFFLOAD_DIR_REPLY].dst);
+
+	flow->ct = ct;
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_ORIGINAL);
+	flow_offload_fill_dir(flow, ct, route, FLOW_OFFLOAD_DIR_REPLY);
+
+	if (ct->status & IPS_SRC_NAT)
+		flow->flags |= FLOW_OFFLOAD_SNAT;
+	if (ct->status & IPS_DST_NAT)
+		flow->flags |= FLOW_OFFLOAD_DNAT;
+
+	return flow;
+}
+EXPORT_SYMBOL_GPL(flow_offload_alloc);
+
+/* Fold the packets forwarded by the fast path into the conntrack entry, so
+ * that accounting keeps working whatever does the forwarding.
+ */
+static void flow_offload_sync_counters(struct flow_offload *flow)
+{
+	struct nf_conn_acct *acct = nf_conn_acct_find(flow->ct);
+	int dir;
+
+	if (!acct)
+		return;
+
+	for (dir = 0; dir < FLOW_OFFLOAD_DIR_MAX; dir++) {
+		u64 packets = atomic64_xchg(&flow->counter[dir].packets, 0);
+		u64 bytes = atomic64_xchg(&flow->counter[dir].bytes, 0);
+
+		atomic64_add(packets, &acct->counter[dir].packets);
+		atomic64_add(bytes, &acct->counter[dir].bytes);
+	}
+}
+
+static void flow_offload_free_rcu(struct rcu_head *head)
+{
+	struct flow_offload *flow;
+
+	flow = container_of(head, struct flow_offload, rcu_head);
+	flow_offload_sync_counters(flow);
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_cache);
+	dst_release(flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_cache);
+	nf_ct_put(flow->ct);
+	kfree(flow);
+}
+
+void flow_offload_free(struct flow_offload *flow)
+{
+	call_rcu(&flow->rcu_head, flow_offload_free_rcu);
+}
+EXPORT_SYMBOL_GPL(flow_offload_free);
+
+int flow_offload_add(struct nf_flowtable *flow_table, struct flow_offload *flow)
+{
+	struct rhashtable *ht = &flow_table->rhashtable;
+
+	flow->timeout = (u32)jiffies + NF_FLOW_TIMEOUT;
+
+	if (!rhashtable_lookup_insert(ht, &flow->tuplehash[0].node))
+		return -EEXIST;
+
+	if (!rhashtable_lookup_insert(ht, &flow->tuplehash[1].node)) {
+		rhashtable_remove(ht, &flow->tuplehash[0].node);
+		return -EEXIST;
+	}
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(flow_offload_add);
+
+/* Hand the entry back to conntrack.  The fast path did not track the TCP
+ * windows, have conntrack pick them up again from the next packets, and
+ * give the entry a timeout of its own again.
+ */
+static void flow_offload_fixup_ct_state(struct nf_conn *ct)
+{
+	unsigned long timeout;
+
+	if (nf_ct_protonum(ct) == IPPROTO_TCP) {
+		spin_lock_bh(&ct->lock);
+		ct->proto.tcp.seen[0].td_maxwin = 0;
+		ct->proto.tcp.seen[1].td_maxwin = 0;
+		spin_unlock_bh(&ct->lock);
+		timeout = NF_FLOW_TIMEOUT_TCP_FIXUP;
+	} else {
+		timeout = NF_FLOW_TIMEOUT_UDP_FIXUP;
+	}
+
+	ct->timeout = nfct_time_stamp + timeout;
+}
+
+/**
+ *	flow_offload_teardown - stop forwarding a flow from the fast path
+ *	@flow: flow to tear down
+ *
+ *	Packets of the flow take the classic path again from now on, the
+ *	garbage collector removes the flow from its table.
+ */
+void flow_offload_teardown(struct flow_offload *flow)
+{
+	flow->flags |= FLOW_OFFLOAD_TEARDOWN;
+	flow_offload_fixup_ct_state(flow->ct);
+}
+EXPORT_SYMBOL_GPL(flow_offload_teardown);
+
+static void flow_offload_del(struct nf_flowtable *flow_table,
+			     struct flow_offload *flow)
+{
+	struct rhashtable *ht = &flow_table->rhashtable;
+
+	flow->flags |= FLOW_OFFLOAD_DYING;
+	rhashtable_remove(ht, &flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].node);
+	rhashtable_remove(ht, &flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].node);
+
+	if (!(flow->flags & FLOW_OFFLOAD_TEARDOWN))
+		flow_offload_fixup_ct_state(flow->ct);
+	clear_bit(IPS_OFFLOAD_BIT, &flow->ct->status);
+
+	flow_offload_free(flow);
+}
+
+/**
+ *	flow_offload_lookup - find the flow a packet belongs to
+ *	@flow_table: flow table to search
+ *	@tuple: tuple of the packet, zeroed up to and including @dir
+ *
+ *	Must be called under rcu_read_lock().
+ */
+struct flow_offload_tuple_rhash *
+flow_offload_lookup(struct nf_flowtable *flow_table,
+		    struct flow_offload_tuple *tuple)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct flow_offload *flow;
+	int dir;
+
+	tuplehash = rhashtable_lookup(&flow_table->rhashtable, tuple);
+	if (!tuplehash)
+		return NULL;
+
+	dir = tuplehash->tuple.dir;
+	flow = container_of(tuplehash, struct flow_offload, tuplehash[dir]);
+	if (flow->flags & (FLOW_OFFLOAD_DYING | FLOW_OFFLOAD_TEARDOWN))
+		return NULL;
+
+	return tuplehash;
+}
+EXPORT_SYMBOL_GPL(flow_offload_lookup);
+
+static void nf_flow_table_iterate(struct nf_flowtable *flow_table,
+				  void (*iter)(struct nf_flowtable *flow_table,
+					       struct flow_offload *flow,
+					       void *data),
+				  void *data)
+{
+	struct flow_offload_tuple_rhash *tuplehash;
+	struct rhashtable_iter hti;
+	struct flow_offload *flow;
+
+	if (rhashtable_walk_init(&flow_table->rhashtable, &hti))
+		return;
+
+	rhashtable_walk_start(&hti);
+
+	while ((tuplehash = rhashtable_walk_next(&hti)) != NULL) {
+		if (IS_ERR(tuplehash)) {
+			if (PTR_ERR(tuplehash) == -EAGAIN)
+				continue;
+			break;
+		}
+		/* every flow is hashed twice, visit it once */
+		if (tuplehash->tuple.dir)
+			continue;
+
+		flow = container_of(tuplehash, struct flow_offload,
+				    tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL]);
+		iter(flow_table, flow, data);
+	}
+
+	rhashtable_walk_stop(&hti);
+	rhashtable_walk_exit(&hti);
+}
+
+static bool nf_flow_has_expired(const struct flow_offload *flow)
+{
+	return (__s32)(flow->timeout - (u32)jiffies) <= 0;
+}
+
+/* Conntrack does not see the packets of offloaded flows, keep the entry
+ * from timing out for as long as the flow is in use.
+ */
+static void flow_offload_keepalive(struct flow_offload *flow)
+{
+	struct nf_conn *ct = flow->ct;
+
+	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
+		return;
+
+	if (nf_ct_expires(ct) < NF_FLOW_TIMEOUT)
+		ct->timeout = nfct_time_stamp + 2 * NF_FLOW_TIMEOUT;
+}
+
+static void nf_flow_offload_gc_step(struct nf_flowtable *flow_table,
+				    struct flow_offload *flow, void *data)
+{
+	if (nf_flow_has_expired(flow) ||
+	    nf_ct_is_dying(flow->ct) ||
+	    (flow->flags & (FLOW_OFFLOAD_DYING | FLOW_OFFLOAD_TEARDOWN))) {
+		flow_offload_del(flow_table, flow);
+		return;
+	}
+
+	flow_offload_keepalive(flow);
+	flow_offload_sync_counters(flow);
+}
+
+static void nf_flow_offload_work_gc(struct work_struct *work)
+{
+	struct nf_flowtable *flow_table;
+
+	flow_table = container_of(work, struct nf_flowtable, gc_work.work);
+	nf_flow_table_iterate(flow_table, nf_flow_offload_gc_step, NULL);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+}
+
+static int nf_flow_nat_port_tcp(struct sk_buff *skb, unsigned int thoff,
+				__be16 port, __be16 new_port)
+{
+	struct tcphdr *tcph;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*tcph)) ||
+	    !skb_make_writable(skb, thoff + sizeof(*tcph)))
+		return -1;
+
+	tcph = (void *)(skb_network_header(skb) + thoff);
+	inet_proto_csum_replace2(&tcph->check, skb, port, new_port, 0);
+
+	return 0;
+}
+
+static int nf_flow_nat_port_udp(struct sk_buff *skb, unsigned int thoff,
+				__be16 port, __be16 new_port)
+{
+	struct udphdr *udph;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*udph)) ||
+	    !skb_make_writable(skb, thoff + sizeof(*udph)))
+		return -1;
+
+	udph = (void *)(skb_network_header(skb) + thoff);
+	if (udph->check || skb->ip_summed == CHECKSUM_PARTIAL) {
+		inet_proto_csum_replace2(&udph->check, skb, port,
+					 new_port, 0);
+		if (!udph->check)
+			udph->check = CSUM_MANGLED_0;
+	}
+
+	return 0;
+}
+
+static int nf_flow_nat_port(struct sk_buff *skb, unsigned int thoff,
+			    u8 protocol, __be16 port, __be16 new_port)
+{
+	switch (protocol) {
+	case IPPROTO_TCP:
+		return nf_flow_nat_port_tcp(skb, thoff, port, new_port);
+	case IPPROTO_UDP:
+		return nf_flow_nat_port_udp(skb, thoff, port, new_port);
+	}
+
+	return 0;
+}
+
+int nf_flow_snat_port(const struct flow_offload *flow,
+		      struct sk_buff *skb, unsigned int thoff,
+		      u8 protocol, enum flow_offload_tuple_dir dir)
+{
+	struct flow_ports *hdr;
+	__be16 port, new_port;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*hdr)) ||
+	    !skb_make_writable(skb, thoff + sizeof(*hdr)))
+		return -1;
+
+	hdr = (void *)(skb_network_header(skb) + thoff);
+
+	switch (dir) {
+	case FLOW_OFFLOAD_DIR_ORIGINAL:
+		port = hdr->source;
+		new_port = flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.dst_port;
+		hdr->source = new_port;
+		break;
+	case FLOW_OFFLOAD_DIR_REPLY:
+		port = hdr->dest;
+		new_port = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.src_port;
+		hdr->dest = new_port;
+		break;
+	default:
+		return -1;
+	}
+
+	return nf_flow_nat_port(skb, thoff, protocol, port, new_port);
+}
+EXPORT_SYMBOL_GPL(nf_flow_snat_port);
+
+int nf_flow_dnat_port(const struct flow_offload *flow,
+		      struct sk_buff *skb, unsigned int thoff,
+		      u8 protocol, enum flow_offload_tuple_dir dir)
+{
+	struct flow_ports *hdr;
+	__be16 port, new_port;
+
+	if (!pskb_may_pull(skb, thoff + sizeof(*hdr)) ||
+	    !skb_make_writable(skb, thoff + sizeof(*hdr)))
+		return -1;
+
+	hdr = (void *)(skb_network_header(skb) + thoff);
+
+	switch (dir) {
+	case FLOW_OFFLOAD_DIR_ORIGINAL:
+		port = hdr->dest;
+		new_port = flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.src_port;
+		hdr->dest = new_port;
+		break;
+	case FLOW_OFFLOAD_DIR_REPLY:
+		port = hdr->source;
+		new_port = flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.dst_port;
+		hdr->source = new_port;
+		break;
+	default:
+		return -1;
+	}
+
+	return nf_flow_nat_port(skb, thoff, protocol, port, new_port);
+}
+EXPORT_SYMBOL_GPL(nf_flow_dnat_port);
+
+/**
+ *	nf_flow_table_init - set up an empty flow table
+ *	@flow_table: flow table, @type is set by the caller
+ *	@net: namespace of the flows
+ */
+int nf_flow_table_init(struct nf_flowtable *flow_table, struct net *net)
+{
+	struct rhashtable_params params = {
+		.head_offset	= offsetof(struct flow_offload_tuple_rhash, node),
+		.key_offset	= offsetof(struct flow_offload_tuple_rhash, tuple),
+		.key_len	= offsetof(struct flow_offload_tuple, dir),
+		.hashfn		= jhash,
+	};
+	int err;
+
+	err = rhashtable_init(&flow_table->rhashtable, &params);
+	if (err < 0)
+		return err;
+
+	flow_table->net = net;
+	INIT_DELAYED_WORK(&flow_table->gc_work, nf_flow_offload_work_gc);
+	queue_delayed_work(system_power_efficient_wq, &flow_table->gc_work, HZ);
+
+	mutex_lock(&flowtable_lock);
+	list_add(&flow_table->list, &flowtables);
+	mutex_unlock(&flowtable_lock);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(nf_flow_table_init);
+
+static void nf_flow_table_do_cleanup(struct nf_flowtable *flow_table,
+				     struct flow_offload *flow, void *data)
+{
+	struct net_device *dev = data;
+
+	if (dev &&
+	    flow->tuplehash[FLOW_OFFLOAD_DIR_ORIGINAL].tuple.iifidx != dev->ifindex &&
+	    flow->tuplehash[FLOW_OFFLOAD_DIR_REPLY].tuple.iifidx != dev->ifindex)
+		return;
+
+	if (!(flow->flags & FLOW_OFFLOAD_TEARDOWN))
+		flow_offload_teardown(flow);
+}
+
+/**
+ *	nf_flow_table_cleanup - tear down the flows through a device
+ *	@net: namespace of the device
+ *	@dev: device going down
+ */
+void nf_flow_table_cleanup(struct net *net, struct net_device *dev)
+{
+	struct nf_flowtable *flow_table;
+
+	mutex_lock(&flowtable_lock);
+	list_for_each_entry(flow_table, &flowtables, list) {
+		if (flow_table->net == net)
+			nf_flow_table_iterate(flow_table,
+					      nf_flow_table_do_cleanup, dev);
+	}
+	mutex_unlock(&flowtable_lock);
+}
+EXPORT_SYMBOL_GPL(nf_flow_table_cleanup);
+
+/**
+ *	nf_flow_table_free - release all flows and the table
+ *	@flow_table: flow table, its hook must be unregistered already
+ */
+void nf_flow_table_free(struct nf_flowtable *flow_table)
+{
+	mutex_lock(&flowtable_lock);
+	list_del(&flow_table->list);
+	mutex_unlock(&flowtable_lock);
+
+	cancel_delayed_work_sync(&flow_table->gc_work);
+	nf_flow_table_iterate(flow_table, nf_flow_table_do_cleanup, NULL);
+	nf_flow_table_iterate(flow_table, nf_flow_offload_gc_step, NULL);
+	rhashtable_destroy(&flow_table->rhashtable);
+}
+EXPORT_SYMBOL_GPL(nf_flow_table_free);
+
+static void __exit nf_flow_table_module_exit(void)
+{
+	/* wait for the flows released by the last flow table */
+	rcu_barrier();
+}
+
+module_exit(nf_flow_table_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Netfilter flow table fast path");
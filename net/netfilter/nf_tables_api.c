@@ -14,6 +14,7 @@
 #include <linux/skbuff.h>
 #include <linux/netlink.h>
 #include <linux/netfilter.h>
+#include <linux/netfilter_ipv4.h>
 #include <linux/netfilter/nfnetlink.h>
 #include <linux/netfilter/nf_tables.h>
 #include <net/netfilter/nf_tables_core.h>
@@ -325,6 +326,51 @@ static int nft_delset(struct nft_ctx *ctx, struct nft_set *set)
 	return err;
 }
 
+/* Internal flow table flag */
+#define NFT_FLOWTABLE_INACTIVE	(1 << 15)
+
+static int nft_trans_flowtable_add(struct nft_ctx *ctx, int msg_type,
+				   struct nft_flowtable *flowtable)
+{
+	struct nft_trans *trans;
+
+	trans = nft_trans_alloc(ctx, msg_type,
+				sizeof(struct nft_trans_flowtable));
+	if (trans == NULL)
+		return -ENOMEM;
+
+	if (msg_type == NFT_MSG_NEWFLOWTABLE)
+		flowtable->flags |= NFT_FLOWTABLE_INACTIVE;
+
+	nft_trans_flowtable(trans) = flowtable;
+	list_add_tail(&trans->list, &ctx->net->nft.commit_list);
+
+	return 0;
+}
+
+static int nft_delflowtable(struct nft_ctx *ctx,
+			    struct nft_flowtable *flowtable)
+{
+	int err;
+
+	err = nft_trans_flowtable_add(ctx, NFT_MSG_DELFLOWTABLE, flowtable);
+	if (err < 0)
+		return err;
+
+	list_del_rcu(&flowtable->list);
+	ctx->table->use--;
+
+	return err;
+}
+
+static void nf_tables_unregister_flowtable_hooks(const struct nft_table *table,
+						 struct nft_flowtable *flowtable,
+						 unsigned int hook_nops)
+{
+	if (!(table->flags & NFT_TABLE_F_DORMANT))
+		nf_unregister_hooks(flowtable->ops, hook_nops);
+}
+
 /*
  * Tables
  */
@@ -554,8 +600,20 @@ err:
 	return err;
 }
 
-static int nf_tables_table_enable(const struct nft_af_info *afi,
-				  struct nft_table *table)
+static void nf_tables_table_disable_chains(const struct nft_af_info *afi,
+					   struct nft_table *table)
+{
+	struct nft_chain *chain;
+
+	list_for_each_entry(chain, &table->chains, list) {
+		if (chain->flags & NFT_BASE_CHAIN)
+			nf_unregister_hooks(nft_base_chain(chain)->ops,
+					    afi->nops);
+	}
+}
+
+static int nf_tables_table_enable_chains(const struct nft_af_info *afi,
+					 struct nft_table *table)
 {
 	struct nft_chain *chain;
 	int err, i = 0;
@@ -584,16 +642,44 @@ err:
 	return err;
 }
 
+static int nf_tables_table_enable(const struct nft_af_info *afi,
+				  struct nft_table *table)
+{
+	struct nft_flowtable *flowtable;
+	int err, i = 0;
+
+	err = nf_tables_table_enable_chains(afi, table);
+	if (err < 0)
+		return err;
+
+	list_for_each_entry(flowtable, &table->flowtables, list) {
+		err = nf_register_hooks(flowtable->ops, afi->nops);
+		if (err < 0)
+			goto err;
+
+		i++;
+	}
+	return 0;
+err:
+	list_for_each_entry(flowtable, &table->flowtables, list) {
+		if (i-- <= 0)
+			break;
+
+		nf_unregister_hooks(flowtable->ops, afi->nops);
+	}
+	nf_tables_table_disable_chains(afi, table);
+	return err;
+}
+
 static void nf_tables_table_disable(const struct nft_af_info *afi,
 				   struct nft_table *table)
 {
-	struct nft_chain *chain;
+	struct nft_flowtable *flowtable;
 
-	list_for_each_entry(chain, &table->chains, list) {
-		if (chain->flags & NFT_BASE_CHAIN)
-			nf_unregister_hooks(nft_base_chain(chain)->ops,
-					    afi->nops);
-	}
+	list_for_each_entry(flowtable, &table->flowtables, list)
+		nf_unregister_hooks(flowtable->ops, afi->nops);
+
+	nf_tables_table_disable_chains(afi, table);
 }
 
 static int nf_tables_updtable(struct nft_ctx *ctx)
@@ -695,6 +781,7 @@ static int nf_tables_newtable(struct sock *nlsk, struct sk_buff *skb,
 	nla_strlcpy(table->name, name, nla_len(name));
 	INIT_LIST_HEAD(&table->chains);
 	INIT_LIST_HEAD(&table->sets);
+	INIT_LIST_HEAD(&table->flowtables);
 	table->flags = flags;
 
 	nft_ctx_init(&ctx, skb, nlh, afi, table, NULL, nla);
@@ -711,6 +798,7 @@ static int nf_tables_newtable(struct sock *nlsk, struct sk_buff *skb,
 static int nft_flush_table(struct nft_ctx *ctx)
 {
 	int err;
+	struct nft_flowtable *flowtable, *nf;
 	struct nft_chain *chain, *nc;
 	struct nft_set *set, *ns;
 
@@ -722,6 +810,12 @@ static int nft_flush_table(struct nft_ctx *ctx)
 			goto out;
 	}
 
+	list_for_each_entry_safe(flowtable, nf, &ctx->table->flowtables, list) {
+		err = nft_delflowtable(ctx, flowtable);
+		if (err < 0)
+			goto out;
+	}
+
 	list_for_each_entry_safe(set, ns, &ctx->table->sets, list) {
 		if (set->flags & NFT_SET_ANONYMOUS &&
 		    !list_empty(&set->bindings))
@@ -3327,6 +3421,542 @@ static int nf_tables_delsetelem(struct sock *nlsk, struct sk_buff *skb,
 	return err;
 }
 
+/*
+ * Flow tables
+ */
+
+static LIST_HEAD(nf_tables_flowtables);
+
+void nft_register_flowtable_type(struct nf_flowtable_type *type)
+{
+	nfnl_lock(NFNL_SUBSYS_NFTABLES);
+	list_add_tail_rcu(&type->list, &nf_tables_flowtables);
+	nfnl_unlock(NFNL_SUBSYS_NFTABLES);
+}
+EXPORT_SYMBOL_GPL(nft_register_flowtable_type);
+
+void nft_unregister_flowtable_type(struct nf_flowtable_type *type)
+{
+	nfnl_lock(NFNL_SUBSYS_NFTABLES);
+	list_del_rcu(&type->list);
+	nfnl_unlock(NFNL_SUBSYS_NFTABLES);
+}
+EXPORT_SYMBOL_GPL(nft_unregister_flowtable_type);
+
+static const struct nf_flowtable_type *__nft_flowtable_type_get(int family)
+{
+	const struct nf_flowtable_type *type;
+
+	list_for_each_entry(type, &nf_tables_flowtables, list) {
+		if (family == type->family)
+			return type;
+	}
+	return NULL;
+}
+
+static const struct nf_flowtable_type *nft_flowtable_type_get(int family)
+{
+	const struct nf_flowtable_type *type;
+
+	type = __nft_flowtable_type_get(family);
+	if (type != NULL && try_module_get(type->owner))
+		return type;
+
+#ifdef CONFIG_MODULES
+	if (type == NULL) {
+		nfnl_unlock(NFNL_SUBSYS_NFTABLES);
+		request_module("nf-flowtable-%u", family);
+		nfnl_lock(NFNL_SUBSYS_NFTABLES);
+		if (__nft_flowtable_type_get(family))
+			return ERR_PTR(-EAGAIN);
+	}
+#endif
+	return ERR_PTR(-ENOENT);
+}
+
+static const struct nla_policy nft_flowtable_policy[NFTA_FLOWTABLE_MAX + 1] = {
+	[NFTA_FLOWTABLE_TABLE]		= { .type = NLA_STRING },
+	[NFTA_FLOWTABLE_NAME]		= { .type = NLA_STRING,
+					    .len = IFNAMSIZ - 1 },
+	[NFTA_FLOWTABLE_HOOK]		= { .type = NLA_NESTED },
+};
+
+static const struct nla_policy nft_flowtable_hook_policy[NFTA_FLOWTABLE_HOOK_MAX + 1] = {
+	[NFTA_FLOWTABLE_HOOK_NUM]	= { .type = NLA_U32 },
+	[NFTA_FLOWTABLE_HOOK_PRIORITY]	= { .type = NLA_U32 },
+	[NFTA_FLOWTABLE_HOOK_DEVS]	= { .type = NLA_NESTED },
+};
+
+static int nft_ctx_init_from_flowtableattr(struct nft_ctx *ctx,
+					   const struct sk_buff *skb,
+					   const struct nlmsghdr *nlh,
+					   const struct nlattr * const nla[])
+{
+	struct net *net = sock_net(skb->sk);
+	const struct nfgenmsg *nfmsg = nlmsg_data(nlh);
+	struct nft_af_info *afi = NULL;
+	struct nft_table *table = NULL;
+
+	if (nfmsg->nfgen_family != NFPROTO_UNSPEC) {
+		afi = nf_tables_afinfo_lookup(net, nfmsg->nfgen_family, false);
+		if (IS_ERR(afi))
+			return PTR_ERR(afi);
+	}
+
+	if (nla[NFTA_FLOWTABLE_TABLE] != NULL) {
+		if (afi == NULL)
+			return -EAFNOSUPPORT;
+
+		table = nf_tables_table_lookup(afi, nla[NFTA_FLOWTABLE_TABLE]);
+		if (IS_ERR(table))
+			return PTR_ERR(table);
+		if (table->flags & NFT_TABLE_INACTIVE)
+			return -ENOENT;
+	}
+
+	nft_ctx_init(ctx, skb, nlh, afi, table, NULL, nla);
+	return 0;
+}
+
+struct nft_flowtable *nf_tables_flowtable_lookup(const struct nft_table *table,
+						 const struct nlattr *nla)
+{
+	struct nft_flowtable *flowtable;
+
+	if (nla == NULL)
+		return ERR_PTR(-EINVAL);
+
+	list_for_each_entry(flowtable, &table->flowtables, list) {
+		if (!nla_strcmp(nla, flowtable->name))
+			return flowtable;
+	}
+	return ERR_PTR(-ENOENT);
+}
+EXPORT_SYMBOL_GPL(nf_tables_flowtable_lookup);
+
+/**
+ *	nft_flowtable_has_device - check whether a device is part of a flow table
+ *
+ *	@flowtable: the flow table
+ *	@dev: the device
+ */
+bool nft_flowtable_has_device(const struct nft_flowtable *flowtable,
+			      const struct net_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < flowtable->ndevs; i++) {
+		if (!strcmp(flowtable->devices[i], dev->name))
+			return true;
+	}
+	return false;
+}
+EXPORT_SYMBOL_GPL(nft_flowtable_has_device);
+
+static int nf_tables_parse_devices(struct nft_flowtable *flowtable,
+				   const struct nlattr *attr)
+{
+	const struct nlattr *nla;
+	int rem;
+
+	nla_for_each_nested(nla, attr, rem) {
+		if (nla_type(nla) != NFTA_DEVICE_NAME)
+			return -EINVAL;
+		if (flowtable->ndevs == NFT_FLOWTABLE_DEVICE_MAX)
+			return -EFBIG;
+
+		nla_strlcpy(flowtable->devices[flowtable->ndevs++], nla,
+			    IFNAMSIZ);
+	}
+	return flowtable->ndevs ? 0 : -EINVAL;
+}
+
+static int nf_tables_flowtable_parse_hook(const struct nft_ctx *ctx,
+					  const struct nlattr *attr,
+					  struct nft_flowtable *flowtable)
+{
+	struct nlattr *tb[NFTA_FLOWTABLE_HOOK_MAX + 1];
+	int err;
+
+	err = nla_parse_nested(tb, NFTA_FLOWTABLE_HOOK_MAX, attr,
+			       nft_flowtable_hook_policy);
+	if (err < 0)
+		return err;
+
+	if (tb[NFTA_FLOWTABLE_HOOK_NUM] == NULL ||
+	    tb[NFTA_FLOWTABLE_HOOK_PRIORITY] == NULL ||
+	    tb[NFTA_FLOWTABLE_HOOK_DEVS] == NULL)
+		return -EINVAL;
+
+	/* The fast path runs before the routing decision, from the first
+	 * hook that sees packets entering the stack.
+	 */
+	flowtable->hooknum = ntohl(nla_get_be32(tb[NFTA_FLOWTABLE_HOOK_NUM]));
+	if (flowtable->hooknum != NF_INET_PRE_ROUTING)
+		return -EOPNOTSUPP;
+
+	/* Offloaded packets skip conntrack, so the hook has to run ahead of
+	 * it, but on reassembled packets.  The IPv6 priorities are the same.
+	 */
+	flowtable->priority =
+		ntohl(nla_get_be32(tb[NFTA_FLOWTABLE_HOOK_PRIORITY]));
+	if (flowtable->priority <= NF_IP_PRI_CONNTRACK_DEFRAG ||
+	    flowtable->priority >= NF_IP_PRI_CONNTRACK)
+		return -ERANGE;
+
+	return nf_tables_parse_devices(flowtable, tb[NFTA_FLOWTABLE_HOOK_DEVS]);
+}
+
+static void nf_tables_flowtable_destroy(struct nft_flowtable *flowtable)
+{
+	const struct nf_flowtable_type *type = flowtable->data.type;
+
+	type->free(&flowtable->data);
+	module_put(type->owner);
+	kfree(flowtable);
+}
+
+static int nf_tables_newflowtable(struct sock *nlsk, struct sk_buff *skb,
+				  const struct nlmsghdr *nlh,
+				  const struct nlattr * const nla[])
+{
+	const struct nfgenmsg *nfmsg = nlmsg_data(nlh);
+	const struct nf_flowtable_type *type;
+	struct nft_flowtable *flowtable;
+	struct net *net = sock_net(skb->sk);
+	int family = nfmsg->nfgen_family;
+	struct nft_af_info *afi;
+	struct nft_table *table;
+	struct nf_hook_ops *ops;
+	struct nft_ctx ctx;
+	unsigned int i;
+	int err;
+
+	if (nla[NFTA_FLOWTABLE_TABLE] == NULL ||
+	    nla[NFTA_FLOWTABLE_NAME] == NULL ||
+	    nla[NFTA_FLOWTABLE_HOOK] == NULL)
+		return -EINVAL;
+
+	afi = nf_tables_afinfo_lookup(net, family, true);
+	if (IS_ERR(afi))
+		return PTR_ERR(afi);
+
+	table = nf_tables_table_lookup(afi, nla[NFTA_FLOWTABLE_TABLE]);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+	if (table->flags & NFT_TABLE_INACTIVE)
+		return -ENOENT;
+
+	flowtable = nf_tables_flowtable_lookup(table, nla[NFTA_FLOWTABLE_NAME]);
+	if (IS_ERR(flowtable)) {
+		if (PTR_ERR(flowtable) != -ENOENT)
+			return PTR_ERR(flowtable);
+		flowtable = NULL;
+	}
+
+	if (flowtable != NULL) {
+		if (nlh->nlmsg_flags & NLM_F_EXCL)
+			return -EEXIST;
+		if (nlh->nlmsg_flags & NLM_F_REPLACE)
+			return -EOPNOTSUPP;
+		return 0;
+	}
+
+	if (!(nlh->nlmsg_flags & NLM_F_CREATE))
+		return -ENOENT;
+
+	if (table->use == UINT_MAX)
+		return -EOVERFLOW;
+
+	nft_ctx_init(&ctx, skb, nlh, afi, table, NULL, nla);
+
+	type = nft_flowtable_type_get(family);
+	if (IS_ERR(type))
+		return PTR_ERR(type);
+
+	err = -ENOMEM;
+	flowtable = kzalloc(sizeof(*flowtable), GFP_KERNEL);
+	if (flowtable == NULL)
+		goto err1;
+
+	nla_strlcpy(flowtable->name, nla[NFTA_FLOWTABLE_NAME], IFNAMSIZ);
+
+	err = nf_tables_flowtable_parse_hook(&ctx, nla[NFTA_FLOWTABLE_HOOK],
+					     flowtable);
+	if (err < 0)
+		goto err2;
+
+	flowtable->data.type = type;
+	err = type->init(&flowtable->data, net);
+	if (err < 0)
+		goto err2;
+
+	for (i = 0; i < afi->nops; i++) {
+		ops = &flowtable->ops[i];
+		ops->pf		= family;
+		ops->owner	= afi->owner;
+		ops->hooknum	= flowtable->hooknum;
+		ops->priority	= flowtable->priority;
+		ops->priv	= &flowtable->data;
+		if (afi->hook_ops_init)
+			afi->hook_ops_init(ops, i);
+		ops->hook	= type->hook;
+	}
+
+	if (!(table->flags & NFT_TABLE_F_DORMANT)) {
+		err = nf_register_hooks(flowtable->ops, afi->nops);
+		if (err < 0)
+			goto err3;
+	}
+
+	err = nft_trans_flowtable_add(&ctx, NFT_MSG_NEWFLOWTABLE, flowtable);
+	if (err < 0)
+		goto err4;
+
+	list_add_tail_rcu(&flowtable->list, &table->flowtables);
+	table->use++;
+	return 0;
+err4:
+	nf_tables_unregister_flowtable_hooks(table, flowtable, afi->nops);
+err3:
+	type->free(&flowtable->data);
+err2:
+	kfree(flowtable);
+err1:
+	module_put(type->owner);
+	return err;
+}
+
+static int nf_tables_delflowtable(struct sock *nlsk, struct sk_buff *skb,
+				  const struct nlmsghdr *nlh,
+				  const struct nlattr * const nla[])
+{
+	const struct nfgenmsg *nfmsg = nlmsg_data(nlh);
+	struct nft_flowtable *flowtable;
+	struct nft_ctx ctx;
+	int err;
+
+	if (nfmsg->nfgen_family == NFPROTO_UNSPEC)
+		return -EAFNOSUPPORT;
+	if (nla[NFTA_FLOWTABLE_TABLE] == NULL)
+		return -EINVAL;
+
+	err = nft_ctx_init_from_flowtableattr(&ctx, skb, nlh, nla);
+	if (err < 0)
+		return err;
+
+	flowtable = nf_tables_flowtable_lookup(ctx.table,
+					       nla[NFTA_FLOWTABLE_NAME]);
+	if (IS_ERR(flowtable))
+		return PTR_ERR(flowtable);
+	if (flowtable->flags & NFT_FLOWTABLE_INACTIVE)
+		return -ENOENT;
+	if (flowtable->use > 0)
+		return -EBUSY;
+
+	return nft_delflowtable(&ctx, flowtable);
+}
+
+static int nf_tables_fill_flowtable_info(struct sk_buff *skb,
+					 const struct nft_ctx *ctx,
+					 const struct nft_flowtable *flowtable,
+					 u16 event, u16 flags)
+{
+	struct nlattr *nest, *nest_devs;
+	struct nfgenmsg *nfmsg;
+	struct nlmsghdr *nlh;
+	unsigned int i;
+
+	event |= NFNL_SUBSYS_NFTABLES << 8;
+	nlh = nlmsg_put(skb, ctx->portid, ctx->seq, event,
+			sizeof(struct nfgenmsg), flags);
+	if (nlh == NULL)
+		goto nla_put_failure;
+
+	nfmsg = nlmsg_data(nlh);
+	nfmsg->nfgen_family	= ctx->afi->family;
+	nfmsg->version		= NFNETLINK_V0;
+	nfmsg->res_id		= htons(ctx->net->nft.base_seq & 0xffff);
+
+	if (nla_put_string(skb, NFTA_FLOWTABLE_TABLE, ctx->table->name) ||
+	    nla_put_string(skb, NFTA_FLOWTABLE_NAME, flowtable->name) ||
+	    nla_put_be32(skb, NFTA_FLOWTABLE_USE, htonl(flowtable->use)))
+		goto nla_put_failure;
+
+	nest = nla_nest_start(skb, NFTA_FLOWTABLE_HOOK);
+	if (nest == NULL)
+		goto nla_put_failure;
+	if (nla_put_be32(skb, NFTA_FLOWTABLE_HOOK_NUM,
+			 htonl(flowtable->hooknum)) ||
+	    nla_put_be32(skb, NFTA_FLOWTABLE_HOOK_PRIORITY,
+			 htonl(flowtable->priority)))
+		goto nla_put_failure;
+
+	nest_devs = nla_nest_start(skb, NFTA_FLOWTABLE_HOOK_DEVS);
+	if (nest_devs == NULL)
+		goto nla_put_failure;
+	for (i = 0; i < flowtable->ndevs; i++) {
+		if (nla_put_string(skb, NFTA_DEVICE_NAME,
+				   flowtable->devices[i]))
+			goto nla_put_failure;
+	}
+	nla_nest_end(skb, nest_devs);
+	nla_nest_end(skb, nest);
+
+	nlmsg_end(skb, nlh);
+	return 0;
+
+nla_put_failure:
+	nlmsg_trim(skb, nlh);
+	return -1;
+}
+
+static int nf_tables_flowtable_notify(const struct nft_ctx *ctx,
+				      const struct nft_flowtable *flowtable,
+				      int event)
+{
+	struct sk_buff *skb;
+	u32 portid = ctx->portid;
+	int err;
+
+	if (!ctx->report &&
+	    !nfnetlink_has_listeners(ctx->net, NFNLGRP_NFTABLES))
+		return 0;
+
+	err = -ENOBUFS;
+	skb = nlmsg_new(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (skb == NULL)
+		goto err;
+
+	err = nf_tables_fill_flowtable_info(skb, ctx, flowtable, event, 0);
+	if (err < 0) {
+		kfree_skb(skb);
+		goto err;
+	}
+
+	err = nfnetlink_send(skb, ctx->net, portid, NFNLGRP_NFTABLES,
+			     ctx->report, GFP_KERNEL);
+err:
+	if (err < 0)
+		nfnetlink_set_err(ctx->net, portid, NFNLGRP_NFTABLES, err);
+	return err;
+}
+
+static int nf_tables_dump_flowtable(struct sk_buff *skb,
+				    struct netlink_callback *cb)
+{
+	const struct nft_flowtable *flowtable;
+	unsigned int idx = 0, s_idx = cb->args[0];
+	struct nft_af_info *afi;
+	struct nft_table *table;
+	struct net *net = sock_net(skb->sk);
+	struct nft_ctx *ctx = cb->data, ctx_dump;
+
+	rcu_read_lock();
+	cb->seq = net->nft.base_seq;
+
+	list_for_each_entry_rcu(afi, &net->nft.af_info, list) {
+		if (ctx->afi && ctx->afi != afi)
+			continue;
+
+		list_for_each_entry_rcu(table, &afi->tables, list) {
+			if (ctx->table && ctx->table != table)
+				continue;
+
+			list_for_each_entry_rcu(flowtable, &table->flowtables,
+						list) {
+				if (idx < s_idx)
+					goto cont;
+				if (flowtable->flags & NFT_FLOWTABLE_INACTIVE)
+					goto cont;
+
+				ctx_dump = *ctx;
+				ctx_dump.afi = afi;
+				ctx_dump.table = table;
+				if (nf_tables_fill_flowtable_info(skb, &ctx_dump,
+						flowtable,
+						NFT_MSG_NEWFLOWTABLE,
+						NLM_F_MULTI) < 0)
+					goto done;
+
+				nl_dump_check_consistent(cb, nlmsg_hdr(skb));
+cont:
+				idx++;
+			}
+		}
+	}
+done:
+	rcu_read_unlock();
+
+	cb->args[0] = idx;
+	return skb->len;
+}
+
+static int nf_tables_dump_flowtable_done(struct netlink_callback *cb)
+{
+	kfree(cb->data);
+	return 0;
+}
+
+static int nf_tables_getflowtable(struct sock *nlsk, struct sk_buff *skb,
+				  const struct nlmsghdr *nlh,
+				  const struct nlattr * const nla[])
+{
+	const struct nfgenmsg *nfmsg = nlmsg_data(nlh);
+	const struct nft_flowtable *flowtable;
+	struct sk_buff *skb2;
+	struct nft_ctx ctx;
+	int err;
+
+	err = nft_ctx_init_from_flowtableattr(&ctx, skb, nlh, nla);
+	if (err < 0)
+		return err;
+
+	if (nlh->nlmsg_flags & NLM_F_DUMP) {
+		struct netlink_dump_control c = {
+			.dump = nf_tables_dump_flowtable,
+			.done = nf_tables_dump_flowtable_done,
+		};
+		struct nft_ctx *ctx_dump;
+
+		ctx_dump = kmalloc(sizeof(*ctx_dump), GFP_KERNEL);
+		if (ctx_dump == NULL)
+			return -ENOMEM;
+
+		*ctx_dump = ctx;
+		c.data = ctx_dump;
+
+		return netlink_dump_start(nlsk, skb, nlh, &c);
+	}
+
+	/* Only accept unspec with dump */
+	if (nfmsg->nfgen_family == NFPROTO_UNSPEC)
+		return -EAFNOSUPPORT;
+	if (ctx.table == NULL)
+		return -EINVAL;
+
+	flowtable = nf_tables_flowtable_lookup(ctx.table,
+					       nla[NFTA_FLOWTABLE_NAME]);
+	if (IS_ERR(flowtable))
+		return PTR_ERR(flowtable);
+	if (flowtable->flags & NFT_FLOWTABLE_INACTIVE)
+		return -ENOENT;
+
+	skb2 = alloc_skb(NLMSG_GOODSIZE, GFP_KERNEL);
+	if (skb2 == NULL)
+		return -ENOMEM;
+
+	err = nf_tables_fill_flowtable_info(skb2, &ctx, flowtable,
+					    NFT_MSG_NEWFLOWTABLE, 0);
+	if (err < 0)
+		goto err;
+
+	return nlmsg_unicast(nlsk, skb2, NETLINK_CB(skb).portid);
+err:
+	kfree_skb(skb2);
+	return err;
+}
+
 static int nf_tables_fill_gen_info(struct sk_buff *skb, struct net *net,
 				   u32 portid, u32 seq)
 {
@@ -3488,6 +4118,21 @@ static const struct nfnl_callback nf_tables_cb[NFT_MSG_MAX] = {
 	[NFT_MSG_GETGEN] = {
 		.call		= nf_tables_getgen,
 	},
+	[NFT_MSG_NEWFLOWTABLE] = {
+		.call_batch	= nf_tables_newflowtable,
+		.attr_count	= NFTA_FLOWTABLE_MAX,
+		.policy		= nft_flowtable_policy,
+	},
+	[NFT_MSG_GETFLOWTABLE] = {
+		.call		= nf_tables_getflowtable,
+		.attr_count	= NFTA_FLOWTABLE_MAX,
+		.policy		= nft_flowtable_policy,
+	},
+	[NFT_MSG_DELFLOWTABLE] = {
+		.call_batch	= nf_tables_delflowtable,
+		.attr_count	= NFTA_FLOWTABLE_MAX,
+		.policy		= nft_flowtable_policy,
+	},
 };
 
 static void nft_chain_commit_update(struct nft_trans *trans)
@@ -3526,6 +4171,9 @@ static void nf_tables_commit_release(struct nft_trans *trans)
 	case NFT_MSG_DELSET:
 		nft_set_destroy(nft_trans_set(trans));
 		break;
+	case NFT_MSG_DELFLOWTABLE:
+		nf_tables_flowtable_destroy(nft_trans_flowtable(trans));
+		break;
 	}
 	kfree(trans);
 }
@@ -3630,6 +4278,22 @@ static int nf_tables_commit(struct sk_buff *skb)
 			te->set->ops->remove(te->set, &te->elem);
 			nft_trans_destroy(trans);
 			break;
+		case NFT_MSG_NEWFLOWTABLE:
+			nft_trans_flowtable(trans)->flags &=
+				~NFT_FLOWTABLE_INACTIVE;
+			nf_tables_flowtable_notify(&trans->ctx,
+						   nft_trans_flowtable(trans),
+						   NFT_MSG_NEWFLOWTABLE);
+			nft_trans_destroy(trans);
+			break;
+		case NFT_MSG_DELFLOWTABLE:
+			nf_tables_flowtable_notify(&trans->ctx,
+						   nft_trans_flowtable(trans),
+						   NFT_MSG_DELFLOWTABLE);
+			nf_tables_unregister_flowtable_hooks(trans->ctx.table,
+						nft_trans_flowtable(trans),
+						trans->ctx.afi->nops);
+			break;
 		}
 	}
 
@@ -3660,6 +4324,9 @@ static void nf_tables_abort_release(struct nft_trans *trans)
 	case NFT_MSG_NEWSET:
 		nft_set_destroy(nft_trans_set(trans));
 		break;
+	case NFT_MSG_NEWFLOWTABLE:
+		nf_tables_flowtable_destroy(nft_trans_flowtable(trans));
+		break;
 	}
 	kfree(trans);
 }
@@ -3742,6 +4409,19 @@ static int nf_tables_abort(struct sk_buff *skb)
 			nft_trans_elem_set(trans)->nelems++;
 			nft_trans_destroy(trans);
 			break;
+		case NFT_MSG_NEWFLOWTABLE:
+			trans->ctx.table->use--;
+			list_del_rcu(&nft_trans_flowtable(trans)->list);
+			nf_tables_unregister_flowtable_hooks(trans->ctx.table,
+						nft_trans_flowtable(trans),
+						trans->ctx.afi->nops);
+			break;
+		case NFT_MSG_DELFLOWTABLE:
+			trans->ctx.table->use++;
+			list_add_tail_rcu(&nft_trans_flowtable(trans)->list,
+					  &trans->ctx.table->flowtables);
+			nft_trans_destroy(trans);
+			break;
 		}
 	}
 
@@ -0,0 +1,312 @@
+/*
+ * Bitmap set type for keys of up to 16 bits, such as ports
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * One bit per possible key tells whether it matches, so a lookup is a
+ * single bit test without any lock, for plain sets as well as intervals.
+ * Elements are kept sorted next to the bitmap for dumps and removals;
+ * intervals are given as in the rbtree set, a key matching the greatest
+ * element not above it unless that one is flagged as an interval end.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/bitmap.h>
+#include <linux/rbtree.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_BITMAP_KEY_MAXLEN	sizeof(u16)
+
+struct nft_bitmap {
+	spinlock_t		lock;
+	struct rb_root		elems;
+	unsigned long		map[];
+};
+
+struct nft_bitmap_elem {
+	struct rb_node		node;
+	u16			flags;
+	struct nft_data		key;
+};
+
+static unsigned int nft_bitmap_bits(unsigned int klen)
+{
+	return 1U << (klen * BITS_PER_BYTE);
+}
+
+static unsigned int nft_bitmap_size(unsigned int klen)
+{
+	return BITS_TO_LONGS(nft_bitmap_bits(klen)) * sizeof(unsigned long);
+}
+
+static unsigned int nft_bitmap_index(const struct nft_set *set,
+				     const struct nft_data *key)
+{
+	const u8 *k = (const u8 *)key->data;
+
+	return set->klen == 1 ? k[0] : k[0] << 8 | k[1];
+}
+
+static bool nft_bitmap_lookup(const struct nft_set *set,
+			      const struct nft_data *key,
+			      struct nft_data *data)
+{
+	const struct nft_bitmap *priv = nft_set_priv(set);
+
+	return test_bit(nft_bitmap_index(set, key), priv->map);
+}
+
+/* Give the keys from @be up to the next interval element to @match */
+static void nft_bitmap_update(const struct nft_set *set,
+			      const struct nft_bitmap_elem *be, bool match)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	const struct nft_bitmap_elem *next;
+	unsigned int lo, hi;
+	struct rb_node *node;
+
+	lo = nft_bitmap_index(set, &be->key);
+	hi = lo + 1;
+	if (set->flags & NFT_SET_INTERVAL) {
+		node = rb_next(&be->node);
+		if (node != NULL) {
+			next = rb_entry(node, struct nft_bitmap_elem, node);
+			hi = nft_bitmap_index(set, &next->key);
+		} else
+			hi = nft_bitmap_bits(set->klen);
+	}
+
+	if (match)
+		bitmap_set(priv->map, lo, hi - lo);
+	else
+		bitmap_clear(priv->map, lo, hi - lo);
+}
+
+static bool nft_bitmap_match(const struct nft_set *set,
+			     const struct nft_bitmap_elem *be)
+{
+	if (be == NULL)
+		return false;
+	if (set->flags & NFT_SET_INTERVAL)
+		return !(be->flags & NFT_SET_ELEM_INTERVAL_END);
+	return true;
+}
+
+static int __nft_bitmap_insert(const struct nft_set *set,
+			       struct nft_bitmap_elem *new)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	struct nft_bitmap_elem *be;
+	struct rb_node *parent, **p;
+	int d;
+
+	parent = NULL;
+	p = &priv->elems.rb_node;
+	while (*p != NULL) {
+		parent = *p;
+		be = rb_entry(parent, struct nft_bitmap_elem, node);
+		d = nft_data_cmp(&new->key, &be->key, set->klen);
+		if (d < 0)
+			p = &parent->rb_left;
+		else if (d > 0)
+			p = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &priv->elems);
+	return 0;
+}
+
+/* Updates are serialized by the nfnetlink mutex, only walks race with them */
+static int nft_bitmap_insert(const struct nft_set *set,
+			     const struct nft_set_elem *elem)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	struct nft_bitmap_elem *be;
+	int err;
+
+	if (!(set->flags & NFT_SET_INTERVAL) && elem->flags != 0)
+		return -EINVAL;
+
+	be = kzalloc(sizeof(*be), GFP_KERNEL);
+	if (be == NULL)
+		return -ENOMEM;
+
+	be->flags = elem->flags;
+	nft_data_copy(&be->key, &elem->key);
+
+	spin_lock_bh(&priv->lock);
+	err = __nft_bitmap_insert(set, be);
+	spin_unlock_bh(&priv->lock);
+	if (err < 0) {
+		kfree(be);
+		return err;
+	}
+
+	nft_bitmap_update(set, be, nft_bitmap_match(set, be));
+	return 0;
+}
+
+static void nft_bitmap_remove(const struct nft_set *set,
+			      const struct nft_set_elem *elem)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	struct nft_bitmap_elem *be = elem->cookie, *prev = NULL;
+	struct rb_node *node;
+
+	if (set->flags & NFT_SET_INTERVAL) {
+		node = rb_prev(&be->node);
+		if (node != NULL)
+			prev = rb_entry(node, struct nft_bitmap_elem, node);
+	}
+	nft_bitmap_update(set, be, nft_bitmap_match(set, prev));
+
+	spin_lock_bh(&priv->lock);
+	rb_erase(&be->node, &priv->elems);
+	spin_unlock_bh(&priv->lock);
+	kfree(be);
+}
+
+static int nft_bitmap_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	const struct rb_node *parent;
+	struct nft_bitmap_elem *be;
+	int d;
+
+	spin_lock_bh(&priv->lock);
+	parent = priv->elems.rb_node;
+	while (parent != NULL) {
+		be = rb_entry(parent, struct nft_bitmap_elem, node);
+
+		d = nft_data_cmp(&elem->key, &be->key, set->klen);
+		if (d < 0)
+			parent = parent->rb_left;
+		else if (d > 0)
+			parent = parent->rb_right;
+		else {
+			elem->cookie = be;
+			elem->flags = be->flags;
+			spin_unlock_bh(&priv->lock);
+			return 0;
+		}
+	}
+	spin_unlock_bh(&priv->lock);
+	return -ENOENT;
+}
+
+static void nft_bitmap_walk(const struct nft_ctx *ctx,
+			    const struct nft_set *set,
+			    struct nft_set_iter *iter)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	const struct nft_bitmap_elem *be;
+	struct nft_set_elem elem;
+	struct rb_node *node;
+
+	spin_lock_bh(&priv->lock);
+	for (node = rb_first(&priv->elems); node != NULL; node = rb_next(node)) {
+		if (iter->count < iter->skip)
+			goto cont;
+
+		be = rb_entry(node, struct nft_bitmap_elem, node);
+		nft_data_copy(&elem.key, &be->key);
+		elem.flags = be->flags;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0) {
+			spin_unlock_bh(&priv->lock);
+			return;
+		}
+cont:
+		iter->count++;
+	}
+	spin_unlock_bh(&priv->lock);
+}
+
+static unsigned int nft_bitmap_privsize(const struct nlattr * const nla[])
+{
+	u32 klen = ntohl(nla_get_be32(nla[NFTA_SET_KEY_LEN]));
+
+	return sizeof(struct nft_bitmap) + nft_bitmap_size(klen);
+}
+
+static int nft_bitmap_init(const struct nft_set *set,
+			   const struct nft_set_desc *desc,
+			   const struct nlattr * const nla[])
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+
+	spin_lock_init(&priv->lock);
+	priv->elems = RB_ROOT;
+	return 0;
+}
+
+static void nft_bitmap_destroy(const struct nft_set *set)
+{
+	struct nft_bitmap *priv = nft_set_priv(set);
+	struct nft_bitmap_elem *be;
+	struct rb_node *node;
+
+	while ((node = priv->elems.rb_node) != NULL) {
+		rb_erase(node, &priv->elems);
+		be = rb_entry(node, struct nft_bitmap_elem, node);
+		nft_data_uninit(&be->key, NFT_DATA_VALUE);
+		kfree(be);
+	}
+}
+
+static bool nft_bitmap_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est)
+{
+	unsigned int nsize;
+
+	if (desc->klen > NFT_BITMAP_KEY_MAXLEN)
+		return false;
+
+	nsize = sizeof(struct nft_bitmap_elem);
+	est->size = sizeof(struct nft_bitmap) + nft_bitmap_size(desc->klen) +
+		    (desc->size ? : 1) * nsize;
+	est->class = NFT_SET_CLASS_O_1;
+
+	return true;
+}
+
+static struct nft_set_ops nft_bitmap_ops __read_mostly = {
+	.privsize	= nft_bitmap_privsize,
+	.estimate	= nft_bitmap_estimate,
+	.init		= nft_bitmap_init,
+	.destroy	= nft_bitmap_destroy,
+	.insert		= nft_bitmap_insert,
+	.remove		= nft_bitmap_remove,
+	.get		= nft_bitmap_get,
+	.lookup		= nft_bitmap_lookup,
+	.walk		= nft_bitmap_walk,
+	.features	= NFT_SET_INTERVAL,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_bitmap_module_init(void)
+{
+	return nft_register_set(&nft_bitmap_ops);
+}
+
+static void __exit nft_bitmap_module_exit(void)
+{
+	nft_unregister_set(&nft_bitmap_ops);
+}
+
+module_init(nft_bitmap_module_init);
+module_exit(nft_bitmap_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
@@ -0,0 +1,302 @@
+/*
+ * Move established conntrack flows to a flow table, whose fast path
+ * forwards their next packets.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netdevice.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/ip.h>
+#include <net/netfilter/nf_tables.h>
+#include <net/netfilter/nf_conntrack.h>
+#include <net/netfilter/nf_conntrack_core.h>
+#include <net/netfilter/nf_conntrack_helper.h>
+#include <net/netfilter/nf_conntrack_l3proto.h>
+#include <net/netfilter/nf_flow_table.h>
+
+struct nft_flow_offload {
+	struct nft_flowtable	*flowtable;
+};
+
+/* The route of this direction is the one of the packet, look up the route
+ * of the reply direction, back to where the packet came from.
+ */
+static int nft_flow_route(const struct nft_pktinfo *pkt,
+			  const struct nf_conn *ct,
+			  struct nf_flow_route *route,
+			  enum ip_conntrack_dir dir)
+{
+	struct dst_entry *this_dst = skb_dst(pkt->skb);
+	struct dst_entry *other_dst = NULL;
+	const struct nf_afinfo *afinfo;
+	struct flowi fl;
+
+	afinfo = nf_get_afinfo(pkt->ops->pf);
+	if (!afinfo || !this_dst)
+		return -ENOENT;
+
+	memset(&fl, 0, sizeof(fl));
+	switch (pkt->ops->pf) {
+	case NFPROTO_IPV4:
+		fl.u.ip4.daddr = ct->tuplehash[dir].tuple.src.u3.ip;
+		fl.u.ip4.flowi4_oif = pkt->in->ifindex;
+		break;
+	case NFPROTO_IPV6:
+		fl.u.ip6.daddr = ct->tuplehash[dir].tuple.src.u3.in6;
+		fl.u.ip6.flowi6_oif = pkt->in->ifindex;
+		break;
+	default:
+		return -ENOENT;
+	}
+
+	afinfo->route(dev_net(pkt->in), &other_dst, &fl, false);
+	if (!other_dst)
+		return -ENOENT;
+
+	route->tuple[dir].dst		= this_dst;
+	route->tuple[dir].ifindex	= pkt->in->ifindex;
+	route->tuple[!dir].dst		= other_dst;
+	route->tuple[!dir].ifindex	= pkt->out->ifindex;
+
+	return 0;
+}
+
+static bool nft_flow_offload_is_eligible(struct nf_conn *ct,
+					 enum ip_conntrack_info ctinfo)
+{
+	switch (nf_ct_protonum(ct)) {
+	case IPPROTO_TCP:
+		if (ct->proto.tcp.state != TCP_CONNTRACK_ESTABLISHED)
+			return false;
+		break;
+	case IPPROTO_UDP:
+		break;
+	default:
+		return false;
+	}
+
+	/* helpers and sequence adjustment need to see every packet */
+	if (nfct_help(ct) || test_bit(IPS_SEQ_ADJUST_BIT, &ct->status))
+		return false;
+
+	if (ctinfo == IP_CT_NEW || ctinfo == IP_CT_RELATED)
+		return false;
+
+	return nf_ct_is_confirmed(ct);
+}
+
+static void nft_flow_offload_eval(const struct nft_expr *expr,
+				  struct nft_data data[NFT_REG_MAX + 1],
+				  const struct nft_pktinfo *pkt)
+{
+	struct nft_flow_offload *priv = nft_expr_priv(expr);
+	struct nf_flowtable *flowtable = &priv->flowtable->data;
+	enum ip_conntrack_info ctinfo;
+	struct nf_flow_route route;
+	struct flow_offload *flow;
+	enum ip_conntrack_dir dir;
+	struct nf_conn *ct;
+
+	ct = nf_ct_get(pkt->skb, &ctinfo);
+	if (!ct || nf_ct_is_untracked(ct))
+		goto out;
+
+	if (!nft_flow_offload_is_eligible(ct, ctinfo))
+		goto out;
+
+	if (!nft_flowtable_has_device(priv->flowtable, pkt->in) ||
+	    !nft_flowtable_has_device(priv->flowtable, pkt->out))
+		goto out;
+
+	if (test_and_set_bit(IPS_OFFLOAD_BIT, &ct->status))
+		goto out;
+
+	dir = CTINFO2DIR(ctinfo);
+	if (nft_flow_route(pkt, ct, &route, dir) < 0)
+		goto err_flow_route;
+
+	flow = flow_offload_alloc(ct, &route);
+	if (!flow)
+		goto err_flow_alloc;
+
+	if (flow_offload_add(flowtable, flow) < 0)
+		goto err_flow_add;
+
+	dst_release(route.tuple[!dir].dst);
+	return;
+
+err_flow_add:
+	flow_offload_free(flow);
+err_flow_alloc:
+	dst_release(route.tuple[!dir].dst);
+err_flow_route:
+	clear_bit(IPS_OFFLOAD_BIT, &ct->status);
+out:
+	data[NFT_REG_VERDICT].verdict = NFT_BREAK;
+}
+
+static int nft_flow_offload_validate(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr,
+				     const struct nft_data **data)
+{
+	return nft_chain_validate_hooks(ctx->chain, 1 << NF_INET_FORWARD);
+}
+
+static const struct nla_policy nft_flow_offload_policy[NFTA_FLOW_MAX + 1] = {
+	[NFTA_FLOW_TABLE_NAME]	= { .type = NLA_STRING,
+				    .len = IFNAMSIZ - 1 },
+};
+
+static int nft_flow_offload_l3proto_try_module_get(u8 family)
+{
+	int err;
+
+	if (family != NFPROTO_INET)
+		return nf_ct_l3proto_try_module_get(family);
+
+	err = nf_ct_l3proto_try_module_get(NFPROTO_IPV4);
+	if (err < 0)
+		return err;
+	err = nf_ct_l3proto_try_module_get(NFPROTO_IPV6);
+	if (err < 0)
+		nf_ct_l3proto_module_put(NFPROTO_IPV4);
+	return err;
+}
+
+static void nft_flow_offload_l3proto_module_put(u8 family)
+{
+	if (family == NFPROTO_INET) {
+		nf_ct_l3proto_module_put(NFPROTO_IPV4);
+		nf_ct_l3proto_module_put(NFPROTO_IPV6);
+	} else
+		nf_ct_l3proto_module_put(family);
+}
+
+static int nft_flow_offload_init(const struct nft_ctx *ctx,
+				 const struct nft_expr *expr,
+				 const struct nlattr * const tb[])
+{
+	struct nft_flow_offload *priv = nft_expr_priv(expr);
+	struct nft_flowtable *flowtable;
+	int err;
+
+	if (!tb[NFTA_FLOW_TABLE_NAME])
+		return -EINVAL;
+
+	err = nft_flow_offload_validate(ctx, expr, NULL);
+	if (err < 0)
+		return err;
+
+	flowtable = nf_tables_flowtable_lookup(ctx->table,
+					       tb[NFTA_FLOW_TABLE_NAME]);
+	if (IS_ERR(flowtable))
+		return PTR_ERR(flowtable);
+
+	err = nft_flow_offload_l3proto_try_module_get(ctx->afi->family);
+	if (err < 0)
+		return err;
+
+	flowtable->use++;
+	priv->flowtable = flowtable;
+
+	return 0;
+}
+
+static void nft_flow_offload_destroy(const struct nft_ctx *ctx,
+				     const struct nft_expr *expr)
+{
+	struct nft_flow_offload *priv = nft_expr_priv(expr);
+
+	priv->flowtable->use--;
+	nft_flow_offload_l3proto_module_put(ctx->afi->family);
+}
+
+static int nft_flow_offload_dump(struct sk_buff *skb,
+				 const struct nft_expr *expr)
+{
+	struct nft_flow_offload *priv = nft_expr_priv(expr);
+
+	if (nla_put_string(skb, NFTA_FLOW_TABLE_NAME, priv->flowtable->name))
+		goto nla_put_failure;
+
+	return 0;
+
+nla_put_failure:
+	return -1;
+}
+
+static struct nft_expr_type nft_flow_offload_type;
+static const struct nft_expr_ops nft_flow_offload_ops = {
+	.type		= &nft_flow_offload_type,
+	.size		= NFT_EXPR_SIZE(sizeof(struct nft_flow_offload)),
+	.eval		= nft_flow_offload_eval,
+	.init		= nft_flow_offload_init,
+	.destroy	= nft_flow_offload_destroy,
+	.validate	= nft_flow_offload_validate,
+	.dump		= nft_flow_offload_dump,
+};
+
+static struct nft_expr_type nft_flow_offload_type __read_mostly = {
+	.name		= "flow_offload",
+	.ops		= &nft_flow_offload_ops,
+	.policy		= nft_flow_offload_policy,
+	.maxattr	= NFTA_FLOW_MAX,
+	.owner		= THIS_MODULE,
+};
+
+/* Flows through a device that goes down are handed back to conntrack */
+static int flow_offload_netdev_event(struct notifier_block *this,
+				     unsigned long event, void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+	if (event != NETDEV_DOWN)
+		return NOTIFY_DONE;
+
+	nf_flow_table_cleanup(dev_net(dev), dev);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block flow_offload_netdev_notifier = {
+	.notifier_call	= flow_offload_netdev_event,
+};
+
+static int __init nft_flow_offload_module_init(void)
+{
+	int err;
+
+	err = register_netdevice_notifier(&flow_offload_netdev_notifier);
+	if (err < 0)
+		return err;
+
+	err = nft_register_expr(&nft_flow_offload_type);
+	if (err < 0)
+		goto register_expr;
+
+	return 0;
+
+register_expr:
+	unregister_netdevice_notifier(&flow_offload_netdev_notifier);
+	return err;
+}
+
+static void __exit nft_flow_offload_module_exit(void)
+{
+	nft_unregister_expr(&nft_flow_offload_type);
+	unregister_netdevice_notifier(&flow_offload_netdev_notifier);
+}
+
+module_init(nft_flow_offload_module_init);
+module_exit(nft_flow_offload_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_EXPR("flow_offload");
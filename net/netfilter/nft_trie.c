@@ -0,0 +1,522 @@
+/*
+ * Multi-bit trie set type for interval matching on prefixes and ranges
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Elements are kept in the same form as in the rbtree set: an interval is
+ * a start element followed by an element flagged NFT_SET_ELEM_INTERVAL_END,
+ * and a key matches the greatest element not above it unless that one is
+ * an interval end.  Each element thus owns the keys up to the next one.
+ *
+ * Lookups do not search the elements though: the key is walked four bits
+ * at a time through a trie whose leaf slots point straight at the start
+ * element owning them, or are NULL where nothing matches.  A slot whose
+ * keys all belong to the same element is a leaf, so a range only costs
+ * nodes along its two boundaries.  Lookups take at most eight steps for
+ * IPv4 and 32 for IPv6, whatever the number of elements, and run under
+ * RCU without any lock.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_TRIE_BITS		4
+#define NFT_TRIE_FANOUT		(1 << NFT_TRIE_BITS)
+#define NFT_TRIE_KEY_MAXLEN	FIELD_SIZEOF(struct nft_data, data)
+#define NFT_TRIE_MAX_DEPTH	(NFT_TRIE_KEY_MAXLEN * BITS_PER_BYTE / \
+				 NFT_TRIE_BITS)
+
+/* Assigning a range splits at most the nodes along its two boundaries */
+#define NFT_TRIE_SPARE		(2 * NFT_TRIE_MAX_DEPTH)
+
+/* Slots holding a node rather than an element have their low bit set */
+#define NFT_TRIE_NODE_BIT	1UL
+
+struct nft_trie_node {
+	struct rcu_head		rcu;
+	void __rcu		*slot[NFT_TRIE_FANOUT];
+};
+
+struct nft_trie {
+	void __rcu		*root;
+	spinlock_t		lock;
+	struct rb_root		elems;
+	unsigned int		nspare;
+	struct nft_trie_node	*spare[NFT_TRIE_SPARE];
+};
+
+struct nft_trie_elem {
+	struct rb_node		node;
+	struct rcu_head		rcu;
+	u16			flags;
+	struct nft_data		key;
+	struct nft_data		data[];
+};
+
+static bool nft_trie_is_node(const void *p)
+{
+	return (unsigned long)p & NFT_TRIE_NODE_BIT;
+}
+
+static struct nft_trie_node *nft_trie_node(const void *p)
+{
+	return (struct nft_trie_node *)((unsigned long)p & ~NFT_TRIE_NODE_BIT);
+}
+
+static void *nft_trie_node_ptr(const struct nft_trie_node *node)
+{
+	return (void *)((unsigned long)node | NFT_TRIE_NODE_BIT);
+}
+
+static unsigned int nft_trie_index(const u8 *key, unsigned int depth)
+{
+	u8 b = key[depth / 2];
+
+	return depth & 1 ? b & 0xf : b >> 4;
+}
+
+static bool nft_trie_lookup(const struct nft_set *set,
+			    const struct nft_data *key,
+			    struct nft_data *data)
+{
+	const struct nft_trie *priv = nft_set_priv(set);
+	const u8 *k = (const u8 *)key->data;
+	const struct nft_trie_node *node;
+	const struct nft_trie_elem *te;
+	unsigned int depth = 0;
+	void *p;
+
+	p = rcu_dereference(priv->root);
+	while (nft_trie_is_node(p)) {
+		node = nft_trie_node(p);
+		p = rcu_dereference(node->slot[nft_trie_index(k, depth++)]);
+	}
+
+	te = p;
+	if (te == NULL)
+		return false;
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(data, te->data);
+
+	return true;
+}
+
+/* Fill the spare node pool, so that updating the trie never fails halfway */
+static int nft_trie_refill(struct nft_trie *priv, gfp_t gfp)
+{
+	struct nft_trie_node *node;
+
+	while (priv->nspare < NFT_TRIE_SPARE) {
+		node = kmalloc(sizeof(*node), gfp);
+		if (node == NULL)
+			return -ENOMEM;
+		priv->spare[priv->nspare++] = node;
+	}
+	return 0;
+}
+
+/* Replace a leaf slot by a node whose slots all point where it did */
+static struct nft_trie_node *nft_trie_split(struct nft_trie *priv,
+					    void __rcu **slot)
+{
+	void *p = rcu_dereference_protected(*slot, 1);
+	struct nft_trie_node *node;
+	unsigned int i;
+
+	if (nft_trie_is_node(p))
+		return nft_trie_node(p);
+
+	BUG_ON(priv->nspare == 0);
+	node = priv->spare[--priv->nspare];
+	for (i = 0; i < NFT_TRIE_FANOUT; i++)
+		RCU_INIT_POINTER(node->slot[i], p);
+
+	rcu_assign_pointer(*slot, nft_trie_node_ptr(node));
+	return node;
+}
+
+/* Turn a node whose slots are all the same leaf back into that leaf */
+static void nft_trie_merge(void __rcu **slot)
+{
+	struct nft_trie_node *node;
+	unsigned int i;
+	void *p;
+
+	node = nft_trie_node(rcu_dereference_protected(*slot, 1));
+	p = rcu_dereference_protected(node->slot[0], 1);
+	if (nft_trie_is_node(p))
+		return;
+	for (i = 1; i < NFT_TRIE_FANOUT; i++) {
+		if (rcu_dereference_protected(node->slot[i], 1) != p)
+			return;
+	}
+
+	rcu_assign_pointer(*slot, p);
+	kfree_rcu(node, rcu);
+}
+
+static void nft_trie_free(void *p)
+{
+	struct nft_trie_node *node;
+	unsigned int i;
+
+	if (!nft_trie_is_node(p))
+		return;
+
+	node = nft_trie_node(p);
+	for (i = 0; i < NFT_TRIE_FANOUT; i++)
+		nft_trie_free(rcu_dereference_protected(node->slot[i], 1));
+	kfree(node);
+}
+
+static void nft_trie_free_rcu(void *p)
+{
+	struct nft_trie_node *node;
+	unsigned int i;
+
+	if (!nft_trie_is_node(p))
+		return;
+
+	node = nft_trie_node(p);
+	for (i = 0; i < NFT_TRIE_FANOUT; i++)
+		nft_trie_free_rcu(rcu_dereference_protected(node->slot[i], 1));
+	kfree_rcu(node, rcu);
+}
+
+struct nft_trie_range {
+	unsigned int		depth;
+	u8			lo[NFT_TRIE_KEY_MAXLEN];
+	u8			hi[NFT_TRIE_KEY_MAXLEN];
+	void			*val;
+};
+
+/* Whether all nibbles of @key from @depth on are @nibble */
+static bool nft_trie_tail_is(const u8 *key, unsigned int depth,
+			     unsigned int max, unsigned int nibble)
+{
+	for (; depth < max; depth++) {
+		if (nft_trie_index(key, depth) != nibble)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Point the keys of @r below @slot at @r->val.  @slot covers the keys that
+ * share their first @depth nibbles, @lo_edge and @hi_edge tell whether
+ * these are also the first nibbles of the range bounds.
+ */
+static void nft_trie_assign(struct nft_trie *priv, void __rcu **slot,
+			    unsigned int depth, const struct nft_trie_range *r,
+			    bool lo_edge, bool hi_edge)
+{
+	struct nft_trie_node *node;
+	unsigned int i, first, last;
+
+	if ((!lo_edge || nft_trie_tail_is(r->lo, depth, r->depth, 0)) &&
+	    (!hi_edge || nft_trie_tail_is(r->hi, depth, r->depth, 0xf))) {
+		void *old = rcu_dereference_protected(*slot, 1);
+
+		rcu_assign_pointer(*slot, r->val);
+		nft_trie_free_rcu(old);
+		return;
+	}
+
+	node  = nft_trie_split(priv, slot);
+	first = lo_edge ? nft_trie_index(r->lo, depth) : 0;
+	last  = hi_edge ? nft_trie_index(r->hi, depth) : NFT_TRIE_FANOUT - 1;
+
+	for (i = first; i <= last; i++)
+		nft_trie_assign(priv, &node->slot[i], depth + 1, r,
+				lo_edge && i == first, hi_edge && i == last);
+
+	nft_trie_merge(slot);
+}
+
+/* Give the keys from @te up to the next element to @val */
+static void nft_trie_update(const struct nft_set *set,
+			    const struct nft_trie_elem *te, void *val)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	const struct nft_trie_elem *next;
+	struct nft_trie_range r;
+	struct rb_node *node;
+	int i;
+
+	r.depth = set->klen * BITS_PER_BYTE / NFT_TRIE_BITS;
+	r.val	= val;
+	memcpy(r.lo, te->key.data, set->klen);
+
+	node = rb_next(&te->node);
+	if (node != NULL) {
+		next = rb_entry(node, struct nft_trie_elem, node);
+		memcpy(r.hi, next->key.data, set->klen);
+		for (i = set->klen - 1; i >= 0 && r.hi[i]-- == 0; i--)
+			;
+	} else
+		memset(r.hi, 0xff, set->klen);
+
+	nft_trie_assign(priv, &priv->root, 0, &r, true, true);
+}
+
+static void *nft_trie_val(const struct nft_trie_elem *te)
+{
+	if (te == NULL || te->flags & NFT_SET_ELEM_INTERVAL_END)
+		return NULL;
+	return (void *)te;
+}
+
+static int __nft_trie_insert(const struct nft_set *set,
+			     struct nft_trie_elem *new)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	struct nft_trie_elem *te;
+	struct rb_node *parent, **p;
+	int d;
+
+	parent = NULL;
+	p = &priv->elems.rb_node;
+	while (*p != NULL) {
+		parent = *p;
+		te = rb_entry(parent, struct nft_trie_elem, node);
+		d = nft_data_cmp(&new->key, &te->key, set->klen);
+		if (d < 0)
+			p = &parent->rb_left;
+		else if (d > 0)
+			p = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &priv->elems);
+	return 0;
+}
+
+/* Updates are serialized by the nfnetlink mutex, only walks race with them */
+static int nft_trie_insert(const struct nft_set *set,
+			   const struct nft_set_elem *elem)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	struct nft_trie_elem *te;
+	unsigned int size;
+	int err;
+
+	size = sizeof(*te);
+	if (set->flags & NFT_SET_MAP &&
+	    !(elem->flags & NFT_SET_ELEM_INTERVAL_END))
+		size += sizeof(te->data[0]);
+
+	te = kzalloc(size, GFP_KERNEL);
+	if (te == NULL)
+		return -ENOMEM;
+
+	te->flags = elem->flags;
+	nft_data_copy(&te->key, &elem->key);
+	if (set->flags & NFT_SET_MAP &&
+	    !(te->flags & NFT_SET_ELEM_INTERVAL_END))
+		nft_data_copy(te->data, &elem->data);
+
+	err = nft_trie_refill(priv, GFP_KERNEL);
+	if (err < 0)
+		goto err;
+
+	spin_lock_bh(&priv->lock);
+	err = __nft_trie_insert(set, te);
+	spin_unlock_bh(&priv->lock);
+	if (err < 0)
+		goto err;
+
+	nft_trie_update(set, te, nft_trie_val(te));
+	return 0;
+err:
+	kfree(te);
+	return err;
+}
+
+static void nft_trie_remove(const struct nft_set *set,
+			    const struct nft_set_elem *elem)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	struct nft_trie_elem *te = elem->cookie, *prev = NULL;
+	struct rb_node *node;
+
+	nft_trie_refill(priv, GFP_KERNEL | __GFP_NOFAIL);
+
+	node = rb_prev(&te->node);
+	if (node != NULL)
+		prev = rb_entry(node, struct nft_trie_elem, node);
+	nft_trie_update(set, te, nft_trie_val(prev));
+
+	spin_lock_bh(&priv->lock);
+	rb_erase(&te->node, &priv->elems);
+	spin_unlock_bh(&priv->lock);
+	kfree_rcu(te, rcu);
+}
+
+static int nft_trie_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	const struct rb_node *parent;
+	struct nft_trie_elem *te;
+	int d;
+
+	spin_lock_bh(&priv->lock);
+	parent = priv->elems.rb_node;
+	while (parent != NULL) {
+		te = rb_entry(parent, struct nft_trie_elem, node);
+
+		d = nft_data_cmp(&elem->key, &te->key, set->klen);
+		if (d < 0)
+			parent = parent->rb_left;
+		else if (d > 0)
+			parent = parent->rb_right;
+		else {
+			elem->cookie = te;
+			if (set->flags & NFT_SET_MAP &&
+			    !(te->flags & NFT_SET_ELEM_INTERVAL_END))
+				nft_data_copy(&elem->data, te->data);
+			elem->flags = te->flags;
+			spin_unlock_bh(&priv->lock);
+			return 0;
+		}
+	}
+	spin_unlock_bh(&priv->lock);
+	return -ENOENT;
+}
+
+static void nft_trie_walk(const struct nft_ctx *ctx,
+			  const struct nft_set *set,
+			  struct nft_set_iter *iter)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	const struct nft_trie_elem *te;
+	struct nft_set_elem elem;
+	struct rb_node *node;
+
+	spin_lock_bh(&priv->lock);
+	for (node = rb_first(&priv->elems); node != NULL; node = rb_next(node)) {
+		if (iter->count < iter->skip)
+			goto cont;
+
+		te = rb_entry(node, struct nft_trie_elem, node);
+		nft_data_copy(&elem.key, &te->key);
+		if (set->flags & NFT_SET_MAP &&
+		    !(te->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_copy(&elem.data, te->data);
+		elem.flags = te->flags;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0) {
+			spin_unlock_bh(&priv->lock);
+			return;
+		}
+cont:
+		iter->count++;
+	}
+	spin_unlock_bh(&priv->lock);
+}
+
+static unsigned int nft_trie_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_trie);
+}
+
+static int nft_trie_init(const struct nft_set *set,
+			 const struct nft_set_desc *desc,
+			 const struct nlattr * const nla[])
+{
+	struct nft_trie *priv = nft_set_priv(set);
+
+	RCU_INIT_POINTER(priv->root, NULL);
+	spin_lock_init(&priv->lock);
+	priv->elems = RB_ROOT;
+	priv->nspare = 0;
+
+	return nft_trie_refill(priv, GFP_KERNEL);
+}
+
+static void nft_trie_destroy(const struct nft_set *set)
+{
+	struct nft_trie *priv = nft_set_priv(set);
+	struct nft_trie_elem *te;
+	struct rb_node *node;
+
+	nft_trie_free(rcu_dereference_protected(priv->root, 1));
+	while (priv->nspare > 0)
+		kfree(priv->spare[--priv->nspare]);
+
+	while ((node = priv->elems.rb_node) != NULL) {
+		rb_erase(node, &priv->elems);
+		te = rb_entry(node, struct nft_trie_elem, node);
+
+		nft_data_uninit(&te->key, NFT_DATA_VALUE);
+		if (set->flags & NFT_SET_MAP &&
+		    !(te->flags & NFT_SET_ELEM_INTERVAL_END))
+			nft_data_uninit(te->data, set->dtype);
+		kfree(te);
+	}
+}
+
+/* Exact matches are better served by the hash set */
+static bool nft_trie_estimate(const struct nft_set_desc *desc, u32 features,
+			      struct nft_set_estimate *est)
+{
+	unsigned int nsize;
+
+	if (!(features & NFT_SET_INTERVAL))
+		return false;
+
+	/* each element splits the nodes along its key, count two of them */
+	nsize = sizeof(struct nft_trie_elem) + 2 * sizeof(struct nft_trie_node);
+	if (features & NFT_SET_MAP)
+		nsize += FIELD_SIZEOF(struct nft_trie_elem, data[0]);
+
+	if (desc->size)
+		est->size = sizeof(struct nft_trie) + desc->size * nsize;
+	else
+		est->size = nsize;
+
+	est->class = NFT_SET_CLASS_O_K;
+
+	return true;
+}
+
+static struct nft_set_ops nft_trie_ops __read_mostly = {
+	.privsize	= nft_trie_privsize,
+	.estimate	= nft_trie_estimate,
+	.init		= nft_trie_init,
+	.destroy	= nft_trie_destroy,
+	.insert		= nft_trie_insert,
+	.remove		= nft_trie_remove,
+	.get		= nft_trie_get,
+	.lookup		= nft_trie_lookup,
+	.walk		= nft_trie_walk,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_trie_module_init(void)
+{
+	return nft_register_set(&nft_trie_ops);
+}
+
+static void __exit nft_trie_module_exit(void)
+{
+	nft_unregister_set(&nft_trie_ops);
+}
+
+module_init(nft_trie_module_init);
+module_exit(nft_trie_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
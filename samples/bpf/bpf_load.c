@@ -8,50 +8,178 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <linux/bpf.h>
 #include <linux/filter.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
 #include "libbpf.h"
 #include "bpf_helpers.h"
 #include "bpf_load.h"
 
+#define DEBUGFS "/sys/kernel/debug/tracing/"
+
 static char license[128];
+static int kern_version;
 static bool processed_sec[128];
 int map_fd[MAX_MAPS];
 int prog_fd[MAX_PROGS];
+int event_fd[MAX_PROGS];
 int prog_cnt;
 
+static int perf_event_open_tp(int id)
+{
+	struct perf_event_attr attr = {};
+
+	attr.type = PERF_TYPE_TRACEPOINT;
+	attr.sample_type = PERF_SAMPLE_RAW;
+	attr.sample_period = 1;
+	attr.wakeup_events = 1;
+	attr.config = id;
+
+	return syscall(__NR_perf_event_open, &attr, -1 /* pid */, 0 /* cpu */,
+		       -1 /* group_fd */, 0);
+}
+
+static int read_event_id(const char *path)
+{
+	char buf[256];
+	int fd, err;
+
+	fd = open(path, O_RDONLY, 0);
+	if (fd < 0) {
+		printf("failed to open event %s\n", path);
+		return -1;
+	}
+
+	err = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (err < 0 || err >= sizeof(buf)) {
+		printf("read from '%s' failed '%s'\n", path, strerror(errno));
+		return -1;
+	}
+	buf[err] = 0;
+
+	return atoi(buf);
+}
+
+/* Section names tell the program type and where to attach it:
+ *   socket*		socket filter, attached by the user program
+ *   kprobe/func	kprobe at the entry of func
+ *   kretprobe/func	kprobe at the return of func
+ *   tracepoint/cat/evt	static tracepoint cat:evt
+ */
 static int load_and_attach(const char *event, struct bpf_insn *prog, int size)
 {
-	int fd;
 	bool is_socket = strncmp(event, "socket", 6) == 0;
-
-	if (!is_socket)
-		/* tracing events tbd */
+	bool is_kprobe = strncmp(event, "kprobe/", 7) == 0;
+	bool is_kretprobe = strncmp(event, "kretprobe/", 10) == 0;
+	bool is_tracepoint = strncmp(event, "tracepoint/", 11) == 0;
+	enum bpf_prog_type prog_type;
+	char buf[256];
+	int fd, efd, err, id;
+
+	if (is_socket) {
+		prog_type = BPF_PROG_TYPE_SOCKET_FILTER;
+	} else if (is_kprobe || is_kretprobe) {
+		prog_type = BPF_PROG_TYPE_KPROBE;
+	} else if (is_tracepoint) {
+		prog_type = BPF_PROG_TYPE_TRACEPOINT;
+	} else {
+		printf("Unknown event '%s'\n", event);
 		return -1;
+	}
 
-	fd = bpf_prog_load(BPF_PROG_TYPE_SOCKET_FILTER,
-			   prog, size, license);
+	fd = bpf_prog_load(prog_type, prog, size, license, kern_version);
 
 	if (fd < 0) {
 		printf("bpf_prog_load() err=%d\n%s", errno, bpf_log_buf);
 		return -1;
 	}
 
-	prog_fd[prog_cnt++] = fd;
+	prog_fd[prog_cnt] = fd;
+
+	if (is_socket) {
+		prog_cnt++;
+		return 0;
+	}
+
+	if (is_kprobe || is_kretprobe) {
+		if (is_kprobe)
+			event += 7;
+		else
+			event += 10;
+
+		snprintf(buf, sizeof(buf),
+			 "echo '%c:%s %s' >> " DEBUGFS "kprobe_events",
+			 is_kprobe ? 'p' : 'r', event, event);
+		err = system(buf);
+		if (err < 0) {
+			printf("failed to create kprobe '%s' error '%s'\n",
+			       event, strerror(errno));
+			return -1;
+		}
+
+		snprintf(buf, sizeof(buf), DEBUGFS "events/kprobes/%s/id",
+			 event);
+	} else {
+		event += 11;
+		snprintf(buf, sizeof(buf), DEBUGFS "events/%s/id", event);
+	}
+
+	id = read_event_id(buf);
+	if (id < 0)
+		return -1;
+
+	efd = perf_event_open_tp(id);
+	if (efd < 0) {
+		printf("event %d fd %d err %s\n", id, efd, strerror(errno));
+		return -1;
+	}
+	event_fd[prog_cnt] = efd;
+	ioctl(efd, PERF_EVENT_IOC_ENABLE, 0);
+	if (ioctl(efd, PERF_EVENT_IOC_SET_BPF, fd) < 0) {
+		printf("cannot attach to event %d err %s\n", id,
+		       strerror(errno));
+		return -1;
+	}
+	prog_cnt++;
 
 	return 0;
 }
 
+static bool is_prog_section(const char *name)
+{
+	return memcmp(name, "socket", 6) == 0 ||
+	       memcmp(name, "kprobe/", 7) == 0 ||
+	       memcmp(name, "kretprobe/", 10) == 0 ||
+	       memcmp(name, "tracepoint/", 11) == 0;
+}
+
 static int load_maps(struct bpf_map_def *maps, int len)
 {
 	int i;
 
 	for (i = 0; i < len / sizeof(struct bpf_map_def); i++) {
 
-		map_fd[i] = bpf_create_map(maps[i].type,
-					   maps[i].key_size,
-					   maps[i].value_size,
-					   maps[i].max_entries);
+		if (maps[i].type == BPF_MAP_TYPE_ARRAY_OF_MAPS ||
+		    maps[i].type == BPF_MAP_TYPE_HASH_OF_MAPS) {
+			/* the template must be defined first */
+			if (maps[i].inner_map_idx >= i)
+				return 1;
+			map_fd[i] = bpf_create_map_in_map(maps[i].type,
+						maps[i].key_size,
+						map_fd[maps[i].inner_map_idx],
+						maps[i].max_entries,
+						maps[i].map_flags);
+		} else {
+			map_fd[i] = bpf_create_map(maps[i].type,
+						   maps[i].key_size,
+						   maps[i].value_size,
+						   maps[i].max_entries,
+						   maps[i].map_flags);
+		}
 		if (map_fd[i] < 0)
 			return 1;
 	}
@@ -149,6 +277,14 @@ int load_bpf_file(char *path)
 		if (strcmp(shname, "license") == 0) {
 			processed_sec[i] = true;
 			memcpy(license, data->d_buf, data->d_size);
+		} else if (strcmp(shname, "version") == 0) {
+			processed_sec[i] = true;
+			if (data->d_size != sizeof(int)) {
+				printf("invalid size of version section %zd\n",
+				       data->d_size);
+				return 1;
+			}
+			memcpy(&kern_version, data->d_buf, sizeof(int));
 		} else if (strcmp(shname, "maps") == 0) {
 			processed_sec[i] = true;
 			if (load_maps(data->d_buf, data->d_size))
@@ -178,8 +314,7 @@ int load_bpf_file(char *path)
 			if (parse_relo_and_apply(data, symbols, &shdr, insns))
 				continue;
 
-			if (memcmp(shname_prog, "events/", 7) == 0 ||
-			    memcmp(shname_prog, "socket", 6) == 0)
+			if (is_prog_section(shname_prog))
 				load_and_attach(shname_prog, insns, data_prog->d_size);
 		}
 	}
@@ -193,8 +328,7 @@ int load_bpf_file(char *path)
 		if (get_sec(elf, i, &ehdr, &shname, &shdr, &data))
 			continue;
 
-		if (memcmp(shname, "events/", 7) == 0 ||
-		    memcmp(shname, "socket", 6) == 0)
+		if (is_prog_section(shname))
 			load_and_attach(shname, data->d_buf, data->d_size);
 	}
 
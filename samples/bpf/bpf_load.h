@@ -6,6 +6,7 @@
 
 extern int map_fd[MAX_MAPS];
 extern int prog_fd[MAX_PROGS];
+extern int event_fd[MAX_PROGS];
 
 /* parses elf file compiled by llvm .c->.o
  * . parses 'maps' section and creates maps via BPF syscall
@@ -13,6 +14,9 @@ extern int prog_fd[MAX_PROGS];
  * . parses elf relocations for BPF maps and adjusts BPF_LD_IMM64 insns by
  *   storing map_fd into insn->imm and marking such insns as BPF_PSEUDO_MAP_FD
  * . loads eBPF programs via BPF syscall
+ * . creates the kprobes of 'kprobe/' and 'kretprobe/' sections and attaches
+ *   their programs, as well as the ones of 'tracepoint/' sections, to the
+ *   trace events with perf_event_open() and PERF_EVENT_IOC_SET_BPF
  *
  * One ELF file can contain multiple BPF programs which will be loaded
  * and their FDs stored stored in prog_fd array
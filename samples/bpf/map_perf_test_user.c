@@ -0,0 +1,132 @@
+/* Measure the cost of map operations from eBPF programs, on all cpus.
+ *
+ * One task per cpu calls a cheap syscall in a loop, each syscall being
+ * kprobed by a program working on a different flavour of map, and the
+ * number of calls per second is reported for every task.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <asm/unistd.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/wait.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <linux/bpf.h>
+#include <string.h>
+#include <time.h>
+#include "libbpf.h"
+#include "bpf_load.h"
+
+#define MAX_CNT 1000000
+
+static __u64 time_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#define HASH_PREALLOC		(1 << 0)
+#define PERCPU_HASH_PREALLOC	(1 << 1)
+#define HASH_KMALLOC		(1 << 2)
+#define PERCPU_HASH_KMALLOC	(1 << 3)
+#define ARRAY			(1 << 4)
+#define PERCPU_ARRAY		(1 << 5)
+#define LRU_HASH		(1 << 6)
+#define PERCPU_LRU_HASH		(1 << 7)
+
+static int test_flags = ~0;
+
+static const struct {
+	int flag;
+	int nr;
+	const char *name;
+} tests[] = {
+	{ HASH_PREALLOC,	__NR_getuid,	"hash_map" },
+	{ PERCPU_HASH_PREALLOC,	__NR_geteuid,	"percpu_hash_map" },
+	{ HASH_KMALLOC,		__NR_getgid,	"hash_map kmalloc" },
+	{ PERCPU_HASH_KMALLOC,	__NR_getegid,	"percpu_hash_map kmalloc" },
+	{ ARRAY,		__NR_getpgrp,	"array_map" },
+	{ PERCPU_ARRAY,		__NR_getppid,	"percpu_array_map" },
+	{ LRU_HASH,		__NR_getpid,	"lru_hash_map insert" },
+	{ PERCPU_LRU_HASH,	__NR_gettid,	"percpu_lru_hash_map insert" },
+};
+
+static void loop(int cpu, int nr, const char *name)
+{
+	__u64 start_time;
+	int i;
+
+	start_time = time_get_ns();
+	for (i = 0; i < MAX_CNT; i++)
+		syscall(nr);
+	printf("%d:%s %lld events per sec\n",
+	       cpu, name, MAX_CNT * 1000000000ll / (time_get_ns() - start_time));
+}
+
+static void run_perf_test(int cpu)
+{
+	cpu_set_t cpuset;
+	int i;
+
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	sched_setaffinity(0, sizeof(cpuset), &cpuset);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+		if (test_flags & tests[i].flag)
+			loop(cpu, tests[i].nr, tests[i].name);
+}
+
+static void run_parallel(int tasks)
+{
+	pid_t pid[tasks];
+	int i;
+
+	for (i = 0; i < tasks; i++) {
+		pid[i] = fork();
+		if (pid[i] == 0) {
+			run_perf_test(i);
+			exit(0);
+		} else if (pid[i] == -1) {
+			printf("couldn't spawn #%d process\n", i);
+			exit(1);
+		}
+	}
+	for (i = 0; i < tasks; i++) {
+		int status;
+
+		assert(waitpid(pid[i], &status, 0) == pid[i]);
+		assert(status == 0);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int num_cpu = sysconf(_SC_NPROCESSORS_CONF);
+	char filename[256];
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	if (argc > 1)
+		test_flags = atoi(argv[1]) ? : test_flags;
+	if (argc > 2)
+		num_cpu = atoi(argv[2]) ? : num_cpu;
+
+	if (load_bpf_file(filename)) {
+		printf("%s", bpf_log_buf);
+		return 1;
+	}
+
+	run_parallel(num_cpu);
+
+	return 0;
+}
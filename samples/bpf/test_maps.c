@@ -17,13 +17,16 @@
 #include <stdlib.h>
 #include "libbpf.h"
 
+static int map_flags;
+
 /* sanity tests for map API */
 static void test_hashmap_sanity(int i, void *data)
 {
 	long long key, next_key, value;
 	int map_fd;
 
-	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(value), 2);
+	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(value),
+				2, map_flags);
 	if (map_fd < 0) {
 		printf("failed to create hashmap '%s'\n", strerror(errno));
 		exit(1);
@@ -94,7 +97,8 @@ static void test_arraymap_sanity(int i, void *data)
 	int key, next_key, map_fd;
 	long long value;
 
-	map_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(value), 2);
+	map_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(key), sizeof(value),
+				2, 0);
 	if (map_fd < 0) {
 		printf("failed to create arraymap '%s'\n", strerror(errno));
 		exit(1);
@@ -142,6 +146,154 @@ static void test_arraymap_sanity(int i, void *data)
 	close(map_fd);
 }
 
+static void test_hashmap_percpu(int task, void *data)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	long long value[nr_cpus];
+	long long key, next_key;
+	int expected_key_mask = 0;
+	int map_fd, i;
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_HASH, sizeof(key),
+				sizeof(value[0]), 2, map_flags);
+	if (map_fd < 0) {
+		printf("failed to create hashmap '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		value[i] = i + 100;
+	key = 1;
+	/* insert key=1 element */
+	assert(!(expected_key_mask & key));
+	assert(bpf_update_elem(map_fd, &key, value, BPF_ANY) == 0);
+	expected_key_mask |= key;
+
+	/* BPF_NOEXIST means: add new element if it doesn't exist */
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == -1 &&
+	       /* key=1 already exists */
+	       errno == EEXIST);
+
+	/* -1 is an invalid flag */
+	assert(bpf_update_elem(map_fd, &key, value, -1) == -1 &&
+	       errno == EINVAL);
+
+	/* check that key=1 can be found. value could be 0 if the lookup
+	 * was run from a different cpu.
+	 */
+	value[0] = 1;
+	assert(bpf_lookup_elem(map_fd, &key, value) == 0 && value[0] == 100);
+
+	key = 2;
+	/* check that key=2 is not found */
+	assert(bpf_lookup_elem(map_fd, &key, value) == -1 && errno == ENOENT);
+
+	/* BPF_EXIST means: update existing element */
+	assert(bpf_update_elem(map_fd, &key, value, BPF_EXIST) == -1 &&
+	       /* key=2 is not there */
+	       errno == ENOENT);
+
+	/* insert key=2 element */
+	assert(!(expected_key_mask & key));
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == 0);
+	expected_key_mask |= key;
+
+	/* key=1 and key=2 were inserted, check that key=0 cannot be inserted
+	 * due to max_entries limit
+	 */
+	key = 0;
+	assert(bpf_update_elem(map_fd, &key, value, BPF_NOEXIST) == -1 &&
+	       errno == E2BIG);
+
+	/* check that key = 0 doesn't exist */
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == ENOENT);
+
+	/* iterate over two elements */
+	while (!bpf_get_next_key(map_fd, &key, &next_key)) {
+		assert((expected_key_mask & next_key) == next_key);
+		expected_key_mask &= ~next_key;
+
+		assert(bpf_lookup_elem(map_fd, &next_key, value) == 0);
+		for (i = 0; i < nr_cpus; i++)
+			assert(value[i] == i + 100);
+
+		key = next_key;
+	}
+	assert(errno == ENOENT);
+
+	/* Update with BPF_EXIST */
+	key = 1;
+	assert(bpf_update_elem(map_fd, &key, value, BPF_EXIST) == 0);
+
+	/* delete both elements */
+	key = 1;
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	key = 2;
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == ENOENT);
+
+	key = 0;
+	/* check that map is empty */
+	assert(bpf_get_next_key(map_fd, &key, &next_key) == -1 &&
+	       errno == ENOENT);
+	close(map_fd);
+}
+
+static void test_arraymap_percpu(int task, void *data)
+{
+	unsigned int nr_cpus = bpf_num_possible_cpus();
+	int key, next_key, map_fd, i;
+	long long values[nr_cpus];
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(key),
+				sizeof(values[0]), 2, 0);
+	if (map_fd < 0) {
+		printf("failed to create arraymap '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		values[i] = i + 100;
+
+	key = 1;
+	/* insert key=1 element */
+	assert(bpf_update_elem(map_fd, &key, values, BPF_ANY) == 0);
+
+	values[0] = 0;
+	assert(bpf_update_elem(map_fd, &key, values, BPF_NOEXIST) == -1 &&
+	       errno == EEXIST);
+
+	/* check that key=1 can be found */
+	assert(bpf_lookup_elem(map_fd, &key, values) == 0 && values[0] == 100);
+
+	key = 0;
+	/* check that key=0 is also found and zero initialized */
+	assert(bpf_lookup_elem(map_fd, &key, values) == 0 &&
+	       values[0] == 0 && values[nr_cpus - 1] == 0);
+
+	/* check that key=2 cannot be inserted due to max_entries limit */
+	key = 2;
+	assert(bpf_update_elem(map_fd, &key, values, BPF_EXIST) == -1 &&
+	       errno == E2BIG);
+
+	/* check that key = 2 doesn't exist */
+	assert(bpf_lookup_elem(map_fd, &key, values) == -1 && errno == ENOENT);
+
+	/* iterate over two elements */
+	assert(bpf_get_next_key(map_fd, &key, &next_key) == 0 &&
+	       next_key == 0);
+	assert(bpf_get_next_key(map_fd, &next_key, &next_key) == 0 &&
+	       next_key == 1);
+	assert(bpf_get_next_key(map_fd, &next_key, &next_key) == -1 &&
+	       errno == ENOENT);
+
+	/* delete shouldn't succeed */
+	key = 1;
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == EINVAL);
+
+	close(map_fd);
+}
+
 #define MAP_SIZE (32 * 1024)
 static void test_map_large(void)
 {
@@ -154,7 +306,7 @@ static void test_map_large(void)
 
 	/* allocate 4Mbyte of memory */
 	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(value),
-				MAP_SIZE);
+				MAP_SIZE, map_flags);
 	if (map_fd < 0) {
 		printf("failed to create large map '%s'\n", strerror(errno));
 		exit(1);
@@ -209,7 +361,9 @@ static void run_parallel(int tasks, void (*fn)(int i, void *data), void *data)
 static void test_map_stress(void)
 {
 	run_parallel(100, test_hashmap_sanity, NULL);
+	run_parallel(100, test_hashmap_percpu, NULL);
 	run_parallel(100, test_arraymap_sanity, NULL);
+	run_parallel(100, test_arraymap_percpu, NULL);
 }
 
 #define TASKS 1024
@@ -237,7 +391,7 @@ static void test_map_parallel(void)
 	int data[2];
 
 	map_fd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(key), sizeof(value),
-				MAP_SIZE);
+				MAP_SIZE, map_flags);
 	if (map_fd < 0) {
 		printf("failed to create map for parallel test '%s'\n",
 		       strerror(errno));
@@ -279,13 +433,150 @@ static void test_map_parallel(void)
 	assert(bpf_get_next_key(map_fd, &key, &key) == -1 && errno == ENOENT);
 }
 
-int main(void)
+static int map_count(int map_fd)
+{
+	long long key = -1;
+	int n = 0;
+
+	while (bpf_get_next_key(map_fd, &key, &key) == 0)
+		n++;
+	return n;
+}
+
+#define LRU_SIZE 512
+static void do_lru_work(int fn, void *data)
+{
+	int map_fd = ((int *)data)[0];
+	long long key, value;
+	int i;
+
+	/* every insert succeeds, evicting the coldest keys once full */
+	for (i = 0; i < 4 * LRU_SIZE; i++) {
+		key = value = (long long)fn << 32 | i;
+		assert(bpf_update_elem(map_fd, &key, &value, BPF_NOEXIST) == 0);
+	}
+}
+
+static void test_lru_map(int lru_flags)
+{
+	/* per-cpu lists get the same share each */
+	int max_size = LRU_SIZE + bpf_num_possible_cpus();
+	long long key, value;
+	int map_fd, i, data[1];
+
+	/* LRU maps only work on preallocated elements */
+	map_fd = bpf_create_map(BPF_MAP_TYPE_LRU_HASH, sizeof(key),
+				sizeof(value), LRU_SIZE,
+				lru_flags | BPF_F_NO_PREALLOC);
+	assert(map_fd == -1 && errno == EINVAL);
+
+	map_fd = bpf_create_map(BPF_MAP_TYPE_LRU_HASH, sizeof(key),
+				sizeof(value), LRU_SIZE, lru_flags);
+	if (map_fd < 0) {
+		printf("failed to create lru map '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	for (i = 0; i < 4 * LRU_SIZE; i++) {
+		key = value = i;
+		assert(bpf_update_elem(map_fd, &key, &value, BPF_NOEXIST) == 0);
+	}
+
+	/* the last key is still there, the first ones were evicted */
+	key = 4 * LRU_SIZE - 1;
+	assert(bpf_lookup_elem(map_fd, &key, &value) == 0 && value == key);
+	assert(map_count(map_fd) <= max_size);
+	/* per-cpu lists only evict on the cpus we ran on */
+	key = 0;
+	if (!(lru_flags & BPF_F_NO_COMMON_LRU))
+		assert(bpf_lookup_elem(map_fd, &key, &value) == -1 &&
+		       errno == ENOENT);
+
+	/* deleted elements are reused */
+	key = 4 * LRU_SIZE - 1;
+	assert(bpf_delete_elem(map_fd, &key) == 0);
+	assert(bpf_delete_elem(map_fd, &key) == -1 && errno == ENOENT);
+	assert(bpf_update_elem(map_fd, &key, &value, BPF_NOEXIST) == 0);
+
+	/* inserts racing from many tasks keep the map bounded */
+	data[0] = map_fd;
+	run_parallel(64, do_lru_work, data);
+	assert(map_count(map_fd) <= max_size);
+
+	close(map_fd);
+}
+
+static void test_map_in_map(enum bpf_map_type type)
+{
+	int inner_fd[2], bad_fd, outer_fd, key = 0, value;
+
+	inner_fd[0] = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(int),
+				     sizeof(long long), 1, 0);
+	inner_fd[1] = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(int),
+				     sizeof(long long), 1, 0);
+	bad_fd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(int),
+				sizeof(int), 1, 0);
+	assert(inner_fd[0] >= 0 && inner_fd[1] >= 0 && bad_fd >= 0);
+
+	/* values are fds of maps shaped like the template */
+	outer_fd = bpf_create_map_in_map(type, sizeof(key), inner_fd[0], 2, 0);
+	if (outer_fd < 0) {
+		printf("failed to create map in map '%s'\n", strerror(errno));
+		exit(1);
+	}
+
+	/* no nesting */
+	assert(bpf_create_map_in_map(type, sizeof(key), outer_fd, 2, 0) == -1 &&
+	       errno == EINVAL);
+
+	value = bad_fd;
+	assert(bpf_update_elem(outer_fd, &key, &value, BPF_ANY) == -1 &&
+	       errno == EINVAL);
+
+	/* swap whole tables under the programs' feet */
+	value = inner_fd[0];
+	assert(bpf_update_elem(outer_fd, &key, &value, BPF_ANY) == 0);
+	value = inner_fd[1];
+	assert(bpf_update_elem(outer_fd, &key, &value, BPF_ANY) == 0);
+
+	/* the outer map keeps its inner maps alive */
+	close(inner_fd[0]);
+	close(inner_fd[1]);
+
+	/* kernel pointers are not handed out */
+	assert(bpf_lookup_elem(outer_fd, &key, &value) == -1 &&
+	       errno == EOPNOTSUPP);
+
+	assert(bpf_delete_elem(outer_fd, &key) == 0);
+	assert(bpf_delete_elem(outer_fd, &key) == -1 && errno == ENOENT);
+
+	close(bad_fd);
+	close(outer_fd);
+}
+
+static void run_all_tests(void)
 {
 	test_hashmap_sanity(0, NULL);
+	test_hashmap_percpu(0, NULL);
 	test_arraymap_sanity(0, NULL);
+	test_arraymap_percpu(0, NULL);
 	test_map_large();
 	test_map_parallel();
 	test_map_stress();
+}
+
+int main(void)
+{
+	/* preallocated hash maps first, then the ones allocating on update */
+	map_flags = 0;
+	run_all_tests();
+	map_flags = BPF_F_NO_PREALLOC;
+	run_all_tests();
+
+	test_lru_map(0);
+	test_lru_map(BPF_F_NO_COMMON_LRU);
+	test_map_in_map(BPF_MAP_TYPE_ARRAY_OF_MAPS);
+	test_map_in_map(BPF_MAP_TYPE_HASH_OF_MAPS);
 	printf("test_maps: OK\n");
 	return 0;
 }
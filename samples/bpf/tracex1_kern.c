@@ -0,0 +1,88 @@
+/* Latency histogram of write() syscalls, aggregated in the kernel.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General Public
+ * License as published by the Free Software Foundation.
+ */
+#include <linux/ptrace.h>
+#include <linux/version.h>
+#include <uapi/linux/bpf.h>
+#include "bpf_helpers.h"
+
+#define MAX_SLOTS 64
+
+struct bpf_map_def SEC("maps") start_ts = {
+	.type = BPF_MAP_TYPE_HASH,
+	.key_size = sizeof(u64),
+	.value_size = sizeof(u64),
+	.max_entries = 4096,
+};
+
+struct bpf_map_def SEC("maps") lat_hist = {
+	.type = BPF_MAP_TYPE_ARRAY,
+	.key_size = sizeof(u32),
+	.value_size = sizeof(long),
+	.max_entries = MAX_SLOTS,
+};
+
+SEC("kprobe/sys_write")
+int write_entry(struct pt_regs *ctx)
+{
+	u64 pid_tgid = bpf_get_current_pid_tgid();
+	u64 ts = bpf_ktime_get_ns();
+
+	bpf_map_update_elem(&start_ts, &pid_tgid, &ts, BPF_ANY);
+	return 0;
+}
+
+static unsigned int log2(unsigned int v)
+{
+	unsigned int r;
+	unsigned int shift;
+
+	r = (v > 0xFFFF) << 4; v >>= r;
+	shift = (v > 0xFF) << 3; v >>= shift; r |= shift;
+	shift = (v > 0xF) << 2; v >>= shift; r |= shift;
+	shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+	r |= (v >> 1);
+	return r;
+}
+
+static unsigned int log2l(unsigned long v)
+{
+	unsigned int hi = v >> 32;
+
+	if (hi)
+		return log2(hi) + 32;
+	else
+		return log2(v);
+}
+
+SEC("kretprobe/sys_write")
+int write_return(struct pt_regs *ctx)
+{
+	u64 pid_tgid = bpf_get_current_pid_tgid();
+	u64 *tsp, delta;
+	u32 slot;
+	long *value;
+
+	tsp = bpf_map_lookup_elem(&start_ts, &pid_tgid);
+	if (!tsp)
+		return 0;
+
+	delta = bpf_ktime_get_ns() - *tsp;
+	bpf_map_delete_elem(&start_ts, &pid_tgid);
+
+	/* one array update per call, nothing reaches the perf ring buffer */
+	slot = log2l(delta / 1000);
+	if (slot >= MAX_SLOTS)
+		slot = MAX_SLOTS - 1;
+
+	value = bpf_map_lookup_elem(&lat_hist, &slot);
+	if (value)
+		__sync_fetch_and_add(value, 1);
+
+	return 0;
+}
+char _license[] SEC("license") = "GPL";
+u32 _version SEC("version") = LINUX_VERSION_CODE;
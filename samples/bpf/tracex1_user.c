@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <linux/bpf.h>
+#include "libbpf.h"
+#include "bpf_load.h"
+
+#define MAX_SLOTS 64
+#define MAX_STARS 40
+
+static void stars(char *str, long val, long max, int width)
+{
+	int i;
+
+	for (i = 0; i < (width * val / max) - 1 && i < width - 1; i++)
+		str[i] = '*';
+	if (val > max)
+		str[i - 1] = '+';
+	str[i] = '\0';
+}
+
+static void print_hist(int fd)
+{
+	long values[MAX_SLOTS];
+	char starstr[MAX_STARS];
+	long max_value = 0;
+	int max_slot = 0;
+	int key;
+
+	for (key = 0; key < MAX_SLOTS; key++) {
+		values[key] = 0;
+		bpf_lookup_elem(fd, &key, &values[key]);
+		if (values[key])
+			max_slot = key;
+		if (values[key] > max_value)
+			max_value = values[key];
+	}
+
+	printf("           usecs : count     distribution\n");
+	for (key = 0; key <= max_slot; key++) {
+		stars(starstr, values[key], max_value ? : 1, MAX_STARS);
+		printf("%8lu -> %-8lu : %-8ld |%-*s|\n",
+		       key ? 1UL << (key - 1) : 0, (1UL << key) - 1,
+		       values[key], MAX_STARS, starstr);
+	}
+}
+
+static void int_exit(int sig)
+{
+	print_hist(map_fd[1]);
+	exit(0);
+}
+
+int main(int ac, char **argv)
+{
+	char filename[256];
+
+	snprintf(filename, sizeof(filename), "%s_kern.o", argv[0]);
+
+	signal(SIGINT, int_exit);
+
+	if (load_bpf_file(filename)) {
+		printf("%s", bpf_log_buf);
+		return 1;
+	}
+
+	for (;;) {
+		sleep(5);
+		print_hist(map_fd[1]);
+	}
+
+	return 0;
+}
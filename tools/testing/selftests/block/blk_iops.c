@@ -0,0 +1,230 @@
+/*
+ * Random O_DIRECT I/O against a block device from a number of threads,
+ * reporting IOPS and read latency.
+ *
+ * Each thread keeps one request in flight, reading or writing a random
+ * block-size aligned offset, with the given percentage of writes. Read
+ * latencies go into a per thread histogram with one microsecond buckets,
+ * anything above the last bucket is counted in it.
+ *
+ * Writes destroy the data on the device, they are only issued with -w.
+ *
+ * Usage:
+ *   blk_iops -d dev [-t secs] [-j jobs] [-b bs] [-w write_pct]
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LAT_BUCKETS	100000		/* 100 ms */
+#define MAX_JOBS	256
+
+static const char *cfg_dev;
+static int cfg_secs = 5;
+static int cfg_jobs = 1;
+static int cfg_bs = 4096;
+static int cfg_write_pct;
+
+static uint64_t dev_blocks;
+static volatile bool stop;
+
+struct job {
+	pthread_t thread;
+	unsigned int seed;
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t read_ns;
+	uint64_t max_ns;
+	uint32_t *lat;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t rand64(unsigned int *seed)
+{
+	return ((uint64_t)rand_r(seed) << 31) ^ rand_r(seed);
+}
+
+static void *job_fn(void *arg)
+{
+	struct job *job = arg;
+	void *buf;
+	int fd;
+
+	fd = open(cfg_dev, (cfg_write_pct ? O_RDWR : O_RDONLY) | O_DIRECT);
+	if (fd < 0)
+		error(1, errno, "open %s", cfg_dev);
+	if (posix_memalign(&buf, 4096, cfg_bs))
+		error(1, 0, "posix_memalign");
+	memset(buf, 0xa5, cfg_bs);
+
+	while (!stop) {
+		off_t off = (rand64(&job->seed) % dev_blocks) * cfg_bs;
+		bool write = rand_r(&job->seed) % 100 < cfg_write_pct;
+		uint64_t start, lat;
+		ssize_t ret;
+
+		start = now_ns();
+		if (write)
+			ret = pwrite(fd, buf, cfg_bs, off);
+		else
+			ret = pread(fd, buf, cfg_bs, off);
+		if (ret != cfg_bs)
+			error(1, ret < 0 ? errno : 0, "%s at %lld",
+			      write ? "write" : "read", (long long)off);
+
+		if (write) {
+			job->writes++;
+			continue;
+		}
+
+		lat = now_ns() - start;
+		job->reads++;
+		job->read_ns += lat;
+		if (lat > job->max_ns)
+			job->max_ns = lat;
+		lat /= 1000;
+		job->lat[lat < LAT_BUCKETS ? lat : LAT_BUCKETS - 1]++;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+/* @permille of the samples in @lat complete within the returned us */
+static unsigned int percentile(const uint32_t *lat, uint64_t total,
+			       int permille)
+{
+	uint64_t want = (total * permille + 999) / 1000, seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += lat[i];
+		if (seen >= want)
+			return i;
+	}
+	return LAT_BUCKETS;
+}
+
+static void usage(const char *prog)
+{
+	error(1, 0, "usage: %s -d dev [-t secs] [-j jobs] [-b bs] [-w write_pct]",
+	      prog);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "b:d:j:t:w:")) != -1) {
+		switch (c) {
+		case 'b':
+			cfg_bs = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			cfg_dev = optarg;
+			break;
+		case 'j':
+			cfg_jobs = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_secs = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			cfg_write_pct = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!cfg_dev || cfg_bs < 512 || cfg_bs % 512 ||
+	    cfg_jobs < 1 || cfg_jobs > MAX_JOBS || cfg_write_pct > 100)
+		usage(argv[0]);
+}
+
+int main(int argc, char **argv)
+{
+	static struct job jobs[MAX_JOBS];
+	uint64_t reads = 0, writes = 0, read_ns = 0, max_ns = 0, size;
+	uint32_t *lat;
+	int fd, i, j;
+
+	parse_opts(argc, argv);
+
+	fd = open(cfg_dev, O_RDONLY);
+	if (fd < 0)
+		error(1, errno, "open %s", cfg_dev);
+	if (ioctl(fd, BLKGETSIZE64, &size))
+		error(1, errno, "BLKGETSIZE64");
+	close(fd);
+
+	dev_blocks = size / cfg_bs;
+	if (!dev_blocks)
+		error(1, 0, "%s smaller than one block", cfg_dev);
+
+	lat = calloc(LAT_BUCKETS, sizeof(*lat));
+	if (!lat)
+		error(1, 0, "calloc");
+
+	for (i = 0; i < cfg_jobs; i++) {
+		jobs[i].seed = i + 1;
+		jobs[i].lat = calloc(LAT_BUCKETS, sizeof(*jobs[i].lat));
+		if (!jobs[i].lat)
+			error(1, 0, "calloc");
+		if (pthread_create(&jobs[i].thread, NULL, job_fn, &jobs[i]))
+			error(1, 0, "pthread_create");
+	}
+
+	sleep(cfg_secs);
+	stop = true;
+
+	for (i = 0; i < cfg_jobs; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		reads += jobs[i].reads;
+		writes += jobs[i].writes;
+		read_ns += jobs[i].read_ns;
+		if (jobs[i].max_ns > max_ns)
+			max_ns = jobs[i].max_ns;
+		for (j = 0; j < LAT_BUCKETS; j++)
+			lat[j] += jobs[i].lat[j];
+		free(jobs[i].lat);
+	}
+
+	printf("read iops %llu write iops %llu\n",
+	       (unsigned long long)reads / cfg_secs,
+	       (unsigned long long)writes / cfg_secs);
+	if (reads)
+		printf("read lat us: avg %llu p50 %u p99 %u p99.9 %u max %llu\n",
+		       (unsigned long long)(read_ns / reads / 1000),
+		       percentile(lat, reads, 500), percentile(lat, reads, 990),
+		       percentile(lat, reads, 999),
+		       (unsigned long long)(max_ns / 1000));
+
+	free(lat);
+	return 0;
+}
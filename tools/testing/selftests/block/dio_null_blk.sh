@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# O_DIRECT IOPS from one task pinned to one CPU, on a null_blk device that
+# completes requests inline, so the numbers are what a core can push
+# through the block layer. Up to 16k the I/O takes the on-stack bio path
+# for block devices, larger sizes go through the generic direct I/O code.
+
+readonly SECS=${SECS:-5}
+readonly dev=/dev/nullb0
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "dio_null_blk: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "dio_null_blk: null_blk already loaded, skipping"
+	exit 0
+fi
+
+modprobe null_blk queue_mode=2 irqmode=0 nr_devices=1 gb=4 || exit 1
+trap 'rmmod null_blk' EXIT
+
+for bs in 512 4096 16384 65536; do
+	for write_pct in 0 100; do
+		echo "bs ${bs}, ${write_pct}% writes, 1 cpu:"
+		taskset -c 0 ./blk_iops -d "${dev}" -t "${SECS}" -j 1 \
+			-b "${bs}" -w "${write_pct}" || exit 1
+	done
+done
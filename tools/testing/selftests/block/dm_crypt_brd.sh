@@ -0,0 +1,69 @@
+#!/bin/sh
+#
+# dm-crypt on a brd ramdisk, so that the numbers are bound by the crypto
+# and its queueing instead of by the disk. For every set of feature
+# arguments data written through the mapping has to read back unchanged
+# but must not be found in the clear on the ramdisk, then O_DIRECT IOPS
+# are measured. sector_size changes the on-disk format, so the data is
+# written anew each time.
+
+readonly SECS=${SECS:-5}
+readonly CIPHER=${CIPHER:-aes-xts-plain64}
+readonly name=dm_crypt_brd
+readonly dev=/dev/mapper/${name}
+readonly tmp=/tmp/${name}.data
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "dm_crypt_brd: need root, skipping"
+	exit 0
+fi
+
+if [ -e /dev/ram0 ]; then
+	echo "dm_crypt_brd: brd already loaded, skipping"
+	exit 0
+fi
+
+if ! command -v dmsetup >/dev/null 2>&1; then
+	echo "dm_crypt_brd: no dmsetup, skipping"
+	exit 0
+fi
+
+modprobe brd rd_nr=1 rd_size=262144 || exit 1
+modprobe dm-crypt 2>/dev/null
+trap 'dmsetup remove ${name} 2>/dev/null; rm -f "${tmp}"; rmmod brd' EXIT
+
+key=$(od -An -tx1 -N32 /dev/urandom | tr -d ' \n')
+size=$(blockdev --getsz /dev/ram0)
+
+dd if=/dev/urandom of="${tmp}" bs=1M count=16 2>/dev/null
+
+for opts in "" "2 same_cpu_crypt submit_from_crypt_cpus" \
+	    "1 inline_sync_io:8" "2 sector_size:4096 inline_sync_io:8"; do
+	if ! echo "0 ${size} crypt ${CIPHER} ${key} 0 /dev/ram0 0 ${opts}" | \
+	     dmsetup create ${name} 2>/dev/null; then
+		if [ -z "${opts}" ]; then
+			echo "dm_crypt_brd: no ${CIPHER}, skipping"
+			exit 0
+		fi
+		echo "dm_crypt_brd: table with '${opts}' rejected"
+		exit 1
+	fi
+
+	dd if="${tmp}" of="${dev}" bs=1M oflag=direct 2>/dev/null || exit 1
+	if ! cmp -s -n 16777216 "${tmp}" "${dev}"; then
+		echo "dm_crypt_brd: '${opts}': data mismatch"
+		exit 1
+	fi
+	if cmp -s -n 16777216 "${tmp}" /dev/ram0; then
+		echo "dm_crypt_brd: '${opts}': data not encrypted"
+		exit 1
+	fi
+
+	for write_pct in 0 100; do
+		echo "'${opts}', bs 4096, ${write_pct}% writes:"
+		./blk_iops -d "${dev}" -t "${SECS}" -j 4 -b 4096 \
+			-w "${write_pct}" || exit 1
+	done
+
+	dmsetup remove ${name} || exit 1
+done
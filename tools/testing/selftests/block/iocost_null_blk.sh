@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+# Cost model based IO control on a blk-mq null_blk with 100 usec
+# completions.  With a latency target the device can't meet, it counts
+# as saturated and two cgroups reading at the same time must get device
+# time in proportion to their blkio.cost.weight.  With a target it
+# easily meets, a cgroup held back by a pessimistic model must make the
+# device vtime speed up, since the controller is work conserving.
+
+readonly SECS=${SECS:-5}
+readonly dev=/dev/nullb0
+readonly queue=/sys/block/nullb0/queue
+readonly blkio=/sys/fs/cgroup/blkio
+readonly model="rbps=1000000000 rseqiops=2000 rrandiops=2000 wbps=1000000000 wseqiops=2000 wrandiops=2000"
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "iocost_null_blk: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "iocost_null_blk: null_blk already loaded, skipping"
+	exit 0
+fi
+
+if [ ! -d "${blkio}" ]; then
+	echo "iocost_null_blk: blkio controller not mounted, skipping"
+	exit 0
+fi
+
+modprobe null_blk queue_mode=2 irqmode=2 completion_nsec=100000 \
+	nr_devices=1 gb=4 || exit 1
+trap "rmdir ${blkio}/iocost_a ${blkio}/iocost_b 2> /dev/null; rmmod null_blk" EXIT
+
+if [ ! -e "${queue}/iocost_enable" ]; then
+	echo "iocost_null_blk: no cost model based IO control, skipping"
+	exit 0
+fi
+
+echo "${model}" > "${queue}/iocost_model" || exit 1
+echo 1 > "${queue}/iocost_enable" || exit 1
+
+# start a direct reader in a new cgroup with the given weight
+reader() {
+	mkdir "${blkio}/$1" || exit 1
+	echo "$2" > "${blkio}/$1/blkio.cost.weight" || exit 1
+	sh -c "echo \$\$ > ${blkio}/$1/tasks &&
+	       exec dd if=${dev} of=/dev/null bs=4k iflag=direct \
+		       2> /dev/null" &
+}
+
+usage_us() {
+	grep nullb0 "${blkio}/$1/blkio.cost.stat" |
+		sed -n 's/.*usage_us=\([0-9]*\).*/\1/p'
+}
+
+# device saturated, shares enforced
+echo "rpct=95 rlat=10 wpct=95 wlat=10" > "${queue}/iocost_qos" || exit 1
+reader iocost_a 100
+reader iocost_b 300
+sleep "${SECS}"
+kill $(jobs -p) 2> /dev/null
+wait
+grep nullb0 "${blkio}/iocost_a/blkio.cost.stat" "${blkio}/iocost_b/blkio.cost.stat"
+
+a=$(usage_us iocost_a)
+b=$(usage_us iocost_b)
+if [ -z "${a}" ] || [ -z "${b}" ] || [ "${a}" -eq 0 ] ||
+   [ "${b}" -lt $((a * 2)) ]; then
+	echo "iocost_null_blk: usage ${a} vs ${b} us at weights 100 and 300 [FAIL]"
+	exit 1
+fi
+rmdir "${blkio}/iocost_a" "${blkio}/iocost_b"
+
+# device keeps up, vtime has to speed up for the lone reader
+echo "rpct=95 rlat=1000000 wpct=95 wlat=1000000" > "${queue}/iocost_qos" ||
+	exit 1
+reader iocost_a 100
+sleep "${SECS}"
+kill $(jobs -p) 2> /dev/null
+wait
+
+vrate=$(cat "${queue}/iocost_vrate")
+echo "vrate ${vrate}%"
+if [ "${vrate}" -le 100 ]; then
+	echo "iocost_null_blk: vrate didn't go up with the device idle [FAIL]"
+	exit 1
+fi
+
+echo 0 > "${queue}/iocost_enable"
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# Cost of the request latency histograms on the completion hot path:
+# random O_DIRECT reads on null_blk completing inline, from one job per
+# cpu, with lat_hist_enable off and on, for both the legacy request and
+# the blk-mq queue mode.  Then check that the reads show up in the
+# queue's lat_hist and, with the blkio controller mounted, in the
+# blkio.lat_hist file of the cgroup they were issued from.  A group's
+# histogram is allocated by a worker after its first request, so a
+# warm-up read creates it and the stats are reset before counting.
+
+readonly SECS=${SECS:-5}
+readonly JOBS=${JOBS:-$(getconf _NPROCESSORS_ONLN)}
+readonly dev=/dev/nullb0
+readonly queue=/sys/block/nullb0/queue
+readonly blkio=/sys/fs/cgroup/blkio
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "lat_hist_null_blk: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "lat_hist_null_blk: null_blk already loaded, skipping"
+	exit 0
+fi
+
+# sum of the read row of a histogram, after the given number of fields
+read_sum() {
+	awk -v skip="$1" '$(skip + 1) == "read" {
+		for (i = skip + 2; i <= NF; i++) s += $i } END { print s + 0 }'
+}
+
+for mode in 1 2; do
+	modprobe null_blk queue_mode=${mode} irqmode=0 nr_devices=1 gb=4 ||
+		exit 1
+
+	if [ ! -e "${queue}/lat_hist_enable" ]; then
+		echo "lat_hist_null_blk: no latency histograms, skipping"
+		rmmod null_blk
+		exit 0
+	fi
+
+	for on in 0 1; do
+		echo ${on} > "${queue}/lat_hist_enable" || exit 1
+		echo "queue_mode ${mode}, lat_hist_enable ${on}:"
+		./blk_iops -d "${dev}" -t "${SECS}" -j "${JOBS}" || exit 1
+	done
+	cat "${queue}/lat_hist"
+
+	if [ "$(read_sum 0 < "${queue}/lat_hist")" -eq 0 ]; then
+		echo "lat_hist_null_blk: no reads in lat_hist [FAIL]"
+		rmmod null_blk
+		exit 1
+	fi
+
+	if [ -d "${blkio}" ]; then
+		cg="${blkio}/lat_hist_test"
+		mkdir "${cg}" || exit 1
+		sh -c "echo \$\$ > ${cg}/tasks &&
+		       exec dd if=${dev} of=/dev/null bs=4k count=1 \
+			       iflag=direct 2> /dev/null"
+		i=0
+		while ! grep -q "nullb0" "${cg}/blkio.lat_hist" && [ ${i} -lt 50 ]
+		do
+			sleep 0.1
+			i=$((i + 1))
+		done
+		echo 1 > "${cg}/blkio.reset_stats" || exit 1
+		sh -c "echo \$\$ > ${cg}/tasks &&
+		       exec dd if=${dev} of=/dev/null bs=4k count=1000 \
+			       iflag=direct 2> /dev/null"
+		grep "nullb0" "${cg}/blkio.lat_hist"
+		sum=$(grep "nullb0" "${cg}/blkio.lat_hist" | read_sum 1)
+		rmdir "${cg}"
+		if [ "${sum}" -ne 1000 ]; then
+			echo "lat_hist_null_blk: ${sum} reads in blkio.lat_hist, expected 1000 [FAIL]"
+			rmmod null_blk
+			exit 1
+		fi
+	fi
+
+	echo 0 > "${queue}/lat_hist_enable"
+	rmmod null_blk
+done
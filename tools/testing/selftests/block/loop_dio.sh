@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Loop device on a file, once going through the backing page cache and
+# once with direct I/O to the backing file. Data written through the loop
+# device has to show up in the file unchanged and read back the same
+# through the device page cache, then O_DIRECT IOPS of both modes are
+# compared. The file is created in $DIR, which has to be on a
+# filesystem supporting direct I/O, tmpfs doesn't.
+
+readonly SECS=${SECS:-5}
+readonly DIR=${DIR:-/var/tmp}
+readonly img=${DIR}/loop_dio.img
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "loop_dio: need root, skipping"
+	exit 0
+fi
+
+if ! losetup --help 2>&1 | grep -q direct-io; then
+	echo "loop_dio: losetup without --direct-io, skipping"
+	exit 0
+fi
+
+modprobe loop 2>/dev/null
+truncate -s 256M "${img}" || exit 1
+trap 'rm -f "${img}" "${img}.data"' EXIT
+
+for dio in off on; do
+	dev=$(losetup -f --show --direct-io="${dio}" "${img}") || exit 1
+	name=$(basename "${dev}")
+
+	if [ "$(cat /sys/block/"${name}"/loop/dio)" != \
+	     "$([ ${dio} = on ] && echo 1 || echo 0)" ]; then
+		echo "loop_dio: ${DIR} doesn't support direct I/O, skipping"
+		losetup -d "${dev}"
+		exit 0
+	fi
+
+	dd if=/dev/urandom of="${img}.data" bs=1M count=16 2>/dev/null
+	dd if="${img}.data" of="${dev}" bs=1M seek=8 oflag=direct \
+		2>/dev/null || exit 1
+	if ! cmp -s -n 16777216 -i 0:8388608 "${img}.data" "${img}"; then
+		echo "loop_dio: dio=${dio}: data mismatch in backing file"
+		losetup -d "${dev}"
+		exit 1
+	fi
+
+	# buffered read, loop fills the device page cache from the file
+	blockdev --flushbufs "${dev}"
+	if ! cmp -s -n 16777216 -i 0:8388608 "${img}.data" "${dev}"; then
+		echo "loop_dio: dio=${dio}: data mismatch in buffered read"
+		losetup -d "${dev}"
+		exit 1
+	fi
+
+	for write_pct in 0 100; do
+		echo "dio=${dio}, bs 4096, ${write_pct}% writes:"
+		./blk_iops -d "${dev}" -t "${SECS}" -j 4 -b 4096 \
+			-w "${write_pct}" || { losetup -d "${dev}"; exit 1; }
+	done
+
+	losetup -d "${dev}"
+done
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Compare a blk-mq null_blk device without an I/O scheduler and with
+# mq-deadline: random read IOPS and read latency, alone and next to
+# a write heavy mix, and check that the scheduler can be switched
+# back and forth while I/O is running.
+#
+# The device completes with a timer, so requests actually queue up.
+
+readonly SECS=${SECS:-5}
+readonly JOBS=${JOBS:-4}
+readonly dev=/dev/nullb0
+readonly sched=/sys/block/nullb0/queue/scheduler
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "null_blk_sched: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "null_blk_sched: null_blk already loaded, skipping"
+	exit 0
+fi
+
+modprobe null_blk queue_mode=2 irqmode=2 completion_nsec=20000 \
+	hw_queue_depth=32 nr_devices=1 || exit 1
+trap 'rmmod null_blk' EXIT
+
+modprobe mq-deadline 2>/dev/null
+if ! grep -q mq-deadline "${sched}"; then
+	echo "null_blk_sched: mq-deadline not available, skipping"
+	exit 0
+fi
+
+for s in none mq-deadline; do
+	echo "${s}" > "${sched}" || exit 1
+	echo "${s}: random read"
+	./blk_iops -d "${dev}" -t "${SECS}" -j "${JOBS}" || exit 1
+	echo "${s}: random read, 70% write"
+	./blk_iops -d "${dev}" -t "${SECS}" -j "${JOBS}" -w 70 || exit 1
+done
+
+./blk_iops -d "${dev}" -t "${SECS}" -j "${JOBS}" -w 50 > /dev/null &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	echo none > "${sched}" || exit 1
+	echo mq-deadline > "${sched}" || exit 1
+done
+wait ${pid} || exit 1
+echo none > "${sched}"
+
+echo "null_blk_sched: switching under load ok"
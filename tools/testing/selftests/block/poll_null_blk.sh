@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Synchronous O_DIRECT reads on null_blk with completions taken from the
+# timer, as an interrupt would, and polled for, both spinning right away
+# and with the hybrid sleep first.
+
+readonly SECS=${SECS:-5}
+readonly dev=/dev/nullb0
+readonly queue=/sys/block/nullb0/queue
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "poll_null_blk: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "poll_null_blk: null_blk already loaded, skipping"
+	exit 0
+fi
+
+modprobe null_blk queue_mode=2 irqmode=2 completion_nsec=20000 \
+	nr_devices=1 gb=4 || exit 1
+trap 'rmmod null_blk' EXIT
+
+if [ ! -e "${queue}/io_poll" ]; then
+	echo "poll_null_blk: no polling support, skipping"
+	exit 0
+fi
+
+echo "interrupt completions:"
+echo 0 > "${queue}/io_poll" || exit 1
+./blk_iops -d "${dev}" -t "${SECS}" -j 1 || exit 1
+
+echo 1 > "${queue}/io_poll" || exit 1
+for delay in -1 0; do
+	echo "${delay}" > "${queue}/io_poll_delay" || exit 1
+	echo "polled completions, io_poll_delay ${delay}:"
+	./blk_iops -d "${dev}" -t "${SECS}" -j 1 || exit 1
+	cat /sys/block/nullb0/mq/0/io_poll
+done
+
+echo 0 > "${queue}/io_poll"
+echo -1 > "${queue}/io_poll_delay"
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# Read latency next to buffered writeback, with and without writeback
+# throttling. null_blk completes every request after a fixed delay, so
+# the reads only get slower when writeback takes all the tags.
+
+readonly SECS=${SECS:-5}
+readonly dev=/dev/nullb0
+readonly queue=/sys/block/nullb0/queue
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "wbt_null_blk: need root, skipping"
+	exit 0
+fi
+
+if [ -e "${dev}" ]; then
+	echo "wbt_null_blk: null_blk already loaded, skipping"
+	exit 0
+fi
+
+modprobe null_blk queue_mode=2 irqmode=2 completion_nsec=200000 \
+	hw_queue_depth=64 nr_devices=1 gb=4 || exit 1
+trap 'rmmod null_blk' EXIT
+
+if [ ! -e "${queue}/wbt_lat_usec" ]; then
+	echo "wbt_null_blk: no writeback throttling, skipping"
+	exit 0
+fi
+
+for lat in 0 1000; do
+	echo "${lat}" > "${queue}/wbt_lat_usec" || exit 1
+
+	dd if=/dev/zero of="${dev}" bs=1M count=3072 2>/dev/null &
+	pid=$!
+	sleep 1
+
+	echo "wbt_lat_usec ${lat}: random read during writeback," \
+	     "wbt_depth $(cat ${queue}/wbt_depth)"
+	./blk_iops -d "${dev}" -t "${SECS}" -j 1 || exit 1
+	echo "wbt_depth after: $(cat ${queue}/wbt_depth)"
+
+	wait ${pid}
+	sync
+done
+
+echo -1 > "${queue}/wbt_lat_usec"
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# zram same filled page elimination and writeback. Pages of one repeated
+# byte must take no memory and read back unchanged. With writeback built
+# in, incompressible pages are then written to a loop device backed by a
+# file, and have to read back unchanged from there as well.
+
+readonly DIR=${DIR:-/var/tmp}
+readonly img=${DIR}/zram_wb.img
+readonly sys=/sys/block/zram0
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "zram_same_wb: need root, skipping"
+	exit 0
+fi
+
+if [ -e /dev/zram0 ]; then
+	echo "zram_same_wb: zram already loaded, skipping"
+	exit 0
+fi
+
+modprobe zram num_devices=1 || exit 1
+loop=
+cleanup() {
+	echo 1 > ${sys}/reset
+	rmmod zram
+	[ -n "${loop}" ] && losetup -d "${loop}"
+	rm -f "${img}" "${img}.data"
+}
+trap cleanup EXIT
+
+if [ -e ${sys}/backing_dev ]; then
+	truncate -s 64M "${img}" || exit 1
+	loop=$(losetup -f --show "${img}") || exit 1
+	echo "${loop}" > ${sys}/backing_dev || exit 1
+fi
+echo 64M > ${sys}/disksize || exit 1
+
+# 8M of 0xaa, then 8M that doesn't compress
+tr '\000' '\252' < /dev/zero | dd of="${img}.data" bs=1M count=8 \
+	iflag=fullblock 2>/dev/null
+dd if=/dev/urandom bs=1M count=8 >> "${img}.data" 2>/dev/null
+dd if="${img}.data" of=/dev/zram0 bs=1M oflag=direct 2>/dev/null || exit 1
+
+same=$(cat ${sys}/same_pages)
+if [ "${same}" -lt $((8 * 1024 * 1024 / $(getconf PAGESIZE))) ]; then
+	echo "zram_same_wb: only ${same} same filled pages"
+	exit 1
+fi
+echo "same_pages ${same}, huge_pages $(cat ${sys}/huge_pages)"
+
+if [ -n "${loop}" ]; then
+	echo huge > ${sys}/writeback || exit 1
+	echo "after writeback: bd_count $(cat ${sys}/bd_count)," \
+	     "huge_pages $(cat ${sys}/huge_pages)"
+	if [ "$(cat ${sys}/bd_count)" -eq 0 ]; then
+		echo "zram_same_wb: nothing written back"
+		exit 1
+	fi
+fi
+
+if ! dd if=/dev/zram0 bs=1M count=16 iflag=direct 2>/dev/null |
+     cmp -s - "${img}.data"; then
+	echo "zram_same_wb: data mismatch"
+	exit 1
+fi
@@ -0,0 +1,364 @@
+/*
+ * Evaluate MSG_ZEROCOPY on TCP
+ *
+ * Send traffic over a loopback TCP connection for a number of seconds and
+ * report the throughput, with or without MSG_ZEROCOPY.
+ *
+ * With zerocopy, also read the completion notifications from the socket
+ * error queue and verify that every send call is reported exactly once,
+ * in order.  Loopback delivers to a local socket, so the kernel has to
+ * copy the data after all and flags the completions as copied; the test
+ * reports how many were.  Pass an address of a remote host running
+ * "msg_zerocopy -r" to measure real zerocopy transmission.
+ *
+ * Usage:
+ *   msg_zerocopy [-4|-6] [-z] [-r] [-a addr] [-p port] [-s size] [-t secs]
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	53
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+
+static int  cfg_family		= AF_INET;
+static int  cfg_port		= 8000;
+static int  cfg_payload_len	= 100 * 1000;
+static int  cfg_runtime_ms	= 4200;
+static bool cfg_rx_only;
+static bool cfg_zerocopy;
+static const char *cfg_addr;
+
+static struct sockaddr_storage cfg_dst_addr;
+static socklen_t cfg_alen;
+
+static uint32_t next_completion;
+static unsigned long completions;
+static unsigned long completions_copied;
+
+static char payload[1 << 20];
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static void setup_sockaddr(int domain, const char *str_addr, void *sockaddr)
+{
+	struct sockaddr_in6 *addr6 = sockaddr;
+	struct sockaddr_in *addr4 = sockaddr;
+
+	switch (domain) {
+	case PF_INET:
+		memset(addr4, 0, sizeof(*addr4));
+		addr4->sin_family = AF_INET;
+		addr4->sin_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET, str_addr,
+					  &addr4->sin_addr) != 1)
+			error(1, 0, "ipv4 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr4);
+		break;
+	case PF_INET6:
+		memset(addr6, 0, sizeof(*addr6));
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET6, str_addr,
+					  &addr6->sin6_addr) != 1)
+			error(1, 0, "ipv6 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr6);
+		break;
+	default:
+		error(1, 0, "illegal domain");
+	}
+}
+
+/* Read one notification and check that it continues the previous range */
+static bool do_recv_completion(int fd)
+{
+	struct sock_extended_err *serr;
+	struct msghdr msg = {};
+	struct cmsghdr *cm;
+	uint32_t hi, lo;
+	char control[100];
+
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE) == -1) {
+		if (errno == EAGAIN)
+			return false;
+		error(1, errno, "recvmsg notification");
+	}
+	if (msg.msg_flags & MSG_CTRUNC)
+		error(1, 0, "recvmsg notification: truncated");
+
+	cm = CMSG_FIRSTHDR(&msg);
+	if (!cm)
+		error(1, 0, "cmsg: no cmsg");
+	if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+	      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+		error(1, 0, "serr: wrong type: %d.%d",
+		      cm->cmsg_level, cm->cmsg_type);
+
+	serr = (void *)CMSG_DATA(cm);
+	if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+		error(1, 0, "serr: wrong origin: %u", serr->ee_origin);
+	if (serr->ee_errno != 0)
+		error(1, 0, "serr: wrong error code: %u", serr->ee_errno);
+
+	hi = serr->ee_data;
+	lo = serr->ee_info;
+	if (lo != next_completion)
+		error(1, 0, "notification: expected %u, got %u",
+		      next_completion, lo);
+	if (hi < lo)
+		error(1, 0, "notification: bad range %u..%u", lo, hi);
+
+	next_completion = hi + 1;
+	completions += hi - lo + 1;
+	if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+		completions_copied += hi - lo + 1;
+	return true;
+}
+
+/* Read all outstanding notifications */
+static void do_recv_completions(int fd)
+{
+	while (do_recv_completion(fd))
+		;
+}
+
+/* Wait for all remaining notifications to arrive */
+static void do_recv_remaining_completions(int fd, uint32_t expected)
+{
+	unsigned long tstop = gettimeofday_ms() + 2000;
+	struct pollfd pfd = { .fd = fd };
+
+	while (next_completion != expected && gettimeofday_ms() < tstop) {
+		if (poll(&pfd, 1, 100) == -1)
+			error(1, errno, "poll");
+		do_recv_completions(fd);
+	}
+
+	if (next_completion != expected)
+		error(1, 0, "missing notifications: %u of %u",
+		      next_completion, expected);
+}
+
+static void do_tx(void)
+{
+	unsigned long tstop, sends = 0, bytes = 0;
+	struct pollfd pfd;
+	int fd, val = 1;
+
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	if (cfg_zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &val, sizeof(val)))
+		error(1, errno, "setsockopt zerocopy");
+
+	if (connect(fd, (void *)&cfg_dst_addr, cfg_alen))
+		error(1, errno, "connect");
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	tstop = gettimeofday_ms() + cfg_runtime_ms;
+	do {
+		ssize_t ret;
+
+		ret = send(fd, payload, cfg_payload_len,
+			   cfg_zerocopy ? MSG_ZEROCOPY : 0);
+		if (ret == -1 && errno != EAGAIN && errno != ENOBUFS)
+			error(1, errno, "send");
+		if (ret > 0) {
+			bytes += ret;
+			sends++;
+		}
+
+		if (cfg_zerocopy) {
+			/* drain notifications, or wait when out of optmem */
+			if (ret == -1 && poll(&pfd, 1, 100) == -1)
+				error(1, errno, "poll");
+			do_recv_completions(fd);
+		}
+	} while (gettimeofday_ms() < tstop);
+
+	if (cfg_zerocopy)
+		do_recv_remaining_completions(fd, sends);
+
+	if (close(fd))
+		error(1, errno, "close");
+
+	fprintf(stderr, "tx=%lu (%lu MB) txc=%lu zc=%c\n",
+		sends, bytes >> 20, completions,
+		cfg_zerocopy && completions != completions_copied ? 'y' : 'n');
+	fprintf(stderr, "%lu MB/s\n",
+		(bytes >> 20) * 1000 / cfg_runtime_ms);
+	if (cfg_zerocopy && completions != sends)
+		error(1, 0, "%lu sends, %lu notifications", sends, completions);
+}
+
+static void do_rx(void)
+{
+	unsigned long bytes = 0;
+	struct sockaddr_storage addr = {};
+	char buf[1 << 16];
+	int fd, fdc, val = 1;
+	ssize_t ret;
+
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket rx");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)))
+		error(1, errno, "setsockopt reuseaddr");
+
+	addr.ss_family = cfg_family;
+	((struct sockaddr_in *)&addr)->sin_port = htons(cfg_port);
+	if (bind(fd, (void *)&addr, cfg_alen))
+		error(1, errno, "bind");
+	if (listen(fd, 1))
+		error(1, errno, "listen");
+
+	fdc = accept(fd, NULL, NULL);
+	if (fdc == -1)
+		error(1, errno, "accept");
+
+	while ((ret = recv(fdc, buf, sizeof(buf), 0)) > 0)
+		bytes += ret;
+	if (ret == -1)
+		error(1, errno, "recv");
+
+	if (cfg_rx_only)
+		fprintf(stderr, "rx=%lu MB\n", bytes >> 20);
+
+	close(fdc);
+	close(fd);
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-4|-6] [-z] [-r] [-a addr] [-p port] "
+		    "[-s size] [-t secs]", filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46a:p:rs:t:z")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = PF_INET;
+			break;
+		case '6':
+			cfg_family = PF_INET6;
+			break;
+		case 'a':
+			cfg_addr = optarg;
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg_rx_only = true;
+			break;
+		case 's':
+			cfg_payload_len = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_runtime_ms = strtoul(optarg, NULL, 10) * 1000;
+			break;
+		case 'z':
+			cfg_zerocopy = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (cfg_payload_len <= 0 || cfg_payload_len > sizeof(payload))
+		error(1, 0, "-s: payload exceeds max (%zu)", sizeof(payload));
+	if (!cfg_addr)
+		cfg_addr = cfg_family == PF_INET ? "127.0.0.1" : "::1";
+
+	setup_sockaddr(cfg_family, cfg_addr, &cfg_dst_addr);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t pid;
+	int i, status;
+
+	parse_opts(argc, argv);
+
+	for (i = 0; i < sizeof(payload); i++)
+		payload[i] = 'a' + (i % 26);
+
+	if (cfg_rx_only) {
+		do_rx();
+		return 0;
+	}
+
+	if (!strcmp(cfg_addr, "127.0.0.1") || !strcmp(cfg_addr, "::1")) {
+		pid = fork();
+		if (pid == -1)
+			error(1, errno, "fork");
+		if (!pid) {
+			do_rx();
+			exit(0);
+		}
+		/* give the receiver time to listen */
+		usleep(100 * 1000);
+
+		do_tx();
+
+		if (waitpid(pid, &status, 0) == -1)
+			error(1, errno, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error(1, 0, "receiver failed");
+	} else {
+		do_tx();
+	}
+
+	fprintf(stderr, "OK. All tests passed\n");
+	return 0;
+}
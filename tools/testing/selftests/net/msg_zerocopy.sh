@@ -0,0 +1,22 @@
+#!/bin/sh
+#
+# Send data over loopback TCP with and without MSG_ZEROCOPY and compare.
+#
+# Loopback delivers to a local socket, so zerocopy sends are copied on
+# receive and their notifications flagged as such: this checks that the
+# notification path is complete and shows its cost relative to copying.
+
+set -e
+
+readonly SECS=${SECS:-4}
+
+for family in 4 6; do
+	for mode in copy zerocopy; do
+		echo "ipv${family} ${mode}"
+		if [ "${mode}" = zerocopy ]; then
+			./msg_zerocopy -"${family}" -t "${SECS}" -z
+		else
+			./msg_zerocopy -"${family}" -t "${SECS}"
+		fi
+	done
+done
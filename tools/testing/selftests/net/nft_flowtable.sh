@@ -0,0 +1,166 @@
+#!/bin/sh
+#
+# Forward TCP through a router with and without an nf_tables flow table.
+#
+# Three network namespaces are chained with veth pairs: client, router
+# and server.  The router masquerades the client.  A bulk TCP transfer
+# (msg_zerocopy) runs once over the classic forwarding path and once with
+# a flow table whose "flow offload" rule sits in the forward chain,
+# followed by a TCP counter.
+#
+# Once offloaded, a connection's packets are forwarded by the flow table
+# hook and no longer reach the forward chain: the counter must only see
+# the handshake and the packets that went by before the offload.  A bulk
+# UDP transfer (udpgso_bench) has a "flow offload" rule too, but only
+# flows one way, never becomes established and must keep being forwarded
+# the classic way: its counter has to see well over MAX_FWD packets.
+#
+# The flow table hook has to sit between defragmentation (-400) and
+# conntrack (-200).
+
+readonly SECS=${SECS:-4}
+
+readonly NS_CL=ft-cl-$$
+readonly NS_RTR=ft-rtr-$$
+readonly NS_SRV=ft-srv-$$
+
+# packets the forward chain may see before the connection is offloaded
+readonly MAX_FWD=${MAX_FWD:-100}
+
+ksft_skip=4
+
+cleanup() {
+	ip netns del "${NS_CL}" 2>/dev/null
+	ip netns del "${NS_RTR}" 2>/dev/null
+	ip netns del "${NS_SRV}" 2>/dev/null
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: need root privileges"
+	exit ${ksft_skip}
+fi
+
+if ! nft --version >/dev/null 2>&1; then
+	echo "SKIP: nft not available"
+	exit ${ksft_skip}
+fi
+
+trap cleanup EXIT
+
+set -e
+
+ip netns add "${NS_CL}"
+ip netns add "${NS_RTR}"
+ip netns add "${NS_SRV}"
+
+ip link add veth0 netns "${NS_CL}" type veth peer name veth1 netns "${NS_RTR}"
+ip link add veth2 netns "${NS_RTR}" type veth peer name veth3 netns "${NS_SRV}"
+
+ip -netns "${NS_CL}" addr add 10.0.1.1/24 dev veth0
+ip -netns "${NS_RTR}" addr add 10.0.1.2/24 dev veth1
+ip -netns "${NS_RTR}" addr add 10.0.2.2/24 dev veth2
+ip -netns "${NS_SRV}" addr add 10.0.2.1/24 dev veth3
+
+for dev in "${NS_CL} veth0" "${NS_RTR} veth1" "${NS_RTR} veth2" \
+	   "${NS_SRV} veth3"; do
+	set -- ${dev}
+	ip -netns "$1" link set "$2" up
+done
+
+ip -netns "${NS_CL}" route add default via 10.0.1.2
+ip netns exec "${NS_RTR}" sysctl -qw net.ipv4.ip_forward=1
+
+set +e
+
+if ! ip netns exec "${NS_RTR}" nft -f - <<EOF
+table ip nat {
+	chain postrouting {
+		type nat hook postrouting priority 100;
+		oifname "veth2" masquerade
+	}
+}
+EOF
+then
+	echo "SKIP: nft nat not available"
+	exit ${ksft_skip}
+fi
+
+run_tcp() {
+	ip netns exec "${NS_SRV}" ./msg_zerocopy -4 -r -p 8000 &
+	rxpid=$!
+	sleep 0.2
+	ip netns exec "${NS_CL}" ./msg_zerocopy -4 -a 10.0.2.1 -p 8000 \
+		-t "${SECS}" 2>&1 | awk '/MB\/s/ { print $1 }'
+	wait ${rxpid}
+}
+
+run_udp() {
+	ip netns exec "${NS_SRV}" ./udpgso_bench -4 -r -p 8001 \
+		-t "${SECS}" 2>&1 | awk '/udp rx/ { print $3 }' &
+	rxpid=$!
+	sleep 0.2
+	ip netns exec "${NS_CL}" ./udpgso_bench -4 -a 10.0.2.1 -p 8001 \
+		-t "${SECS}" >/dev/null 2>&1
+	wait ${rxpid}
+}
+
+fwd_packets() {
+	ip netns exec "${NS_RTR}" nft list chain inet filter forward |
+		awk -v proto="$1" '/counter packets/ && $0 ~ "l4proto " proto {
+			for (i = 1; i < NF; i++)
+				if ($i == "packets") print $(i + 1) }'
+}
+
+tcp_base=$(run_tcp)
+udp_base=$(run_udp)
+
+if ! ip netns exec "${NS_RTR}" nft -f - <<EOF
+table inet filter {
+	flowtable f {
+		hook ingress priority -300; devices = { veth1, veth2 };
+	}
+	chain forward {
+		type filter hook forward priority 0; policy accept;
+		meta l4proto tcp flow offload @f
+		meta l4proto tcp counter
+		meta l4proto udp flow offload @f
+		meta l4proto udp counter
+	}
+}
+EOF
+then
+	echo "SKIP: nft flowtable not available"
+	exit ${ksft_skip}
+fi
+
+tcp_ft=$(run_tcp)
+udp_ft=$(run_udp)
+fwd=$(fwd_packets tcp)
+fwd_udp=$(fwd_packets udp)
+
+echo "tcp: ${tcp_base:-0} MB/s forwarded, ${tcp_ft:-0} MB/s offloaded"
+echo "udp: ${udp_base:-0} MB/s forwarded, ${udp_ft:-0} MB/s offloaded"
+echo "forward chain: ${fwd:-0} tcp packets, ${fwd_udp:-0} udp packets"
+
+if [ -z "${tcp_ft}" ] || [ "${tcp_ft}" -eq 0 ]; then
+	echo "FAIL: no tcp traffic through the flow table"
+	exit 1
+fi
+
+if [ -z "${udp_ft}" ] || [ "${udp_ft}" -eq 0 ]; then
+	echo "FAIL: no udp traffic next to the flow table"
+	exit 1
+fi
+
+if [ -z "${fwd}" ] || [ "${fwd}" -gt "${MAX_FWD}" ]; then
+	echo "FAIL: offloaded flows still take the forward chain"
+	exit 1
+fi
+
+if [ -z "${fwd_udp}" ] || [ "${fwd_udp}" -le "${MAX_FWD}" ]; then
+	echo "FAIL: one way udp flow was offloaded"
+	exit 1
+fi
+
+echo "OK. All tests passed"
+exit 0
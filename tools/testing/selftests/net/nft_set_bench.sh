@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Compare nf_tables interval set types on a large address ACL.
+#
+# A set of address prefixes, plus one covering loopback, is looked up by
+# an output rule for every datagram of a loopback UDP transfer, and a set
+# of port ranges by a second rule.  "policy memory" lets nf_tables pick
+# the rbtree set type, "policy performance" the trie for addresses and
+# the bitmap for ports.  Each run reports the datagram rate and checks
+# that both lookups matched.
+
+readonly SECS=${SECS:-4}
+readonly PREFIXES=${PREFIXES:-20000}
+
+readonly NS=nft-set-$$
+
+ksft_skip=4
+
+cleanup() {
+	ip netns del "${NS}" 2>/dev/null
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: need root privileges"
+	exit ${ksft_skip}
+fi
+
+if ! nft --version >/dev/null 2>&1; then
+	echo "SKIP: nft not available"
+	exit ${ksft_skip}
+fi
+
+trap cleanup EXIT
+
+ip netns add "${NS}" || exit 1
+ip -netns "${NS}" link set lo up
+
+# distinct /24s within 10.0.0.0/8, up to 65536 of them, then loopback
+prefixes() {
+	awk -v n="${PREFIXES}" 'BEGIN {
+		for (i = 0; i < n && i < 65536; i++)
+			printf "10.%d.%d.0/24,\n", int(i / 256), i % 256
+		print "127.0.0.0/8"
+	}'
+}
+
+# every other block of 100 ports, 8000-8099 holds the bench port
+ports() {
+	awk 'BEGIN {
+		for (p = 1000; p < 60000; p += 200)
+			printf "%s%d-%d", (p > 1000 ? ",\n" : ""), p, p + 99
+		print ""
+	}'
+}
+
+load() {
+	ip netns exec "${NS}" nft flush ruleset
+	{
+		echo "table ip filter {"
+		echo "	set acl { type ipv4_addr; flags interval; policy $1;"
+		echo "		elements = {"
+		prefixes
+		echo "	} }"
+		echo "	set ports { type inet_service; flags interval; policy $1;"
+		echo "		elements = {"
+		ports
+		echo "	} }"
+		echo "	chain output {"
+		echo "		type filter hook output priority 0;"
+		echo "		ip daddr @acl counter"
+		echo "		udp dport @ports counter"
+		echo "	}"
+		echo "}"
+	} | ip netns exec "${NS}" nft -f -
+}
+
+matches() {
+	ip netns exec "${NS}" nft list chain ip filter output |
+		awk '/counter packets/ { for (i = 1; i < NF; i++)
+						if ($i == "packets") print $(i + 1) }'
+}
+
+run() {
+	ip netns exec "${NS}" ./udpgso_bench -4 -p 8000 -t "${SECS}" 2>&1 |
+		awk '/udp rx/ { print $7 }'
+}
+
+for policy in memory performance; do
+	if ! load "${policy}"; then
+		echo "SKIP: nft interval sets with policy ${policy} not available"
+		exit ${ksft_skip}
+	fi
+
+	rate=$(run)
+	echo "policy ${policy}: ${rate:-0} msg/s, ${PREFIXES} prefixes"
+
+	for n in $(matches); do
+		if [ "${n}" -eq 0 ]; then
+			echo "FAIL: policy ${policy}: set lookup did not match"
+			exit 1
+		fi
+	done
+	if [ -z "${rate}" ] || [ "${rate}" -eq 0 ]; then
+		echo "FAIL: policy ${policy}: no traffic"
+		exit 1
+	fi
+done
+
+echo "OK. All tests passed"
+exit 0
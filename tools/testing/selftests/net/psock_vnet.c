@@ -0,0 +1,203 @@
+/*
+ * Receive UDP segmentation offload packets on a PACKET_VNET_HDR socket
+ *
+ * Loopback carries UDP_SEGMENT sends as one large gso packet.  A packet
+ * socket bound to lo with PACKET_VNET_HDR sees that packet on its way
+ * out and in, and virtio_net_hdr has no gso type for it: the socket must
+ * drop it with an error rather than take the kernel down.
+ *
+ * Send a gso burst and then a plain marker datagram over lo, and read the
+ * packet socket until the marker arrives.  Every packet before it must
+ * either be reported with a valid header or fail with EINVAL; the UDP
+ * receiver must still get all the datagrams of the burst.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103
+#endif
+
+#define PORT		8001
+#define MSS		1000
+#define NUM_SEGS	4
+#define MARKER_LEN	17
+
+static char buf[1 << 16];
+
+static int socket_udp_rx(struct sockaddr_in *addr)
+{
+	struct timeval tv = { .tv_sec = 1 };
+	int fd;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket udp");
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+		error(1, errno, "setsockopt rcvtimeo");
+
+	if (bind(fd, (void *)addr, sizeof(*addr)))
+		error(1, errno, "bind udp");
+
+	return fd;
+}
+
+static int socket_packet(void)
+{
+	struct sockaddr_ll ll = { 0 };
+	int fd, one = 1;
+
+	fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (fd == -1)
+		error(1, errno, "socket packet");
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &one, sizeof(one)))
+		error(1, errno, "setsockopt vnet hdr");
+
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(ETH_P_IP);
+	ll.sll_ifindex = if_nametoindex("lo");
+	if (!ll.sll_ifindex)
+		error(1, errno, "if_nametoindex lo");
+
+	if (bind(fd, (void *)&ll, sizeof(ll)))
+		error(1, errno, "bind packet");
+
+	return fd;
+}
+
+static void send_udp(struct sockaddr_in *addr)
+{
+	int fd, mss = MSS;
+
+	fd = socket(PF_INET, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket tx");
+
+	if (connect(fd, (void *)addr, sizeof(*addr)))
+		error(1, errno, "connect");
+
+	if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &mss, sizeof(mss)))
+		error(1, errno, "setsockopt udp segment");
+
+	memset(buf, 'a', sizeof(buf));
+	if (send(fd, buf, MSS * NUM_SEGS, 0) != MSS * NUM_SEGS)
+		error(1, errno, "send gso");
+
+	/* shorter than mss, so sent without gso */
+	if (send(fd, buf, MARKER_LEN, 0) != MARKER_LEN)
+		error(1, errno, "send marker");
+
+	if (close(fd))
+		error(1, errno, "close tx");
+}
+
+static int read_packet(int fd)
+{
+	struct virtio_net_hdr *vh = (void *)buf;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct udphdr *uh;
+	struct iphdr *iph;
+	int ret;
+
+	ret = poll(&pfd, 1, 1000);
+	if (ret == -1)
+		error(1, errno, "poll");
+	if (!ret)
+		error(1, 0, "packet: timeout before the marker");
+
+	ret = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (ret == -1) {
+		if (errno == EINVAL || errno == EAGAIN)
+			return 0;
+		error(1, errno, "recv packet");
+	}
+
+	if (ret < (int)(sizeof(*vh) + ETH_HLEN + sizeof(*iph) + sizeof(*uh)))
+		return 0;
+
+	/* loopback frames carry an all zero ethernet header */
+	iph = (void *)(vh + 1) + ETH_HLEN;
+	if (iph->protocol != IPPROTO_UDP)
+		return 0;
+
+	uh = (void *)iph + iph->ihl * 4;
+	if (uh->dest != htons(PORT))
+		return 0;
+
+	if (vh->gso_type != VIRTIO_NET_HDR_GSO_NONE)
+		fprintf(stderr, "packet: gso_type %u len %d\n",
+			vh->gso_type, ret);
+
+	return ntohs(uh->len) == sizeof(*uh) + MARKER_LEN;
+}
+
+static void read_udp(int fd)
+{
+	int i, ret;
+
+	for (i = 0; i < NUM_SEGS; i++) {
+		ret = recv(fd, buf, sizeof(buf), 0);
+		if (ret != MSS)
+			error(1, errno, "udp: datagram %d: %d", i, ret);
+	}
+
+	ret = recv(fd, buf, sizeof(buf), 0);
+	if (ret != MARKER_LEN)
+		error(1, errno, "udp: marker: %d", ret);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr = { 0 };
+	int fdp, fdu;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	fdu = socket_udp_rx(&addr);
+	fdp = socket_packet();
+
+	send_udp(&addr);
+
+	while (!read_packet(fdp))
+		;
+
+	read_udp(fdu);
+
+	if (close(fdp))
+		error(1, errno, "close packet");
+	if (close(fdu))
+		error(1, errno, "close udp");
+
+	fprintf(stderr, "OK\n");
+	return 0;
+}
@@ -0,0 +1,339 @@
+/*
+ * Test functionality of BPF filters for SO_REUSEPORT.
+ *
+ * A group of UDP sockets is bound to the same port with SO_REUSEPORT and
+ * a classic BPF program returning (first payload word % group size) is
+ * attached with SO_ATTACH_REUSEPORT_CBPF.  Each datagram carries its index
+ * and must be received on the socket with that index.  Replacing the
+ * program, closing a member, and SO_INCOMING_CPU selection are covered too.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/filter.h>
+#include <linux/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+#define PORT		8888
+#define NUM_SOCKS	10
+
+struct test_params {
+	int recv_family;
+	int send_family;
+	int port;
+};
+
+static socklen_t sockaddr_size(void)
+{
+	return sizeof(struct sockaddr_storage);
+}
+
+static struct sockaddr *new_any_sockaddr(int family, uint16_t port)
+{
+	struct sockaddr_storage *addr;
+	struct sockaddr_in *addr4;
+	struct sockaddr_in6 *addr6;
+
+	addr = malloc(sizeof(struct sockaddr_storage));
+	memset(addr, 0, sizeof(struct sockaddr_storage));
+
+	switch (family) {
+	case AF_INET:
+		addr4 = (struct sockaddr_in *)addr;
+		addr4->sin_family = AF_INET;
+		addr4->sin_addr.s_addr = htonl(INADDR_ANY);
+		addr4->sin_port = htons(port);
+		break;
+	case AF_INET6:
+		addr6 = (struct sockaddr_in6 *)addr;
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_addr = in6addr_any;
+		addr6->sin6_port = htons(port);
+		break;
+	default:
+		error(1, 0, "Unsupported family %d", family);
+	}
+	return (struct sockaddr *)addr;
+}
+
+static struct sockaddr *new_loopback_sockaddr(int family, uint16_t port)
+{
+	struct sockaddr *addr = new_any_sockaddr(family, port);
+	struct sockaddr_in *addr4;
+	struct sockaddr_in6 *addr6;
+
+	switch (family) {
+	case AF_INET:
+		addr4 = (struct sockaddr_in *)addr;
+		addr4->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		break;
+	case AF_INET6:
+		addr6 = (struct sockaddr_in6 *)addr;
+		addr6->sin6_addr = in6addr_loopback;
+		break;
+	default:
+		error(1, 0, "Unsupported family %d", family);
+	}
+	return addr;
+}
+
+static void attach_cbpf(int fd, uint16_t mod)
+{
+	struct sock_filter code[] = {
+		/* A = (uint32_t)skb[0] */
+		{ BPF_LD  | BPF_W | BPF_ABS, 0, 0, 0 },
+		/* A = A % mod */
+		{ BPF_ALU | BPF_MOD, 0, 0, mod },
+		/* return A */
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog p = {
+		.len = sizeof(code) / sizeof(code[0]),
+		.filter = code,
+	};
+
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &p, sizeof(p)))
+		error(1, errno, "failed to set SO_ATTACH_REUSEPORT_CBPF");
+}
+
+static void build_recv_group(const struct test_params p, int fd[],
+			     uint16_t mod, void (*attach_bpf)(int, uint16_t))
+{
+	struct sockaddr * const addr =
+		new_any_sockaddr(p.recv_family, p.port);
+	int i, opt;
+
+	for (i = 0; i < NUM_SOCKS; ++i) {
+		fd[i] = socket(p.recv_family, SOCK_DGRAM, 0);
+		if (fd[i] < 0)
+			error(1, errno, "failed to create recv %d", i);
+
+		opt = 1;
+		if (setsockopt(fd[i], SOL_SOCKET, SO_REUSEPORT, &opt,
+			       sizeof(opt)))
+			error(1, errno, "failed to set SO_REUSEPORT on %d", i);
+
+		if (i == 0 && attach_bpf)
+			attach_bpf(fd[i], mod);
+
+		if (bind(fd[i], addr, sockaddr_size()))
+			error(1, errno, "failed to bind recv socket %d", i);
+	}
+	free(addr);
+}
+
+static void send_from(struct test_params p, uint16_t sport, char *buf,
+		      size_t len)
+{
+	struct sockaddr * const saddr = new_any_sockaddr(p.send_family, sport);
+	struct sockaddr * const daddr =
+		new_loopback_sockaddr(p.send_family, p.port);
+	const int fd = socket(p.send_family, SOCK_DGRAM, 0);
+	int opt = 1;
+
+	if (fd < 0)
+		error(1, errno, "failed to create send socket");
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)))
+		error(1, errno, "failed to set SO_REUSEADDR");
+
+	if (bind(fd, saddr, sockaddr_size()))
+		error(1, errno, "failed to bind send socket");
+
+	if (sendto(fd, buf, len, MSG_NOSIGNAL, daddr, sockaddr_size()) < 0)
+		error(1, errno, "failed to send message");
+
+	close(fd);
+	free(saddr);
+	free(daddr);
+}
+
+static int epoll_for(int fd[], int n)
+{
+	struct epoll_event ev;
+	int epfd, i;
+
+	epfd = epoll_create(1);
+	if (epfd < 0)
+		error(1, errno, "failed to create epoll");
+	for (i = 0; i < n; ++i) {
+		if (fd[i] < 0)
+			continue;
+		ev.events = EPOLLIN;
+		ev.data.fd = fd[i];
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd[i], &ev))
+			error(1, errno, "failed to register sock %d epoll", i);
+	}
+	return epfd;
+}
+
+static void test_recv_order(const struct test_params p, int fd[], int mod)
+{
+	char recv_buf[8], send_buf[8];
+	struct msghdr msg;
+	struct iovec recv_io = { recv_buf, 8 };
+	struct epoll_event ev;
+	int epfd, conn, i, sport, expected;
+	uint32_t data, ndata;
+
+	epfd = epoll_for(fd, NUM_SOCKS);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &recv_io;
+	msg.msg_iovlen = 1;
+
+	for (data = 0; data < NUM_SOCKS * 2; ++data) {
+		sport = p.port + data % 16 + 1;
+		ndata = htonl(data);
+		memcpy(send_buf, &ndata, sizeof(ndata));
+		send_from(p, sport, send_buf, sizeof(ndata));
+
+		i = epoll_wait(epfd, &ev, 1, 1000);
+		if (i < 0)
+			error(1, errno, "epoll wait failed");
+		if (i == 0)
+			error(1, 0, "timed out waiting for datagram %u", data);
+
+		conn = ev.data.fd;
+		if (recvmsg(conn, &msg, 0) < 0)
+			error(1, errno, "error receiving data");
+
+		for (i = 0; i < NUM_SOCKS; ++i)
+			if (fd[i] == conn)
+				break;
+		expected = data % mod;
+		if (i != expected)
+			error(1, 0, "data %u: expected socket %d, got %d",
+			      data, expected, i);
+	}
+	close(epfd);
+}
+
+static void test_reuseport_cbpf(struct test_params p)
+{
+	int i, fd[NUM_SOCKS];
+
+	fprintf(stderr, "Testing CBPF mod %d...\n", NUM_SOCKS);
+	build_recv_group(p, fd, NUM_SOCKS, attach_cbpf);
+	test_recv_order(p, fd, NUM_SOCKS);
+
+	fprintf(stderr, "Reprograming, testing mod %d...\n", NUM_SOCKS / 2);
+	attach_cbpf(fd[0], NUM_SOCKS / 2);
+	test_recv_order(p, fd, NUM_SOCKS / 2);
+
+	for (i = 0; i < NUM_SOCKS; ++i)
+		if (close(fd[i]))
+			error(1, errno, "failed to close receive socket %d", i);
+}
+
+/* Closing members shrinks the group: the last member fills the hole, so
+ * the program's indices keep pointing at live sockets.
+ */
+static void test_close_member(struct test_params p)
+{
+	int fd[NUM_SOCKS];
+	int i;
+
+	fprintf(stderr, "Testing closing a group member...\n");
+	build_recv_group(p, fd, NUM_SOCKS, attach_cbpf);
+
+	close(fd[NUM_SOCKS - 1]);
+	fd[NUM_SOCKS - 1] = -1;
+	attach_cbpf(fd[0], NUM_SOCKS - 1);
+	test_recv_order(p, fd, NUM_SOCKS - 1);
+
+	for (i = 0; i < NUM_SOCKS - 1; ++i)
+		close(fd[i]);
+}
+
+/* Without a program, a member pinned with SO_INCOMING_CPU to the CPU the
+ * datagram is processed on must receive it.  Loopback traffic is processed
+ * on the sending CPU, so pin ourselves and one member to CPU 0.
+ */
+static void test_incoming_cpu(struct test_params p)
+{
+	char buf[4] = { 0 };
+	struct epoll_event ev;
+	cpu_set_t cpus;
+	int fd[NUM_SOCKS];
+	int epfd, i, cpu = 0;
+
+	fprintf(stderr, "Testing SO_INCOMING_CPU selection...\n");
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		error(1, errno, "failed to pin to cpu %d", cpu);
+
+	build_recv_group(p, fd, 0, NULL);
+	if (setsockopt(fd[NUM_SOCKS / 2], SOL_SOCKET, SO_INCOMING_CPU, &cpu,
+		       sizeof(cpu)))
+		error(1, errno, "failed to set SO_INCOMING_CPU");
+
+	epfd = epoll_for(fd, NUM_SOCKS);
+	for (i = 0; i < NUM_SOCKS; ++i) {
+		send_from(p, p.port + i + 1, buf, sizeof(buf));
+		if (epoll_wait(epfd, &ev, 1, 1000) != 1)
+			error(1, errno, "timed out waiting for datagram %d", i);
+		if (ev.data.fd != fd[NUM_SOCKS / 2])
+			error(1, 0, "datagram %d not received on pinned socket",
+			      i);
+		if (recv(ev.data.fd, buf, sizeof(buf), 0) < 0)
+			error(1, errno, "error receiving data");
+	}
+	close(epfd);
+
+	for (i = 0; i < NUM_SOCKS; ++i)
+		close(fd[i]);
+
+	CPU_ZERO(&cpus);
+	for (i = 0; i < CPU_SETSIZE; i++)
+		CPU_SET(i, &cpus);
+	sched_setaffinity(0, sizeof(cpus), &cpus);
+}
+
+static void test_family(int recv_family, int send_family, const char *name)
+{
+	struct test_params p = {
+		.recv_family = recv_family,
+		.send_family = send_family,
+		.port = PORT,
+	};
+
+	fprintf(stderr, "---- %s ----\n", name);
+	test_reuseport_cbpf(p);
+	p.port += 32;
+	test_close_member(p);
+	p.port += 32;
+	test_incoming_cpu(p);
+}
+
+int main(void)
+{
+	test_family(AF_INET, AF_INET, "IPv4 UDP");
+	test_family(AF_INET6, AF_INET6, "IPv6 UDP");
+	test_family(AF_INET6, AF_INET, "IPv6 UDP w/ IPv4 packets");
+	fprintf(stderr, "SUCCESS\n");
+	return 0;
+}
@@ -0,0 +1,130 @@
+#!/bin/sh
+#
+# Compare BBR with CUBIC over an emulated bottleneck.
+#
+# Three network namespaces are chained with veth pairs: sender, router and
+# receiver.  The router's egress towards the receiver is a netem qdisc with
+# a rate limit, a propagation delay and a deep (bufferbloated) queue; the
+# sender uses fq so that BBR's pacing rate is enforced.  With TX_QDISC set
+# to another qdisc (e.g. pfifo_fast), TCP paces BBR itself with its pacing
+# timer, whose firings are counted in /proc/net/netstat.  Each congestion
+# control sends for a while and tcp_cc_perf reports throughput and the
+# queueing delay (smoothed RTT minus min RTT) it kept at the bottleneck.
+#
+# BBR must keep the queue well below what loss-based CUBIC fills, without
+# giving up more than a quarter of CUBIC's throughput.
+
+readonly SECS=${SECS:-10}
+readonly RATE=${RATE:-50mbit}
+readonly DELAY=${DELAY:-20ms}
+readonly LIMIT=${LIMIT:-2000}
+readonly TX_QDISC=${TX_QDISC:-fq}
+
+readonly NS_TX=bbr-tx-$$
+readonly NS_RTR=bbr-rtr-$$
+readonly NS_RX=bbr-rx-$$
+
+ksft_skip=4
+
+cleanup() {
+	ip netns del "${NS_TX}" 2>/dev/null
+	ip netns del "${NS_RTR}" 2>/dev/null
+	ip netns del "${NS_RX}" 2>/dev/null
+}
+
+if [ "$(id -u)" -ne 0 ]; then
+	echo "SKIP: need root privileges"
+	exit ${ksft_skip}
+fi
+
+if ! grep -qw bbr /proc/sys/net/ipv4/tcp_available_congestion_control &&
+   ! modprobe tcp_bbr 2>/dev/null; then
+	echo "SKIP: tcp_bbr not available"
+	exit ${ksft_skip}
+fi
+
+trap cleanup EXIT
+
+set -e
+
+ip netns add "${NS_TX}"
+ip netns add "${NS_RTR}"
+ip netns add "${NS_RX}"
+
+ip link add veth0 netns "${NS_TX}" type veth peer name veth1 netns "${NS_RTR}"
+ip link add veth2 netns "${NS_RTR}" type veth peer name veth3 netns "${NS_RX}"
+
+ip -netns "${NS_TX}" addr add 10.0.1.1/24 dev veth0
+ip -netns "${NS_RTR}" addr add 10.0.1.2/24 dev veth1
+ip -netns "${NS_RTR}" addr add 10.0.2.2/24 dev veth2
+ip -netns "${NS_RX}" addr add 10.0.2.1/24 dev veth3
+
+for dev in "${NS_TX} veth0" "${NS_RTR} veth1" "${NS_RTR} veth2" \
+	   "${NS_RX} veth3"; do
+	set -- ${dev}
+	ip -netns "$1" link set "$2" up
+	ip netns exec "$1" ethtool -K "$2" tso off gso off gro off \
+		>/dev/null 2>&1 || true
+done
+
+ip -netns "${NS_TX}" route add default via 10.0.1.2
+ip -netns "${NS_RX}" route add default via 10.0.2.2
+ip netns exec "${NS_RTR}" sysctl -qw net.ipv4.ip_forward=1
+
+if ! ip netns exec "${NS_RTR}" tc qdisc add dev veth2 root netem \
+	delay "${DELAY}" rate "${RATE}" limit "${LIMIT}" 2>/dev/null; then
+	echo "SKIP: netem not available"
+	exit ${ksft_skip}
+fi
+ip netns exec "${NS_TX}" tc qdisc add dev veth0 root "${TX_QDISC}"
+
+set +e
+
+pacing_timer() {
+	ip netns exec "${NS_TX}" awk '
+		/^TcpExt:/ && !n { for (i = 2; i <= NF; i++) k[i] = $i; n = 1; next }
+		/^TcpExt:/ { for (i = 2; i <= NF; i++)
+				if (k[i] == "TCPPacingTimer") print $i }
+	' /proc/net/netstat
+}
+
+run_cc() {
+	ip netns exec "${NS_RX}" ./tcp_cc_perf -r -p "$2" &
+	rxpid=$!
+	sleep 0.2
+	ip netns exec "${NS_TX}" ./tcp_cc_perf -C "$1" -a 10.0.2.1 -p "$2" \
+		-t "${SECS}"
+	ret=$?
+	wait ${rxpid}
+	return ${ret}
+}
+
+cubic=$(run_cc cubic 8000) || { echo "FAIL: cubic run"; exit 1; }
+timer_before=$(pacing_timer)
+bbr=$(run_cc bbr 8001) || { echo "FAIL: bbr run"; exit 1; }
+timer_after=$(pacing_timer)
+
+if [ "${TX_QDISC}" != fq ] &&
+   [ "${timer_after:-0}" -le "${timer_before:-0}" ]; then
+	echo "FAIL: no internal pacing under ${TX_QDISC}"
+	exit 1
+fi
+
+set -- ${cubic} ${bbr}
+cubic_tput=$1
+cubic_queue=$2
+bbr_tput=$3
+bbr_queue=$4
+
+if [ "${bbr_tput}" -lt $((cubic_tput * 3 / 4)) ]; then
+	echo "FAIL: bbr throughput ${bbr_tput} Mbit/s, cubic ${cubic_tput} Mbit/s"
+	exit 1
+fi
+if [ "${bbr_queue}" -ge $((cubic_queue / 2)) ]; then
+	echo "FAIL: bbr queueing delay ${bbr_queue} us, cubic ${cubic_queue} us"
+	exit 1
+fi
+
+echo "OK (${TX_QDISC}). bbr: ${bbr_tput} Mbit/s, ${bbr_queue} us queueing;" \
+     "cubic: ${cubic_tput} Mbit/s, ${cubic_queue} us queueing"
+exit 0
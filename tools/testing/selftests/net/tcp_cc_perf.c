@@ -0,0 +1,269 @@
+/*
+ * Measure throughput and queueing delay of a TCP congestion control
+ *
+ * Send bulk data over one TCP connection with the congestion control
+ * selected with -C for a number of seconds.  While sending, sample
+ * TCP_INFO every 100 ms and report the average smoothed RTT, the minimum
+ * RTT seen by the kernel (tcpi_min_rtt) and their difference, which is
+ * the queueing delay the flow keeps standing at the bottleneck, along
+ * with the delivery rate estimate (tcpi_delivery_rate).
+ *
+ * Meant to be run across an emulated path, see tcp_bbr_netem.sh.
+ *
+ * Usage:
+ *   tcp_cc_perf [-4|-6] [-r] [-C cc] [-a addr] [-p port] [-t secs]
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <linux/tcp.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int  cfg_family		= AF_INET;
+static int  cfg_port		= 8000;
+static int  cfg_runtime_ms	= 10000;
+static bool cfg_rx_only;
+static const char *cfg_cc	= "cubic";
+static const char *cfg_addr;
+
+static struct sockaddr_storage cfg_dst_addr;
+static socklen_t cfg_alen;
+
+static char payload[1 << 16];
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static void setup_sockaddr(int domain, const char *str_addr, void *sockaddr)
+{
+	struct sockaddr_in6 *addr6 = sockaddr;
+	struct sockaddr_in *addr4 = sockaddr;
+
+	switch (domain) {
+	case PF_INET:
+		memset(addr4, 0, sizeof(*addr4));
+		addr4->sin_family = AF_INET;
+		addr4->sin_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET, str_addr,
+					  &addr4->sin_addr) != 1)
+			error(1, 0, "ipv4 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr4);
+		break;
+	case PF_INET6:
+		memset(addr6, 0, sizeof(*addr6));
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET6, str_addr,
+					  &addr6->sin6_addr) != 1)
+			error(1, 0, "ipv6 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr6);
+		break;
+	default:
+		error(1, 0, "illegal domain");
+	}
+}
+
+static void do_tx(void)
+{
+	unsigned long tstart, tnext, now, bytes = 0;
+	unsigned long long rtt_sum = 0, rate = 0;
+	unsigned int samples = 0, min_rtt = ~0U;
+	struct tcp_info info;
+	socklen_t len;
+	int fd;
+
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	if (setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, cfg_cc,
+		       strlen(cfg_cc)))
+		error(1, errno, "setsockopt congestion %s", cfg_cc);
+
+	if (connect(fd, (void *)&cfg_dst_addr, cfg_alen))
+		error(1, errno, "connect");
+
+	tstart = gettimeofday_ms();
+	tnext = tstart + 100;
+	do {
+		ssize_t ret;
+
+		ret = send(fd, payload, sizeof(payload), 0);
+		if (ret == -1)
+			error(1, errno, "send");
+		bytes += ret;
+
+		now = gettimeofday_ms();
+		if (now < tnext)
+			continue;
+		tnext = now + 100;
+
+		/* skip the first second: startup is not the steady state */
+		if (now - tstart < 1000)
+			continue;
+
+		len = sizeof(info);
+		if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len))
+			error(1, errno, "getsockopt tcp_info");
+		if (len < sizeof(info))
+			error(1, 0, "tcp_info too short: no tcpi_min_rtt");
+
+		rtt_sum += info.tcpi_rtt;
+		if (info.tcpi_min_rtt < min_rtt)
+			min_rtt = info.tcpi_min_rtt;
+		rate = info.tcpi_delivery_rate;
+		samples++;
+	} while (now < tstart + cfg_runtime_ms);
+
+	if (close(fd))
+		error(1, errno, "close");
+
+	if (!samples)
+		error(1, 0, "no tcp_info samples, runtime too short");
+
+	rtt_sum /= samples;
+	fprintf(stderr, "%s: %lu Mbit/s rtt=%llu us min_rtt=%u us "
+			"queueing=%llu us delivery_rate=%llu Mbit/s\n",
+		cfg_cc, (bytes * 8 / 1000) / cfg_runtime_ms,
+		rtt_sum, min_rtt, rtt_sum > min_rtt ? rtt_sum - min_rtt : 0,
+		rate * 8 / 1000000);
+	/* machine readable: throughput (Mbit/s) and queueing delay (us) */
+	printf("%lu %llu\n", (bytes * 8 / 1000) / cfg_runtime_ms,
+	       rtt_sum > min_rtt ? rtt_sum - min_rtt : 0);
+}
+
+static void do_rx(void)
+{
+	struct sockaddr_storage addr = {};
+	char buf[1 << 16];
+	int fd, fdc, val = 1;
+	ssize_t ret;
+
+	fd = socket(cfg_family, SOCK_STREAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket rx");
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)))
+		error(1, errno, "setsockopt reuseaddr");
+
+	addr.ss_family = cfg_family;
+	((struct sockaddr_in *)&addr)->sin_port = htons(cfg_port);
+	if (bind(fd, (void *)&addr, cfg_alen))
+		error(1, errno, "bind");
+	if (listen(fd, 1))
+		error(1, errno, "listen");
+
+	fdc = accept(fd, NULL, NULL);
+	if (fdc == -1)
+		error(1, errno, "accept");
+
+	while ((ret = recv(fdc, buf, sizeof(buf), 0)) > 0)
+		;
+	if (ret == -1)
+		error(1, errno, "recv");
+
+	close(fdc);
+	close(fd);
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-4|-6] [-r] [-C cc] [-a addr] [-p port] "
+		    "[-t secs]", filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46a:C:p:rt:")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = PF_INET;
+			break;
+		case '6':
+			cfg_family = PF_INET6;
+			break;
+		case 'a':
+			cfg_addr = optarg;
+			break;
+		case 'C':
+			cfg_cc = optarg;
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg_rx_only = true;
+			break;
+		case 't':
+			cfg_runtime_ms = strtoul(optarg, NULL, 10) * 1000;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (cfg_runtime_ms < 2000)
+		error(1, 0, "-t: need at least 2 seconds");
+	if (!cfg_addr)
+		cfg_addr = cfg_family == PF_INET ? "127.0.0.1" : "::1";
+
+	setup_sockaddr(cfg_family, cfg_addr, &cfg_dst_addr);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t pid;
+	int status;
+
+	parse_opts(argc, argv);
+
+	if (cfg_rx_only) {
+		do_rx();
+		return 0;
+	}
+
+	if (!strcmp(cfg_addr, "127.0.0.1") || !strcmp(cfg_addr, "::1")) {
+		pid = fork();
+		if (pid == -1)
+			error(1, errno, "fork");
+		if (!pid) {
+			do_rx();
+			exit(0);
+		}
+		/* give the receiver time to listen */
+		usleep(100 * 1000);
+
+		do_tx();
+
+		if (waitpid(pid, &status, 0) == -1)
+			error(1, errno, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error(1, 0, "receiver failed");
+	} else {
+		do_tx();
+	}
+
+	return 0;
+}
@@ -0,0 +1,388 @@
+/*
+ * Evaluate UDP segmentation offload and UDP GRO
+ *
+ * Send MSS-sized datagrams over loopback UDP for a number of seconds and
+ * report the throughput on both ends, either one datagram per send call or,
+ * with UDP_SEGMENT, many datagrams per call that the stack splits late.
+ *
+ * Loopback carries the large packet unsegmented.  A receiver without
+ * UDP_GRO gets it split into the original datagrams, one per recv call;
+ * with UDP_GRO it reads it whole, with the datagram size in a UDP_GRO
+ * control message.  The receiver checks that every datagram, or every
+ * coalesced packet, has the size it was sent with.
+ *
+ * With UDP_SEGMENT the payload need not be a multiple of the segment size:
+ * the last datagram of a call is then shorter, and a payload that fits in
+ * a single segment is sent as a plain datagram.
+ *
+ * Usage:
+ *   udpgso_bench [-4|-6] [-S] [-c] [-G] [-r] [-a addr] [-p port] [-m mss]
+ *		  [-s size] [-t secs]
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <error.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP		17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT	103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO		104
+#endif
+
+#define UDP_MAX_SEGMENTS	64
+
+static int  cfg_family		= AF_INET;
+static int  cfg_port		= 8000;
+static int  cfg_mss;
+static int  cfg_payload_len;
+static int  cfg_runtime_ms	= 4000;
+static bool cfg_cmsg;
+static bool cfg_gro;
+static bool cfg_gso;
+static bool cfg_rx_only;
+static const char *cfg_addr;
+
+static struct sockaddr_storage cfg_dst_addr;
+static socklen_t cfg_alen;
+
+static char payload[1 << 16];
+
+/* size of the short last datagram of a send call, 0 if all are mss */
+static int cfg_tail_len;
+
+static unsigned long gettimeofday_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+static void setup_sockaddr(int domain, const char *str_addr, void *sockaddr)
+{
+	struct sockaddr_in6 *addr6 = sockaddr;
+	struct sockaddr_in *addr4 = sockaddr;
+
+	switch (domain) {
+	case PF_INET:
+		memset(addr4, 0, sizeof(*addr4));
+		addr4->sin_family = AF_INET;
+		addr4->sin_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET, str_addr,
+					  &addr4->sin_addr) != 1)
+			error(1, 0, "ipv4 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr4);
+		break;
+	case PF_INET6:
+		memset(addr6, 0, sizeof(*addr6));
+		addr6->sin6_family = AF_INET6;
+		addr6->sin6_port = htons(cfg_port);
+		if (str_addr && inet_pton(AF_INET6, str_addr,
+					  &addr6->sin6_addr) != 1)
+			error(1, 0, "ipv6 parse error: %s", str_addr);
+		cfg_alen = sizeof(*addr6);
+		break;
+	default:
+		error(1, 0, "illegal domain");
+	}
+}
+
+/* Pass the segment size per call instead of per socket */
+static ssize_t send_udp_segment_cmsg(int fd, char *data, size_t len)
+{
+	char control[CMSG_SPACE(sizeof(uint16_t))] = {0};
+	struct iovec iov = { .iov_base = data, .iov_len = len };
+	struct msghdr msg = {0};
+	struct cmsghdr *cm;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_UDP;
+	cm->cmsg_type = UDP_SEGMENT;
+	cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+	*((uint16_t *)CMSG_DATA(cm)) = cfg_mss;
+
+	return sendmsg(fd, &msg, 0);
+}
+
+static void do_tx(void)
+{
+	unsigned long tstop, sends = 0, bytes = 0;
+	int fd, val;
+
+	fd = socket(cfg_family, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket");
+
+	if (cfg_gso && !cfg_cmsg) {
+		val = cfg_mss;
+		if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)))
+			error(1, errno, "setsockopt udp segment");
+	}
+
+	if (connect(fd, (void *)&cfg_dst_addr, cfg_alen))
+		error(1, errno, "connect");
+
+	tstop = gettimeofday_ms() + cfg_runtime_ms;
+	do {
+		ssize_t ret;
+
+		if (cfg_gso && cfg_cmsg)
+			ret = send_udp_segment_cmsg(fd, payload,
+						    cfg_payload_len);
+		else
+			ret = send(fd, payload, cfg_payload_len, 0);
+
+		/* loopback delivers in the send call: a full receive queue
+		 * drops, it does not block
+		 */
+		if (ret == -1 && errno != ENOBUFS && errno != ECONNREFUSED)
+			error(1, errno, "send");
+		if (ret > 0) {
+			bytes += ret;
+			sends++;
+		}
+	} while (gettimeofday_ms() < tstop);
+
+	if (close(fd))
+		error(1, errno, "close");
+
+	fprintf(stderr, "udp tx: %6lu MB/s %8lu calls/s %8lu msg/s\n",
+		(bytes >> 20) * 1000 / cfg_runtime_ms,
+		sends * 1000 / cfg_runtime_ms,
+		sends * ((cfg_payload_len + cfg_mss - 1) / cfg_mss) * 1000 /
+		cfg_runtime_ms);
+}
+
+static int recv_gso_size(struct msghdr *msg)
+{
+	struct cmsghdr *cm;
+
+	for (cm = CMSG_FIRSTHDR(msg); cm; cm = CMSG_NXTHDR(msg, cm))
+		if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+			return *(int *)CMSG_DATA(cm);
+
+	return 0;
+}
+
+static void do_rx(void)
+{
+	unsigned long tstop, recvs = 0, msgs = 0, bytes = 0;
+	struct sockaddr_storage addr = {};
+	char control[CMSG_SPACE(sizeof(int))];
+	struct pollfd pfd;
+	int fd, val;
+
+	fd = socket(cfg_family, SOCK_DGRAM, 0);
+	if (fd == -1)
+		error(1, errno, "socket rx");
+
+	val = 1 << 21;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &val, sizeof(val)))
+		error(1, errno, "setsockopt rcvbuf");
+
+	if (cfg_gro) {
+		val = 1;
+		if (setsockopt(fd, SOL_UDP, UDP_GRO, &val, sizeof(val)))
+			error(1, errno, "setsockopt udp gro");
+	}
+
+	addr.ss_family = cfg_family;
+	((struct sockaddr_in *)&addr)->sin_port = htons(cfg_port);
+	if (bind(fd, (void *)&addr, cfg_alen))
+		error(1, errno, "bind");
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	/* the sender starts after us and stops before us */
+	tstop = gettimeofday_ms() + cfg_runtime_ms + 1000;
+	while (gettimeofday_ms() < tstop) {
+		struct iovec iov = { .iov_base = payload,
+				     .iov_len = sizeof(payload) };
+		struct msghdr msg = {0};
+		int gso_size;
+		ssize_t ret;
+
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		ret = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (ret == -1) {
+			if (errno != EAGAIN)
+				error(1, errno, "recv");
+			if (poll(&pfd, 1, 100) == -1)
+				error(1, errno, "poll");
+			continue;
+		}
+
+		gso_size = recv_gso_size(&msg);
+		if (gso_size && !cfg_gro)
+			error(1, 0, "gro cmsg without UDP_GRO");
+		if (gso_size && gso_size != cfg_mss)
+			error(1, 0, "gro: segment size %d, expected %d",
+			      gso_size, cfg_mss);
+		if (gso_size ? ret % cfg_mss && ret % cfg_mss != cfg_tail_len :
+			       ret != cfg_mss && ret != cfg_tail_len)
+			error(1, 0, "recv: %zd bytes, segment size %d",
+			      ret, cfg_mss);
+
+		recvs++;
+		msgs += (ret + cfg_mss - 1) / cfg_mss;
+		bytes += ret;
+	}
+
+	close(fd);
+
+	if (!recvs)
+		error(1, 0, "no data received");
+
+	fprintf(stderr, "udp rx: %6lu MB/s %8lu calls/s %8lu msg/s\n",
+		(bytes >> 20) * 1000 / cfg_runtime_ms,
+		recvs * 1000 / cfg_runtime_ms,
+		msgs * 1000 / cfg_runtime_ms);
+}
+
+static void usage(const char *filepath)
+{
+	error(1, 0, "Usage: %s [-4|-6] [-S] [-c] [-G] [-r] [-a addr] "
+		    "[-p port] [-m mss] [-s size] [-t secs]", filepath);
+}
+
+static void parse_opts(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "46a:cGm:p:rSs:t:")) != -1) {
+		switch (c) {
+		case '4':
+			cfg_family = PF_INET;
+			break;
+		case '6':
+			cfg_family = PF_INET6;
+			break;
+		case 'a':
+			cfg_addr = optarg;
+			break;
+		case 'c':
+			cfg_cmsg = true;
+			cfg_gso = true;
+			break;
+		case 'G':
+			cfg_gro = true;
+			break;
+		case 'm':
+			cfg_mss = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg_port = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg_rx_only = true;
+			break;
+		case 'S':
+			cfg_gso = true;
+			break;
+		case 's':
+			cfg_payload_len = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			cfg_runtime_ms = strtoul(optarg, NULL, 10) * 1000;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* a datagram that fits an ethernet frame, as on the wire */
+	if (!cfg_mss)
+		cfg_mss = cfg_family == PF_INET ? 1472 : 1452;
+
+	/* as many whole datagrams as fit one send call */
+	if (!cfg_payload_len)
+		cfg_payload_len = cfg_gso ? cfg_mss * (60000 / cfg_mss) :
+					    cfg_mss;
+
+	if (cfg_mss <= 0 || cfg_payload_len <= 0 || cfg_payload_len > 65000)
+		error(1, 0, "-s: payload must be between 1 and 65000");
+	if (!cfg_gso && cfg_payload_len != cfg_mss)
+		error(1, 0, "-s: without -S a send carries one datagram");
+	if ((cfg_payload_len + cfg_mss - 1) / cfg_mss > UDP_MAX_SEGMENTS)
+		error(1, 0, "-s: at most %d segments per send",
+		      UDP_MAX_SEGMENTS);
+	cfg_tail_len = cfg_payload_len % cfg_mss;
+	if (!cfg_addr)
+		cfg_addr = cfg_family == PF_INET ? "127.0.0.1" : "::1";
+
+	setup_sockaddr(cfg_family, cfg_addr, &cfg_dst_addr);
+}
+
+int main(int argc, char **argv)
+{
+	pid_t pid;
+	int i, status;
+
+	parse_opts(argc, argv);
+
+	for (i = 0; i < sizeof(payload); i++)
+		payload[i] = 'a' + (i % 26);
+
+	if (cfg_rx_only) {
+		do_rx();
+		return 0;
+	}
+
+	if (!strcmp(cfg_addr, "127.0.0.1") || !strcmp(cfg_addr, "::1")) {
+		pid = fork();
+		if (pid == -1)
+			error(1, errno, "fork");
+		if (!pid) {
+			do_rx();
+			exit(0);
+		}
+		/* give the receiver time to bind */
+		usleep(100 * 1000);
+
+		do_tx();
+
+		if (waitpid(pid, &status, 0) == -1)
+			error(1, errno, "waitpid");
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			error(1, 0, "receiver failed");
+	} else {
+		do_tx();
+	}
+
+	fprintf(stderr, "OK. All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Send MSS-sized datagrams over loopback UDP one per call, with UDP
+# segmentation offload set per socket and per call, and with a UDP GRO
+# receiver, and compare the throughput.
+#
+# Each run also checks that the receiver sees the datagram sizes the
+# sender used: split again without UDP_GRO, whole with it.  The last runs
+# send a payload shorter than one segment, which must go out as a plain
+# datagram, and one with a short last segment.
+
+set -e
+
+readonly SECS=${SECS:-4}
+
+for family in 4 6; do
+	echo "ipv${family} udp"
+	./udpgso_bench -"${family}" -t "${SECS}"
+
+	echo "ipv${family} udp gso"
+	./udpgso_bench -"${family}" -t "${SECS}" -S
+
+	echo "ipv${family} udp gso cmsg"
+	./udpgso_bench -"${family}" -t "${SECS}" -c
+
+	echo "ipv${family} udp gso gro"
+	./udpgso_bench -"${family}" -t "${SECS}" -S -G
+
+	echo "ipv${family} udp gso short"
+	./udpgso_bench -"${family}" -t "${SECS}" -S -s 1000
+
+	echo "ipv${family} udp gso short gro"
+	./udpgso_bench -"${family}" -t "${SECS}" -S -G -s 1000
+
+	echo "ipv${family} udp gso uneven"
+	./udpgso_bench -"${family}" -t "${SECS}" -S -s 40000
+done